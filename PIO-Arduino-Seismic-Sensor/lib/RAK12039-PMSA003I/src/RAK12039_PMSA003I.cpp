@@ -58,17 +58,28 @@ bool RAK_PMSA003I::begin(TwoWire &wirePort, uint8_t deviceAddress)
  */
 bool RAK_PMSA003I::readDate(PMSA_Data_t *pmsa_data)
 {
-  uint8_t buf8[32];
-  uint16_t buf16[16];
-  uint16_t sum = 0;
-
   if (pmsa_data == NULL) 
   {
     LIB_LOG_PMS("Pointer is Null.");
     return false;
   }
 
-  readRegister(PMSA003I_REG_ID , buf8 , 32);
+  // The frame is read directly into the structure
+  readRegister(PMSA003I_REG_ID , (uint8_t *)pmsa_data , sizeof(PMSA_Data_t));
+
+  return parseDate(pmsa_data);
+}
+
+/*!
+ *  @brief  Check and convert a raw frame in place.
+ *          The frame is big endian, the 16 bit values are swapped inside the structure.
+ *  @param  pmsa_data : Raw frame as read from the sensor, refer to the data structure @PMSA_Data_t.
+ *  @return Returns true if start characters and checksum are correct, otherwise returns false.
+ */
+bool RAK_PMSA003I::parseDate(PMSA_Data_t *pmsa_data)
+{
+  uint8_t *buf8 = (uint8_t *)pmsa_data;
+  uint16_t sum = 0;
 
   // Check that start byte is correct!
   if (buf8[0] != 0x42  || buf8[1] != 0x4d) 
@@ -77,23 +88,23 @@ bool RAK_PMSA003I::readDate(PMSA_Data_t *pmsa_data)
     return false;
   }
   
-  for (uint8_t i = 0; i < 30; i++) 
+  // Checksum covers everything except the checksum itself
+  for (uint8_t i = 0; i < sizeof(PMSA_Data_t) - 2; i++) 
   {
     sum += buf8[i];
-    LIB_LOG_PMS("buf8[%d] = %x",i,buf8[i]);
   }
-  
-  for (uint8_t i = 0; i < 16; i++) 
+
+  // Swap the 16 bit values, version and error code are single bytes
+  for (uint8_t i = 0; i < sizeof(PMSA_Data_t); i += 2) 
   {
-    buf16[i] = buf8[i*2 + 1];
-    buf16[i] += (buf8[i*2] << 8);
-    LIB_LOG_PMS("buf16[%d] = %x",i,buf16[i]);
+    if (i == offsetof(PMSA_Data_t, version))
+    {
+      continue;
+    }
+    uint8_t high = buf8[i];
+    buf8[i] = buf8[i + 1];
+    buf8[i + 1] = high;
   }
-
-  memcpy((void *)pmsa_data, (void *)buf16, sizeof(PMSA_Data_t));
-  LIB_LOG_PMS("pmsa_data.header = %x",pmsa_data->header);
-  LIB_LOG_PMS("pmsa_data.date_len = %x",pmsa_data->date_len);
-
   LIB_LOG_PMS("sum = %x",sum);
   LIB_LOG_PMS("pmsa_data->check_sum = %x",pmsa_data->check_sum);
   
@@ -102,11 +113,7 @@ bool RAK_PMSA003I::readDate(PMSA_Data_t *pmsa_data)
     LIB_LOG_PMS("PMSA003I read date fail.");
     return false;
   }
-  else
-  {
-    LIB_LOG_PMS("PMSA003I read date success.");
-    return true;
-  }
+  LIB_LOG_PMS("PMSA003I read date success.");
   return true;
 }
 
@@ -12,6 +12,7 @@
 
 #include <Arduino.h>
 #include <Wire.h>
+#include <stddef.h>
 
 #define LIB_DEBUG_PMS     0
 
@@ -69,6 +70,7 @@ public:
   RAK_PMSA003I(byte addr = PMSA003I_DEV_ADDR);
   bool begin(TwoWire &wirePort = Wire, uint8_t deviceAddress = PMSA003I_DEV_ADDR);
   bool readDate(PMSA_Data_t *data);
+  static bool parseDate(PMSA_Data_t *data);
 
 private:
   void readRegister(uint8_t registerAddress, uint8_t *readData, uint8_t size);
@@ -2,20 +2,180 @@
  * @file RAK12002_rtc.cpp
  * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
  * @brief Initialization and usage of RAK12002 RTC module
- * @version 0.1
- * @date 2022-02-18
+ *        The RTC is read once at boot and then only for a periodic resync of the clock.
+ * @version 0.2
+ * @date 2023-03-08
  *
  * @copyright Copyright (c) 2022
  *
  */
 #include "app.h"
+#include "epoch_clock.h"
 #include <Melopero_RV3028.h>
 
+/** I2C address of the RV3028 */
+#define RV3028_ADDR 0x52
+
+/** Status register of the RV3028 */
+#define RV3028_STATUS 0x0E
+
+/** Power On Reset flag, the time registers were reset and are not valid */
+#define RV3028_PORF 0x01
+
 /** Instance of the RTC class */
 Melopero_RV3028 rtc;
 
 date_time_s g_date_time;
 
+/** millis() at the last read of the RTC */
+static uint32_t rtc_read_millis = 0;
+
+/** Flag if the RTC has a valid time, false after a power loss until the time is set */
+static bool rtc_time_valid = false;
+
+/**
+ * @brief Convert a BCD register value
+ *
+ * @param bcd value in BCD format
+ * @return uint8_t binary value
+ */
+static inline uint8_t bcd_to_bin(uint8_t bcd)
+{
+	return (bcd >> 4) * 10 + (bcd & 0x0F);
+}
+
+/**
+ * @brief Read all time registers and the status register of the RV3028 in one I2C transfer
+ *
+ * @param epoch Unix time read from the RTC
+ * @param status content of the status register
+ * @return true if success
+ * @return false if I2C transfer failed
+ */
+static bool burst_read_rak12002(uint32_t *epoch, uint8_t *status)
+{
+	uint8_t reg = 0x00;
+	uint8_t regs[RV3028_STATUS + 1];
+	if (!i2c_read_regs(I2C_DEV_RTC, RV3028_ADDR, &reg, 1, regs, RV3028_STATUS + 1))
+	{
+		return false;
+	}
+	*status = regs[RV3028_STATUS];
+
+	// Registers: seconds, minutes, hours (24h), weekday, date, month, year
+	*epoch = clock_to_epoch(2000 + bcd_to_bin(regs[6]), bcd_to_bin(regs[5] & 0x1F), bcd_to_bin(regs[4] & 0x3F),
+							bcd_to_bin(regs[2] & 0x3F), bcd_to_bin(regs[1] & 0x7F), bcd_to_bin(regs[0] & 0x7F));
+	return true;
+}
+
+/**
+ * @brief Clear the Power On Reset flag after the time was written
+ *
+ */
+static void clear_porf_rak12002(void)
+{
+	uint8_t reg = RV3028_STATUS;
+	uint8_t status;
+	if (!i2c_read_regs(I2C_DEV_RTC, RV3028_ADDR, &reg, 1, &status, 1))
+	{
+		return;
+	}
+	uint8_t data[2] = {RV3028_STATUS, (uint8_t)(status & ~RV3028_PORF)};
+	if (i2c_write(I2C_DEV_RTC, RV3028_ADDR, data, 2))
+	{
+		rtc_time_valid = true;
+	}
+}
+
+/**
+ * @brief Check if the RTC has a valid time
+ *
+ * @return true time was set after the last power loss of the RTC
+ * @return false RTC lost its time
+ */
+bool is_rak12002_valid(void)
+{
+	return rtc_time_valid;
+}
+
+/**
+ * @brief Sync the clock with the RTC
+ *        The RTC has a resolution of 1 second, the read happens somewhere
+ *        within the second, so the middle of the second is used.
+ *        After a power loss of the RTC the time registers hold a reset value,
+ *        the clock is not synced until the time is set again.
+ *
+ * @param force sync even if the clock has a more precise time
+ * @return true if success
+ * @return false if I2C transfer failed or the RTC has no valid time
+ */
+bool sync_rak12002(bool force)
+{
+	uint32_t rtc_epoch;
+	uint8_t status;
+	if (!burst_read_rak12002(&rtc_epoch, &status))
+	{
+		MYLOG("RTC", "Burst read failed");
+		return false;
+	}
+	rtc_read_millis = millis();
+	rtc_time_valid = (status & RV3028_PORF) == 0;
+	if (!rtc_time_valid)
+	{
+		MYLOG("RTC", "RTC lost power, time not valid");
+		return false;
+	}
+	clock_sync((uint64_t)rtc_epoch * 1000 + 500, CLOCK_RTC_UNCERTAINTY, CLOCK_SRC_RTC, force);
+	return true;
+}
+
+/**
+ * @brief Sync the clock again, called by the SCHED_RTC_SYNC job
+ *        Skipped if the RTC was read or set within the window of the job
+ *
+ */
+void resync_rak12002(void)
+{
+	if (has_rak12002 && ((millis() - rtc_read_millis) >= CLOCK_RESYNC_INTERVAL - CLOCK_RESYNC_INTERVAL / SCHED_RTC_SYNC_TOLERANCE_DIV))
+	{
+		sync_rak12002(false);
+	}
+}
+
+/**
+ * @brief Write a time from another source, e.g. the network, into the RTC
+ *
+ * @param epoch Unix time in seconds
+ */
+void write_rak12002(uint32_t epoch)
+{
+	if (!has_rak12002)
+	{
+		return;
+	}
+	date_time_s new_time;
+	clock_to_date(epoch, &new_time);
+	i2c_begin(I2C_DEV_RTC);
+	rtc.setTime(new_time.year, new_time.month, new_time.weekday, new_time.date, new_time.hour, new_time.minute, new_time.second);
+	// Address, register and 7 time registers
+	i2c_end(I2C_DEV_RTC, 9);
+	clear_porf_rak12002();
+	rtc_read_millis = millis();
+	MYLOG("RTC", "RTC set to %ld", epoch);
+}
+
+/**
+ * @brief Convert the current time into the g_date_time structure
+ *
+ */
+static void read_g_date_time(void)
+{
+	clock_to_date(get_clock_ms() / 1000, &g_date_time);
+	MYLOG("RTC", "Got %d %d %d %02d:%02d:%d",
+		  g_date_time.month, g_date_time.date, g_date_time.year,
+		  g_date_time.hour, g_date_time.minute, g_date_time.second);
+}
+
 /**
  * @brief Initialize the RTC
  *
@@ -24,14 +184,15 @@ date_time_s g_date_time;
  */
 bool init_rak12002(void)
 {
-	Wire.begin();
-	Wire.beginTransmission(0x52);
-	if (Wire.endTransmission() != 0)
+	uint8_t reg = 0x00;
+	uint8_t seconds;
+	if (!i2c_read_regs(I2C_DEV_RTC, RV3028_ADDR, &reg, 1, &seconds, 1))
 	{
 		// No device found
 		return false;
 	}
 
+	i2c_begin(I2C_DEV_RTC);
 	rtc.initI2C(Wire);
 
 	rtc.useEEPROM(false);
@@ -40,25 +201,29 @@ bool init_rak12002(void)
 	rtc.writeToRegister(0x37, 0xB4); // Direct Switching Mode (DSM): when VDD < VBACKUP, switchover occurs from VDD to VBACKUP
 
 	rtc.set24HourMode(); // Set the device to use the 24hour format (default) instead of the 12 hour format
+	// Read-modify-write of the control registers
+	i2c_end(I2C_DEV_RTC, 4 * 7);
 
-	g_date_time.year = rtc.getYear();
-	g_date_time.month = rtc.getMonth();
-	g_date_time.weekday = rtc.getWeekday();
-	g_date_time.date = rtc.getDate();
-	g_date_time.hour = rtc.getHour();
-	g_date_time.minute = rtc.getMinute();
-	g_date_time.second = rtc.getSecond();
+	if (!sync_rak12002(false))
+	{
+		// The RTC is there, the clock waits for the network or a manual set
+		MYLOG("RTC", "Clock not synced from the RTC");
+	}
+	read_g_date_time();
 
 	MYLOG("RTC", "%d.%02d.%02d %d:%02d:%02d", g_date_time.year, g_date_time.month, g_date_time.date, g_date_time.hour, g_date_time.minute, g_date_time.second);
+
+	// Correct the clock drift against the RTC from time to time, shares the wakeup of a heartbeat
+	sched_start(SCHED_RTC_SYNC, CLOCK_RESYNC_INTERVAL, CLOCK_RESYNC_INTERVAL, CLOCK_RESYNC_INTERVAL / SCHED_RTC_SYNC_TOLERANCE_DIV);
 	return true;
 }
 
 /**
  * @brief Set the RAK12002 date and time
  *
- * @param year in 4 digit format, e.g. 2020
+ * @param year 2000 to 2099, the RTC has a 2 digit year
  * @param month 1 to 12
- * @param date 1 to 31
+ * @param date 1 to 28, 29, 30 or 31, depending on the month
  * @param hour 0 to 23
  * @param minute 0 to 59
  */
@@ -67,15 +232,22 @@ void set_rak12002(uint16_t year, uint8_t month, uint8_t date, uint8_t hour, uint
 	if (!has_rak12002)
 	{
 		// No RTC, just return
+		return;
 	}
-	uint8_t weekday = (date + (uint16_t)((2.6 * month) - 0.2) - (2 * (year / 100)) + year + (uint16_t)(year / 4) + (uint16_t)(year / 400)) % 7;
+	uint8_t weekday = clock_weekday(clock_days_from_civil(year, month, date));
 	MYLOG("RTC", "Calculated weekday is %d", weekday);
+	i2c_begin(I2C_DEV_RTC);
 	rtc.setTime(year, month, weekday, date, hour, minute, 0);
+	i2c_end(I2C_DEV_RTC, 9);
+	clear_porf_rak12002();
+
+	// Time was set manually, take it even if the clock was synced by the network
+	sync_rak12002(true);
 }
 
 /**
  * @brief Update g_data_time structure with current the date
- *        and time from the RTC
+ *        and time from the clock
  *
  */
 void read_rak12002(void)
@@ -83,15 +255,8 @@ void read_rak12002(void)
 	if (!has_rak12002)
 	{
 		// No RTC, just return
+		return;
 	}
-	g_date_time.year = rtc.getYear();
-	g_date_time.month = rtc.getMonth();
-	g_date_time.weekday = rtc.getWeekday();
-	g_date_time.date = rtc.getDate();
-	g_date_time.hour = rtc.getHour();
-	g_date_time.minute = rtc.getMinute();
-	g_date_time.second = rtc.getSecond();
-	MYLOG("RTC", "Got %d %d %d %02d:%02d:%d",
-		  g_date_time.month, g_date_time.date, g_date_time.year,
-		  g_date_time.hour, g_date_time.minute, g_date_time.second);
-}
\ No newline at end of file
+	read_g_date_time();
+}
+
@@ -36,34 +36,22 @@ RAK_D7S D7S;
 // Slot F      WB_IO5
 //******************************************************************//
 
-/** Interrupt pin, depends on slot */
-#if RAK12027_SLOT == 0 // Slot A
-#pragma message "Slot A"
-#define INT1_PIN WB_IO1
-#define INT2_PIN WB_IO2
-#elif RAK12027_SLOT == 1 // Slot B
-#pragma message "Slot B"
-#define INT1_PIN WB_IO2
-#define INT2_PIN WB_IO1
-#elif RAK12027_SLOT == 2 // Slot C
-#pragma message "Slot C"
-#define INT1_PIN WB_IO3
-#define INT2_PIN WB_IO4
-#elif RAK12027_SLOT == 3 // Slot D
-#pragma message "Slot D"
-#define INT1_PIN WB_IO5
-#define INT2_PIN WB_IO6
-#elif RAK12027_SLOT == 4 // Slot E
-#pragma message "Slot E"
-#define INT1_PIN WB_IO4
-#define INT2_PIN WB_IO3
-#elif RAK12027_SLOT == 5 // Slot F
-#pragma message "Slot F"
-#define INT1_PIN WB_IO6
-#define INT2_PIN WB_IO5
-else
-#pragma message "No slot defined"
-#endif
+// The pins of each slot are in d7s_array.cpp
+
+/** I2C address of the D7S */
+#define D7S_I2C_ADDR 0x55
+
+/** D7S registers with SI followed by PGA */
+#define D7S_REG_INSTANT_SI 0x2000
+#define D7S_REG_LATEST_SI 0x3008
+
+/** Bytes on the bus for a D7S register access, the register address has 2 bytes */
+#define D7S_READ8_BYTES 5
+#define D7S_READ16_BYTES 6
+#define D7S_WRITE8_BYTES 4
+
+static bool calib_sensor_rak12027(uint8_t sensor, bool probe);
+
 // flag variables to handle collapse/shutoff only one time during an earthquake
 bool shutoff_alert = false;
 bool collapse_alert = false;
@@ -73,9 +61,110 @@ bool earthquake_start = false;
 float savedSI = 0.0f;
 float savedPGA = 0.0f;
 
+// Highest SI and PGA sampled during the current earthquake
+float peakSI = 0.0f;
+float peakPGA = 0.0f;
+
+/**
+ * @brief Check if a D7S finished its current operation
+ *
+ * @param sensor sensor index
+ * @return true D7S is ready
+ * @return false D7S is busy
+ */
+static bool is_ready_rak12027(uint8_t sensor)
+{
+	i2c_begin(I2C_DEV_D7S);
+	d7s_select(sensor);
+	bool ready = D7S.isReady();
+	i2c_end(I2C_DEV_D7S, D7S_READ8_BYTES);
+	return ready;
+}
+
+/**
+ * @brief Read SI and PGA of a D7S in one transfer
+ *        The PGA register follows directly after the SI register
+ *
+ * @param sensor sensor index
+ * @param reg address of the SI register
+ * @param si SI in m/s
+ * @param pga PGA in m/s2
+ * @return true if success
+ * @return false if the D7S did not answer
+ */
+static bool read_si_pga_rak12027(uint8_t sensor, uint16_t reg, float *si, float *pga)
+{
+	uint8_t reg_addr[2] = {(uint8_t)(reg >> 8), (uint8_t)(reg)};
+	uint8_t data[4];
+	i2c_begin(I2C_DEV_D7S);
+	d7s_select(sensor);
+	bool result = i2c_read_regs(I2C_DEV_D7S, D7S_I2C_ADDR, reg_addr, 2, data, 4);
+	i2c_end(I2C_DEV_D7S, 0);
+	if (!result)
+	{
+		return false;
+	}
+	*si = (float)(((uint16_t)data[0] << 8) | data[1]) / 1000.0f;
+	*pga = (float)(((uint16_t)data[2] << 8) | data[3]) / 1000.0f;
+	return true;
+}
+
+/** Buffer for the background read of SI and PGA */
+static uint8_t capture_data[4];
+
+/**
+ * @brief Update the peak values of a sensor
+ *
+ * @param sensor sensor index
+ * @param si SI in m/s
+ * @param pga PGA in m/s2
+ */
+static void update_peak_rak12027(uint8_t sensor, float si, float pga)
+{
+	if (si > d7s_sensors[sensor].peak_si)
+	{
+		d7s_sensors[sensor].peak_si = si;
+	}
+	if (pga > d7s_sensors[sensor].peak_pga)
+	{
+		d7s_sensors[sensor].peak_pga = pga;
+	}
+}
+
+/**
+ * @brief Callback of the background read of SI and PGA of a single D7S
+ *        Updates the peak values
+ *
+ * @param success result of the transfer
+ * @param context not used
+ */
+static void capture_done(bool success, void *context)
+{
+	if (!success)
+	{
+		MYLOG("SEIS", "Capture failed");
+		return;
+	}
+	float currentSI = (float)(((uint16_t)capture_data[0] << 8) | capture_data[1]) / 1000.0f;
+	float currentPGA = (float)(((uint16_t)capture_data[2] << 8) | capture_data[3]) / 1000.0f;
+	update_peak_rak12027(d7s_first(), currentSI, currentPGA);
+	if (currentSI > peakSI)
+	{
+		peakSI = currentSI;
+	}
+	if (currentPGA > peakPGA)
+	{
+		peakPGA = currentPGA;
+	}
+	MYLOG("SEIS", "Capture SI %.4f PGA %.4f", currentSI, currentPGA);
+}
+
 void report_status(void)
 {
+	i2c_begin(I2C_DEV_D7S);
+	d7s_select(d7s_first());
 	uint8_t current_state = D7S.getState();
+	i2c_end(I2C_DEV_D7S, D7S_READ8_BYTES);
 	char status_txt[128];
 	switch (current_state)
 	{
@@ -102,52 +191,69 @@ void report_status(void)
 }
 
 /**
- * @brief Callback for INT 1
- * Wakes up application with signal SEISMIC_ALERT
+ * @brief Callback for INT 1 of all sensors
+ * Wakes up the seismic task with signal SEISMIC_ALERT
  * Activated on Collapse and Shutoff signals
  *
  */
 void d7s_int1_handler(void)
 {
-	api_wake_loop(SEISMIC_ALERT);
+	uint32_t irq_us = micros();
+	uint8_t fired = d7s_int1_isr();
+	// Switch the shutoff output here, the seismic task confirms it after reading the D7S
+	shutoff_irq(irq_us, d7s_int1_agreed());
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
+	{
+		if (fired & (1 << sensor))
+		{
+			perf_irq(1);
+			// Line 1 and 2 for the first sensor, 3 and 4 for the second sensor, ...
+			usb_stream_irq(sensor * 2 + 1, LOW);
+		}
+	}
+	seismic_notify_from_isr(SEISMIC_ALERT);
 }
 
 /**
- * @brief Callback for INT 2
- * Wakes up application with signal SEISMIC_EVENT
+ * @brief Callback for INT 2 of all sensors
+ * Wakes up the seismic task with signal SEISMIC_EVENT
  * Activated on Earthquake start and end
  *
  */
 void d7s_int2_handler(void)
 {
-	if (digitalRead(INT2_PIN) == LOW)
-	{
-		digitalWrite(LED_BLUE, HIGH);
-	}
-	else
+	uint8_t changed = d7s_int2_isr();
+	bool quake = false;
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
 	{
-		digitalWrite(LED_BLUE, LOW);
+		uint8_t level = digitalRead(d7s_sensors[sensor].int2_pin);
+		if (d7s_sensors[sensor].present && (level == LOW))
+		{
+			quake = true;
+		}
+		if (changed & (1 << sensor))
+		{
+			perf_irq(2);
+			usb_stream_irq(sensor * 2 + 2, level);
+		}
 	}
-	api_wake_loop(SEISMIC_EVENT);
+	digitalWrite(LED_BLUE, quake ? HIGH : LOW);
+	seismic_notify_from_isr(SEISMIC_EVENT);
 }
 
 /**
- * @brief Initialize Omron D7S seismic sensor
+ * @brief Initialize one D7S
  *
+ * @param sensor sensor index
+ * @param slot_changed set to true if a different slot was detected
  * @return true If sensor was found and is initialized
  * @return false If sensor initialization failed
  */
-bool init_rak12027(void)
+static bool init_sensor_rak12027(uint8_t sensor, bool *slot_changed)
 {
-	// Read threshold settings from Flash
-	read_threshold_settings();
-
-	// start D7S connection
-	D7S.begin();
-
 	// wait until the D7S is ready
 	time_t start_wait_time = millis();
-	while (!D7S.isReady())
+	while (!is_ready_rak12027(sensor))
 	{
 		if ((millis() - start_wait_time) > 10000)
 		{
@@ -160,29 +266,79 @@ bool init_rak12027(void)
 	//--- SETTINGS ---
 	// setting the D7S to switch the axis at inizialization time
 	MYLOG("SEIS", "Setting D7S sensor to switch axis at inizialization time.");
+	i2c_begin(I2C_DEV_D7S);
+	d7s_select(sensor);
 	D7S.setAxis(SWITCH_AT_INSTALLATION);
+	i2c_end(I2C_DEV_D7S, D7S_READ8_BYTES + D7S_WRITE8_BYTES);
 
 	/*********************************************************************/
 	/** Calling calibration, this should be done from AT command instead */
 	/*********************************************************************/
-	if (!calib_rak12027())
+	// The first calibration after power up is used to find the slot of the D7S
+	d7s_probe_start(sensor);
+	bool calibrated = calib_sensor_rak12027(sensor, true);
+	bool changed = d7s_probe_end(sensor);
+	if (!calibrated)
 	{
 		MYLOG("SEIS", "Calibration failed with timeout");
 		return false;
 	}
-
-	// Get saved threshold level
-
-	// Set low threshold
-	// D7S.setThreshold(THRESHOLD_LOW);
-	threshold_rak12027(threshold_level);
+	if (changed)
+	{
+		*slot_changed = true;
+	}
 
 	//--- RESETTING EVENTS ---
 	// reset the events shutoff/collapse memorized into the D7S
+	i2c_begin(I2C_DEV_D7S);
+	d7s_select(sensor);
 	D7S.resetEvents();
+	i2c_end(I2C_DEV_D7S, D7S_READ8_BYTES + D7S_WRITE8_BYTES);
+	return true;
+}
+
+/**
+ * @brief Initialize Omron D7S seismic sensors
+ *        Sensors that fail are left out, the others keep working
+ *
+ * @return true If at least one sensor was found and is initialized
+ * @return false If sensor initialization failed
+ */
+bool init_rak12027(void)
+{
+	// start D7S connection
+	D7S.begin();
+	// The library restarts Wire with the default clock
+	i2c_clock_changed();
+
+	uint8_t configured = init_d7s_array();
+	bool slot_changed = false;
+	for (uint8_t sensor = 0; sensor < configured; sensor++)
+	{
+		if (init_sensor_rak12027(sensor, &slot_changed))
+		{
+			d7s_set_present(sensor);
+		}
+		else
+		{
+			MYLOG("SEIS", "D7S %d failed", sensor);
+		}
+	}
+	if (slot_changed)
+	{
+		// Keep the detected slots for the next start
+		save_app_settings();
+	}
+	if (d7s_num == 0)
+	{
+		return false;
+	}
+
+	// Get saved threshold level
+	threshold_rak12027(g_app_settings.threshold);
 
 	//--- READY TO GO ---
-	MYLOG("SEIS", "Listening for earthquakes!");
+	MYLOG("SEIS", "Listening for earthquakes with %d D7S, %d must agree on an alert", d7s_num, d7s_votes_needed());
 
 #if MY_DEBUG > 0
 	//--- Report status
@@ -190,34 +346,49 @@ bool init_rak12027(void)
 #endif
 
 	//--- INTERRUPT SETTINGS ---
-	// registering event handler
-	pinMode(INT1_PIN, INPUT);
-	pinMode(INT2_PIN, INPUT);
-	attachInterrupt(INT1_PIN, d7s_int1_handler, FALLING);
-	attachInterrupt(INT2_PIN, d7s_int2_handler, CHANGE);
+	// registering event handler, all sensors share the handlers
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
+	{
+		if (d7s_sensors[sensor].present)
+		{
+			pinMode(d7s_sensors[sensor].int1_pin, INPUT);
+			pinMode(d7s_sensors[sensor].int2_pin, INPUT);
+			attachInterrupt(d7s_sensors[sensor].int1_pin, d7s_int1_handler, FALLING);
+			attachInterrupt(d7s_sensors[sensor].int2_pin, d7s_int2_handler, CHANGE);
+		}
+	}
 
 	return true;
 }
 
 /**
- * @brief Calibration of D7S sensor
- * Should be called if position of sensor is changing
+ * @brief Calibration of one D7S
  *
+ * @param sensor sensor index
+ * @param probe true to check the INT2 pins for the slot detection
  * @return true if calibrarion succeed
  * @return false if calibration timeout
  */
-bool calib_rak12027(void)
+static bool calib_sensor_rak12027(uint8_t sensor, bool probe)
 {
 	//--- INITIALIZZATION ---
 	MYLOG("SEIS", "Initializing the D7S sensor in 2 seconds. Please keep it steady during the initializing process.");
 	delay(2000);
 	MYLOG("SEIS", "Initializing...");
 	// start the initial installation procedure
+	i2c_begin(I2C_DEV_D7S);
+	d7s_select(sensor);
 	D7S.initialize();
+	i2c_end(I2C_DEV_D7S, D7S_READ8_BYTES + D7S_WRITE8_BYTES);
 	// wait until the D7S is ready (the initializing process is ended)
 	time_t start_wait_time = millis();
-	while (!D7S.isReady())
+	while (!is_ready_rak12027(sensor))
 	{
+		if (probe)
+		{
+			// INT2 is low while the D7S is busy
+			d7s_probe_sample();
+		}
 		if ((millis() - start_wait_time) > 5000)
 		{
 			MYLOG("SEIS", "Timeout waiting initialization of D7S");
@@ -229,20 +400,67 @@ bool calib_rak12027(void)
 	return true;
 }
 
-void threshold_rak12027(uint8_t new_threshold)
+/**
+ * @brief Calibration of the D7S sensors
+ * Should be called if position of sensor is changing
+ *
+ * @return true if calibrarion succeed for all sensors
+ * @return false if calibration timeout
+ */
+bool calib_rak12027(void)
 {
-	if (new_threshold == 1)
+	bool result = true;
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
 	{
-		D7S.setThreshold(THRESHOLD_LOW);
+		if (d7s_sensors[sensor].present)
+		{
+			result &= calib_sensor_rak12027(sensor, false);
+		}
 	}
-	else
+	return result;
+}
+
+void threshold_rak12027(uint8_t new_threshold)
+{
+	i2c_begin(I2C_DEV_D7S);
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
 	{
-		D7S.setThreshold(THRESHOLD_HIGH);
+		if (!d7s_sensors[sensor].present)
+		{
+			continue;
+		}
+		d7s_select(sensor);
+		if (new_threshold == 1)
+		{
+			D7S.setThreshold(THRESHOLD_LOW);
+		}
+		else
+		{
+			D7S.setThreshold(THRESHOLD_HIGH);
+		}
 	}
+	i2c_end(I2C_DEV_D7S, d7s_num * (D7S_READ8_BYTES + D7S_WRITE8_BYTES));
+}
+
+/**
+ * @brief Get the current state of the first present D7S
+ *
+ * @return uint8_t state as reported by the D7S
+ */
+uint8_t state_rak12027(void)
+{
+	i2c_begin(I2C_DEV_D7S);
+	d7s_select(d7s_first());
+	uint8_t state = D7S.getState();
+	i2c_end(I2C_DEV_D7S, D7S_READ8_BYTES);
+	return state;
 }
 
 /**
- * @brief Get events from the D7S after interrupt occured
+ * @brief Get events from the D7S sensors after interrupt occured
+ *        Only the sensors with a pending interrupt are read.
+ *        Collapse and shutoff are only reported if enough sensors agree, see d7s_vote().
+ *        An earthquake starts with the first sensor and ends when all sensors ended it.
  *
  * @param is_int1 true if it was INT1, false if it was INT2
  * @return uint8_t event code
@@ -252,6 +470,7 @@ void threshold_rak12027(uint8_t new_threshold)
  * 			3 Collapse and Shutoff alert
  * 			4 Earthquake start detected
  * 			5 Earthquake end detected
+ * 			6 Earthquake continues, another sensor started or ended
  */
 uint8_t check_event_rak12027(bool is_int1)
 {
@@ -263,43 +482,85 @@ uint8_t check_event_rak12027(bool is_int1)
 #endif
 
 	uint8_t return_val = 0;
-	if (is_int1)
+	uint16_t bytes = 0;
+	uint8_t pending = d7s_take_pending(is_int1);
+	i2c_begin(I2C_DEV_D7S);
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
 	{
-		// Check for collapse event
-		if (D7S.isInCollapse() == 1)
+		if (!(pending & (1 << sensor)))
 		{
-			D7S.resetEvents();
-			return_val = 1;
+			continue;
 		}
-		// Check for SI > 5
-		if (D7S.isInShutoff() == 1)
+		d7s_select(sensor);
+		if (is_int1)
 		{
-			D7S.resetEvents();
-			return_val = return_val + 2;
+			uint8_t alert = 0;
+			// Check for collapse event
+			if (D7S.isInCollapse() == 1)
+			{
+				alert = 1;
+			}
+			// Check for SI > 5
+			if (D7S.isInShutoff() == 1)
+			{
+				alert = alert + 2;
+			}
+			bytes += 2 * D7S_READ8_BYTES;
+			// One reset clears both events
+			if (alert != 0)
+			{
+				D7S.resetEvents();
+				bytes += D7S_READ8_BYTES + D7S_WRITE8_BYTES;
+				return_val |= d7s_vote(sensor, alert);
+			}
+		}
+		else
+		{
+			// Check if earthquake started or ended
+			bytes += D7S_READ8_BYTES;
+			d7s_sensors[sensor].quake = D7S.isEarthquakeOccuring();
+			if (!d7s_sensors[sensor].quake)
+			{
+				D7S.resetEvents();
+				bytes += D7S_READ8_BYTES + D7S_WRITE8_BYTES;
+			}
 		}
 	}
-	else
+	i2c_end(I2C_DEV_D7S, bytes);
+
+	if (!is_int1)
 	{
-		// Check if earthquake started or ended
-		if (D7S.isEarthquakeOccuring())
+		bool quake = false;
+		for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
 		{
-			earthquake_start = true;
-			return_val = 4;
+			quake |= d7s_sensors[sensor].present && d7s_sensors[sensor].quake;
 		}
-		else
+		if (quake)
 		{
-			D7S.resetEvents();
-			if (earthquake_start)
+			if (!earthquake_start)
+			{
+				d7s_clear_votes();
+				earthquake_start = true;
+				return_val = 4;
+			}
+			else
 			{
-				return_val = 5;
+				return_val = 6;
 			}
 		}
+		else if (earthquake_start)
+		{
+			return_val = 5;
+			earthquake_start = false;
+		}
 	}
 	return return_val;
 }
 
 /**
  * @brief Read latest saved SI and PGA values
+ *        With several sensors the value that enough sensors agree on is used,
+ *        the values of each sensor are added to the payload as well
  *
  * @param add_values if true, values will be added to payload, false will just read
  * @return true new values recorded
@@ -318,17 +579,30 @@ bool read_rak12027(bool add_values)
 #endif
 
 	// get information about the current earthquake
-	float currentSI = D7S.getInstantaneusSI();
-	float currentPGA = D7S.getInstantaneusPGA();
-
-	float lastSI = D7S.getLastestSI(0);
-	float lastPGA = D7S.getLastestPGA(0);
+	float si[D7S_MAX_SENSORS] = {0.0f};
+	float pga[D7S_MAX_SENSORS] = {0.0f};
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
+	{
+		if (d7s_sensors[sensor].present)
+		{
+			read_si_pga_rak12027(sensor, D7S_REG_LATEST_SI, &si[sensor], &pga[sensor]);
+			d7s_sensors[sensor].si = si[sensor];
+			d7s_sensors[sensor].pga = pga[sensor];
+		}
+	}
+	float lastSI = d7s_agreed_value(si);
+	float lastPGA = d7s_agreed_value(pga);
 
+#if MY_DEBUG > 0
+	i2c_begin(I2C_DEV_D7S);
+	d7s_select(d7s_first());
 	for (int idx = 0; idx < 5; idx++)
 	{
 		MYLOG("SEIS", "SI level at %d %.4f", idx, D7S.getLastestSI(idx));
 		MYLOG("SEIS", "PGA level at %d %.4f", idx, D7S.getLastestPGA(idx));
 	}
+	i2c_end(I2C_DEV_D7S, 10 * D7S_READ16_BYTES);
+#endif
 
 	if ((savedSI != 0.0) && (savedPGA != 0.0))
 	{
@@ -348,8 +622,88 @@ bool read_rak12027(bool add_values)
 		g_solution_data.addPresence(LPP_CHANNEL_EQ_EVENT, true);
 		g_solution_data.addAnalogInput(LPP_CHANNEL_EQ_SI, lastSI * 10.0);
 		g_solution_data.addAnalogInput(LPP_CHANNEL_EQ_PGA, lastPGA * 10.0);
+		// Values of each sensor, only if there is space for them
+		if ((d7s_num > 1) && is_full_payload())
+		{
+			for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
+			{
+				if (d7s_sensors[sensor].present)
+				{
+					g_solution_data.addAnalogInput(LPP_CHANNEL_EQ_SI_ARRAY + sensor, si[sensor] * 10.0);
+					g_solution_data.addAnalogInput(LPP_CHANNEL_EQ_PGA_ARRAY + sensor, pga[sensor] * 10.0);
+				}
+			}
+		}
 	}
 	MYLOG("SEIS", "SI level %.4f", lastSI);
 	MYLOG("SEIS", "PGA level %.4f", lastPGA);
 	return true;
 }
+
+/**
+ * @brief Read the instantaneous SI and PGA
+ *        With several sensors the value that enough sensors agree on is returned
+ *
+ * @param si SI in m/s
+ * @param pga PGA in m/s2
+ * @return true if success
+ * @return false if a D7S did not answer
+ */
+bool instant_rak12027(float *si, float *pga)
+{
+	if (d7s_num <= 1)
+	{
+		return read_si_pga_rak12027(d7s_first(), D7S_REG_INSTANT_SI, si, pga);
+	}
+	float sensor_si[D7S_MAX_SENSORS] = {0.0f};
+	float sensor_pga[D7S_MAX_SENSORS] = {0.0f};
+	bool result = true;
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
+	{
+		if (d7s_sensors[sensor].present)
+		{
+			result &= read_si_pga_rak12027(sensor, D7S_REG_INSTANT_SI, &sensor_si[sensor], &sensor_pga[sensor]);
+		}
+	}
+	*si = d7s_agreed_value(sensor_si);
+	*pga = d7s_agreed_value(sensor_pga);
+	return result;
+}
+
+/**
+ * @brief Sample the instantaneous SI and PGA during an earthquake
+ *        Called with the capture rate set in the application settings
+ *        A single D7S is read in the background, the peaks are updated when it is finished.
+ *        Several D7S are read one after the other, the peaks are the values enough sensors agree on.
+ *
+ */
+void capture_rak12027(void)
+{
+	if (d7s_num <= 1)
+	{
+		static const uint8_t reg_addr[2] = {(uint8_t)(D7S_REG_INSTANT_SI >> 8), (uint8_t)(D7S_REG_INSTANT_SI)};
+		i2c_begin(I2C_DEV_D7S);
+		d7s_select(d7s_first());
+		i2c_read_async(I2C_DEV_D7S, D7S_I2C_ADDR, reg_addr, 2, capture_data, 4, capture_done, NULL);
+		// The bus is released when the read is finished
+		i2c_end(I2C_DEV_D7S, 0);
+		return;
+	}
+
+	float peak_si[D7S_MAX_SENSORS];
+	float peak_pga[D7S_MAX_SENSORS];
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
+	{
+		float si = 0.0f;
+		float pga = 0.0f;
+		if (d7s_sensors[sensor].present && read_si_pga_rak12027(sensor, D7S_REG_INSTANT_SI, &si, &pga))
+		{
+			update_peak_rak12027(sensor, si, pga);
+		}
+		peak_si[sensor] = d7s_sensors[sensor].peak_si;
+		peak_pga[sensor] = d7s_sensors[sensor].peak_pga;
+	}
+	peakSI = d7s_agreed_value(peak_si);
+	peakPGA = d7s_agreed_value(peak_pga);
+	MYLOG("SEIS", "Capture SI %.4f PGA %.4f", peakSI, peakPGA);
+}
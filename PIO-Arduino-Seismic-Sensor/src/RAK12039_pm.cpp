@@ -0,0 +1,270 @@
+/**
+ * @file RAK12039_pm.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Initialize and read data from the PMSA003I particle sensor
+ *        The fan of the sensor is switched on only for a sampling burst before the next heartbeat.
+ *        After the warmup time a number of frames is read and averaged, then the fan is switched off again.
+ *        If the heartbeat is too short for this cycle the fan stays on and the sensor is sampled continuously.
+ * @version 0.1
+ * @date 2023-03-16
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "RAK12039_PMSA003I.h"
+
+#if defined(_SLOT_D_) || defined(_SLOT_F_)
+#pragma message "RAK12039 SET pin conflicts with the RAK12027 interrupts in this slot"
+#endif
+
+/** Register of the data frame */
+#define PM_REG_DATA 0x00
+
+/** Time for the fan to get a stable air flow, from the datasheet */
+#ifndef PM_WARMUP_TIME
+#define PM_WARMUP_TIME 30000
+#endif
+
+/** Time between two samples, the sensor updates its values about every 2 seconds */
+#ifndef PM_SAMPLE_INTERVAL
+#define PM_SAMPLE_INTERVAL 2500
+#endif
+
+/** Number of samples averaged for one heartbeat */
+#ifndef PM_SAMPLE_NUM
+#define PM_SAMPLE_NUM 8
+#endif
+
+/** Time the warm-up may be longer, the first sample can share a wakeup with another job */
+#define PM_WARMUP_TOLERANCE 5000
+
+/** Time the sampling should be finished before the heartbeat */
+#define PM_SAMPLE_MARGIN 5000
+
+/** Duration of one complete sampling cycle */
+#define PM_CYCLE_TIME (PM_WARMUP_TIME + PM_WARMUP_TOLERANCE + PM_SAMPLE_NUM * PM_SAMPLE_INTERVAL + PM_SAMPLE_MARGIN)
+
+/** States of the sampling cycle */
+enum pm_state_e
+{
+	PM_OFF = 0,
+	PM_WARMUP,
+	PM_SAMPLING
+};
+
+/** Current state of the sampling cycle */
+static pm_state_e pm_state = PM_OFF;
+
+/** Flag if the fan stays on, heartbeat is shorter than a sampling cycle */
+static bool pm_continuous = false;
+
+/** Samples taken in the current cycle */
+static uint8_t pm_samples = 0;
+
+/** Raw frame, converted in place */
+static PMSA_Data_t pm_frame;
+
+/** Running averages of the environmental values */
+static float pm_avg_10 = 0.0f;
+static float pm_avg_25 = 0.0f;
+static float pm_avg_100 = 0.0f;
+
+/** Number of samples in the averages */
+static uint16_t pm_avg_num = 0;
+
+/**
+ * @brief Switch the fan on or off
+ *
+ * @param on true to switch the fan on
+ */
+static void pm_fan(bool on)
+{
+	digitalWrite(PM_SET_PIN, on ? HIGH : LOW);
+}
+
+/**
+ * @brief Schedule the next step of the cycle
+ *
+ * @param period time in ms until the next PM_SAMPLE event
+ * @param tolerance time the step may start early
+ */
+static void pm_schedule(uint32_t period, uint32_t tolerance)
+{
+	sched_start(SCHED_PM, period, 0, tolerance);
+}
+
+/**
+ * @brief Read one frame and add it to the running averages
+ *
+ * @return true frame was valid
+ * @return false I2C transfer or checksum failed
+ */
+static bool sample_rak12039(void)
+{
+	uint8_t reg = PM_REG_DATA;
+	if (!i2c_read_regs(I2C_DEV_PMSA, PMSA003I_DEV_ADDR, &reg, 1, (uint8_t *)&pm_frame, sizeof(PMSA_Data_t)))
+	{
+		MYLOG("PM", "Reading PMSA003I failed");
+		return false;
+	}
+	if (!RAK_PMSA003I::parseDate(&pm_frame))
+	{
+		MYLOG("PM", "PMSA003I frame invalid");
+		return false;
+	}
+
+	pm_avg_num++;
+	pm_avg_10 += ((float)pm_frame.pm10_env - pm_avg_10) / pm_avg_num;
+	pm_avg_25 += ((float)pm_frame.pm25_env - pm_avg_25) / pm_avg_num;
+	pm_avg_100 += ((float)pm_frame.pm100_env - pm_avg_100) / pm_avg_num;
+	MYLOG("PM", "PM1.0 %d PM2.5 %d PM10 %d", pm_frame.pm10_env, pm_frame.pm25_env, pm_frame.pm100_env);
+	return true;
+}
+
+/**
+ * @brief Start the fan and wait for a stable air flow
+ *        The first sample may be taken up to PM_WARMUP_TOLERANCE later, never earlier
+ *
+ */
+static void pm_warmup(void)
+{
+	pm_fan(true);
+	pm_state = PM_WARMUP;
+	pm_schedule(PM_WARMUP_TIME + PM_WARMUP_TOLERANCE, PM_WARMUP_TOLERANCE);
+}
+
+/**
+ * @brief Schedule the next sampling cycle relative to the heartbeat
+ *        Called after the PM values were added to a packet
+ *        The cycle is planned for the due time of the heartbeat job, the heartbeat
+ *        can run early and its last sample shares the wakeup of the heartbeat
+ *
+ */
+static void schedule_rak12039(void)
+{
+	uint32_t heartbeat = get_heartbeat_time();
+	bool continuous = (heartbeat == 0) || (heartbeat <= PM_CYCLE_TIME);
+
+	if (continuous)
+	{
+		if (!pm_continuous)
+		{
+			MYLOG("PM", "Heartbeat too short, fan stays on");
+			pm_continuous = true;
+			pm_warmup();
+		}
+		return;
+	}
+
+	// Time until the next heartbeat, the heartbeat after it if this one is too close
+	uint32_t next = sched_remaining(SCHED_HEARTBEAT);
+	if (next == 0)
+	{
+		next = heartbeat;
+	}
+	else if (next <= PM_CYCLE_TIME)
+	{
+		next += heartbeat;
+	}
+	pm_continuous = false;
+	pm_fan(false);
+	pm_state = PM_OFF;
+	pm_schedule(next - PM_CYCLE_TIME, PM_SAMPLE_MARGIN);
+}
+
+/**
+ * @brief Initialize the particle sensor
+ *
+ * @return true if initialization is ok
+ * @return false if sensor could not be found
+ */
+bool init_rak12039(void)
+{
+	pinMode(PM_SET_PIN, OUTPUT);
+	pm_fan(true);
+
+	RAK_PMSA003I pmsa003i;
+	i2c_begin(I2C_DEV_PMSA);
+	bool result = pmsa003i.begin(Wire);
+	// Address, register and ID
+	i2c_end(I2C_DEV_PMSA, 3);
+	// The library might restart Wire with the default clock
+	i2c_clock_changed();
+	if (!result)
+	{
+		MYLOG("PM", "Could not initialize PMSA003I");
+		pm_fan(false);
+		return false;
+	}
+
+	// First values for the first heartbeat
+	pm_warmup();
+	return true;
+}
+
+/**
+ * @brief Handle the PM_SAMPLE event, advances the sampling cycle
+ *
+ */
+void handle_rak12039(void)
+{
+	switch (pm_state)
+	{
+	case PM_OFF:
+		MYLOG("PM", "Fan on");
+		pm_warmup();
+		break;
+	case PM_WARMUP:
+		pm_state = PM_SAMPLING;
+		pm_samples = 0;
+		// fall through
+	case PM_SAMPLING:
+		sample_rak12039();
+		pm_samples++;
+		if (pm_continuous || (pm_samples < PM_SAMPLE_NUM))
+		{
+			pm_schedule(PM_SAMPLE_INTERVAL, PM_SAMPLE_INTERVAL / 4);
+		}
+		else
+		{
+			MYLOG("PM", "Fan off, %d samples", pm_avg_num);
+			pm_fan(false);
+			pm_state = PM_OFF;
+			sched_stop(SCHED_PM);
+		}
+		break;
+	}
+}
+
+/**
+ * @brief Add the averaged PM values to the payload
+ *     Data is added to Cayenne LPP payload as channel
+ *     LPP_CHANNEL_PM_1_0, LPP_CHANNEL_PM_2_5, LPP_CHANNEL_PM_10_0
+ *     The averages are restarted and the next sampling cycle is scheduled
+ *
+ */
+void read_rak12039(void)
+{
+	if (pm_avg_num != 0)
+	{
+		g_solution_data.addVoc_index(LPP_CHANNEL_PM_1_0, (uint32_t)(pm_avg_10 + 0.5f));
+		g_solution_data.addVoc_index(LPP_CHANNEL_PM_2_5, (uint32_t)(pm_avg_25 + 0.5f));
+		g_solution_data.addVoc_index(LPP_CHANNEL_PM_10_0, (uint32_t)(pm_avg_100 + 0.5f));
+	}
+	else
+	{
+		MYLOG("PM", "No PM values yet");
+	}
+
+	pm_avg_10 = 0.0f;
+	pm_avg_25 = 0.0f;
+	pm_avg_100 = 0.0f;
+	pm_avg_num = 0;
+
+	// A cycle that is still running keeps going, its samples go into the next packet
+	if (pm_state == PM_OFF || pm_continuous)
+	{
+		schedule_rak12039();
+	}
+}
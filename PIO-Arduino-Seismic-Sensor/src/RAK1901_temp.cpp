@@ -2,8 +2,10 @@
  * @file RAK1901_temp.cpp
  * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
  * @brief Initialize and read data from SHTC3 sensor
- * @version 0.2
- * @date 2022-01-30
+ *        The measurement is split into start and collect, so the conversion
+ *        runs while the radio is busy. The payload uses the values of the last collect.
+ * @version 0.3
+ * @date 2023-03-15
  *
  * @copyright Copyright (c) 2022
  *
@@ -11,9 +13,53 @@
 #include "app.h"
 #include "SparkFun_SHTC3.h"
 
+/** I2C address of the SHTC3 */
+#define SHTC3_ADDR 0x70
+
+/** Conversion time of a normal mode measurement in ms */
+#define SHTC3_CONVERSION_TIME 13
+
+/** SHTC3 commands */
+static const uint8_t shtc3_wakeup[2] = {0x35, 0x17};
+static const uint8_t shtc3_measure[2] = {0x78, 0x66}; // Temperature first, normal mode, no clock stretching
+static const uint8_t shtc3_sleep[2] = {0xB0, 0x98};
+
 /** Sensor instance */
 SHTC3 shtc3;
 
+/** Last collected values */
+static float rak1901_temp = 0.0f;
+static float rak1901_humid = 0.0f;
+
+/** Flag if the last collected values are valid */
+static bool rak1901_valid = false;
+
+/** Flag if a conversion is running */
+static bool rak1901_converting = false;
+
+/** millis() when the conversion was started */
+static uint32_t rak1901_start = 0;
+
+/**
+ * @brief CRC8 of a SHTC3 data word
+ *
+ * @param data pointer to the 2 bytes of the word
+ * @return uint8_t CRC
+ */
+static uint8_t shtc3_crc(const uint8_t *data)
+{
+	uint8_t crc = 0xFF;
+	for (uint8_t idx = 0; idx < 2; idx++)
+	{
+		crc ^= data[idx];
+		for (uint8_t bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : (crc << 1);
+		}
+	}
+	return crc;
+}
+
 /**
  * @brief Initialize the temperature and humidity sensor
  *
@@ -22,8 +68,13 @@ SHTC3 shtc3;
  */
 bool init_rak1901(void)
 {
-	Wire.setClock(100000); // Wire.setClock(400000);
-	if (shtc3.begin(Wire) != SHTC3_Status_Nominal)
+	i2c_begin(I2C_DEV_SHTC3);
+	bool result = shtc3.begin(Wire) == SHTC3_Status_Nominal;
+	// ID read plus sleep command
+	i2c_end(I2C_DEV_SHTC3, 3 + 4 + 3);
+	// The library might restart Wire with the default clock
+	i2c_clock_changed();
+	if (!result)
 	{
 		MYLOG("T_H", "Could not initialize SHTC3");
 		return false;
@@ -32,28 +83,96 @@ bool init_rak1901(void)
 }
 
 /**
- * @brief Read the temperature and humidity values
+ * @brief Wake up the SHTC3 and start a conversion
+ *        Returns immediately, the values are read with collect_rak1901()
+ *
+ * @return true conversion started
+ * @return false SHTC3 did not answer
+ */
+bool start_rak1901(void)
+{
+	if (rak1901_converting)
+	{
+		return true;
+	}
+	i2c_begin(I2C_DEV_SHTC3);
+	bool result = i2c_write(I2C_DEV_SHTC3, SHTC3_ADDR, shtc3_wakeup, 2);
+	if (result)
+	{
+		// Wakeup time
+		delayMicroseconds(240);
+		result = i2c_write(I2C_DEV_SHTC3, SHTC3_ADDR, shtc3_measure, 2);
+	}
+	i2c_end(I2C_DEV_SHTC3, 0);
+	if (!result)
+	{
+		MYLOG("T_H", "Start SHTC3 failed");
+		return false;
+	}
+	rak1901_converting = true;
+	rak1901_start = millis();
+	return true;
+}
+
+/**
+ * @brief Read the result of a started conversion and send the SHTC3 to sleep
+ *
+ * @return true new values collected
+ * @return false no conversion started, conversion not finished or read failed
+ */
+bool collect_rak1901(void)
+{
+	if (!rak1901_converting || ((millis() - rak1901_start) < SHTC3_CONVERSION_TIME))
+	{
+		return false;
+	}
+	rak1901_converting = false;
+
+	uint8_t data[6];
+	i2c_begin(I2C_DEV_SHTC3);
+	bool result = i2c_read(I2C_DEV_SHTC3, SHTC3_ADDR, data, 6);
+	i2c_write(I2C_DEV_SHTC3, SHTC3_ADDR, shtc3_sleep, 2);
+	i2c_end(I2C_DEV_SHTC3, 0);
+
+	if (!result || (shtc3_crc(&data[0]) != data[2]) || (shtc3_crc(&data[3]) != data[5]))
+	{
+		MYLOG("T_H", "Reading SHTC3 failed");
+		return false;
+	}
+	uint16_t raw_temp = ((uint16_t)data[0] << 8) | data[1];
+	uint16_t raw_humid = ((uint16_t)data[3] << 8) | data[4];
+	rak1901_temp = -45.0f + 175.0f * (float)raw_temp / 65536.0f;
+	rak1901_humid = 100.0f * (float)raw_humid / 65536.0f;
+	rak1901_valid = true;
+	MYLOG("T_H", "T: %.2f H: %.2f", rak1901_temp, rak1901_humid);
+	return true;
+}
+
+/**
+ * @brief Add the temperature and humidity values to the payload
  *     Data is added to Cayenne LPP payload as channel
  *     LPP_CHANNEL_HUMID, LPP_CHANNEL_TEMP
+ *     Uses the values of the last conversion, only the very first call waits for a conversion
  *
  */
 void read_rak1901(void)
 {
-	MYLOG("T_H", "Reading SHTC3");
-	shtc3.update();
+	// Conversion started with the last packet, but not collected yet
+	collect_rak1901();
 
-	if (shtc3.lastStatus == SHTC3_Status_Nominal)
+	if (!rak1901_valid)
 	{
-		int16_t temp_int = (int16_t)(shtc3.toDegC() * 10.0);
-		uint16_t humid_int = (uint16_t)(shtc3.toPercent() * 2);
-
-		MYLOG("T_H", "T: %.2f H: %.2f", (float)temp_int / 10.0, (float)humid_int / 2.0);
-
-		g_solution_data.addRelativeHumidity(LPP_CHANNEL_HUMID, shtc3.toPercent());
-		g_solution_data.addTemperature(LPP_CHANNEL_TEMP, shtc3.toDegC());
+		MYLOG("T_H", "No values yet, read SHTC3");
+		if (start_rak1901())
+		{
+			delay(SHTC3_CONVERSION_TIME);
+			collect_rak1901();
+		}
 	}
-	else
+
+	if (rak1901_valid)
 	{
-		MYLOG("T_H", "Reading SHTC3 failed");
+		g_solution_data.addRelativeHumidity(LPP_CHANNEL_HUMID, rak1901_humid);
+		g_solution_data.addTemperature(LPP_CHANNEL_TEMP, rak1901_temp);
 	}
 }
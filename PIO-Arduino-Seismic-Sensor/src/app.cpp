@@ -11,11 +11,6 @@
 
 #include "app.h"
 
-#ifdef NRF52_SERIES
-/** Timer to wakeup task frequently and send message */
-SoftwareTimer delayed_sending;
-#endif
-
 /** Set the device name, max length is 10 characters */
 char g_ble_dev_name[10] = "RAK-SEISM";
 
@@ -28,6 +23,9 @@ uint8_t join_or_send_fail = 0;
 /** Flag if RAK1901 temperature sensor is installed */
 bool has_rak1901 = false;
 
+/** Flag if RAK12039 particle sensor is installed */
+bool has_rak12039 = false;
+
 /** Flag if RAK12002 RTC is installed */
 bool has_rak12002 = false;
 
@@ -35,16 +33,31 @@ bool has_rak12002 = false;
 bool rejoin_network = false;
 
 /**
- * @brief Timer function used to avoid sending packages too often.
- *       Delays the next package by 10 seconds
+ * @brief Start the slow sensor conversions for the next packet
+ *        Called after a packet was enqueued, the conversions run while the radio is busy
  *
- * @param unused
- *      Timer handle, not used
  */
-void send_delayed(TimerHandle_t unused)
+void start_samples(void)
 {
-	api_wake_loop(STATUS);
-	delayed_sending.stop();
+	if (has_rak1901 && is_full_payload())
+	{
+		start_rak1901();
+	}
+}
+
+/**
+ * @brief Collect the sensor values for the next packet
+ *        Called when the radio is finished, the battery is sampled without the TX load
+ *
+ */
+void collect_samples(void)
+{
+	sample_batt();
+	update_batt_profile();
+	if (has_rak1901)
+	{
+		collect_rak1901();
+	}
 }
 
 /**
@@ -70,8 +83,6 @@ void setup_app(void)
 	}
 	digitalWrite(LED_GREEN, LOW);
 
-	// Prepare delayed sending timer
-	delayed_sending.begin(g_lorawan_settings.send_repeat_time, send_delayed, NULL, false);
 	AT_PRINTF("Seismic Sensor\n");
 	AT_PRINTF("Built with RAK's WisBlock\n");
 	AT_PRINTF("SW Version %d.%d.%d\n", g_sw_ver_1, g_sw_ver_2, g_sw_ver_3);
@@ -95,17 +106,22 @@ bool init_app(void)
 	bool init_result = true;
 	MYLOG("APP", "init_app");
 
+	// Check the retained counters and count this reset
+	init_perf();
+
 	pinMode(WB_IO2, OUTPUT);
 	digitalWrite(WB_IO2, LOW);
 
 	// Start the I2C bus
-	Wire.begin();
-	Wire.setClock(400000);
+	init_i2c_bus();
+
+	// Start the wakeup scheduler, used by the sensor and sync modules
+	init_scheduler();
 
 	// Initialize Seismic module
 	MYLOG("APP", "Initialize RAK12027");
 	// Get saved threshold setting
-	read_threshold_settings();
+	read_app_settings();
 	init_result = init_rak12027();
 	MYLOG("APP", "RAK12027 %s", init_result ? "success" : "failed");
 	if (init_result)
@@ -113,6 +129,15 @@ bool init_app(void)
 		Serial.println("+EVT: RAK12027 OK");
 	}
 
+	// Prepare the shutoff output, the pins of the D7S are known now
+	init_shutoff();
+
+	// Start the task for the earthquake handling
+	if (!init_seismic_task())
+	{
+		MYLOG("APP", "Seismic events are handled by the loop");
+	}
+
 	// Initialize Temperature sensor
 	MYLOG("APP", "Initialize RAK1901");
 	has_rak1901 = init_rak1901();
@@ -122,6 +147,15 @@ bool init_app(void)
 		Serial.println("+EVT: RAK1901 OK");
 	}
 
+	// Initialize particle sensor
+	MYLOG("APP", "Initialize RAK12039");
+	has_rak12039 = init_rak12039();
+	MYLOG("APP", "RAK12039 %s", has_rak12039 ? "success" : "failed");
+	if (has_rak12039)
+	{
+		Serial.println("+EVT: RAK12039 OK");
+	}
+
 	// Initialize RTC
 	MYLOG("APP", "Initialize RAK12002");
 	has_rak12002 = init_rak12002();
@@ -131,6 +165,27 @@ bool init_app(void)
 		Serial.println("+EVT: RAK12002 OK");
 	}
 
+	// Initialize event journal
+	MYLOG("APP", "Initialize event journal");
+	if (!init_event_log())
+	{
+		MYLOG("APP", "Event journal failed");
+	}
+
+	// Initialize event journal dump
+	init_event_dump();
+
+	// Initialize network time sync
+	init_time_sync();
+
+	// Prepare the P2P alert flooding
+	init_mesh();
+
+#ifdef NRF52_SERIES
+	// Add the BLE telemetry service
+	init_ble_telemetry();
+#endif
+
 	// Initialize AT commands
 	init_user_at();
 
@@ -139,6 +194,13 @@ bool init_app(void)
 	// Reset the packet
 	g_solution_data.reset();
 
+	// The heartbeat is a job of the scheduler, in LoRaWAN mode it starts after the join
+	if (!g_lorawan_settings.lorawan_enable)
+	{
+		api_timer_stop();
+		heartbeat_start();
+	}
+
 	return init_result;
 }
 
@@ -149,85 +211,73 @@ bool init_app(void)
  */
 void app_event_handler(void)
 {
-	// Seismic sensor alert (collapse or shut down interrupt)
-	if ((g_task_event_type & SEISMIC_ALERT) == SEISMIC_ALERT)
+	uint32_t perf_start = micros();
+	perf_wakeup(g_task_event_type & ~(LORA_DATA | LORA_TX_FIN | LORA_JOIN_FIN | BLE_DATA));
+
+	// Run scheduled jobs that can share this wakeup
+	sched_service();
+
+	// Seismic events are handled by the seismic task, they end up here only if the task is not running
+	if ((g_task_event_type & SEISMIC_TASK_EVENTS) != 0)
 	{
-		g_task_event_type &= N_SEISMIC_ALERT;
-		switch (check_event_rak12027(true))
+		uint16_t seismic_events = g_task_event_type & SEISMIC_TASK_EVENTS;
+		g_task_event_type &= ~SEISMIC_TASK_EVENTS;
+		seismic_handler(seismic_events);
+	}
+
+	// Write the record of a finished earthquake into the journal
+	event_log_flush();
+
+	// Send next page of the event journal
+	if ((g_task_event_type & EVENT_DUMP) == EVENT_DUMP)
+	{
+		g_task_event_type &= N_EVENT_DUMP;
+		send_event_dump();
+	}
+
+	// Time sync request or beacon, or the RTC resync
+	if ((g_task_event_type & TIME_SYNC) == TIME_SYNC)
+	{
+		g_task_event_type &= N_TIME_SYNC;
+		if (sched_take(SCHED_RTC_SYNC))
 		{
-		case 1:
-			// Collapse alert
-			collapse_alert = true;
-			MYLOG("APP", "Earthquake collapse alert!");
-			break;
-		case 2:
-			// ShutDown alert
-			shutoff_alert = true;
-			MYLOG("APP", "Earthquake shutoff alert!");
-			break;
-		case 3:
-			// Collapse & ShutDown alert
-			collapse_alert = true;
-			shutoff_alert = true;
-			MYLOG("APP", "Earthquake collapse & shutoff alert!");
-			break;
-		default:
-			// False alert
-			digitalWrite(LED_BLUE, LOW);
-			MYLOG("APP", "Earthquake false alert!");
-			break;
+			// Correct the clock drift against the RTC from time to time
+			resync_rak12002();
+		}
+		if (sched_take(SCHED_TIME_SYNC))
+		{
+			time_sync_handler();
 		}
 	}
 
-	// Handle Seismic Events
-	if ((g_task_event_type & SEISMIC_EVENT) == SEISMIC_EVENT)
+	// Particle sensor sampling cycle
+	if ((g_task_event_type & PM_SAMPLE) == PM_SAMPLE)
 	{
-		MYLOG("APP", "Earthquake event");
-		g_task_event_type &= N_SEISMIC_EVENT;
-		switch (check_event_rak12027(false))
-		{
-		case 4:
-			// Earthquake start
-			MYLOG("APP", "Earthquake start alert!");
-			read_rak12027(false);
-			earthquake_end = false;
-			g_solution_data.addPresence(LPP_CHANNEL_EQ_EVENT, true);
-			// Make sure no packet is sent while analyzing
-			api_timer_stop();
-			delayed_sending.stop();
+		g_task_event_type &= N_PM_SAMPLE;
+		handle_rak12039();
+	}
 
-			// // Request packet sending
-			// g_task_event_type = g_task_event_type | STATUS;
+#ifdef NRF52_SERIES
+	// BLE telemetry notifications
+	if ((g_task_event_type & BLE_TELEMETRY) == BLE_TELEMETRY)
+	{
+		g_task_event_type &= N_BLE_TELEMETRY;
+		ble_telemetry_handler();
+	}
+#endif
 
-			break;
-		case 5:
-			// Earthquake end
-			MYLOG("APP", "Earthquake end alert!");
-			read_rak12027(true);
-			earthquake_end = true;
-			g_solution_data.addPresence(LPP_CHANNEL_EQ_EVENT, true);
-			g_solution_data.addPresence(LPP_CHANNEL_EQ_SHUTOFF, shutoff_alert);
-			g_solution_data.addPresence(LPP_CHANNEL_EQ_COLLAPSE, collapse_alert);
-
-			// Reset flags
-			shutoff_alert = false;
-			collapse_alert = false;
-			// Send another packet in 1 minute
-			delayed_sending.setPeriod(60000);
-			delayed_sending.start();
-			// Restart frequent sending
-			api_timer_restart(g_lorawan_settings.send_repeat_time);
-
-			// Request packet sending
-			g_task_event_type = g_task_event_type | STATUS;
+	// USB stream snapshot
+	if ((g_task_event_type & USB_STREAM) == USB_STREAM)
+	{
+		g_task_event_type &= N_USB_STREAM;
+		usb_stream_handler();
+	}
 
-			break;
-		default:
-			// False alert
-			earthquake_end = true;
-			MYLOG("APP", "Earthquake false alert!");
-			break;
-		}
+	// P2P alert frames
+	if ((g_task_event_type & P2P_MESH) == P2P_MESH)
+	{
+		g_task_event_type &= N_P2P_MESH;
+		mesh_handler();
 	}
 
 	// Timer triggered event
@@ -236,14 +286,45 @@ void app_event_handler(void)
 		g_task_event_type &= N_STATUS;
 		MYLOG("APP", "Timer wakeup");
 
+		// The API starts its own timer after a join and with AT+SENDINT, the heartbeat is a job of the scheduler
+		api_timer_stop();
+		if (!earthquake_start)
+		{
+			heartbeat_check();
+		}
+
+		// Acknowledge of a downlink command has priority, the sensor data follows with the next wakeup
+		if (dl_ack_pending)
+		{
+			if (send_downlink_ack())
+			{
+				sched_start(SCHED_FOLLOW_UP, 10000, 0, SCHED_FOLLOW_UP_TOLERANCE);
+				perf_handler_done(PERF_HANDLER_APP, perf_start);
+				return;
+			}
+		}
+
+		// Requested diagnostic uplink, the sensor data follows with the next wakeup
+		if (perf_uplink_pending)
+		{
+			send_perf_uplink();
+			sched_start(SCHED_FOLLOW_UP, 10000, 0, SCHED_FOLLOW_UP_TOLERANCE);
+			perf_handler_done(PERF_HANDLER_APP, perf_start);
+			return;
+		}
+
 #ifdef NRF52_SERIES
-		// If BLE is enabled, restart Advertising
-		if (g_enable_ble)
+		// If BLE is enabled, restart Advertising, skipped if the battery is low
+		if (g_enable_ble && is_ble_allowed())
 		{
 			restart_advertising(15);
 		}
 #endif
 
+		// The seismic task adds the earthquake values to the same packet
+		payload_lock();
+		uint8_t perf_type = PERF_UP_STATUS;
+
 		if (!rejoin_network)
 		{
 			// Check for seismic events
@@ -255,6 +336,7 @@ void app_event_handler(void)
 				g_solution_data.addAnalogInput(LPP_CHANNEL_EQ_SI, savedSI * 10.0);
 				g_solution_data.addAnalogInput(LPP_CHANNEL_EQ_PGA, savedPGA * 10.0);
 				earthquake_end = false;
+				perf_type = PERF_UP_ALERT;
 				MYLOG("APP", "Sending earthquake end message");
 			}
 			else
@@ -262,15 +344,30 @@ void app_event_handler(void)
 				g_solution_data.addPresence(LPP_CHANNEL_EQ_EVENT, false);
 			}
 
-			// Get battery level
-			float batt_level_f = read_batt();
-			g_solution_data.addVoltage(LPP_CHANNEL_BATT, batt_level_f / 1000.0);
+			// Get battery level, sampled after the last transmission
+			if (get_batt_mv() == 0.0f)
+			{
+				sample_batt();
+				update_batt_profile();
+			}
+			// Compact payload has only the 1 byte state of charge
+			if (is_full_payload())
+			{
+				g_solution_data.addVoltage(LPP_CHANNEL_BATT, get_batt_mv() / 1000.0);
+			}
+			g_solution_data.addPercentage(LPP_CHANNEL_BATT_SOC, get_batt_soc());
 
-			// Get temperature and humidity if sensor is installed
-			if (has_rak1901)
+			// Get temperature and humidity if sensor is installed, converted during the last transmission
+			if (has_rak1901 && is_full_payload())
 			{
 				read_rak1901();
 			}
+
+			// Get the particle values averaged since the last packet
+			if (has_rak12039 && is_full_payload())
+			{
+				read_rak12039();
+			}
 		}
 		else
 		{
@@ -289,9 +386,11 @@ void app_event_handler(void)
 				{
 				case LMH_SUCCESS:
 					MYLOG("APP", "Packet enqueued");
+					perf_uplink(perf_type, PERF_RES_QUEUED);
 					break;
 				case LMH_BUSY:
 					MYLOG("APP", "LoRa transceiver is busy");
+					perf_uplink(perf_type, PERF_RES_BUSY);
 					AT_PRINTF("+EVT:BUSY\n");
 
 					/// \todo if 10 times busy, restart the node
@@ -305,6 +404,7 @@ void app_event_handler(void)
 					break;
 				case LMH_ERROR:
 					AT_PRINTF("+EVT:SIZE_ERROR\n");
+					perf_uplink(perf_type, PERF_RES_ERROR);
 					MYLOG("APP", "Packet error, too big to send with current DR");
 
 					/// \todo if 10 times busy, restart the node
@@ -325,25 +425,33 @@ void app_event_handler(void)
 		}
 		else
 		{
-			// Add the device DevEUI as a device ID to the packet
-			uint8_t packet_buffer[g_solution_data.getSize() + 8];
-			memcpy(packet_buffer, g_lorawan_settings.node_device_eui, 8);
-			memcpy(&packet_buffer[8], g_solution_data.getBuffer(), g_solution_data.getSize());
+			// Add the device DevEUI as a device ID in front of the payload
+			uint8_t *frame = g_solution_data.getFrame(g_lorawan_settings.node_device_eui);
 
 			// Send packet over LoRa
-			if (send_p2p_packet(packet_buffer, g_solution_data.getSize() + 8))
+			if ((frame != NULL) && (g_solution_data.getFrameSize() <= 255) && send_p2p_packet(frame, g_solution_data.getFrameSize()))
 			{
 				MYLOG("APP", "Packet enqueued");
+				perf_uplink(perf_type, PERF_RES_QUEUED);
 			}
 			else
 			{
 				AT_PRINTF("+EVT:SIZE_ERROR\n");
+				perf_uplink(perf_type, PERF_RES_ERROR);
 				MYLOG("APP", "Packet too big");
 			}
 		}
 		// Reset the packet
 		g_solution_data.reset();
+		payload_unlock();
+
+		// Start the conversions for the next packet
+		start_samples();
 	}
+
+	// Finish sensor reads that run in the background
+	i2c_async_wait(I2C_ASYNC_TIMEOUT);
+	perf_handler_done(PERF_HANDLER_APP, perf_start);
 }
 
 #ifdef NRF52_SERIES
@@ -358,16 +466,13 @@ void ble_data_handler(void)
 		// BLE UART data handling
 		if ((g_task_event_type & BLE_DATA) == BLE_DATA)
 		{
-			MYLOG("AT", "RECEIVED BLE");
 			/** BLE UART data arrived */
 			g_task_event_type &= N_BLE_DATA;
 
-			while (g_ble_uart.available() > 0)
-			{
-				at_serial_input(uint8_t(g_ble_uart.read()));
-				delay(5);
-			}
-			at_serial_input(uint8_t('\n'));
+			uint32_t perf_start = micros();
+			perf_wakeup(BLE_DATA);
+			ble_rx_handler();
+			perf_handler_done(PERF_HANDLER_BLE, perf_start);
 		}
 	}
 }
@@ -379,6 +484,9 @@ void ble_data_handler(void)
  */
 void lora_data_handler(void)
 {
+	uint32_t perf_start = micros();
+	perf_wakeup(g_task_event_type & (LORA_DATA | LORA_TX_FIN | LORA_JOIN_FIN));
+
 	// LoRa Join finished handling
 	if ((g_task_event_type & LORA_JOIN_FIN) == LORA_JOIN_FIN)
 	{
@@ -389,13 +497,23 @@ void lora_data_handler(void)
 			// Reset join failed counter
 			join_or_send_fail = 0;
 
+			// The heartbeat is a job of the scheduler, not the timer the API started after the join
+			api_timer_stop();
+			heartbeat_start();
+
 			// // Force a sensor reading in 10 seconds
-			delayed_sending.setPeriod(10000);
-			delayed_sending.start();
+			sched_start(SCHED_FOLLOW_UP, 10000, 0, SCHED_FOLLOW_UP_TOLERANCE);
+
+			// Request the network time after the first packet
+			start_time_sync(TIME_SYNC_JOIN_DELAY);
+
+			// Listen to the early warnings, the join removed the multicast session
+			init_early_warning();
 		}
 		else
 		{
 			MYLOG("APP", "Join network failed");
+			perf_join_fail();
 			/// \todo here join could be restarted.
 			lmh_join();
 
@@ -438,16 +556,44 @@ void lora_data_handler(void)
 						// Save the new send frequency
 						g_lorawan_settings.send_repeat_time = new_send_frequency * 1000;
 
-						// Set the timer to the new send frequency
-						api_timer_restart(g_lorawan_settings.send_repeat_time);
+						// Set the timer to the new send frequency, during an earthquake the restart at its end takes it
+						if (!earthquake_start)
+						{
+							heartbeat_start();
+						}
 						// Save the new send frequency
 						save_settings();
 					}
 				}
 			}
+			// Check if downlink is a configuration command frame
+			else if (g_last_fport == DL_CMD_FPORT)
+			{
+				handle_downlink_cmd(g_rx_lora_data, g_rx_data_len);
+				if (!send_downlink_ack())
+				{
+					// Retry with the next wakeup
+					perf_retry();
+					sched_start(SCHED_FOLLOW_UP, 10000, 0, SCHED_FOLLOW_UP_TOLERANCE);
+				}
+			}
+			// Check if downlink is a clock synchronization answer
+			else if (g_last_fport == TIME_SYNC_FPORT)
+			{
+				handle_time_sync_ans(g_rx_lora_data, g_rx_data_len);
+			}
+			// Check if downlink is an early warning from the multicast group
+			else if (g_last_fport == EW_FPORT)
+			{
+				handle_early_warning(g_rx_lora_data, g_rx_data_len);
+			}
 
 			if (g_lorawan_settings.lorawan_enable)
 			{
+				if (g_last_fport != EW_FPORT)
+				{
+					ew_other_downlink();
+				}
 				AT_PRINTF("+EVT:RX_1, RSSI %d, SNR %d\n", g_last_rssi, g_last_snr);
 				AT_PRINTF("+EVT:%d:", g_last_fport);
 				for (int idx = 0; idx < g_rx_data_len; idx++)
@@ -458,6 +604,12 @@ void lora_data_handler(void)
 			}
 			else
 			{
+				// Check if the packet is an alert of a neighbour or a time beacon
+				if (!handle_mesh_frame(g_rx_lora_data, g_rx_data_len))
+				{
+					handle_time_beacon(g_rx_lora_data, g_rx_data_len);
+				}
+
 				AT_PRINTF("+EVT:RXP2P, RSSI %d, SNR %d\n", g_last_rssi, g_last_snr);
 				AT_PRINTF("+EVT:");
 				for (int idx = 0; idx < g_rx_data_len; idx++)
@@ -474,5 +626,10 @@ void lora_data_handler(void)
 		g_task_event_type &= N_LORA_TX_FIN;
 
 		MYLOG("APP", "LPWAN TX cycle %s", g_rx_fin_result ? "finished ACK" : "failed NAK");
+		perf_tx_done(g_rx_fin_result);
+
+		// Radio is idle, collect the values for the next packet
+		collect_samples();
 	}
+	perf_handler_done(PERF_HANDLER_LORA, perf_start);
 }
@@ -22,19 +22,19 @@
 #define MY_DEBUG 1
 #endif
 
-/** Examples for application events */
-#define ACC_TRIGGER 0b1000000000000000
-#define N_ACC_TRIGGER 0b0111111111111111
 
 #ifdef NRF52_SERIES
 #if MY_DEBUG > 0
 #define MYLOG(tag, ...)                     \
 	do                                      \
 	{                                       \
-		if (tag)                            \
-			PRINTF("[%s] ", tag);           \
-		PRINTF(__VA_ARGS__);                \
-		PRINTF("\n");                       \
+		if (!g_usb_stream)                  \
+		{                                   \
+			if (tag)                        \
+				PRINTF("[%s] ", tag);       \
+			PRINTF(__VA_ARGS__);            \
+			PRINTF("\n");                   \
+		}                                   \
 		if (g_ble_uart_is_connected)        \
 		{                                   \
 			g_ble_uart.printf(__VA_ARGS__); \
@@ -65,6 +65,20 @@
 #define N_SEISMIC_EVENT 0b1111011111111111
 #define SEISMIC_ALERT 0b0000010000000000
 #define N_SEISMIC_ALERT 0b1111101111111111
+#define SEISMIC_CAPTURE 0b0000001000000000
+#define N_SEISMIC_CAPTURE 0b1111110111111111
+#define EVENT_DUMP 0b0001000000000000
+#define N_EVENT_DUMP 0b1110111111111111
+#define TIME_SYNC 0b0010000000000000
+#define N_TIME_SYNC 0b1101111111111111
+#define PM_SAMPLE 0b0100000000000000
+#define N_PM_SAMPLE 0b1011111111111111
+#define BLE_TELEMETRY 0b0000000100000000
+#define N_BLE_TELEMETRY 0b1111111011111111
+#define USB_STREAM 0b0000000010000000
+#define N_USB_STREAM 0b1111111101111111
+#define P2P_MESH 0b1000000000000000
+#define N_P2P_MESH 0b0111111111111111
 
 // LoRaWAN stuff
 /** Include the WisBlock-API */
@@ -118,9 +132,19 @@
 #define LPP_CHANNEL_EQ_PGA 45		   // RAK12027
 #define LPP_CHANNEL_EQ_SHUTOFF 46	   // RAK12027
 #define LPP_CHANNEL_EQ_COLLAPSE 47	   // RAK12027
+#define LPP_CHANNEL_EQ_TIME 48		   // RAK12027 + RAK12002
+#define LPP_CHANNEL_EQ_TIME_MS 49	   // RAK12027 + clock
+#define LPP_CHANNEL_EQ_TIME_ACC 50	   // RAK12027 + clock
+#define LPP_CHANNEL_BATT_SOC 51		   // Base Board
+#define LPP_CHANNEL_EQ_SI_ARRAY 52	   // RAK12027 array, SI of sensor 0 to 3 on channel 52 to 55
+#define LPP_CHANNEL_EQ_PGA_ARRAY 56	   // RAK12027 array, PGA of sensor 0 to 3 on channel 56 to 59
 
 extern WisCayenne g_solution_data;
 
+/** Sensor sampling pipeline */
+void start_samples(void);
+void collect_samples(void);
+
 /** Application function definitions */
 void setup_app(void);
 bool init_app(void);
@@ -129,9 +153,189 @@ void ble_data_handler(void) __attribute__((weak));
 void lora_data_handler(void);
 extern uint8_t g_last_fport;
 
+/** Battery stuff */
+#define BATT_FILTER_DIV 8 // Weight of a new sample is 1/8
+void sample_batt(void);
+float get_batt_mv(void);
+uint8_t get_batt_soc(void);
+
+/** Battery profile stuff */
+#define BATT_PROFILE_NORMAL 0
+#define BATT_PROFILE_CONSERVE 1
+#define BATT_PROFILE_CRITICAL 2
+#define BATT_CONSERVE_MV 3600 // Below this voltage the conserve profile is used
+#define BATT_CRITICAL_MV 3400 // Below this voltage the critical profile is used
+#define BATT_HYSTERESIS 100 // Voltage above a threshold required to return to the better profile
+void update_batt_profile(void);
+uint8_t get_batt_profile(void);
+uint32_t get_heartbeat_time(void);
+bool is_full_payload(void);
+bool is_ble_allowed(void);
+void print_batt_profile(void);
+
+/** BLE UART stuff */
+#define BLE_RX_LINE_TIMEOUT 100 // A line without line end is handled after 100 ms without new data
+void ble_rx_handler(void);
+
+/** BLE telemetry stuff */
+#define TELEM_DEFAULT_INTERVAL 1000 // Notification interval if none is set
+#define TELEM_CONN_MIN 15 // Shortest connection interval requested in ms
+#define TELEM_CONN_MAX 500 // Longest connection interval requested in ms, must be below half the supervision timeout
+#define TELEM_FLAG_EARTHQUAKE 0x01
+#define TELEM_FLAG_SHUTOFF 0x02
+#define TELEM_FLAG_COLLAPSE 0x04
+#define TELEM_FLAG_CLOCK 0x08
+#define TELEM_FLAG_JOINED 0x10
+void init_ble_telemetry(void);
+void ble_telemetry_handler(void);
+void ble_telemetry_interval_changed(void);
+void print_ble_telemetry(void);
+
+/** USB stream stuff */
+#define STREAM_SNAPSHOT 0x01
+#define STREAM_IRQ 0x02
+#define STREAM_STATE 0x03
+#define STREAM_LOST 0x04
+#define STREAM_INTERVAL_MIN 10 // Shortest snapshot interval in ms
+void usb_stream_irq(uint8_t line, uint8_t level);
+void usb_stream_state(uint8_t code);
+void usb_stream_handler(void);
+void usb_stream_start(uint16_t interval_ms);
+uint16_t usb_stream_interval(void);
+extern bool g_usb_stream;
+
+/** Performance counter stuff */
+#define PERF_FPORT 12
+#define PERF_UPLINK_SIZE 40
+#define PERF_UP_STATUS 0
+#define PERF_UP_ALERT 1
+#define PERF_UP_ACK 2
+#define PERF_UP_DUMP 3
+#define PERF_UP_SYNC 4
+#define PERF_UP_DIAG 5
+#define PERF_UP_NUM 6
+#define PERF_RES_QUEUED 0
+#define PERF_RES_BUSY 1
+#define PERF_RES_ERROR 2
+#define PERF_RES_NUM 3
+#define PERF_RESET_POWER 0
+#define PERF_RESET_PIN 1
+#define PERF_RESET_WDT 2
+#define PERF_RESET_SOFT 3
+#define PERF_RESET_LOCKUP 4
+#define PERF_RESET_WAKE 5
+#define PERF_RESET_NUM 6
+#define PERF_HANDLER_APP 0
+#define PERF_HANDLER_LORA 1
+#define PERF_HANDLER_BLE 2
+#define PERF_HANDLER_SEISMIC 3
+#define PERF_HANDLER_NUM 4
+void init_perf(void);
+void perf_reset(void);
+void perf_wakeup(uint16_t events);
+void perf_irq(uint8_t line);
+void perf_irq_handled(void);
+void perf_i2c(uint16_t bytes);
+void perf_i2c_error(void);
+void perf_uplink(uint8_t type, uint8_t result);
+lmh_error_status perf_lora_uplink(uint8_t type, lmh_error_status result);
+void perf_tx_done(bool success);
+void perf_retry(void);
+void perf_join_fail(void);
+void perf_handler_done(uint8_t handler, uint32_t start_us);
+void perf_print(void);
+void perf_request_uplink(void);
+bool send_perf_uplink(void);
+extern bool perf_uplink_pending;
+
+/** Seismic task stuff */
+#define SEISMIC_TASK_EVENTS (SEISMIC_EVENT | SEISMIC_ALERT | SEISMIC_CAPTURE)
+#define SEISMIC_TASK_PRIO TASK_PRIO_NORMAL // Above the loop, below the BLE stack
+bool init_seismic_task(void);
+void seismic_handler(uint16_t events);
+void seismic_notify(uint16_t events);
+void seismic_notify_from_isr(uint16_t events);
+void payload_lock(void);
+void payload_unlock(void);
+
+/** Wakeup scheduler stuff */
+#define SCHED_FOLLOW_UP 0
+#define SCHED_CAPTURE 1
+#define SCHED_DUMP 2
+#define SCHED_TIME_SYNC 3
+#define SCHED_PM 4
+#define SCHED_BLE_RX 5
+#define SCHED_TELEMETRY 6
+#define SCHED_USB_STREAM 7
+#define SCHED_MESH 8
+#define SCHED_HEARTBEAT 9
+#define SCHED_RTC_SYNC 10
+#define SCHED_JOB_NUM 11
+#define SCHED_FOLLOW_UP_TOLERANCE 2000 // Follow-up packets may be sent 2 seconds early
+#define SCHED_DUMP_TOLERANCE 5000 // Dump pages may be sent 5 seconds early
+#define SCHED_TIME_SYNC_TOLERANCE_DIV 8 // Sync requests may be sent 1/8 of the delay early
+#define SCHED_HEARTBEAT_TOLERANCE 8000 // The heartbeat may be sent 8 seconds early, it shares the wakeup of the last PM sample
+#define SCHED_RTC_SYNC_TOLERANCE_DIV 4 // The RTC resync may run 1/4 of its interval early, it shares a heartbeat
+#define SCHED_CAPTURE_TOLERANCE_DIV 4 // SI/PGA polls may run 1/4 of the capture rate early
+void init_scheduler(void);
+void sched_start(uint8_t job, uint32_t delay_ms, uint32_t period_ms, uint32_t tolerance_ms);
+void sched_stop(uint8_t job);
+bool sched_active(uint8_t job);
+bool sched_take(uint8_t job);
+uint32_t sched_remaining(uint8_t job);
+void heartbeat_start(void);
+void heartbeat_stop(void);
+void heartbeat_check(void);
+void sched_service(void);
+void sched_print_stats(void);
+void sched_reset_stats(void);
+
+/** I2C bus stuff */
+#define I2C_DEV_D7S 0
+#define I2C_DEV_SHTC3 1
+#define I2C_DEV_RTC 2
+#define I2C_DEV_PMSA 3
+#define I2C_DEV_NUM 4
+#define I2C_ASYNC_TIMEOUT 50
+#define I2C_STOP_TIMEOUT 2
+typedef void (*i2c_done_cb_t)(bool success, void *context);
+struct i2c_stats_s
+{
+	uint32_t transfers;
+	uint32_t bytes;
+	uint32_t bus_us;
+	uint32_t cpu_us;
+	uint32_t clock_switches;
+	uint32_t errors;
+};
+void init_i2c_bus(void);
+void i2c_clock_changed(void);
+void i2c_begin(uint8_t dev);
+void i2c_end(uint8_t dev, uint16_t bytes);
+bool i2c_read_regs(uint8_t dev, uint8_t addr, const uint8_t *reg, uint8_t reg_len, uint8_t *data, uint8_t len);
+bool i2c_read(uint8_t dev, uint8_t addr, uint8_t *data, uint8_t len);
+bool i2c_write(uint8_t dev, uint8_t addr, const uint8_t *data, uint8_t len);
+bool i2c_read_async(uint8_t dev, uint8_t addr, const uint8_t *reg, uint8_t reg_len, uint8_t *data, uint8_t len, i2c_done_cb_t callback, void *context);
+void i2c_async_poll(void);
+bool i2c_async_wait(uint32_t timeout_ms);
+i2c_stats_s *i2c_get_stats(uint8_t dev);
+void i2c_reset_stats(void);
+void i2c_print_stats(void);
+
 /** Temperature + Humidity stuff */
 bool init_rak1901(void);
 void read_rak1901(void);
+bool start_rak1901(void);
+bool collect_rak1901(void);
+
+/** Particle sensor stuff */
+#ifndef PM_SET_PIN
+#define PM_SET_PIN WB_IO6 // SET pin of the PMSA003I, high = fan on, low = sleep
+#endif
+bool init_rak12039(void);
+void handle_rak12039(void);
+void read_rak12039(void);
+extern bool has_rak12039;
 
 /** Seismic sensor stuff */
 bool init_rak12027(void);
@@ -139,17 +343,108 @@ bool calib_rak12027(void);
 void threshold_rak12027(uint8_t new_threshold);
 bool read_rak12027(bool add_values);
 uint8_t check_event_rak12027(bool is_int1);
+void capture_rak12027(void);
+bool instant_rak12027(float *si, float *pga);
 extern bool shutoff_alert;
 extern bool collapse_alert;
 extern bool earthquake_end;
+extern bool earthquake_start;
 extern float savedSI;
 extern float savedPGA;
-extern uint8_t threshold_level;
+extern float peakSI;
+extern float peakPGA;
+uint8_t state_rak12027(void);
+
+/** D7S array stuff */
+#define D7S_MAX_SENSORS 4
+#define D7S_SLOTS 6
+#define D7S_SLOT_UNKNOWN 0xFF
+#define D7S_VOTE_WINDOW_DEFAULT 3000 // Alerts of different sensors within 3 seconds are counted together
+struct d7s_sensor_s
+{
+	bool present;		   // Sensor answered during the initialization
+	uint8_t slot;		   // Slot of the interrupt pins
+	uint8_t int1_pin;	   // Collapse and shutoff interrupt
+	uint8_t int2_pin;	   // Earthquake start and end interrupt
+	bool quake;			   // Sensor reports an earthquake
+	bool collapse_vote;	   // Sensor reported a collapse
+	bool shutoff_vote;	   // Sensor reported a shutoff
+	uint32_t collapse_time; // millis() of the collapse report
+	uint32_t shutoff_time; // millis() of the shutoff report
+	uint32_t int1_count;   // Number of INT1 interrupts
+	uint32_t int1_time;	   // millis() of the last INT1, set in the interrupt
+	bool int1_vote;		   // INT1 was seen since the start of the earthquake
+	uint32_t int2_count;   // Number of INT2 changes
+	float si;			   // Latest SI of the last earthquake
+	float pga;			   // Latest PGA of the last earthquake
+	float peak_si;		   // Highest sampled SI of the current earthquake
+	float peak_pga;		   // Highest sampled PGA of the current earthquake
+};
+extern d7s_sensor_s d7s_sensors[D7S_MAX_SENSORS];
+extern uint8_t d7s_configured;
+extern uint8_t d7s_num;
+uint8_t init_d7s_array(void);
+void d7s_set_present(uint8_t sensor);
+uint8_t d7s_first(void);
+void d7s_probe_start(uint8_t sensor);
+void d7s_probe_sample(void);
+bool d7s_probe_end(uint8_t sensor);
+void d7s_select(uint8_t sensor);
+uint8_t d7s_int1_isr(void);
+bool d7s_int1_agreed(void);
+bool d7s_int1_waiting(void);
+uint8_t d7s_int2_isr(void);
+uint8_t d7s_present_mask(void);
+uint8_t d7s_take_pending(bool is_int1);
+uint8_t d7s_votes_needed(void);
+uint32_t d7s_vote_window(void);
+uint8_t d7s_vote(uint8_t sensor, uint8_t alert);
+void d7s_clear_votes(void);
+float d7s_agreed_value(const float *values);
+void print_d7s_array(void);
+
+/** Shutoff output stuff */
+#define SHUTOFF_OFF 0
+#define SHUTOFF_LATCH 1 // On until reset with AT+SHUTOFF
+#define SHUTOFF_PULSE 2 // On for the shutoff time
+#define SHUTOFF_AUTO 3	// Off the shutoff time after the earthquake ended
+#define SHUTOFF_TIME_DEFAULT 10 // Pulse length or hold time in s
+void init_shutoff(void);
+void shutoff_irq(uint32_t irq_us, bool agreed);
+void shutoff_alert_check(uint8_t alert);
+void shutoff_quake_end(void);
+void shutoff_warning_start(void);
+void shutoff_release(void);
+bool shutoff_active(void);
+void print_shutoff(void);
+
+/** P2P alert flooding stuff */
+#define MESH_TTL_DEFAULT 3 // Hops of an own alert
+void init_mesh(void);
+void mesh_send_alert(uint8_t alert);
+bool handle_mesh_frame(uint8_t *data, uint8_t len);
+void mesh_handler(void);
+void print_mesh(void);
+
+/** Early warning stuff */
+#define EW_FPORT 20		// Multicast early warnings
+#define EW_SHUTOFF_SI 0.05 // Expected SI in m/s that pre-arms the shutoff output
+void init_early_warning(void);
+bool handle_early_warning(uint8_t *data, uint8_t len);
+void ew_other_downlink(void);
+bool ew_armed(void);
+void ew_quake_start(void);
+void print_early_warning(void);
 
 /** RTC stuff */
+#define CLOCK_RESYNC_INTERVAL (6 * 60 * 60 * 1000UL)
 bool init_rak12002(void);
 void set_rak12002(uint16_t year, uint8_t month, uint8_t date, uint8_t hour, uint8_t minute);
 void read_rak12002(void);
+bool sync_rak12002(bool force);
+void resync_rak12002(void);
+void write_rak12002(uint32_t epoch);
+bool is_rak12002_valid(void);
 extern bool has_rak12002;
 
 /** RTC date/time structure */
@@ -165,6 +460,110 @@ struct date_time_s
 };
 extern date_time_s g_date_time;
 
+/** Clock stuff */
+#define CLOCK_SRC_NONE 0
+#define CLOCK_SRC_RTC 1
+#define CLOCK_SRC_NETWORK 2
+#define CLOCK_SRC_P2P 3
+#define CLOCK_RTC_UNCERTAINTY 1000 // RTC resolution plus the error of the time it was set to, in ms
+#define CLOCK_DRIFT_CORRECTED_PPM 20 // Remaining drift after the drift was measured
+#define CLOCK_DRIFT_UNCORRECTED_PPM 50 // Worst case drift of the 32 kHz crystal over temperature
+#define CLOCK_DRIFT_MAX_PPM 200 // Larger differences between two syncs are time jumps, not drift
+#define CLOCK_DRIFT_MIN_INTERVAL (60 * 60 * 1000UL) // Minimum time between two syncs to measure the drift
+uint64_t get_clock_ms(void);
+uint32_t get_clock_uncertainty(void);
+bool is_clock_valid(void);
+uint8_t get_clock_source(void);
+bool clock_sync(uint64_t reference_ms, uint32_t uncertainty_ms, uint8_t source, bool force);
+void clock_to_date(uint32_t epoch, date_time_s *date_time);
+
+/** Time sync stuff */
+#define TIME_SYNC_FPORT 202 // LoRaWAN application layer clock synchronization (TS003)
+#define TIME_SYNC_JOIN_DELAY 30000 // First request after the join
+#define TIME_SYNC_INTERVAL (24 * 60 * 60 * 1000UL) // Request interval after a successful sync
+#define TIME_SYNC_RETRY_INTERVAL (5 * 60 * 1000UL) // Request interval while no answer was received
+#define TIME_SYNC_RETRIES 3 // Requests before waiting for the next interval
+#define TIME_SYNC_LATENCY 50 // Processing delay of the network server and the device in ms
+#define TIME_SYNC_UNCERTAINTY 1000 // The correction has 1 s resolution, the server can round or truncate it
+#define TIME_BEACON_INTERVAL (60 * 60 * 1000UL) // Interval of the P2P time beacon
+#define TIME_BEACON_LATENCY 20 // Delay between the end of the reception and the handling in ms
+void init_time_sync(void);
+void start_time_sync(uint32_t delay_ms);
+void time_sync_handler(void);
+uint32_t p2p_airtime(uint8_t len);
+void handle_time_sync_ans(uint8_t *data, uint8_t len);
+bool handle_time_beacon(uint8_t *data, uint8_t len);
+
+/** Event journal stuff */
+#define EVENT_LOG_SLOTS 128
+#define EVENT_LOG_PENDING 4 // Records the seismic task can hand over before the loop writes them
+#define EVLOG_FLAG_SHUTOFF 0x01
+#define EVLOG_FLAG_COLLAPSE 0x02
+#define EVLOG_FLAG_RTC 0x04
+#define EVLOG_UNCERTAINTY_UNKNOWN 0xFFFF
+
+/** Event journal record, fixed size, saved as is to the flash */
+struct __attribute__((packed)) event_record_s
+{
+	uint32_t seq;		// Sequence number, increments with every record
+	uint32_t timestamp; // Start of the event, Unix time if EVLOG_FLAG_RTC is set, otherwise seconds since boot
+	uint16_t duration;	// Duration of the event in seconds
+	uint16_t peak_si;	// SI reported by the D7S in 0.001 m/s
+	uint16_t peak_pga;	// PGA reported by the D7S in 0.001 m/s2
+	uint8_t flags;		// EVLOG_FLAG_xxx
+	uint8_t d7s_state;	// State of the D7S at the end of the event
+	uint16_t time_ms;	// Milliseconds of the start time
+	uint16_t time_uncertainty; // Uncertainty of the start time in ms, EVLOG_UNCERTAINTY_UNKNOWN if unknown or too large
+	uint16_t reserved;
+	uint16_t crc; // CRC16 over all fields above
+};
+
+bool init_event_log(void);
+bool event_log_add(event_record_s *record);
+bool event_log_get(uint16_t pos, event_record_s *record);
+bool event_log_get_seq(uint32_t seq, event_record_s *record);
+uint16_t event_log_count(void);
+uint32_t event_log_first_seq(void);
+uint16_t event_log_find(uint32_t from, uint32_t to, uint16_t *first);
+bool event_log_in_range(uint16_t pos, uint32_t from, uint32_t to);
+void event_log_start(void);
+uint32_t event_log_start_time(void);
+bool event_log_start_clock(void);
+uint16_t event_log_start_ms(void);
+uint16_t event_log_start_uncertainty(void);
+void event_log_finish(float peak_si, float peak_pga, bool shutoff, bool collapse, uint8_t d7s_state);
+void event_log_flush(void);
+
+/** Downlink commands */
+#define DL_CMD_FPORT 10
+#define DL_CMD_THRESHOLD 0x01	   // 1 byte, 1 = low, 0 = high
+#define DL_CMD_HEARTBEAT 0x02	   // 4 byte, send interval in seconds, 0 = off
+#define DL_CMD_RECALIBRATE 0x03	   // no value
+#define DL_CMD_CAPTURE_RATE 0x04   // 2 byte, SI/PGA sample interval in ms during an earthquake, 0 = off
+#define DL_CMD_PAYLOAD_FORMAT 0x05 // 1 byte, PAYLOAD_FULL or PAYLOAD_COMPACT
+#define DL_CMD_LOG_DUMP 0x06	   // 8 byte, time range <from><to> of the event journal
+#define DL_CMD_DUMP_RESUME 0x07	   // 4 or 8 byte, sequence number to continue the dump from, optional sequence number of the last record
+#define DL_CMD_DIAG 0x08		   // no value, send the performance counters on PERF_FPORT
+#define DL_ACK_OK 0
+#define DL_ACK_MALFORMED 1
+#define DL_ACK_UNKNOWN 2
+#define DL_ACK_INVALID 3
+#define DL_ACK_BUSY 4
+bool handle_downlink_cmd(uint8_t *data, uint8_t len);
+bool send_downlink_ack(void);
+extern bool dl_ack_pending;
+
+/** Event journal dump */
+#define DUMP_FPORT 11
+#define DUMP_PAGE_INTERVAL 30000
+#define DUMP_HEADER_SIZE 6
+#define DUMP_RECORD_SIZE 16
+void init_event_dump(void);
+uint16_t start_event_dump(uint32_t from, uint32_t to);
+uint16_t resume_event_dump(uint32_t seq, uint32_t last);
+void stop_event_dump(void);
+void send_event_dump(void);
+
 /** Battery level uinion */
 union batt_s
 {
@@ -172,13 +571,45 @@ union batt_s
 	uint8_t batt8[2];
 };
 
+/** Application settings, saved in the flash
+ *  New fields only at the end, the file of an older firmware is shorter and the new fields keep their defaults */
+#define APP_SETTINGS_MARK 0xAA
+#define PAYLOAD_FULL 0
+#define PAYLOAD_COMPACT 1
+struct app_settings_s
+{
+	uint8_t valid_mark = APP_SETTINGS_MARK;
+	uint8_t threshold = 0;		// D7S threshold 1 = low, 0 = high
+	uint8_t payload_format = 0; // PAYLOAD_FULL or PAYLOAD_COMPACT
+	uint8_t telemetry_rate = 0; // BLE telemetry notification interval in 100 ms, 0 = TELEM_DEFAULT_INTERVAL
+	uint16_t capture_rate = 0; // Interval to sample SI/PGA during an earthquake in ms, 0 = off
+	uint8_t vote_k = 0; // D7S that must agree on an alert, 0 = majority
+	uint8_t vote_window = 0; // Time window for the votes in 100 ms, 0 = D7S_VOTE_WINDOW_DEFAULT
+	uint8_t d7s_slot[D7S_MAX_SENSORS] = {D7S_SLOT_UNKNOWN, D7S_SLOT_UNKNOWN, D7S_SLOT_UNKNOWN, D7S_SLOT_UNKNOWN}; // Detected slot of each D7S
+	uint8_t shutoff_mode = 0; // SHUTOFF_OFF, SHUTOFF_LATCH, SHUTOFF_PULSE or SHUTOFF_AUTO
+	uint8_t shutoff_time = 0; // Pulse length or hold time in s, 0 = SHUTOFF_TIME_DEFAULT
+	uint8_t mesh_ttl = MESH_TTL_DEFAULT; // Hops of own P2P alerts, 0 = no flooding
+	uint32_t mc_dev_addr = 0; // Multicast address of the early warnings, 0 = off
+	uint8_t mc_nwk_skey[16] = {0}; // Multicast network session key
+	uint8_t mc_app_skey[16] = {0}; // Multicast application session key
+};
+extern app_settings_s g_app_settings;
+
 /** AT Commands */
 void init_user_at(void);
-void save_threshold_settings(uint8_t sens_level);
-void read_threshold_settings(void);
+void save_app_settings(void);
+void read_app_settings(void);
 int at_query_threshold(void);
 int at_set_threshold(char *str);
 int at_query_rtc(void);
 int at_set_rtc(char *str);
+int at_query_evlog(void);
+int at_exec_evlog(char *str);
+int at_query_i2c(void);
+int at_exec_i2c(char *str);
+int at_query_telem(void);
+int at_set_telem(char *str);
+int at_query_stream(void);
+int at_set_stream(char *str);
 
 #endif
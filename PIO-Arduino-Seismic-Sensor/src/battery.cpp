@@ -0,0 +1,136 @@
+/**
+ * @file battery.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Battery voltage and state of charge
+ *        The battery is sampled only while the radio is idle, after a transmission is finished.
+ *        Each sample is the median of several ADC reads, the samples are filtered with an EMA.
+ *        The state of charge is interpolated from a LiPo discharge curve.
+ * @version 0.1
+ * @date 2023-03-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+
+/** ADC reads per sample, odd number for the median */
+#define BATT_READS 5
+
+/** Point of the discharge curve */
+struct batt_curve_s
+{
+	uint16_t mv;
+	uint8_t soc;
+};
+
+/** Typical LiPo discharge curve at low load, voltage must be ascending */
+static constexpr batt_curve_s batt_curve[] = {
+	{3000, 0},
+	{3300, 2},
+	{3500, 5},
+	{3600, 10},
+	{3680, 20},
+	{3730, 30},
+	{3770, 40},
+	{3800, 50},
+	{3840, 60},
+	{3900, 70},
+	{3970, 80},
+	{4050, 90},
+	{4100, 95},
+	{4200, 100},
+};
+
+/** Number of points of the discharge curve */
+static constexpr uint8_t batt_curve_len = sizeof(batt_curve) / sizeof(batt_curve_s);
+
+/**
+ * @brief Check at compile time that voltage and SoC of the curve are ascending
+ *
+ * @param idx point to start from
+ * @return true if the curve is ascending from idx on
+ */
+static constexpr bool batt_curve_ascending(uint8_t idx)
+{
+	return (idx + 1 >= batt_curve_len) ||
+		   ((batt_curve[idx].mv < batt_curve[idx + 1].mv) && (batt_curve[idx].soc <= batt_curve[idx + 1].soc) && batt_curve_ascending(idx + 1));
+}
+static_assert(batt_curve_ascending(0), "Battery curve must be ascending");
+
+/** Filtered battery voltage in mV, 0 if not sampled yet */
+static float batt_filtered = 0.0f;
+
+/**
+ * @brief Median of several ADC reads, removes single spikes
+ *
+ * @return float battery voltage in mV
+ */
+static float read_batt_median(void)
+{
+	float reads[BATT_READS];
+	for (uint8_t idx = 0; idx < BATT_READS; idx++)
+	{
+		float value = read_batt();
+		// Insertion sort
+		int8_t pos = idx;
+		while ((pos > 0) && (reads[pos - 1] > value))
+		{
+			reads[pos] = reads[pos - 1];
+			pos--;
+		}
+		reads[pos] = value;
+	}
+	return reads[BATT_READS / 2];
+}
+
+/**
+ * @brief Take a battery sample and add it to the filter
+ *        Call only when the radio is idle, the voltage drops during TX
+ *
+ */
+void sample_batt(void)
+{
+	float sample = read_batt_median();
+	if (batt_filtered == 0.0f)
+	{
+		batt_filtered = sample;
+	}
+	else
+	{
+		batt_filtered += (sample - batt_filtered) / BATT_FILTER_DIV;
+	}
+	MYLOG("BATT", "Sample %.0f mV, filtered %.0f mV, SoC %d%%", sample, batt_filtered, get_batt_soc());
+}
+
+/**
+ * @brief Get the filtered battery voltage
+ *
+ * @return float battery voltage in mV, 0 if not sampled yet
+ */
+float get_batt_mv(void)
+{
+	return batt_filtered;
+}
+
+/**
+ * @brief Get the state of charge of the filtered battery voltage
+ *
+ * @return uint8_t state of charge in %
+ */
+uint8_t get_batt_soc(void)
+{
+	if (batt_filtered <= batt_curve[0].mv)
+	{
+		return batt_curve[0].soc;
+	}
+	for (uint8_t idx = 1; idx < batt_curve_len; idx++)
+	{
+		if (batt_filtered < batt_curve[idx].mv)
+		{
+			const batt_curve_s *low = &batt_curve[idx - 1];
+			const batt_curve_s *high = &batt_curve[idx];
+			return low->soc + (uint8_t)((batt_filtered - low->mv) * (high->soc - low->soc) / (high->mv - low->mv));
+		}
+	}
+	return batt_curve[batt_curve_len - 1].soc;
+}
@@ -0,0 +1,155 @@
+/**
+ * @file battery_profile.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Operation profiles depending on the battery level
+ *        The profile follows the filtered battery voltage with a hysteresis,
+ *        so a short voltage drop does not switch the profile.
+ *        NORMAL    configured heartbeat, BLE advertising, all sensors
+ *        CONSERVE  2x heartbeat, no BLE advertising, compact payload
+ *        CRITICAL  4x heartbeat, no BLE advertising, compact payload
+ *        Earthquake handling is the same in all profiles.
+ * @version 0.1
+ * @date 2023-03-18
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+
+/** Current profile */
+static uint8_t batt_profile = BATT_PROFILE_NORMAL;
+
+/** Names for the log and AT command */
+static const char *batt_profile_name[] = {"NORMAL", "CONSERVE", "CRITICAL"};
+
+/**
+ * @brief Select the profile for a filtered battery voltage
+ *        Going down uses the enter thresholds, going up needs the voltage
+ *        to be BATT_HYSTERESIS above them
+ *
+ * @param mv filtered battery voltage
+ * @return uint8_t new profile
+ */
+static uint8_t select_batt_profile(float mv)
+{
+	switch (batt_profile)
+	{
+	case BATT_PROFILE_NORMAL:
+		if (mv < BATT_CRITICAL_MV)
+		{
+			return BATT_PROFILE_CRITICAL;
+		}
+		if (mv < BATT_CONSERVE_MV)
+		{
+			return BATT_PROFILE_CONSERVE;
+		}
+		break;
+	case BATT_PROFILE_CONSERVE:
+		if (mv < BATT_CRITICAL_MV)
+		{
+			return BATT_PROFILE_CRITICAL;
+		}
+		if (mv > (BATT_CONSERVE_MV + BATT_HYSTERESIS))
+		{
+			return BATT_PROFILE_NORMAL;
+		}
+		break;
+	case BATT_PROFILE_CRITICAL:
+		if (mv > (BATT_CONSERVE_MV + BATT_HYSTERESIS))
+		{
+			return BATT_PROFILE_NORMAL;
+		}
+		if (mv > (BATT_CRITICAL_MV + BATT_HYSTERESIS))
+		{
+			return BATT_PROFILE_CONSERVE;
+		}
+		break;
+	}
+	return batt_profile;
+}
+
+/**
+ * @brief Switch the profile if required
+ *        Called after a new battery sample was taken
+ *
+ */
+void update_batt_profile(void)
+{
+	float mv = get_batt_mv();
+	if (mv == 0.0f)
+	{
+		return;
+	}
+
+	uint8_t new_profile = select_batt_profile(mv);
+	if (new_profile == batt_profile)
+	{
+		return;
+	}
+	MYLOG("BATT", "Profile %s -> %s at %.0f mV", batt_profile_name[batt_profile], batt_profile_name[new_profile], mv);
+	batt_profile = new_profile;
+
+	// The heartbeat is stopped during an earthquake and restarted at its end
+	if (!earthquake_start && (g_lorawan_settings.send_repeat_time != 0))
+	{
+		heartbeat_start();
+	}
+}
+
+/**
+ * @brief Get the current profile
+ *
+ * @return uint8_t BATT_PROFILE_xxx
+ */
+uint8_t get_batt_profile(void)
+{
+	return batt_profile;
+}
+
+/**
+ * @brief Get the heartbeat interval of the current profile
+ *        The configured interval is not changed
+ *
+ * @return uint32_t heartbeat interval in ms, 0 if off
+ */
+uint32_t get_heartbeat_time(void)
+{
+	switch (batt_profile)
+	{
+	case BATT_PROFILE_CONSERVE:
+		return g_lorawan_settings.send_repeat_time * 2;
+	case BATT_PROFILE_CRITICAL:
+		return g_lorawan_settings.send_repeat_time * 4;
+	default:
+		return g_lorawan_settings.send_repeat_time;
+	}
+}
+
+/**
+ * @brief Check if the heartbeat should include the optional sensor values
+ *
+ * @return true if payload format is full and battery is good
+ */
+bool is_full_payload(void)
+{
+	return (g_app_settings.payload_format == PAYLOAD_FULL) && (batt_profile == BATT_PROFILE_NORMAL);
+}
+
+/**
+ * @brief Check if BLE advertising should be restarted with the heartbeat
+ *
+ * @return true if battery is good
+ */
+bool is_ble_allowed(void)
+{
+	return batt_profile == BATT_PROFILE_NORMAL;
+}
+
+/**
+ * @brief Print the profile and the filtered battery voltage
+ *
+ */
+void print_batt_profile(void)
+{
+	AT_PRINTF("%s:%ld:%ld\n", batt_profile_name[batt_profile], (uint32_t)get_batt_mv(), get_heartbeat_time() / 1000);
+}
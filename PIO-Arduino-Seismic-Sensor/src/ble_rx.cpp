@@ -0,0 +1,195 @@
+/**
+ * @file ble_rx.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Receive AT commands over BLE UART
+ *        The BLE UART FIFO is copied into a ring buffer in blocks, complete lines are
+ *        passed to the AT command parser. Only a few lines are handled per wakeup,
+ *        the loop is woken up again for the rest, so other events are not blocked.
+ *        A line without line end is handled after BLE_RX_LINE_TIMEOUT without new data.
+ *        A line longer than BLE_RX_HIGH_WATER is dropped up to its line end.
+ *        If the ring buffer fills up, the central is asked to pause with +EVT:BLE_BUSY
+ *        and to continue with +EVT:BLE_READY.
+ * @version 0.1
+ * @date 2023-03-21
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+
+#ifdef NRF52_SERIES
+/** Size of the ring buffer, must be a power of 2 */
+#define BLE_RX_SIZE 512
+
+/** Fill level to ask the central to pause */
+#define BLE_RX_HIGH_WATER (BLE_RX_SIZE * 3 / 4)
+
+/** Fill level to let the central continue */
+#define BLE_RX_LOW_WATER (BLE_RX_SIZE / 4)
+
+/** Lines passed to the AT command parser per wakeup */
+#define BLE_RX_LINES_PER_WAKEUP 4
+
+/** Ring buffer */
+static uint8_t ble_rx_buf[BLE_RX_SIZE];
+
+/** Write and read position, free running, masked on access */
+static uint16_t ble_rx_head = 0;
+static uint16_t ble_rx_tail = 0;
+
+/** Flag if the central was asked to pause */
+static bool ble_rx_paused = false;
+
+/** Flag if the rest of a dropped line is still in the buffer */
+static bool ble_rx_drop_line = false;
+
+/** millis() when the last data was received */
+static uint32_t ble_rx_last = 0;
+
+/**
+ * @brief Number of bytes in the ring buffer
+ *
+ * @return uint16_t fill level
+ */
+static inline uint16_t ble_rx_level(void)
+{
+	return (uint16_t)(ble_rx_head - ble_rx_tail);
+}
+
+/**
+ * @brief Copy the data from the BLE UART FIFO into the ring buffer
+ *        Reads in blocks up to the end of the ring buffer
+ *
+ */
+static void ble_rx_fill(void)
+{
+	while (g_ble_uart.available() > 0)
+	{
+		uint16_t free_space = BLE_RX_SIZE - ble_rx_level();
+		if (free_space == 0)
+		{
+			// Data stays in the BLE UART FIFO until there is space
+			break;
+		}
+		uint16_t pos = ble_rx_head & (BLE_RX_SIZE - 1);
+		uint16_t block = BLE_RX_SIZE - pos;
+		if (block > free_space)
+		{
+			block = free_space;
+		}
+		int received = g_ble_uart.read(&ble_rx_buf[pos], block);
+		if (received <= 0)
+		{
+			break;
+		}
+		ble_rx_head += received;
+		ble_rx_last = millis();
+	}
+}
+
+/**
+ * @brief Pass a line from the ring buffer to the AT command parser
+ *
+ * @param len number of bytes of the line without line end
+ * @param skip number of line end bytes to remove after the line
+ */
+static void ble_rx_dispatch(uint16_t len, uint16_t skip)
+{
+	if (len != 0)
+	{
+		for (uint16_t idx = 0; idx < len; idx++)
+		{
+			at_serial_input(ble_rx_buf[(ble_rx_tail + idx) & (BLE_RX_SIZE - 1)]);
+		}
+		at_serial_input(uint8_t('\n'));
+	}
+	ble_rx_tail += len + skip;
+}
+
+/**
+ * @brief Tell the central to pause or continue sending
+ *
+ */
+static void ble_rx_flow_control(void)
+{
+	// Data still in the BLE UART FIFO counts as well
+	uint16_t backlog = ble_rx_level() + g_ble_uart.available();
+	if (!ble_rx_paused && (backlog >= BLE_RX_HIGH_WATER))
+	{
+		ble_rx_paused = true;
+		g_ble_uart.write((const uint8_t *)"+EVT:BLE_BUSY\n", 14);
+	}
+	else if (ble_rx_paused && (backlog <= BLE_RX_LOW_WATER))
+	{
+		ble_rx_paused = false;
+		g_ble_uart.write((const uint8_t *)"+EVT:BLE_READY\n", 15);
+	}
+}
+
+/**
+ * @brief Handle received BLE UART data
+ *        Called from the loop with the BLE_DATA event
+ *
+ */
+void ble_rx_handler(void)
+{
+	ble_rx_fill();
+
+	uint8_t lines = 0;
+	uint16_t scanned = 0;
+	while ((scanned < ble_rx_level()) && (lines < BLE_RX_LINES_PER_WAKEUP))
+	{
+		uint8_t rx_char = ble_rx_buf[(ble_rx_tail + scanned) & (BLE_RX_SIZE - 1)];
+		if ((rx_char == '\r') || (rx_char == '\n'))
+		{
+			if (ble_rx_drop_line)
+			{
+				// End of a line that was too long
+				ble_rx_drop_line = false;
+				ble_rx_dispatch(0, scanned + 1);
+				scanned = 0;
+				continue;
+			}
+			// Empty lines, e.g. from CR LF, do not count
+			if (scanned != 0)
+			{
+				lines++;
+			}
+			ble_rx_dispatch(scanned, 1);
+			scanned = 0;
+			continue;
+		}
+		scanned++;
+	}
+
+	// A line without line end above the high water mark can never complete, the central will be paused
+	if ((lines < BLE_RX_LINES_PER_WAKEUP) && (ble_rx_level() >= BLE_RX_HIGH_WATER))
+	{
+		MYLOG("BLE", "Line too long, dropped");
+		ble_rx_dispatch(0, ble_rx_level());
+		ble_rx_drop_line = true;
+	}
+
+	ble_rx_flow_control();
+
+	if ((lines == BLE_RX_LINES_PER_WAKEUP) || (g_ble_uart.available() > 0))
+	{
+		// More to do, let other events run first
+		api_wake_loop(BLE_DATA);
+	}
+	else if (ble_rx_level() != 0)
+	{
+		// Line without line end, handle it if no more data arrives
+		if ((millis() - ble_rx_last) >= BLE_RX_LINE_TIMEOUT)
+		{
+			ble_rx_dispatch(ble_rx_drop_line ? 0 : ble_rx_level(), ble_rx_drop_line ? ble_rx_level() : 0);
+			ble_rx_drop_line = false;
+			ble_rx_flow_control();
+		}
+		else
+		{
+			sched_start(SCHED_BLE_RX, BLE_RX_LINE_TIMEOUT, 0, 0);
+		}
+	}
+}
+#endif
@@ -0,0 +1,301 @@
+/**
+ * @file ble_telemetry.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief BLE GATT service with live values for the installation on site
+ *        Works in release builds as well, it does not depend on MYLOG.
+ *        All values are binary, little endian:
+ *        STATE  1 byte  D7S state
+ *        SI/PGA 8 bytes instant SI, instant PGA, peak SI, peak PGA, uint16 in 0.001 m/s and 0.001 m/s2
+ *        FLAGS  1 byte  TELEM_FLAG_xxx
+ *        BATT   4 bytes battery mV uint16, SoC in %, BATT_PROFILE_xxx
+ *        SI/PGA is sent with every cycle, the other values only if they changed.
+ *        The notifications run only while a client is subscribed.
+ * @version 0.1
+ * @date 2023-03-22
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+
+#ifdef NRF52_SERIES
+/** Service UUID 52414B00-5345-4953-4D2D-54454C454D00, the characteristics use 52414B01 to 52414B04, LSB first */
+#define TELEM_UUID(id) {0x00, 0x4D, 0x45, 0x4C, 0x45, 0x54, 0x2D, 0x4D, 0x53, 0x49, 0x45, 0x53, id, 0x4B, 0x41, 0x52}
+
+static const uint8_t telem_service_uuid[] = TELEM_UUID(0x00);
+static const uint8_t telem_state_uuid[] = TELEM_UUID(0x01);
+static const uint8_t telem_si_pga_uuid[] = TELEM_UUID(0x02);
+static const uint8_t telem_flags_uuid[] = TELEM_UUID(0x03);
+static const uint8_t telem_batt_uuid[] = TELEM_UUID(0x04);
+
+/** Value sizes */
+#define TELEM_STATE_LEN 1
+#define TELEM_SI_PGA_LEN 8
+#define TELEM_FLAGS_LEN 1
+#define TELEM_BATT_LEN 4
+
+/** Notifications per cycle if all values changed */
+#define TELEM_CHARS 4
+
+BLEService telem_service(telem_service_uuid);
+BLECharacteristic telem_state_char(telem_state_uuid);
+BLECharacteristic telem_si_pga_char(telem_si_pga_uuid);
+BLECharacteristic telem_flags_char(telem_flags_uuid);
+BLECharacteristic telem_batt_char(telem_batt_uuid);
+
+/** Last sent values, only changes are notified */
+static uint8_t telem_last_state[TELEM_STATE_LEN];
+static uint8_t telem_last_flags[TELEM_FLAGS_LEN];
+static uint8_t telem_last_batt[TELEM_BATT_LEN];
+
+/** Connection of the subscribed client */
+static uint16_t telem_conn_hdl = 0;
+
+/** Flag if the service was added */
+static bool telem_started = false;
+
+/**
+ * @brief Put a 16 bit value into a buffer, little endian
+ *
+ * @param buffer destination
+ * @param value value to add
+ * @return uint8_t number of bytes added
+ */
+static uint8_t telem_put_u16(uint8_t *buffer, uint16_t value)
+{
+	buffer[0] = (uint8_t)(value);
+	buffer[1] = (uint8_t)(value >> 8);
+	return 2;
+}
+
+/**
+ * @brief Convert a D7S value to 0.001 units, limited to 16 bit
+ *
+ * @param value SI in m/s or PGA in m/s2
+ * @return uint16_t value in 0.001 units
+ */
+static uint16_t telem_milli(float value)
+{
+	if (value <= 0.0f)
+	{
+		return 0;
+	}
+	if (value >= 65.535f)
+	{
+		return 0xFFFF;
+	}
+	return (uint16_t)(value * 1000.0f + 0.5f);
+}
+
+/**
+ * @brief Get the notification interval
+ *
+ * @return uint32_t interval in ms
+ */
+static uint32_t telem_interval(void)
+{
+	return g_app_settings.telemetry_rate == 0 ? TELEM_DEFAULT_INTERVAL : g_app_settings.telemetry_rate * 100UL;
+}
+
+/**
+ * @brief Check if a client subscribed to any of the values
+ *
+ * @return true if at least one notification is enabled
+ */
+static bool telem_subscribed(void)
+{
+	return telem_state_char.notifyEnabled() || telem_si_pga_char.notifyEnabled() ||
+		   telem_flags_char.notifyEnabled() || telem_batt_char.notifyEnabled();
+}
+
+/**
+ * @brief Ask the central for a connection interval that fits the notification interval
+ *        All values of a cycle can be sent before the next cycle starts
+ *
+ */
+static void telem_request_conn_interval(void)
+{
+	BLEConnection *connection = Bluefruit.Connection(telem_conn_hdl);
+	if (connection == NULL)
+	{
+		return;
+	}
+	uint32_t conn_ms = telem_interval() / TELEM_CHARS;
+	if (conn_ms < TELEM_CONN_MIN)
+	{
+		conn_ms = TELEM_CONN_MIN;
+	}
+	if (conn_ms > TELEM_CONN_MAX)
+	{
+		conn_ms = TELEM_CONN_MAX;
+	}
+	// Connection interval is in units of 1.25 ms
+	connection->requestConnectionParameter((uint16_t)(conn_ms * 4 / 5));
+	MYLOG("TELEM", "Requested connection interval %ld ms", conn_ms);
+}
+
+/**
+ * @brief Callback when a client enables or disables notifications
+ *        Starts the notifications with the first subscription
+ *
+ * @param conn_hdl connection handle
+ * @param chr characteristic, not used
+ * @param cccd_value CCCD value, not used
+ */
+static void telem_cccd_callback(uint16_t conn_hdl, BLECharacteristic *chr, uint16_t cccd_value)
+{
+	telem_conn_hdl = conn_hdl;
+	if (telem_subscribed())
+	{
+		if (!sched_active(SCHED_TELEMETRY))
+		{
+			// Force the first notification of all values
+			memset(telem_last_state, 0xFF, sizeof(telem_last_state));
+			memset(telem_last_flags, 0xFF, sizeof(telem_last_flags));
+			memset(telem_last_batt, 0xFF, sizeof(telem_last_batt));
+			telem_request_conn_interval();
+			sched_start(SCHED_TELEMETRY, 0, telem_interval(), 0);
+		}
+	}
+	else
+	{
+		sched_stop(SCHED_TELEMETRY);
+	}
+}
+
+/**
+ * @brief Update a value, notify the client if it is subscribed and the value changed
+ *
+ * @param chr characteristic of the value
+ * @param value new value
+ * @param last last sent value, NULL to always notify
+ * @param len size of the value
+ */
+static void telem_update(BLECharacteristic *chr, uint8_t *value, uint8_t *last, uint8_t len)
+{
+	if (!chr->notifyEnabled())
+	{
+		chr->write(value, len);
+		return;
+	}
+	if ((last != NULL) && (memcmp(value, last, len) == 0))
+	{
+		return;
+	}
+	if (chr->notify(value, len) && (last != NULL))
+	{
+		memcpy(last, value, len);
+	}
+}
+
+/**
+ * @brief Add the telemetry service to the GATT server
+ *        Must be called after the BLE stack was started by the API
+ *
+ */
+void init_ble_telemetry(void)
+{
+	if (!g_enable_ble)
+	{
+		return;
+	}
+	telem_service.begin();
+
+	telem_state_char.setProperties(CHR_PROPS_READ | CHR_PROPS_NOTIFY);
+	telem_state_char.setPermission(SECMODE_OPEN, SECMODE_NO_ACCESS);
+	telem_state_char.setFixedLen(TELEM_STATE_LEN);
+	telem_state_char.setUserDescriptor("D7S state");
+	telem_state_char.setCccdWriteCallback(telem_cccd_callback);
+	telem_state_char.begin();
+
+	telem_si_pga_char.setProperties(CHR_PROPS_READ | CHR_PROPS_NOTIFY);
+	telem_si_pga_char.setPermission(SECMODE_OPEN, SECMODE_NO_ACCESS);
+	telem_si_pga_char.setFixedLen(TELEM_SI_PGA_LEN);
+	telem_si_pga_char.setUserDescriptor("SI/PGA");
+	telem_si_pga_char.setCccdWriteCallback(telem_cccd_callback);
+	telem_si_pga_char.begin();
+
+	telem_flags_char.setProperties(CHR_PROPS_READ | CHR_PROPS_NOTIFY);
+	telem_flags_char.setPermission(SECMODE_OPEN, SECMODE_NO_ACCESS);
+	telem_flags_char.setFixedLen(TELEM_FLAGS_LEN);
+	telem_flags_char.setUserDescriptor("Event flags");
+	telem_flags_char.setCccdWriteCallback(telem_cccd_callback);
+	telem_flags_char.begin();
+
+	telem_batt_char.setProperties(CHR_PROPS_READ | CHR_PROPS_NOTIFY);
+	telem_batt_char.setPermission(SECMODE_OPEN, SECMODE_NO_ACCESS);
+	telem_batt_char.setFixedLen(TELEM_BATT_LEN);
+	telem_batt_char.setUserDescriptor("Battery");
+	telem_batt_char.setCccdWriteCallback(telem_cccd_callback);
+	telem_batt_char.begin();
+
+	telem_started = true;
+}
+
+/**
+ * @brief Send the current values
+ *        Called from the loop with the BLE_TELEMETRY event
+ *
+ */
+void ble_telemetry_handler(void)
+{
+	if (!telem_started || !telem_subscribed())
+	{
+		// Client unsubscribed or disconnected
+		sched_stop(SCHED_TELEMETRY);
+		return;
+	}
+
+	uint8_t state[TELEM_STATE_LEN];
+	state[0] = state_rak12027();
+	telem_update(&telem_state_char, state, telem_last_state, TELEM_STATE_LEN);
+
+	float si = 0.0f;
+	float pga = 0.0f;
+	instant_rak12027(&si, &pga);
+	uint8_t si_pga[TELEM_SI_PGA_LEN];
+	uint8_t pos = 0;
+	pos += telem_put_u16(&si_pga[pos], telem_milli(si));
+	pos += telem_put_u16(&si_pga[pos], telem_milli(pga));
+	pos += telem_put_u16(&si_pga[pos], telem_milli(peakSI));
+	pos += telem_put_u16(&si_pga[pos], telem_milli(peakPGA));
+	telem_update(&telem_si_pga_char, si_pga, NULL, TELEM_SI_PGA_LEN);
+
+	uint8_t flags[TELEM_FLAGS_LEN];
+	flags[0] = (earthquake_start ? TELEM_FLAG_EARTHQUAKE : 0) |
+			   (shutoff_alert ? TELEM_FLAG_SHUTOFF : 0) |
+			   (collapse_alert ? TELEM_FLAG_COLLAPSE : 0) |
+			   (is_clock_valid() ? TELEM_FLAG_CLOCK : 0) |
+			   (g_lpwan_has_joined ? TELEM_FLAG_JOINED : 0);
+	telem_update(&telem_flags_char, flags, telem_last_flags, TELEM_FLAGS_LEN);
+
+	uint8_t batt[TELEM_BATT_LEN];
+	telem_put_u16(&batt[0], (uint16_t)get_batt_mv());
+	batt[2] = get_batt_soc();
+	batt[3] = get_batt_profile();
+	telem_update(&telem_batt_char, batt, telem_last_batt, TELEM_BATT_LEN);
+}
+
+/**
+ * @brief Apply a new notification interval
+ *        Called after the interval was changed with the AT command
+ *
+ */
+void ble_telemetry_interval_changed(void)
+{
+	if (sched_active(SCHED_TELEMETRY))
+	{
+		telem_request_conn_interval();
+		sched_start(SCHED_TELEMETRY, telem_interval(), telem_interval(), 0);
+	}
+}
+
+/**
+ * @brief Print the notification interval and the subscription state
+ *
+ */
+void print_ble_telemetry(void)
+{
+	AT_PRINTF("%ld:%s\n", telem_interval(), sched_active(SCHED_TELEMETRY) ? "subscribed" : "idle");
+}
+#endif
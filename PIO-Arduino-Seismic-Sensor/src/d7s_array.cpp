@@ -0,0 +1,611 @@
+/**
+ * @file d7s_array.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Up to 4 D7S sensors behind a TCA9548 I2C multiplexer
+ *        All D7S have the same I2C address, sensor n is connected to channel n of the multiplexer.
+ *        The interrupt lines of each sensor use the pins of a WisBlock slot,
+ *        set with RAK12027_SLOT for the first sensor and RAK12027_SLOT_1 to RAK12027_SLOT_3 for the others.
+ *        The slot of a sensor is detected during its first calibration and saved in the settings,
+ *        the build flags are only used until a slot was detected.
+ *        Without multiplexer only the first sensor is used.
+ *        The TCA9548 default address 0x70 is the address of the SHTC3 of the RAK1901,
+ *        the multiplexer must be strapped to 0x71 to 0x77 and is set with D7S_MUX_ADDR.
+ *        It is only accepted if its control register reads back the channel mask, a bare ACK is not enough.
+ *        A collapse or shutoff alert is only accepted if enough sensors report it within a time window,
+ *        so one noisy or tilted module cannot trigger an alert on its own.
+ * @version 0.1
+ * @date 2023-03-25
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+
+/** I2C address of the TCA9548, A0 strapped high */
+#ifndef D7S_MUX_ADDR
+#define D7S_MUX_ADDR 0x71
+#endif
+
+// 0x70 is the SHTC3 of the RAK1901, it would ACK the channel mask
+static_assert((D7S_MUX_ADDR >= 0x71) && (D7S_MUX_ADDR <= 0x77), "D7S_MUX_ADDR must be 0x71 to 0x77");
+
+/** No multiplexer channel selected */
+#define D7S_NO_CHANNEL 0xFF
+
+#ifndef RAK12027_SLOT
+#define RAK12027_SLOT 2 // Slot C
+#endif
+
+/** INT1 and INT2 pin per slot, index is the slot number */
+static constexpr uint8_t d7s_slot_pins[D7S_SLOTS][2] = {
+	{WB_IO1, WB_IO2}, // Slot A
+	{WB_IO2, WB_IO1}, // Slot B
+	{WB_IO3, WB_IO4}, // Slot C
+	{WB_IO5, WB_IO6}, // Slot D
+	{WB_IO4, WB_IO3}, // Slot E
+	{WB_IO6, WB_IO5}, // Slot F
+};
+
+// The slots A/B, C/E and D/F use the same pins with INT1 and INT2 swapped
+static_assert((d7s_slot_pins[0][0] == d7s_slot_pins[1][1]) && (d7s_slot_pins[0][1] == d7s_slot_pins[1][0]), "Slot A/B pins");
+static_assert((d7s_slot_pins[2][0] == d7s_slot_pins[4][1]) && (d7s_slot_pins[2][1] == d7s_slot_pins[4][0]), "Slot C/E pins");
+static_assert((d7s_slot_pins[3][0] == d7s_slot_pins[5][1]) && (d7s_slot_pins[3][1] == d7s_slot_pins[5][0]), "Slot D/F pins");
+
+/** GPIOs the application drives, they are never pulled up for the slot detection
+ *  WB_IO2 switches the sensor power, the others are the shutoff relay and the fan of the particle sensor */
+static constexpr uint8_t d7s_reserved_pins[] = {
+	WB_IO2,
+#ifdef SHUTOFF_PIN
+	SHUTOFF_PIN,
+#endif
+	PM_SET_PIN,
+};
+
+/** Slot of each sensor, in the order of the multiplexer channels */
+static const uint8_t d7s_sensor_slots[] = {
+	RAK12027_SLOT,
+#ifdef RAK12027_SLOT_1
+	RAK12027_SLOT_1,
+#endif
+#ifdef RAK12027_SLOT_2
+	RAK12027_SLOT_2,
+#endif
+#ifdef RAK12027_SLOT_3
+	RAK12027_SLOT_3,
+#endif
+};
+
+/** Number of sensors set in the build flags */
+#define D7S_CONFIGURED (sizeof(d7s_sensor_slots) / sizeof(d7s_sensor_slots[0]))
+
+/** State of each sensor */
+d7s_sensor_s d7s_sensors[D7S_MAX_SENSORS];
+
+/** Number of sensors that are checked, sensors that failed the initialization are not present */
+uint8_t d7s_configured = 0;
+
+/** Number of present sensors */
+uint8_t d7s_num = 0;
+
+/** Flag if the multiplexer was found */
+static bool d7s_mux = false;
+
+/** Currently selected multiplexer channel */
+static uint8_t d7s_channel = D7S_NO_CHANNEL;
+
+/** Sensors with a pending INT1, set in the interrupt */
+static volatile uint8_t d7s_int1_pending = 0;
+
+/** Sensors with a changed INT2, set in the interrupt */
+static volatile uint8_t d7s_int2_pending = 0;
+
+/** Last INT2 level of each sensor */
+static volatile uint8_t d7s_int2_level = 0;
+
+/** Slots whose INT2 pin was high before the calibration of the probed sensor */
+static uint8_t d7s_probe_candidates = 0;
+
+/** Candidate slots whose INT2 pin went low during the calibration */
+static uint8_t d7s_probe_low = 0;
+
+/**
+ * @brief Set the slot of a sensor and its interrupt pins
+ *
+ * @param sensor sensor index
+ * @param slot slot number, 0 = Slot A ... 5 = Slot F
+ */
+static void d7s_set_slot(uint8_t sensor, uint8_t slot)
+{
+	d7s_sensors[sensor].slot = slot;
+	d7s_sensors[sensor].int1_pin = d7s_slot_pins[slot][0];
+	d7s_sensors[sensor].int2_pin = d7s_slot_pins[slot][1];
+}
+
+/**
+ * @brief Find the multiplexer and set up the sensor table
+ *        Must be called before the sensors are initialized
+ *
+ * @return uint8_t number of sensors to initialize
+ */
+uint8_t init_d7s_array(void)
+{
+	d7s_mux = false;
+	d7s_channel = D7S_NO_CHANNEL;
+	if (D7S_CONFIGURED > 1)
+	{
+		// The control register reads back the channel mask, another device on the address does not
+		uint8_t channel_mask = 0x01;
+		uint8_t control = 0x00;
+		d7s_mux = i2c_write(I2C_DEV_D7S, D7S_MUX_ADDR, &channel_mask, 1) && i2c_read(I2C_DEV_D7S, D7S_MUX_ADDR, &control, 1) && (control == channel_mask);
+		if (d7s_mux)
+		{
+			d7s_channel = 0;
+		}
+		MYLOG("D7S", "Multiplexer 0x%02X %s", D7S_MUX_ADDR, d7s_mux ? "found" : "not found, using one D7S");
+	}
+	d7s_configured = d7s_mux ? D7S_CONFIGURED : 1;
+	d7s_num = 0;
+	memset(d7s_sensors, 0, sizeof(d7s_sensors));
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
+	{
+		// Use the detected slot if there is one
+		uint8_t slot = g_app_settings.d7s_slot[sensor];
+		d7s_set_slot(sensor, slot < D7S_SLOTS ? slot : d7s_sensor_slots[sensor]);
+	}
+	d7s_int1_pending = 0;
+	d7s_int2_pending = 0;
+	d7s_int2_level = 0;
+	return d7s_configured;
+}
+
+/**
+ * @brief Mark a sensor as present after its initialization
+ *
+ * @param sensor sensor index
+ */
+void d7s_set_present(uint8_t sensor)
+{
+	d7s_sensors[sensor].present = true;
+	d7s_num++;
+	if (digitalRead(d7s_sensors[sensor].int2_pin) == HIGH)
+	{
+		d7s_int2_level |= 1 << sensor;
+	}
+}
+
+/**
+ * @brief Check if a GPIO is driven by the application
+ *
+ * @param pin GPIO
+ * @return true pin is in d7s_reserved_pins
+ * @return false pin can be probed
+ */
+static bool d7s_pin_reserved(uint8_t pin)
+{
+	for (uint8_t reserved : d7s_reserved_pins)
+	{
+		if (reserved == pin)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Start the slot detection of a sensor, called before its calibration
+ *        The INT2 line of the D7S is low while the calibration runs.
+ *        Pins of sensors that are already running and the pins in d7s_reserved_pins are not checked.
+ *        The probe runs before init_shutoff() and init_rak12039(), a pull-up on their pins would switch the relay or the fan.
+ *        A D7S with its INT2 on one of these pins (always Slot A, Slot D with the default PM_SET_PIN)
+ *        is never detected and keeps the slot from the settings.
+ *
+ * @param sensor sensor index
+ */
+void d7s_probe_start(uint8_t sensor)
+{
+	d7s_probe_candidates = 0;
+	d7s_probe_low = 0;
+	for (uint8_t slot = 0; slot < D7S_SLOTS; slot++)
+	{
+		uint8_t pin = d7s_slot_pins[slot][1];
+		if (d7s_pin_reserved(pin))
+		{
+			continue;
+		}
+		bool used = false;
+		for (uint8_t other = 0; other < sensor; other++)
+		{
+			if (d7s_sensors[other].present && ((d7s_sensors[other].int1_pin == pin) || (d7s_sensors[other].int2_pin == pin)))
+			{
+				used = true;
+			}
+		}
+		if (used)
+		{
+			continue;
+		}
+		pinMode(pin, INPUT_PULLUP);
+		if (digitalRead(pin) == HIGH)
+		{
+			d7s_probe_candidates |= 1 << slot;
+		}
+	}
+}
+
+/**
+ * @brief Check the candidate pins while the calibration runs
+ *
+ */
+void d7s_probe_sample(void)
+{
+	for (uint8_t slot = 0; slot < D7S_SLOTS; slot++)
+	{
+		if ((d7s_probe_candidates & (1 << slot)) && (digitalRead(d7s_slot_pins[slot][1]) == LOW))
+		{
+			d7s_probe_low |= 1 << slot;
+		}
+	}
+}
+
+/**
+ * @brief Finish the slot detection of a sensor
+ *        If exactly one candidate pin went low, its slot is used and saved in the settings.
+ *
+ * @param sensor sensor index
+ * @return true the slot is different from the saved one, the settings must be saved
+ * @return false the slot did not change or was not detected
+ */
+bool d7s_probe_end(uint8_t sensor)
+{
+	for (uint8_t slot = 0; slot < D7S_SLOTS; slot++)
+	{
+		if (d7s_probe_candidates & (1 << slot))
+		{
+			pinMode(d7s_slot_pins[slot][1], INPUT);
+		}
+	}
+	uint8_t found = d7s_probe_low;
+	d7s_probe_candidates = 0;
+	d7s_probe_low = 0;
+	// Exactly one slot must have seen the calibration
+	if ((found == 0) || ((found & (found - 1)) != 0))
+	{
+		MYLOG("D7S", "D7S %d slot not detected, using Slot %c", sensor, 'A' + d7s_sensors[sensor].slot);
+		return false;
+	}
+	uint8_t slot = 0;
+	while ((found & (1 << slot)) == 0)
+	{
+		slot++;
+	}
+	MYLOG("D7S", "D7S %d detected in Slot %c", sensor, 'A' + slot);
+	d7s_set_slot(sensor, slot);
+	if (g_app_settings.d7s_slot[sensor] == slot)
+	{
+		return false;
+	}
+	g_app_settings.d7s_slot[sensor] = slot;
+	return true;
+}
+
+/**
+ * @brief Get the first present sensor
+ *        Used for the values that are read from one sensor only, e.g. the state
+ *
+ * @return uint8_t sensor index
+ */
+uint8_t d7s_first(void)
+{
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
+	{
+		if (d7s_sensors[sensor].present)
+		{
+			return sensor;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Route the D7S accesses to a sensor
+ *        Must be called inside an I2C_DEV_D7S bus session, so the other task cannot switch the channel
+ *
+ * @param sensor sensor index
+ */
+void d7s_select(uint8_t sensor)
+{
+	if (!d7s_mux || (d7s_channel == sensor))
+	{
+		return;
+	}
+	uint8_t channel_mask = 1 << sensor;
+	d7s_channel = i2c_write(I2C_DEV_D7S, D7S_MUX_ADDR, &channel_mask, 1) ? sensor : D7S_NO_CHANNEL;
+}
+
+/**
+ * @brief Find the sensors that pulled INT1 low
+ *        Called from the INT1 interrupt, all sensors share the handler
+ *
+ * @return uint8_t mask of the sensors with a new INT1
+ */
+uint8_t d7s_int1_isr(void)
+{
+	uint8_t low = 0;
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
+	{
+		if (d7s_sensors[sensor].present && (digitalRead(d7s_sensors[sensor].int1_pin) == LOW))
+		{
+			low |= 1 << sensor;
+		}
+	}
+	uint8_t fired = low & ~d7s_int1_pending;
+	d7s_int1_pending |= low;
+	uint32_t now = millis();
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
+	{
+		if (fired & (1 << sensor))
+		{
+			d7s_sensors[sensor].int1_count++;
+			d7s_sensors[sensor].int1_time = now;
+			d7s_sensors[sensor].int1_vote = true;
+		}
+	}
+	return fired;
+}
+
+/**
+ * @brief Check if enough sensors pulled INT1 low within the voting window
+ *        Called from the INT1 interrupt after d7s_int1_isr(), the registers are not read yet.
+ *        INT1 means collapse or shutoff, both switch the shutoff output, so the type is not needed here.
+ *        The seismic task votes per type after it read the sensors and can still reject the alert.
+ *
+ * @return true enough sensors agree
+ */
+bool d7s_int1_agreed(void)
+{
+	uint32_t now = millis();
+	uint8_t votes = 0;
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
+	{
+		d7s_sensor_s *state = &d7s_sensors[sensor];
+		if (state->present && state->int1_vote && ((now - state->int1_time) <= d7s_vote_window()))
+		{
+			votes++;
+		}
+	}
+	return votes >= d7s_votes_needed();
+}
+
+/**
+ * @brief Check if an INT1 is waiting for the seismic task
+ *
+ * @return true an INT1 was not read yet
+ */
+bool d7s_int1_waiting(void)
+{
+	return d7s_int1_pending != 0;
+}
+
+/**
+ * @brief Find the sensors that changed INT2
+ *        Called from the INT2 interrupt, all sensors share the handler
+ *
+ * @return uint8_t mask of the sensors with a changed INT2
+ */
+uint8_t d7s_int2_isr(void)
+{
+	uint8_t high = 0;
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
+	{
+		if (d7s_sensors[sensor].present && (digitalRead(d7s_sensors[sensor].int2_pin) == HIGH))
+		{
+			high |= 1 << sensor;
+		}
+	}
+	uint8_t changed = high ^ d7s_int2_level;
+	d7s_int2_level = high;
+	d7s_int2_pending |= changed;
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
+	{
+		if (changed & (1 << sensor))
+		{
+			d7s_sensors[sensor].int2_count++;
+		}
+	}
+	return changed;
+}
+
+/**
+ * @brief Get the mask of all present sensors
+ *
+ * @return uint8_t sensor mask
+ */
+uint8_t d7s_present_mask(void)
+{
+	uint8_t mask = 0;
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
+	{
+		if (d7s_sensors[sensor].present)
+		{
+			mask |= 1 << sensor;
+		}
+	}
+	return mask;
+}
+
+/**
+ * @brief Take the sensors with a pending interrupt
+ *        If no interrupt is pending, e.g. after a missed edge, all sensors are returned
+ *
+ * @param is_int1 true for INT1, false for INT2
+ * @return uint8_t mask of the sensors to check
+ */
+uint8_t d7s_take_pending(bool is_int1)
+{
+	taskENTER_CRITICAL();
+	uint8_t pending = is_int1 ? d7s_int1_pending : d7s_int2_pending;
+	if (is_int1)
+	{
+		d7s_int1_pending = 0;
+	}
+	else
+	{
+		d7s_int2_pending = 0;
+	}
+	taskEXIT_CRITICAL();
+	return pending == 0 ? d7s_present_mask() : pending;
+}
+
+/**
+ * @brief Number of sensors that must agree on an alert
+ *        Default is the majority of the present sensors
+ *
+ * @return uint8_t required votes
+ */
+uint8_t d7s_votes_needed(void)
+{
+	if (d7s_num == 0)
+	{
+		return 1;
+	}
+	uint8_t needed = g_app_settings.vote_k == 0 ? d7s_num / 2 + 1 : g_app_settings.vote_k;
+	return needed > d7s_num ? d7s_num : needed;
+}
+
+/**
+ * @brief Get the voting time window
+ *
+ * @return uint32_t window in ms
+ */
+uint32_t d7s_vote_window(void)
+{
+	return g_app_settings.vote_window == 0 ? D7S_VOTE_WINDOW_DEFAULT : g_app_settings.vote_window * 100UL;
+}
+
+/**
+ * @brief Count the sensors that reported an alert within the time window
+ *
+ * @param now millis() of the check
+ * @param collapse true for collapse, false for shutoff
+ * @return uint8_t number of votes
+ */
+static uint8_t d7s_count_votes(uint32_t now, bool collapse)
+{
+	uint8_t votes = 0;
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
+	{
+		d7s_sensor_s *state = &d7s_sensors[sensor];
+		bool voted = collapse ? state->collapse_vote : state->shutoff_vote;
+		uint32_t vote_time = collapse ? state->collapse_time : state->shutoff_time;
+		if (state->present && voted && ((now - vote_time) <= d7s_vote_window()))
+		{
+			votes++;
+		}
+	}
+	return votes;
+}
+
+/**
+ * @brief Add the alert of a sensor and check if enough sensors agree
+ *
+ * @param sensor sensor index
+ * @param alert 1 collapse, 2 shutoff, 3 both
+ * @return uint8_t confirmed alerts, 1 collapse, 2 shutoff, 3 both, 0 none
+ */
+uint8_t d7s_vote(uint8_t sensor, uint8_t alert)
+{
+	uint32_t now = millis();
+	d7s_sensor_s *state = &d7s_sensors[sensor];
+	if (alert & 0x01)
+	{
+		state->collapse_vote = true;
+		state->collapse_time = now;
+	}
+	if (alert & 0x02)
+	{
+		state->shutoff_vote = true;
+		state->shutoff_time = now;
+	}
+
+	uint8_t confirmed = 0;
+	uint8_t needed = d7s_votes_needed();
+	uint8_t collapse_votes = d7s_count_votes(now, true);
+	uint8_t shutoff_votes = d7s_count_votes(now, false);
+	if (collapse_votes >= needed)
+	{
+		confirmed |= 0x01;
+	}
+	if (shutoff_votes >= needed)
+	{
+		confirmed |= 0x02;
+	}
+	MYLOG("D7S", "Sensor %d alert %d, votes collapse %d shutoff %d of %d", sensor, alert, collapse_votes, shutoff_votes, needed);
+	return confirmed;
+}
+
+/**
+ * @brief Clear the votes and the peak values of all sensors
+ *        Called when an earthquake starts
+ *
+ */
+void d7s_clear_votes(void)
+{
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
+	{
+		d7s_sensors[sensor].collapse_vote = false;
+		d7s_sensors[sensor].shutoff_vote = false;
+		d7s_sensors[sensor].int1_vote = false;
+		d7s_sensors[sensor].peak_si = 0.0f;
+		d7s_sensors[sensor].peak_pga = 0.0f;
+	}
+}
+
+/**
+ * @brief Get the value that enough sensors agree on
+ *        This is the n-th highest value of the present sensors, n is the number of required votes,
+ *        so a single sensor cannot raise the reported value
+ *
+ * @param values value per sensor, index is the sensor index
+ * @return float agreed value
+ */
+float d7s_agreed_value(const float *values)
+{
+	float sorted[D7S_MAX_SENSORS];
+	uint8_t num = 0;
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
+	{
+		if (!d7s_sensors[sensor].present)
+		{
+			continue;
+		}
+		// Insert sorted, highest first
+		uint8_t pos = num++;
+		while ((pos > 0) && (sorted[pos - 1] < values[sensor]))
+		{
+			sorted[pos] = sorted[pos - 1];
+			pos--;
+		}
+		sorted[pos] = values[sensor];
+	}
+	if (num == 0)
+	{
+		return 0.0f;
+	}
+	return sorted[d7s_votes_needed() - 1];
+}
+
+/**
+ * @brief Print the voting settings and the state of each sensor
+ *
+ */
+void print_d7s_array(void)
+{
+	AT_PRINTF("%d:%d:%ld\n", d7s_num, d7s_votes_needed(), d7s_vote_window());
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
+	{
+		d7s_sensor_s *state = &d7s_sensors[sensor];
+		AT_PRINTF("D7S%d:%c:%s:%ld:%ld:%.3f:%.3f\n", sensor, 'A' + state->slot, state->present ? "OK" : "FAIL",
+				  state->int1_count, state->int2_count, state->peak_si, state->peak_pga);
+	}
+}
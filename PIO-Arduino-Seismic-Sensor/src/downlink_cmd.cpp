@@ -0,0 +1,349 @@
+/**
+ * @file downlink_cmd.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Batched remote configuration over LoRaWAN downlinks
+ *        A frame holds a sequence number followed by TLV coded commands
+ *        [seq] [type][len][value] [type][len][value] ...
+ *        All commands of a frame are checked first and applied only if all are valid.
+ *        The result is sent back as a compact acknowledge on the same fPort
+ *        [seq] [status] [applied commands mask or offset of failed command] ([records to dump])
+ * @version 0.1
+ * @date 2023-03-03
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+
+/** Acknowledge packet */
+static uint8_t dl_ack[5];
+
+/** Size of the acknowledge packet */
+static uint8_t dl_ack_len = 0;
+
+/** Flag if an acknowledge is waiting to be sent */
+bool dl_ack_pending = false;
+
+/** Commands collected from one frame, applied only if the whole frame is valid */
+struct dl_cmd_batch_s
+{
+	uint8_t mask = 0;
+	uint8_t threshold = 0;
+	uint32_t heartbeat = 0;
+	uint16_t capture_rate = 0;
+	uint8_t payload_format = 0;
+	uint32_t dump_from = 0;
+	uint32_t dump_to = 0;
+	uint32_t dump_resume = 0;
+	uint32_t dump_resume_last = 0;
+};
+
+/**
+ * @brief Read a big endian value from the frame
+ *
+ * @param data pointer to the first byte
+ * @param len number of bytes, 1 to 4
+ * @return uint32_t value
+ */
+static uint32_t dl_get_value(uint8_t *data, uint8_t len)
+{
+	uint32_t value = 0;
+	for (uint8_t idx = 0; idx < len; idx++)
+	{
+		value = (value << 8) | data[idx];
+	}
+	return value;
+}
+
+/**
+ * @brief Prepare the acknowledge packet
+ *
+ * @param seq sequence number of the received frame
+ * @param status DL_ACK_xxx status
+ * @param detail mask of applied commands or offset of the failed command
+ */
+static void dl_prepare_ack(uint8_t seq, uint8_t status, uint8_t detail)
+{
+	dl_ack[0] = seq;
+	dl_ack[1] = status;
+	dl_ack[2] = detail;
+	dl_ack_len = 3;
+	dl_ack_pending = true;
+}
+
+/**
+ * @brief Check all commands of a frame
+ *
+ * @param data frame data after the sequence number
+ * @param len length of the data
+ * @param batch collected commands
+ * @param fail_offset offset of the failed command
+ * @return uint8_t DL_ACK_OK or error status
+ */
+static uint8_t dl_parse(uint8_t *data, uint8_t len, dl_cmd_batch_s *batch, uint8_t *fail_offset)
+{
+	uint8_t offset = 0;
+	while (offset < len)
+	{
+		*fail_offset = offset + 1;
+		if ((offset + 2) > len)
+		{
+			return DL_ACK_MALFORMED;
+		}
+		uint8_t type = data[offset];
+		uint8_t value_len = data[offset + 1];
+		uint8_t *value = &data[offset + 2];
+		if ((offset + 2 + value_len) > len)
+		{
+			return DL_ACK_MALFORMED;
+		}
+
+		switch (type)
+		{
+		case DL_CMD_THRESHOLD:
+			if ((value_len != 1) || (value[0] > 1))
+			{
+				return DL_ACK_INVALID;
+			}
+			batch->threshold = value[0];
+			break;
+		case DL_CMD_HEARTBEAT:
+			if (value_len != 4)
+			{
+				return DL_ACK_INVALID;
+			}
+			batch->heartbeat = dl_get_value(value, 4);
+			// Allow 0 = off, otherwise at least 30 seconds
+			if ((batch->heartbeat != 0) && ((batch->heartbeat < 30) || (batch->heartbeat > 2147483)))
+			{
+				return DL_ACK_INVALID;
+			}
+			break;
+		case DL_CMD_RECALIBRATE:
+			if (value_len != 0)
+			{
+				return DL_ACK_INVALID;
+			}
+			break;
+		case DL_CMD_CAPTURE_RATE:
+			if (value_len != 2)
+			{
+				return DL_ACK_INVALID;
+			}
+			batch->capture_rate = dl_get_value(value, 2);
+			// Allow 0 = off, otherwise at least 100 ms
+			if ((batch->capture_rate != 0) && (batch->capture_rate < 100))
+			{
+				return DL_ACK_INVALID;
+			}
+			break;
+		case DL_CMD_PAYLOAD_FORMAT:
+			if ((value_len != 1) || (value[0] > PAYLOAD_COMPACT))
+			{
+				return DL_ACK_INVALID;
+			}
+			batch->payload_format = value[0];
+			break;
+		case DL_CMD_LOG_DUMP:
+			if (value_len != 8)
+			{
+				return DL_ACK_INVALID;
+			}
+			batch->dump_from = dl_get_value(value, 4);
+			batch->dump_to = dl_get_value(&value[4], 4);
+			if (batch->dump_to < batch->dump_from)
+			{
+				return DL_ACK_INVALID;
+			}
+			if (batch->mask & (1 << (DL_CMD_DUMP_RESUME - 1)))
+			{
+				// Either a new dump or a resume
+				return DL_ACK_INVALID;
+			}
+			break;
+		case DL_CMD_DUMP_RESUME:
+			// The last record is optional, the server can request a single gap
+			if ((value_len != 4) && (value_len != 8))
+			{
+				return DL_ACK_INVALID;
+			}
+			batch->dump_resume = dl_get_value(value, 4);
+			batch->dump_resume_last = value_len == 8 ? dl_get_value(&value[4], 4) : 0;
+			if ((batch->dump_resume_last != 0) && (batch->dump_resume_last < batch->dump_resume))
+			{
+				return DL_ACK_INVALID;
+			}
+			if (batch->mask & (1 << (DL_CMD_LOG_DUMP - 1)))
+			{
+				// Either a new dump or a resume
+				return DL_ACK_INVALID;
+			}
+			break;
+		case DL_CMD_DIAG:
+			if (value_len != 0)
+			{
+				return DL_ACK_INVALID;
+			}
+			break;
+		default:
+			return DL_ACK_UNKNOWN;
+		}
+		if ((batch->mask & (1 << (type - 1))) != 0)
+		{
+			// Same command twice in one frame
+			return DL_ACK_INVALID;
+		}
+		batch->mask |= 1 << (type - 1);
+		offset += 2 + value_len;
+	}
+	return DL_ACK_OK;
+}
+
+/**
+ * @brief Handle a command frame received on DL_CMD_FPORT
+ *        The frame is either applied completely or not at all
+ *
+ * @param data received data
+ * @param len length of received data
+ * @return true all commands applied
+ * @return false frame rejected
+ */
+bool handle_downlink_cmd(uint8_t *data, uint8_t len)
+{
+	dl_cmd_batch_s batch;
+	uint8_t fail_offset = 0;
+
+	if (len < 2)
+	{
+		MYLOG("DL_CMD", "Frame too short");
+		dl_prepare_ack(len == 1 ? data[0] : 0, DL_ACK_MALFORMED, 0);
+		return false;
+	}
+
+	uint8_t seq = data[0];
+	uint8_t status = dl_parse(&data[1], len - 1, &batch, &fail_offset);
+	if (status != DL_ACK_OK)
+	{
+		MYLOG("DL_CMD", "Frame %d rejected, status %d at offset %d", seq, status, fail_offset);
+		dl_prepare_ack(seq, status, fail_offset);
+		return false;
+	}
+
+	// Recalibration and threshold changes are not possible while the D7S is analyzing an earthquake
+	if (earthquake_start && (batch.mask & ((1 << (DL_CMD_RECALIBRATE - 1)) | (1 << (DL_CMD_THRESHOLD - 1)))))
+	{
+		MYLOG("DL_CMD", "Frame %d rejected, earthquake active", seq);
+		dl_prepare_ack(seq, DL_ACK_BUSY, 0);
+		return false;
+	}
+
+	bool app_settings_changed = false;
+
+	if (batch.mask & (1 << (DL_CMD_THRESHOLD - 1)))
+	{
+		MYLOG("DL_CMD", "Threshold %s", batch.threshold == 1 ? "low" : "high");
+		g_app_settings.threshold = batch.threshold;
+		threshold_rak12027(g_app_settings.threshold);
+		app_settings_changed = true;
+	}
+	if (batch.mask & (1 << (DL_CMD_CAPTURE_RATE - 1)))
+	{
+		MYLOG("DL_CMD", "Capture rate %d ms", batch.capture_rate);
+		g_app_settings.capture_rate = batch.capture_rate;
+		app_settings_changed = true;
+	}
+	if (batch.mask & (1 << (DL_CMD_PAYLOAD_FORMAT - 1)))
+	{
+		MYLOG("DL_CMD", "Payload format %d", batch.payload_format);
+		g_app_settings.payload_format = batch.payload_format;
+		app_settings_changed = true;
+	}
+	if (batch.mask & (1 << (DL_CMD_RECALIBRATE - 1)))
+	{
+		MYLOG("DL_CMD", "Recalibrate D7S");
+		if (!calib_rak12027())
+		{
+			MYLOG("DL_CMD", "Calibration failed");
+		}
+		// Calibration resets the threshold
+		threshold_rak12027(g_app_settings.threshold);
+	}
+	if (batch.mask & (1 << (DL_CMD_HEARTBEAT - 1)))
+	{
+		MYLOG("DL_CMD", "Heartbeat %ld s", batch.heartbeat);
+		g_lorawan_settings.send_repeat_time = batch.heartbeat * 1000;
+		// The heartbeat is stopped during an earthquake, the restart at its end takes the new value
+		if (earthquake_start)
+		{
+			MYLOG("DL_CMD", "Heartbeat applied after the earthquake");
+		}
+		else
+		{
+			// Stops the heartbeat for 0
+			heartbeat_start();
+		}
+		save_settings();
+	}
+
+	// Save all changed settings with one write
+	if (app_settings_changed)
+	{
+		save_app_settings();
+	}
+
+	dl_prepare_ack(seq, DL_ACK_OK, batch.mask);
+
+	if (batch.mask & ((1 << (DL_CMD_LOG_DUMP - 1)) | (1 << (DL_CMD_DUMP_RESUME - 1))))
+	{
+		uint16_t num;
+		if (batch.mask & (1 << (DL_CMD_DUMP_RESUME - 1)))
+		{
+			num = resume_event_dump(batch.dump_resume, batch.dump_resume_last);
+		}
+		else
+		{
+			num = start_event_dump(batch.dump_from, batch.dump_to);
+		}
+		MYLOG("DL_CMD", "Dump request, %d records to send", num);
+		dl_ack[3] = (uint8_t)(num >> 8);
+		dl_ack[4] = (uint8_t)(num);
+		dl_ack_len = 5;
+	}
+
+	if (batch.mask & (1 << (DL_CMD_DIAG - 1)))
+	{
+		// Sent after the acknowledge
+		MYLOG("DL_CMD", "Diagnostic uplink requested");
+		perf_request_uplink();
+		sched_start(SCHED_FOLLOW_UP, 10000, 0, SCHED_FOLLOW_UP_TOLERANCE);
+	}
+	return true;
+}
+
+/**
+ * @brief Send the pending acknowledge
+ *
+ * @return true acknowledge was enqueued or there was nothing to send
+ * @return false acknowledge could not be sent, will be retried
+ */
+bool send_downlink_ack(void)
+{
+	if (!dl_ack_pending)
+	{
+		return true;
+	}
+	if (!g_lorawan_settings.lorawan_enable || !g_lpwan_has_joined)
+	{
+		// Nobody to acknowledge to
+		dl_ack_pending = false;
+		return true;
+	}
+	if (perf_lora_uplink(PERF_UP_ACK, send_lora_packet(dl_ack, dl_ack_len, DL_CMD_FPORT)) != LMH_SUCCESS)
+	{
+		MYLOG("DL_CMD", "Acknowledge not sent");
+		return false;
+	}
+	MYLOG("DL_CMD", "Acknowledge enqueued");
+	dl_ack_pending = false;
+	return true;
+}
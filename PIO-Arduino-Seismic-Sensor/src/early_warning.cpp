@@ -0,0 +1,228 @@
+/**
+ * @file early_warning.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Early warnings from other sites, received over a LoRaWAN multicast group
+ *        The application server sends a warning to the multicast group when one site detects strong shaking.
+ *        The device must be in Class C to receive it at any time, the multicast session is set with AT+MCAST.
+ *        A warning starts the SI/PGA capture before the waves arrive. If the expected SI is high enough,
+ *        the start of the earthquake switches the shutoff output, without waiting for the D7S shutoff judgement.
+ *        Warning on EW_FPORT, MSB first:
+ *        'E' 'W' <version> <origin ID 4 bytes> <expected SI 2 bytes> <ETA 2 bytes>
+ *        SI is in 0.001 m/s, the ETA is the time until the waves arrive in 100 ms
+ *        The API does not tell if a downlink came over the multicast session. The LoRaMAC checks the MIC
+ *        of a multicast frame with the session keys and sets the downlink counter of the session, a warning
+ *        is only accepted if that counter moved since the last downlink.
+ * @version 0.1
+ * @date 2023-03-27
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+
+/** Warning frame */
+#define EW_MAGIC_1 'E'
+#define EW_MAGIC_2 'W'
+#define EW_VERSION 1
+#define EW_SIZE 11
+
+/** Time after the ETA the warning stays armed in ms */
+#define EW_ARM_WINDOW 30000
+
+/** Capture interval if the capture is switched off in the settings */
+#define EW_CAPTURE_RATE 100
+
+/** Expected SI in 0.001 m/s that pre-arms the shutoff output */
+#define EW_SHUTOFF_LEVEL ((uint16_t)(EW_SHUTOFF_SI * 1000 + 0.5))
+
+/** Multicast session, must stay valid while it is linked */
+static MulticastParams_t ew_mc_params;
+
+/** Flag if the multicast session is linked */
+static bool ew_mc_linked = false;
+
+/** Downlink counter of the multicast session at the last downlink */
+static uint32_t ew_mc_counter = 0;
+
+/** Arm window end in millis(), valid if ew_armed_flag is set */
+static volatile uint32_t ew_armed_until = 0;
+static volatile bool ew_armed_flag = false;
+
+/** Flag if the shutoff output is pre-armed */
+static volatile bool ew_shutoff_armed = false;
+
+/** Statistics */
+static uint32_t ew_received = 0;
+static uint32_t ew_invalid = 0;
+static uint32_t ew_last_origin = 0;
+static uint16_t ew_last_si = 0;
+static uint16_t ew_last_eta = 0;
+
+/**
+ * @brief Link the multicast session from the settings to the LoRaWAN stack
+ *        Called after the join, the stack loses the session with a new join
+ *
+ */
+void init_early_warning(void)
+{
+	if (!g_lorawan_settings.lorawan_enable || !g_lpwan_has_joined)
+	{
+		return;
+	}
+	if (ew_mc_linked)
+	{
+		LoRaMacMulticastChannelUnlink(&ew_mc_params);
+		ew_mc_linked = false;
+	}
+	if (g_app_settings.mc_dev_addr == 0)
+	{
+		return;
+	}
+	// The same session keeps its counter after a new join, old warnings cannot be sent again
+	bool same_session = (ew_mc_params.Address == g_app_settings.mc_dev_addr) &&
+						(memcmp(ew_mc_params.NwkSKey, g_app_settings.mc_nwk_skey, 16) == 0) &&
+						(memcmp(ew_mc_params.AppSKey, g_app_settings.mc_app_skey, 16) == 0);
+	uint32_t counter = same_session ? ew_mc_params.DownLinkCounter : 0;
+	memset(&ew_mc_params, 0, sizeof(ew_mc_params));
+	ew_mc_params.Address = g_app_settings.mc_dev_addr;
+	memcpy(ew_mc_params.NwkSKey, g_app_settings.mc_nwk_skey, 16);
+	memcpy(ew_mc_params.AppSKey, g_app_settings.mc_app_skey, 16);
+	ew_mc_params.DownLinkCounter = counter;
+	ew_mc_params.Next = NULL;
+	ew_mc_counter = counter;
+	if (LoRaMacMulticastChannelLink(&ew_mc_params) != LORAMAC_STATUS_OK)
+	{
+		MYLOG("EW", "Multicast session not linked");
+		return;
+	}
+	ew_mc_linked = true;
+	MYLOG("EW", "Multicast %08lX linked", g_app_settings.mc_dev_addr);
+	if (g_lorawan_settings.lora_class != CLASS_C)
+	{
+		MYLOG("EW", "Not in Class C, warnings arrive only after an uplink");
+	}
+}
+
+/**
+ * @brief Check if a warning is armed
+ *
+ * @return true a warning was received and the arm window is not over
+ */
+bool ew_armed(void)
+{
+	if (ew_armed_flag && ((int32_t)(ew_armed_until - millis()) <= 0))
+	{
+		ew_armed_flag = false;
+		ew_shutoff_armed = false;
+	}
+	return ew_armed_flag;
+}
+
+/**
+ * @brief Handle the start of a local earthquake, called by the seismic task
+ *        Switches the shutoff output if a strong warning is armed
+ *
+ */
+void ew_quake_start(void)
+{
+	if (ew_armed() && ew_shutoff_armed)
+	{
+		shutoff_warning_start();
+	}
+}
+
+/**
+ * @brief Check if the last downlink came over the multicast session
+ *
+ * @return true the downlink counter of the session moved
+ */
+static bool ew_from_session(void)
+{
+	if (!ew_mc_linked || (ew_mc_params.DownLinkCounter == ew_mc_counter))
+	{
+		return false;
+	}
+	ew_mc_counter = ew_mc_params.DownLinkCounter;
+	return true;
+}
+
+/**
+ * @brief Handle a downlink on another port than EW_FPORT
+ *        A multicast frame on another port must not validate the next warning
+ *
+ */
+void ew_other_downlink(void)
+{
+	ew_from_session();
+}
+
+/**
+ * @brief Handle a downlink on EW_FPORT
+ *
+ * @param data received data
+ * @param len length of received data
+ * @return true valid warning
+ * @return false invalid frame or not received over the multicast session
+ */
+bool handle_early_warning(uint8_t *data, uint8_t len)
+{
+	if (!ew_from_session())
+	{
+		MYLOG("EW", "Not received over the multicast session");
+		ew_invalid++;
+		return false;
+	}
+	if ((len != EW_SIZE) || (data[0] != EW_MAGIC_1) || (data[1] != EW_MAGIC_2) || (data[2] != EW_VERSION))
+	{
+		ew_invalid++;
+		return false;
+	}
+	ew_received++;
+	ew_last_origin = ((uint32_t)data[3] << 24) | ((uint32_t)data[4] << 16) | ((uint32_t)data[5] << 8) | data[6];
+	ew_last_si = ((uint16_t)data[7] << 8) | data[8];
+	ew_last_eta = ((uint16_t)data[9] << 8) | data[10];
+
+	// Arm until some time after the waves should have arrived
+	// A later warning from another site does not shorten the window or disarm the shutoff output
+	uint32_t armed_until = millis() + ew_last_eta * 100UL + EW_ARM_WINDOW;
+	bool strong = ew_last_si >= EW_SHUTOFF_LEVEL;
+	taskENTER_CRITICAL();
+	bool armed = ew_armed();
+	if (!armed || ((int32_t)(armed_until - ew_armed_until) > 0))
+	{
+		ew_armed_until = armed_until;
+	}
+	// Same level as the shutoff judgement of the D7S
+	ew_shutoff_armed = (armed && ew_shutoff_armed) || strong;
+	ew_armed_flag = true;
+	taskEXIT_CRITICAL();
+
+	// Capture from now on, the start of the earthquake is not missed
+	if (!earthquake_start && !sched_active(SCHED_CAPTURE))
+	{
+		uint16_t rate = g_app_settings.capture_rate != 0 ? g_app_settings.capture_rate : EW_CAPTURE_RATE;
+		sched_start(SCHED_CAPTURE, rate, rate, rate / SCHED_CAPTURE_TOLERANCE_DIV);
+	}
+	// The waves arrived before the warning, the warning confirms the strength
+	if (earthquake_start && strong)
+	{
+		shutoff_warning_start();
+	}
+
+	MYLOG("EW", "Warning from %08lX, SI %.3f, ETA %.1f s, shutoff %s", ew_last_origin, ew_last_si / 1000.0f,
+		  ew_last_eta / 10.0f, ew_shutoff_armed ? "armed" : "not armed");
+	AT_PRINTF("+EVT:EW:%08lX:%.3f:%.1f\n", ew_last_origin, ew_last_si / 1000.0f, ew_last_eta / 10.0f);
+	return true;
+}
+
+/**
+ * @brief Print the multicast session and the warning statistics
+ *        <multicast address>:<linked>:<class C>:<armed>:<received>:<invalid>:<last origin>:<last SI>:<last ETA>
+ *
+ */
+void print_early_warning(void)
+{
+	AT_PRINTF("%08lX:%d:%d:%d:%ld:%ld:%08lX:%.3f:%.1f\n", g_app_settings.mc_dev_addr, ew_mc_linked ? 1 : 0,
+			  g_lorawan_settings.lora_class == CLASS_C ? 1 : 0, ew_armed() ? 1 : 0, ew_received, ew_invalid,
+			  ew_last_origin, ew_last_si / 1000.0f, ew_last_eta / 10.0f);
+}
@@ -0,0 +1,206 @@
+/**
+ * @file epoch_clock.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Local clock, extrapolated from millis() between syncs
+ *        Syncs come from the RAK12002 RTC, the LoRaWAN network or a P2P time beacon.
+ *        Every sync comes with an uncertainty, a sync is only taken if it is better
+ *        than what the clock already knows. Repeated syncs are used to measure the
+ *        drift of millis().
+ * @version 0.1
+ * @date 2023-03-10
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "epoch_clock.h"
+
+/** Unix time of the last sync in ms */
+static uint64_t clock_sync_epoch_ms = 0;
+
+/** millis() at the last sync */
+static uint32_t clock_sync_millis = 0;
+
+/** Uncertainty of the last sync in ms */
+static uint32_t clock_sync_uncertainty = 0;
+
+/** Source of the last sync */
+static uint8_t clock_source = CLOCK_SRC_NONE;
+
+/** Drift of millis() in ppm, positive if millis() is too slow */
+static int32_t clock_drift_ppm = 0;
+
+/** Flag if the drift was measured */
+static bool clock_drift_known = false;
+
+/** Unix time in ms of the sync the drift is measured against */
+static uint64_t drift_ref_epoch_ms = 0;
+
+/** millis() at the sync the drift is measured against */
+static uint32_t drift_ref_millis = 0;
+
+/** Uncertainty of the sync the drift is measured against */
+static uint32_t drift_ref_uncertainty = 0;
+
+/**
+ * @brief Get the current time in ms
+ *        Extrapolated from the last sync with millis(), no I2C access
+ *
+ * @return uint64_t Unix time in ms if the clock is valid, otherwise ms since boot
+ */
+uint64_t get_clock_ms(void)
+{
+	if (clock_source == CLOCK_SRC_NONE)
+	{
+		return millis();
+	}
+	uint32_t elapsed = millis() - clock_sync_millis;
+	return clock_sync_epoch_ms + elapsed + ((int64_t)elapsed * clock_drift_ppm) / 1000000;
+}
+
+/**
+ * @brief Get the uncertainty of the current time
+ *        Uncertainty of the last sync plus the possible drift since then
+ *
+ * @return uint32_t uncertainty in ms, 0xFFFFFFFF if the clock was never synced
+ */
+uint32_t get_clock_uncertainty(void)
+{
+	if (clock_source == CLOCK_SRC_NONE)
+	{
+		return 0xFFFFFFFF;
+	}
+	uint32_t elapsed = millis() - clock_sync_millis;
+	uint32_t drift_ppm = clock_drift_known ? CLOCK_DRIFT_CORRECTED_PPM : CLOCK_DRIFT_UNCORRECTED_PPM;
+	return clock_sync_uncertainty + (uint32_t)(((uint64_t)elapsed * drift_ppm) / 1000000);
+}
+
+/**
+ * @brief Check if the clock is synced to an absolute time
+ *
+ * @return true time is Unix time
+ * @return false time is time since boot
+ */
+bool is_clock_valid(void)
+{
+	return clock_source != CLOCK_SRC_NONE;
+}
+
+/**
+ * @brief Get the source of the last sync
+ *
+ * @return uint8_t CLOCK_SRC_xxx
+ */
+uint8_t get_clock_source(void)
+{
+	return clock_source;
+}
+
+/**
+ * @brief Measure the drift of millis() against an older sync
+ *        The older sync is kept until the time between both syncs is long
+ *        enough that their uncertainties do not hide the drift.
+ *
+ * @param reference_ms Unix time in ms
+ * @param uncertainty_ms uncertainty of the reference in ms
+ * @param now_millis millis() at the time of the reference
+ */
+static void clock_measure_drift(uint64_t reference_ms, uint32_t uncertainty_ms, uint32_t now_millis)
+{
+	uint32_t elapsed = now_millis - drift_ref_millis;
+	if ((drift_ref_epoch_ms != 0) && ((elapsed < CLOCK_DRIFT_MIN_INTERVAL) || ((uint64_t)(drift_ref_uncertainty + uncertainty_ms) * 1000000 / elapsed >= CLOCK_DRIFT_UNCORRECTED_PPM)))
+	{
+		// Too early, keep the older sync as reference
+		return;
+	}
+
+	if (drift_ref_epoch_ms != 0)
+	{
+		int64_t error_ms = (int64_t)(reference_ms - drift_ref_epoch_ms) - (int64_t)elapsed;
+		int32_t measured_ppm = (int32_t)((error_ms * 1000000) / elapsed);
+		if ((measured_ppm > CLOCK_DRIFT_MAX_PPM) || (measured_ppm < -CLOCK_DRIFT_MAX_PPM))
+		{
+			// Not a drift, one of the two times was wrong, e.g. a manually set RTC
+			MYLOG("CLK", "Drift %ld ppm not possible, restart measurement", measured_ppm);
+		}
+		else if (clock_drift_known)
+		{
+			// Smooth the drift
+			clock_drift_ppm = (clock_drift_ppm * 3 + measured_ppm) / 4;
+		}
+		else
+		{
+			clock_drift_ppm = measured_ppm;
+			clock_drift_known = true;
+		}
+		MYLOG("CLK", "Drift %ld ppm", clock_drift_ppm);
+	}
+
+	drift_ref_epoch_ms = reference_ms;
+	drift_ref_millis = now_millis;
+	drift_ref_uncertainty = uncertainty_ms;
+}
+
+/**
+ * @brief Sync the clock to a reference time
+ *        The reference is only taken if it is more precise than the current time.
+ *
+ * @param reference_ms Unix time in ms
+ * @param uncertainty_ms uncertainty of the reference in ms
+ * @param source CLOCK_SRC_xxx
+ * @param force take the reference even if the current time is more precise, e.g. after the time was set manually
+ * @return true reference was taken
+ * @return false current time is more precise
+ */
+bool clock_sync(uint64_t reference_ms, uint32_t uncertainty_ms, uint8_t source, bool force)
+{
+	uint32_t now_millis = millis();
+	uint32_t current_uncertainty = get_clock_uncertainty();
+
+	if (!force && (uncertainty_ms > current_uncertainty))
+	{
+		MYLOG("CLK", "Sync from %d ignored, %ld ms > %ld ms", source, uncertainty_ms, current_uncertainty);
+		return false;
+	}
+
+	if (force)
+	{
+		// Time jumped, start the drift measurement again
+		drift_ref_epoch_ms = 0;
+	}
+	clock_measure_drift(reference_ms, uncertainty_ms, now_millis);
+
+	clock_sync_epoch_ms = reference_ms;
+	clock_sync_millis = now_millis;
+	clock_sync_uncertainty = uncertainty_ms;
+	clock_source = source;
+	MYLOG("CLK", "Synced from %d, uncertainty %ld ms", source, uncertainty_ms);
+	return true;
+}
+
+/**
+ * @brief Convert Unix time into date and time
+ *
+ * @param epoch Unix time in seconds
+ * @param date_time converted date and time
+ */
+void clock_to_date(uint32_t epoch, date_time_s *date_time)
+{
+	int32_t days = epoch / 86400;
+	uint32_t seconds = epoch % 86400;
+
+	// Civil from days, March based year
+	int32_t era = (days + 719468) / 146097;
+	uint32_t day_of_era = days + 719468 - era * 146097;
+	uint32_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+	uint32_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+	uint32_t month_march = (5 * day_of_year + 2) / 153;
+
+	date_time->date = day_of_year - (153 * month_march + 2) / 5 + 1;
+	date_time->month = month_march < 10 ? month_march + 3 : month_march - 9;
+	date_time->year = year_of_era + era * 400 + (date_time->month <= 2 ? 1 : 0);
+	date_time->weekday = clock_weekday(days);
+	date_time->hour = seconds / 3600;
+	date_time->minute = (seconds % 3600) / 60;
+	date_time->second = seconds % 60;
+}
@@ -0,0 +1,103 @@
+/**
+ * @file epoch_clock.h
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Calendar conversion between date and Unix time
+ *        Based on the days from civil algorithm, valid for the proleptic Gregorian calendar.
+ *        All functions are constexpr, a date known at compile time costs nothing.
+ * @version 0.1
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef EPOCH_CLOCK_H
+#define EPOCH_CLOCK_H
+
+#include <stdint.h>
+
+/** Era of 400 years the year belongs to */
+constexpr int32_t clock_era(int32_t year)
+{
+	return (year >= 0 ? year : year - 399) / 400;
+}
+
+/** Day of a year that starts at March 1st, 0 to 365 */
+constexpr uint32_t clock_day_of_year(uint32_t month, uint32_t date)
+{
+	return (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + date - 1;
+}
+
+/** Day of the era, 0 to 146096 */
+constexpr uint32_t clock_day_of_era(uint32_t year_of_era, uint32_t day_of_year)
+{
+	return year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+}
+
+/** Days since 1970-01-01 for a year that starts at March 1st */
+constexpr int32_t clock_days_march_year(int32_t year, uint32_t month, uint32_t date)
+{
+	return clock_era(year) * 146097 + (int32_t)clock_day_of_era(year - clock_era(year) * 400, clock_day_of_year(month, date)) - 719468;
+}
+
+/**
+ * @brief Days since 1970-01-01
+ *
+ * @param year 4 digit year
+ * @param month 1 to 12
+ * @param date 1 to 31
+ * @return int32_t days, negative before 1970
+ */
+constexpr int32_t clock_days_from_civil(int32_t year, uint32_t month, uint32_t date)
+{
+	return clock_days_march_year(month <= 2 ? year - 1 : year, month, date);
+}
+
+/**
+ * @brief Weekday of a day since 1970-01-01
+ *
+ * @param days days since 1970-01-01
+ * @return uint8_t 0 = Sunday to 6 = Saturday
+ */
+constexpr uint8_t clock_weekday(int32_t days)
+{
+	return days >= -4 ? (days + 4) % 7 : (days + 5) % 7 + 6;
+}
+
+/**
+ * @brief Unix time of a date
+ *
+ * @return uint32_t seconds since 1970-01-01 00:00:00
+ */
+constexpr uint32_t clock_to_epoch(uint16_t year, uint8_t month, uint8_t date, uint8_t hour, uint8_t minute, uint8_t second)
+{
+	return (uint32_t)clock_days_from_civil(year, month, date) * 86400UL + hour * 3600UL + minute * 60UL + second;
+}
+
+/** Leap year check */
+constexpr bool clock_is_leap(uint16_t year)
+{
+	return (year % 4 == 0) && ((year % 100 != 0) || (year % 400 == 0));
+}
+
+/**
+ * @brief Number of days of a month
+ *
+ * @param year 4 digit year
+ * @param month 1 to 12
+ * @return uint8_t 28 to 31
+ */
+constexpr uint8_t clock_days_in_month(uint16_t year, uint8_t month)
+{
+	return month == 2 ? (clock_is_leap(year) ? 29 : 28) : ((month == 4) || (month == 6) || (month == 9) || (month == 11) ? 30 : 31);
+}
+
+static_assert(clock_days_from_civil(1970, 1, 1) == 0, "Epoch start");
+static_assert(clock_days_from_civil(2000, 3, 1) == 11017, "Leap year 2000");
+static_assert(clock_days_from_civil(2100, 3, 1) - clock_days_from_civil(2100, 2, 28) == 1, "No leap day in 2100");
+static_assert(clock_days_from_civil(2024, 3, 1) - clock_days_from_civil(2024, 2, 28) == 2, "Leap day in 2024");
+static_assert(clock_days_in_month(2000, 2) == 29 && clock_days_in_month(2100, 2) == 28, "Days of February");
+static_assert(clock_weekday(0) == 4, "1970-01-01 was a Thursday");
+static_assert(clock_weekday(clock_days_from_civil(2023, 1, 1)) == 0, "2023-01-01 was a Sunday");
+static_assert(clock_to_epoch(2038, 1, 19, 3, 14, 7) == 2147483647UL, "32 bit signed limit");
+
+#endif
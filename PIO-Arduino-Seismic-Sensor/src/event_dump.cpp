@@ -0,0 +1,263 @@
+/**
+ * @file event_dump.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Send the event journal over LoRaWAN in pages
+ *        Each page is as big as the current datarate allows
+ *        [seq of first record 4 bytes] [records left after this page 2 bytes] [record] [record] ...
+ *        Records are sent without sequence number and CRC
+ *        [timestamp 4 bytes] [ms 2 bytes] [uncertainty 2 bytes] [duration 2 bytes] [SI 2 bytes] [PGA 2 bytes] [flags] [D7S state]
+ *        Lost pages can be requested again with the resume command using the sequence number,
+ *        with the sequence number of the last record only the records of a gap are sent again
+ *        The records of a page have consecutive sequence numbers, records outside of the time range end the page
+ *        A record that cannot be read from the flash is sent with all 16 bytes 0xFF
+ * @version 0.1
+ * @date 2023-03-06
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+
+/** Flag if a dump is active */
+static bool dump_active = false;
+
+/** Sequence number of the next record to send */
+static uint32_t dump_cursor = 0;
+
+/** Sequence number of the last record to send */
+static uint32_t dump_last = 0;
+
+/** Time range of the dump, kept for the resume command */
+static uint32_t dump_from = 0;
+static uint32_t dump_to = 0xFFFFFFFF;
+
+/** Buffer for one page */
+static uint8_t dump_page[242];
+
+/**
+ * @brief Initialize the dump
+ *        The pages are sent by the SCHED_DUMP job of the scheduler
+ *
+ */
+void init_event_dump(void)
+{
+	dump_active = false;
+}
+
+/**
+ * @brief Count the records in the time range of the dump
+ *
+ * @param seq sequence number of the first record to check
+ * @return uint16_t number of records from seq to dump_last in the time range
+ */
+static uint16_t dump_count(uint32_t seq)
+{
+	uint32_t first_seq = event_log_first_seq();
+	uint16_t num = 0;
+	for (; seq <= dump_last; seq++)
+	{
+		if ((seq >= first_seq) && event_log_in_range(seq - first_seq, dump_from, dump_to))
+		{
+			num++;
+		}
+	}
+	return num;
+}
+
+/**
+ * @brief Start sending the records of a time range
+ *
+ * @param from start of the time range
+ * @param to end of the time range
+ * @return uint16_t number of records that will be sent
+ */
+uint16_t start_event_dump(uint32_t from, uint32_t to)
+{
+	uint16_t first;
+	uint16_t num = event_log_find(from, to, &first);
+	if (num == 0)
+	{
+		stop_event_dump();
+		return 0;
+	}
+	dump_from = from;
+	dump_to = to;
+	dump_cursor = event_log_first_seq() + first;
+	dump_last = event_log_first_seq() + event_log_count() - 1;
+	dump_active = true;
+	sched_start(SCHED_DUMP, DUMP_PAGE_INTERVAL, DUMP_PAGE_INTERVAL, SCHED_DUMP_TOLERANCE);
+	MYLOG("DUMP", "Dump seq %ld to %ld", dump_cursor, dump_last);
+	return num;
+}
+
+/**
+ * @brief Continue a dump from a record
+ *        Used by the server to request lost pages again, the time range of the last dump is kept
+ *
+ * @param seq sequence number of the first record to send
+ * @param last sequence number of the last record to send, 0 to continue up to the end of the dump
+ * @return uint16_t number of records that will be sent
+ */
+uint16_t resume_event_dump(uint32_t seq, uint32_t last)
+{
+	uint32_t first_seq = event_log_first_seq();
+	uint32_t newest_seq = first_seq + event_log_count() - 1;
+	if (last != 0)
+	{
+		// Only a gap is sent again
+		dump_last = last > newest_seq ? newest_seq : last;
+	}
+	else if (dump_last == 0)
+	{
+		// No dump requested before, send up to the newest record
+		dump_last = newest_seq;
+	}
+	if (seq < first_seq)
+	{
+		// Record was already overwritten
+		seq = first_seq;
+	}
+	if ((event_log_count() == 0) || (seq > dump_last))
+	{
+		stop_event_dump();
+		return 0;
+	}
+	uint16_t num = dump_count(seq);
+	if (num == 0)
+	{
+		stop_event_dump();
+		return 0;
+	}
+	dump_cursor = seq;
+	dump_active = true;
+	sched_start(SCHED_DUMP, DUMP_PAGE_INTERVAL, DUMP_PAGE_INTERVAL, SCHED_DUMP_TOLERANCE);
+	MYLOG("DUMP", "Resume seq %ld to %ld", dump_cursor, dump_last);
+	return num;
+}
+
+/**
+ * @brief Stop an active dump
+ *
+ */
+void stop_event_dump(void)
+{
+	sched_stop(SCHED_DUMP);
+	dump_active = false;
+	dump_last = 0;
+}
+
+/**
+ * @brief Get the maximum payload size for the current datarate
+ *
+ * @return uint8_t maximum payload size
+ */
+static uint8_t dump_max_payload(void)
+{
+	LoRaMacTxInfo_t tx_info;
+	LoRaMacQueryTxPossible(0, &tx_info);
+	return tx_info.MaxPossiblePayload > sizeof(dump_page) ? sizeof(dump_page) : tx_info.MaxPossiblePayload;
+}
+
+/**
+ * @brief Send the next page of an active dump
+ *        Called from the timer, skipped while an earthquake is active
+ *        or while the sensor data is waiting to be sent.
+ *
+ */
+void send_event_dump(void)
+{
+	if (!dump_active)
+	{
+		sched_stop(SCHED_DUMP);
+		return;
+	}
+	if (earthquake_start || ((g_task_event_type & (STATUS | SEISMIC_EVENT | SEISMIC_ALERT)) != 0) || dl_ack_pending)
+	{
+		MYLOG("DUMP", "Paused");
+		return;
+	}
+	if (!g_lorawan_settings.lorawan_enable || !g_lpwan_has_joined)
+	{
+		return;
+	}
+
+	uint32_t first_seq = event_log_first_seq();
+	if (dump_cursor < first_seq)
+	{
+		// Records were overwritten while the dump was running
+		dump_cursor = first_seq;
+	}
+	// Skip the records outside of the time range
+	while ((dump_cursor <= dump_last) && !event_log_in_range(dump_cursor - first_seq, dump_from, dump_to))
+	{
+		dump_cursor++;
+	}
+	if (dump_cursor > dump_last)
+	{
+		stop_event_dump();
+		return;
+	}
+
+	uint8_t max_records = (dump_max_payload() - DUMP_HEADER_SIZE) / DUMP_RECORD_SIZE;
+	if (max_records == 0)
+	{
+		MYLOG("DUMP", "Datarate too low for a page");
+		return;
+	}
+	// The receiver counts the sequence numbers from the page header, only consecutive records fit in a page
+	uint8_t num = 0;
+	while ((num < max_records) && (dump_cursor + num <= dump_last) && event_log_in_range(dump_cursor + num - first_seq, dump_from, dump_to))
+	{
+		num++;
+	}
+	uint16_t records_left = dump_count(dump_cursor + num);
+
+	uint8_t *page = dump_page;
+	*page++ = (uint8_t)(dump_cursor >> 24);
+	*page++ = (uint8_t)(dump_cursor >> 16);
+	*page++ = (uint8_t)(dump_cursor >> 8);
+	*page++ = (uint8_t)(dump_cursor);
+	*page++ = (uint8_t)(records_left >> 8);
+	*page++ = (uint8_t)(records_left);
+
+	event_record_s record;
+	for (uint8_t idx = 0; idx < num; idx++)
+	{
+		if (!event_log_get_seq(dump_cursor + idx, &record))
+		{
+			// Flash read or CRC error, sent with all bytes 0xFF, flags 0xFF is never set by a real record
+			MYLOG("DUMP", "Record %ld unreadable", dump_cursor + idx);
+			memset(&record, 0xFF, sizeof(event_record_s));
+		}
+		*page++ = (uint8_t)(record.timestamp >> 24);
+		*page++ = (uint8_t)(record.timestamp >> 16);
+		*page++ = (uint8_t)(record.timestamp >> 8);
+		*page++ = (uint8_t)(record.timestamp);
+		*page++ = (uint8_t)(record.time_ms >> 8);
+		*page++ = (uint8_t)(record.time_ms);
+		*page++ = (uint8_t)(record.time_uncertainty >> 8);
+		*page++ = (uint8_t)(record.time_uncertainty);
+		*page++ = (uint8_t)(record.duration >> 8);
+		*page++ = (uint8_t)(record.duration);
+		*page++ = (uint8_t)(record.peak_si >> 8);
+		*page++ = (uint8_t)(record.peak_si);
+		*page++ = (uint8_t)(record.peak_pga >> 8);
+		*page++ = (uint8_t)(record.peak_pga);
+		*page++ = record.flags;
+		*page++ = record.d7s_state;
+	}
+
+	if (perf_lora_uplink(PERF_UP_DUMP, send_lora_packet(dump_page, page - dump_page, DUMP_FPORT)) != LMH_SUCCESS)
+	{
+		MYLOG("DUMP", "Page not sent, retry later");
+		perf_retry();
+		return;
+	}
+	MYLOG("DUMP", "Sent %d records from seq %ld", num, dump_cursor);
+	dump_cursor += num;
+	if (records_left == 0)
+	{
+		MYLOG("DUMP", "Dump finished");
+		stop_event_dump();
+	}
+}
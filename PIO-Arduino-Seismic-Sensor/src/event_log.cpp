@@ -0,0 +1,542 @@
+/**
+ * @file event_log.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Earthquake event journal in flash
+ *        Fixed size records in a ring inside a LittleFS file
+ *        with a small RAM index of the timestamps
+ *        Only the loop accesses the file. The seismic task hands the record
+ *        of a finished earthquake over with event_log_finish(), the loop writes
+ *        it with event_log_flush().
+ * @version 0.1
+ * @date 2023-03-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include <Adafruit_LittleFS.h>
+#include <InternalFileSystem.h>
+using namespace Adafruit_LittleFS_Namespace;
+
+/** Filename of the event journal */
+static const char event_log_name[] = "EVLOG2";
+
+/** Filename of the journal with the old record size */
+static const char event_log_old_name[] = "EVLOG";
+
+/** File handle for the event journal */
+static File event_log_file(InternalFS);
+
+/** Timestamps of the records, index is the slot number */
+static uint32_t event_log_index[EVENT_LOG_SLOTS];
+
+/** Records with a Unix time (EVLOG_FLAG_RTC), bit n is slot n */
+static uint8_t event_log_timed[EVENT_LOG_SLOTS / 8];
+
+/** Slot of the oldest record */
+static uint16_t event_log_tail = 0;
+
+/** Number of valid records in the ring */
+static uint16_t event_log_num = 0;
+
+/** Sequence number of the newest record */
+static uint32_t event_log_seq = 0;
+
+/** Start of the current earthquake */
+static uint32_t event_start_time = 0;
+
+/** Milliseconds of the start time */
+static uint16_t event_start_time_ms = 0;
+
+/** Uncertainty of the start time in ms */
+static uint16_t event_start_uncertainty = EVLOG_UNCERTAINTY_UNKNOWN;
+
+/** Flag if the start time is Unix time, taken with the start time */
+static bool event_start_clock = false;
+
+/** Start of the current earthquake in ms, used for the duration */
+static time_t event_start_ms = 0;
+
+/** Flag if the start of the current earthquake was recorded */
+static bool event_started = false;
+
+/** Records of finished earthquakes waiting for the loop */
+static event_record_s event_log_pending[EVENT_LOG_PENDING];
+
+/** Number of waiting records */
+static uint8_t event_log_pending_num = 0;
+
+/**
+ * @brief CRC16 CCITT over a record
+ *
+ * @param data pointer to the data
+ * @param len number of bytes
+ * @return uint16_t CRC
+ */
+static uint16_t event_log_crc(const uint8_t *data, size_t len)
+{
+	uint16_t crc = 0xFFFF;
+	while (len--)
+	{
+		crc ^= (uint16_t)(*data++) << 8;
+		for (uint8_t bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+		}
+	}
+	return crc;
+}
+
+/**
+ * @brief Check if a record read from flash is complete
+ *        Erased or partly written records fail the CRC
+ *
+ * @param record record to check
+ * @return true record is valid
+ * @return false record is empty or corrupted
+ */
+static bool event_log_valid(event_record_s *record)
+{
+	if ((record->seq == 0) || (record->seq == 0xFFFFFFFF))
+	{
+		return false;
+	}
+	return event_log_crc((uint8_t *)record, sizeof(event_record_s) - 2) == record->crc;
+}
+
+/**
+ * @brief Put the time of a record into the RAM index
+ *
+ * @param slot slot number
+ * @param record record in the slot
+ */
+static void event_log_set_index(uint16_t slot, event_record_s *record)
+{
+	event_log_index[slot] = record->timestamp;
+	if (record->flags & EVLOG_FLAG_RTC)
+	{
+		event_log_timed[slot / 8] |= 1 << (slot % 8);
+	}
+	else
+	{
+		event_log_timed[slot / 8] &= ~(1 << (slot % 8));
+	}
+}
+
+/**
+ * @brief Read one slot of the ring
+ *
+ * @param slot slot number
+ * @param record buffer for the record
+ * @return true record read and valid
+ * @return false read error or invalid record
+ */
+static bool event_log_read_slot(uint16_t slot, event_record_s *record)
+{
+	if (!event_log_file.open(event_log_name, FILE_O_READ))
+	{
+		return false;
+	}
+	bool result = false;
+	if (event_log_file.seek(slot * sizeof(event_record_s)))
+	{
+		if (event_log_file.read(record, sizeof(event_record_s)) == sizeof(event_record_s))
+		{
+			result = event_log_valid(record);
+		}
+	}
+	event_log_file.close();
+	return result;
+}
+
+/**
+ * @brief Scan the journal and rebuild the RAM index
+ *        The newest valid record (highest sequence number) marks the head of the ring.
+ *        A record that was cut by a power loss fails the CRC and is skipped.
+ *
+ * @return true journal found or created
+ * @return false journal could not be opened
+ */
+bool init_event_log(void)
+{
+	event_record_s record;
+	uint16_t head_slot = 0;
+
+	event_log_num = 0;
+	event_log_tail = 0;
+	event_log_seq = 0;
+
+	if (InternalFS.exists(event_log_old_name))
+	{
+		// Records without the ms time, not worth converting
+		InternalFS.remove(event_log_old_name);
+		MYLOG("EVLOG", "Removed old journal");
+	}
+
+	if (!InternalFS.exists(event_log_name))
+	{
+		// Create an empty journal
+		if (!event_log_file.open(event_log_name, FILE_O_WRITE))
+		{
+			MYLOG("EVLOG", "Could not create journal");
+			return false;
+		}
+		event_log_file.close();
+		MYLOG("EVLOG", "Created empty journal");
+		return true;
+	}
+
+	if (!event_log_file.open(event_log_name, FILE_O_READ))
+	{
+		MYLOG("EVLOG", "Could not open journal");
+		return false;
+	}
+
+	for (uint16_t slot = 0; slot < EVENT_LOG_SLOTS; slot++)
+	{
+		if (event_log_file.read(&record, sizeof(event_record_s)) != sizeof(event_record_s))
+		{
+			// End of file, rest of the ring was never written
+			break;
+		}
+		if (event_log_valid(&record))
+		{
+			event_log_set_index(slot, &record);
+			if (record.seq > event_log_seq)
+			{
+				event_log_seq = record.seq;
+				head_slot = slot;
+			}
+		}
+	}
+
+	if (event_log_seq == 0)
+	{
+		event_log_file.close();
+		MYLOG("EVLOG", "Journal is empty");
+		return true;
+	}
+
+	// Walk backwards from the newest record as long as the sequence numbers are consecutive
+	uint16_t slot = head_slot;
+	uint32_t expected_seq = event_log_seq;
+	while (event_log_num < EVENT_LOG_SLOTS)
+	{
+		if (!event_log_file.seek(slot * sizeof(event_record_s)) || (event_log_file.read(&record, sizeof(event_record_s)) != sizeof(event_record_s)))
+		{
+			break;
+		}
+		if (!event_log_valid(&record) || (record.seq != expected_seq))
+		{
+			break;
+		}
+		event_log_num++;
+		event_log_tail = slot;
+		expected_seq--;
+		slot = (slot == 0) ? EVENT_LOG_SLOTS - 1 : slot - 1;
+	}
+	event_log_file.close();
+
+	MYLOG("EVLOG", "Found %d records, last seq %ld", event_log_num, event_log_seq);
+	return true;
+}
+
+/**
+ * @brief Append a record to the journal
+ *        Overwrites the oldest record if the ring is full
+ *
+ * @param record record to add, seq and crc are set here
+ * @return true record written
+ * @return false write failed
+ */
+bool event_log_add(event_record_s *record)
+{
+	uint16_t slot = (event_log_tail + event_log_num) % EVENT_LOG_SLOTS;
+
+	record->seq = event_log_seq + 1;
+	record->crc = event_log_crc((uint8_t *)record, sizeof(event_record_s) - 2);
+
+	if (!event_log_file.open(event_log_name, FILE_O_WRITE))
+	{
+		MYLOG("EVLOG", "Could not open journal");
+		return false;
+	}
+	if (!event_log_file.seek(slot * sizeof(event_record_s)))
+	{
+		event_log_file.close();
+		MYLOG("EVLOG", "Seek to slot %d failed", slot);
+		return false;
+	}
+	size_t written = event_log_file.write((uint8_t *)record, sizeof(event_record_s));
+	event_log_file.close();
+	if (written != sizeof(event_record_s))
+	{
+		MYLOG("EVLOG", "Write to slot %d failed", slot);
+		return false;
+	}
+
+	event_log_seq = record->seq;
+	event_log_set_index(slot, record);
+	if (event_log_num < EVENT_LOG_SLOTS)
+	{
+		event_log_num++;
+	}
+	else
+	{
+		event_log_tail = (event_log_tail + 1) % EVENT_LOG_SLOTS;
+	}
+	MYLOG("EVLOG", "Saved record %ld in slot %d", record->seq, slot);
+	return true;
+}
+
+/**
+ * @brief Number of records in the journal
+ *
+ * @return uint16_t number of records
+ */
+uint16_t event_log_count(void)
+{
+	return event_log_num;
+}
+
+/**
+ * @brief Sequence number of the oldest record
+ *        Sequence numbers in the ring are consecutive, so the
+ *        position of a record is its sequence number minus this value
+ *
+ * @return uint32_t sequence number, 0 if the journal is empty
+ */
+uint32_t event_log_first_seq(void)
+{
+	if (event_log_num == 0)
+	{
+		return 0;
+	}
+	return event_log_seq - event_log_num + 1;
+}
+
+/**
+ * @brief Get a record by its position, 0 is the oldest record
+ *
+ * @param pos position in the journal
+ * @param record buffer for the record
+ * @return true record found
+ * @return false position out of range or read error
+ */
+bool event_log_get(uint16_t pos, event_record_s *record)
+{
+	if (pos >= event_log_num)
+	{
+		return false;
+	}
+	return event_log_read_slot((event_log_tail + pos) % EVENT_LOG_SLOTS, record);
+}
+
+/**
+ * @brief Get a record by its sequence number
+ *        The position of a record changes when the ring is full and a new record is added
+ *
+ * @param seq sequence number
+ * @param record buffer for the record
+ * @return true record found
+ * @return false record was overwritten or not written yet, or read error
+ */
+bool event_log_get_seq(uint32_t seq, event_record_s *record)
+{
+	uint32_t first_seq = event_log_first_seq();
+	if ((event_log_num == 0) || (seq < first_seq) || (seq > event_log_seq))
+	{
+		return false;
+	}
+	return event_log_get(seq - first_seq, record) && (record->seq == seq);
+}
+
+/**
+ * @brief Check if a record is in a time range
+ *        Records without a Unix time have the seconds since boot and a clock step can move the time backwards,
+ *        so the timestamps in the ring are not sorted. Only records with a Unix time are in a time range,
+ *        the range 0 to 0xFFFFFFFF selects all records.
+ *
+ * @param pos position in the journal
+ * @param from start of the range (inclusive)
+ * @param to end of the range (inclusive)
+ * @return true record is in the range
+ * @return false record is outside of the range or has no Unix time
+ */
+bool event_log_in_range(uint16_t pos, uint32_t from, uint32_t to)
+{
+	if (pos >= event_log_num)
+	{
+		return false;
+	}
+	if ((from == 0) && (to == 0xFFFFFFFF))
+	{
+		return true;
+	}
+	uint16_t slot = (event_log_tail + pos) % EVENT_LOG_SLOTS;
+	if ((event_log_timed[slot / 8] & (1 << (slot % 8))) == 0)
+	{
+		return false;
+	}
+	return (event_log_index[slot] >= from) && (event_log_index[slot] <= to);
+}
+
+/**
+ * @brief Find the records in a time range
+ *        Linear scan of the RAM index, the records in the range are not always consecutive.
+ *        Use event_log_in_range() to skip the records between them.
+ *
+ * @param from start of the range (inclusive)
+ * @param to end of the range (inclusive)
+ * @param first position of the first record in the range
+ * @return uint16_t number of records in the range
+ */
+uint16_t event_log_find(uint32_t from, uint32_t to, uint16_t *first)
+{
+	uint16_t num = 0;
+	*first = 0;
+	for (uint16_t pos = 0; pos < event_log_num; pos++)
+	{
+		if (event_log_in_range(pos, from, to))
+		{
+			if (num == 0)
+			{
+				*first = pos;
+			}
+			num++;
+		}
+	}
+	return num;
+}
+
+/**
+ * @brief Remember the start of an earthquake
+ *        Reads the time from the clock, so it is cheap enough to be called from the event handler
+ *
+ */
+void event_log_start(void)
+{
+	uint64_t clock_ms = get_clock_ms();
+	uint32_t uncertainty = get_clock_uncertainty();
+	event_start_time = clock_ms / 1000;
+	event_start_time_ms = clock_ms % 1000;
+	event_start_uncertainty = uncertainty >= EVLOG_UNCERTAINTY_UNKNOWN ? EVLOG_UNCERTAINTY_UNKNOWN : uncertainty;
+	// A sync during the earthquake must not turn the uptime into a Unix time
+	event_start_clock = is_clock_valid();
+	event_start_ms = millis();
+	event_started = true;
+}
+
+/**
+ * @brief Hand over the record of a finished earthquake to the loop
+ *        Called from the seismic task, the file system is not used here
+ *
+ * @param peak_si SI value reported by the D7S
+ * @param peak_pga PGA value reported by the D7S
+ * @param shutoff shutoff alert was raised
+ * @param collapse collapse alert was raised
+ * @param d7s_state state of the D7S
+ */
+void event_log_finish(float peak_si, float peak_pga, bool shutoff, bool collapse, uint8_t d7s_state)
+{
+	event_record_s record;
+	memset(&record, 0, sizeof(event_record_s));
+
+	if (!event_started)
+	{
+		// Start of the event was missed
+		event_log_start();
+	}
+	uint32_t duration = (millis() - event_start_ms) / 1000;
+
+	record.timestamp = event_start_time;
+	record.time_ms = event_start_time_ms;
+	record.time_uncertainty = event_start_uncertainty;
+	record.duration = duration > 0xFFFF ? 0xFFFF : duration;
+	record.peak_si = (uint16_t)(peak_si * 1000.0);
+	record.peak_pga = (uint16_t)(peak_pga * 1000.0);
+	record.flags = (shutoff ? EVLOG_FLAG_SHUTOFF : 0) | (collapse ? EVLOG_FLAG_COLLAPSE : 0) | (event_start_clock ? EVLOG_FLAG_RTC : 0);
+	record.d7s_state = d7s_state;
+	event_started = false;
+
+	taskENTER_CRITICAL();
+	bool queued = event_log_pending_num < EVENT_LOG_PENDING;
+	if (queued)
+	{
+		memcpy(&event_log_pending[event_log_pending_num++], &record, sizeof(event_record_s));
+	}
+	taskEXIT_CRITICAL();
+	if (!queued)
+	{
+		MYLOG("EVLOG", "Record lost, loop did not write the last records");
+	}
+}
+
+/**
+ * @brief Write the records of finished earthquakes into the journal
+ *        Called from the loop on every wakeup
+ *
+ */
+void event_log_flush(void)
+{
+	event_record_s record;
+	for (;;)
+	{
+		taskENTER_CRITICAL();
+		bool pending = event_log_pending_num != 0;
+		if (pending)
+		{
+			memcpy(&record, &event_log_pending[0], sizeof(event_record_s));
+			event_log_pending_num--;
+			memmove(&event_log_pending[0], &event_log_pending[1], event_log_pending_num * sizeof(event_record_s));
+		}
+		taskEXIT_CRITICAL();
+		if (!pending)
+		{
+			return;
+		}
+		event_log_add(&record);
+	}
+}
+
+/**
+ * @brief Get the start time of the current or last earthquake
+ *
+ * @return uint32_t start time, Unix time if event_log_start_clock() is true
+ */
+uint32_t event_log_start_time(void)
+{
+	return event_start_time;
+}
+
+/**
+ * @brief Check if the start time of the current or last earthquake is Unix time
+ *        The state of the clock is taken at the start, not when the earthquake ends
+ *
+ * @return true start time is Unix time
+ * @return false start time is seconds since boot
+ */
+bool event_log_start_clock(void)
+{
+	return event_start_clock;
+}
+
+/**
+ * @brief Get the milliseconds of the start time of the current or last earthquake
+ *
+ * @return uint16_t 0 to 999
+ */
+uint16_t event_log_start_ms(void)
+{
+	return event_start_time_ms;
+}
+
+/**
+ * @brief Get the uncertainty of the start time of the current or last earthquake
+ *
+ * @return uint16_t uncertainty in ms, EVLOG_UNCERTAINTY_UNKNOWN if the clock was never synced
+ */
+uint16_t event_log_start_uncertainty(void)
+{
+	return event_start_uncertainty;
+}
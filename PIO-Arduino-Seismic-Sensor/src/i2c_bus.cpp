@@ -0,0 +1,500 @@
+/**
+ * @file i2c_bus.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Owner of the I2C bus
+ *        Every access to a device is wrapped in i2c_begin() / i2c_end().
+ *        The bus clock is switched only when the next device needs a different speed,
+ *        so the D7S keeps 400kHz even if the SHTC3 needs 100kHz.
+ *        Bytes, transfers and bus time are counted per device.
+ *        Register reads use the TWIM EasyDMA directly, the CPU sleeps or does other
+ *        work while the transfer runs. The CPU busy time is counted separately.
+ *        The bus is shared by the loop and the seismic task, a session of one task
+ *        blocks the other task in i2c_begin() until it is finished. The lock is a recursive
+ *        mutex, the task holding the bus inherits the priority of a waiting task.
+ * @version 0.1
+ * @date 2023-03-13
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+
+/** Bus clock per device, index is I2C_DEV_xxx */
+static const uint32_t i2c_dev_clock[I2C_DEV_NUM] = {
+	400000, // D7S
+	100000, // SHTC3
+	400000, // RV3028
+	100000, // PMSA003I
+};
+
+/** Names for the statistics */
+static const char *i2c_dev_name[I2C_DEV_NUM] = {"D7S", "SHTC3", "RTC", "PMSA"};
+
+/** Statistics per device */
+static i2c_stats_s i2c_stats[I2C_DEV_NUM];
+
+/** Current bus clock */
+static uint32_t i2c_clock = 0;
+
+/** micros() when the bus was taken */
+static uint32_t i2c_start_us = 0;
+
+/** Flag if the current bus session had a DMA transfer, the CPU time is counted separately */
+static bool i2c_session_async = false;
+
+/** Lock of the bus, a DMA session is finished by i2c_end() of the task that started it */
+static SemaphoreHandle_t i2c_lock = NULL;
+
+#ifdef NRF52_SERIES
+/** TWIM instance used by Wire */
+#define I2C_TWIM NRF_TWIM0
+#define I2C_TWIM_IRQn SPIM0_SPIS0_TWIM0_TWIS0_SPI0_TWI0_IRQn
+
+/** Flag if a DMA transfer is running */
+static volatile bool i2c_async_active = false;
+
+/** Flag if the running DMA transfer had an error */
+static bool i2c_async_error = false;
+
+/** Device of the running DMA transfer */
+static uint8_t i2c_async_dev = 0;
+
+/** Expected number of received bytes */
+static uint8_t i2c_async_len = 0;
+
+/** Register address, EasyDMA can only read from RAM */
+static uint8_t i2c_async_tx[4];
+
+/** Flag if the STOP of a timed out transfer did not finish, its STOPPED event comes late */
+static bool i2c_stop_pending = false;
+#endif
+
+/** Callback of the running transfer */
+static i2c_done_cb_t i2c_async_cb = NULL;
+
+/** Context of the running transfer */
+static void *i2c_async_context = NULL;
+
+/**
+ * @brief Start the I2C bus
+ *        Must be called once before any device is initialized
+ *
+ */
+void init_i2c_bus(void)
+{
+	i2c_lock = xSemaphoreCreateRecursiveMutex();
+	Wire.begin();
+	i2c_clock = 400000;
+	Wire.setClock(i2c_clock);
+	i2c_reset_stats();
+}
+
+/**
+ * @brief Mark the bus clock as unknown
+ *        Needed after a library called Wire.begin(), which sets the default clock
+ *
+ */
+void i2c_clock_changed(void)
+{
+	i2c_clock = 0;
+}
+
+/**
+ * @brief Take the bus for a device
+ *        Calls can be nested to batch several transfers of the same device
+ *        into one bus session with one clock check.
+ *
+ * @param dev I2C_DEV_xxx
+ */
+void i2c_begin(uint8_t dev)
+{
+	bool nested = xSemaphoreGetMutexHolder(i2c_lock) == xTaskGetCurrentTaskHandle();
+	// Wait until the other task released the bus
+	xSemaphoreTakeRecursive(i2c_lock, portMAX_DELAY);
+	// Wire and the DMA transfer share the TWIM
+	i2c_async_wait(I2C_ASYNC_TIMEOUT);
+#ifdef NRF52_SERIES
+	if (i2c_stop_pending && I2C_TWIM->EVENTS_STOPPED)
+	{
+		// The bus was released, Wire must not see the late STOPPED event
+		I2C_TWIM->EVENTS_STOPPED = 0;
+		i2c_stop_pending = false;
+	}
+#endif
+	if (nested)
+	{
+		return;
+	}
+	i2c_session_async = false;
+	if (i2c_clock != i2c_dev_clock[dev])
+	{
+		i2c_clock = i2c_dev_clock[dev];
+		Wire.setClock(i2c_clock);
+		i2c_stats[dev].clock_switches++;
+	}
+	i2c_start_us = micros();
+}
+
+/**
+ * @brief Release the bus
+ *
+ * @param dev I2C_DEV_xxx
+ * @param bytes number of bytes on the bus, including address and register bytes, 0 if the session only grouped other transfers
+ */
+void i2c_end(uint8_t dev, uint16_t bytes)
+{
+	if (bytes != 0)
+	{
+		// 0 for a session that only groups other transfers
+		i2c_stats[dev].bytes += bytes;
+		i2c_stats[dev].transfers++;
+		perf_i2c(bytes);
+	}
+	uint32_t elapsed = micros() - i2c_start_us;
+	bool async = i2c_session_async;
+	xSemaphoreGiveRecursive(i2c_lock);
+	if (xSemaphoreGetMutexHolder(i2c_lock) == xTaskGetCurrentTaskHandle())
+	{
+		// Nested session, the bus is still taken
+		return;
+	}
+	// The other task may have the bus already
+	taskENTER_CRITICAL();
+	i2c_stats[dev].bus_us += elapsed;
+	if (!async)
+	{
+		// Wire waits in a busy loop
+		i2c_stats[dev].cpu_us += elapsed;
+	}
+	taskEXIT_CRITICAL();
+}
+
+#ifdef NRF52_SERIES
+/**
+ * @brief Callback for the blocking read
+ *
+ * @param success result of the transfer
+ * @param context pointer to the result of i2c_read_regs()
+ */
+static void i2c_read_done(bool success, void *context)
+{
+	*(bool *)context = success;
+}
+
+/**
+ * @brief Finish the running DMA transfer and call the callback
+ *
+ * @param success true if all bytes were received
+ */
+static void i2c_async_complete(bool success)
+{
+	uint32_t cpu_start = micros();
+	uint8_t dev = i2c_async_dev;
+	I2C_TWIM->INTENCLR = TWIM_INTEN_STOPPED_Msk | TWIM_INTEN_ERROR_Msk;
+	I2C_TWIM->SHORTS = 0;
+	// Wire waits for these events without clearing them first, a left over event ends its wait too early
+	I2C_TWIM->EVENTS_TXSTARTED = 0;
+	I2C_TWIM->EVENTS_LASTTX = 0;
+	I2C_TWIM->EVENTS_RXSTARTED = 0;
+	I2C_TWIM->EVENTS_LASTRX = 0;
+	I2C_TWIM->EVENTS_SUSPENDED = 0;
+	I2C_TWIM->EVENTS_STOPPED = 0;
+	I2C_TWIM->EVENTS_ERROR = 0;
+	NVIC_ClearPendingIRQ(I2C_TWIM_IRQn);
+	i2c_async_active = false;
+	if (!success)
+	{
+		i2c_stats[dev].errors++;
+		perf_i2c_error();
+	}
+	i2c_end(dev, 2 + I2C_TWIM->TXD.MAXCNT + i2c_async_len);
+	if (i2c_async_cb != NULL)
+	{
+		i2c_async_cb(success, i2c_async_context);
+	}
+	i2c_stats[dev].cpu_us += micros() - cpu_start;
+}
+
+/**
+ * @brief Check the TWIM events of the running DMA transfer
+ *
+ * @return true transfer is finished
+ * @return false transfer is still running
+ */
+static bool i2c_async_check(void)
+{
+	if (I2C_TWIM->EVENTS_ERROR)
+	{
+		// Address or data NACK, the TWIM needs a STOP
+		I2C_TWIM->EVENTS_ERROR = 0;
+		I2C_TWIM->ERRORSRC = I2C_TWIM->ERRORSRC;
+		i2c_async_error = true;
+		I2C_TWIM->TASKS_STOP = 1;
+	}
+	if (I2C_TWIM->EVENTS_STOPPED)
+	{
+		I2C_TWIM->EVENTS_STOPPED = 0;
+		i2c_async_complete(!i2c_async_error && (I2C_TWIM->RXD.AMOUNT == i2c_async_len));
+		return true;
+	}
+	return false;
+}
+#endif
+
+/**
+ * @brief Start reading registers of a device
+ *        The register address is written and the data is read with a repeated start by the EasyDMA.
+ *        The bus stays taken until the transfer is finished, the next user of the bus waits for it.
+ *        The callback is called from i2c_async_poll() or i2c_async_wait().
+ *
+ * @param dev I2C_DEV_xxx
+ * @param addr I2C address
+ * @param reg register address, MSB first
+ * @param reg_len length of the register address, 1 to 4 bytes
+ * @param data buffer for the register values, must stay valid until the callback
+ * @param len number of bytes to read
+ * @param callback called when the transfer is finished, can be NULL
+ * @param context passed to the callback
+ * @return true transfer started
+ * @return false wrong parameters
+ */
+bool i2c_read_async(uint8_t dev, uint8_t addr, const uint8_t *reg, uint8_t reg_len, uint8_t *data, uint8_t len, i2c_done_cb_t callback, void *context)
+{
+#ifdef NRF52_SERIES
+	if ((reg_len == 0) || (reg_len > sizeof(i2c_async_tx)) || (len == 0))
+	{
+		return false;
+	}
+	i2c_begin(dev);
+	uint32_t cpu_start = micros();
+	i2c_session_async = true;
+	i2c_async_dev = dev;
+	i2c_async_len = len;
+	i2c_async_error = false;
+	i2c_async_cb = callback;
+	i2c_async_context = context;
+	memcpy(i2c_async_tx, reg, reg_len);
+
+	I2C_TWIM->ADDRESS = addr;
+	I2C_TWIM->TXD.PTR = (uintptr_t)i2c_async_tx;
+	I2C_TWIM->TXD.MAXCNT = reg_len;
+	I2C_TWIM->RXD.PTR = (uintptr_t)data;
+	I2C_TWIM->RXD.MAXCNT = len;
+	I2C_TWIM->EVENTS_STOPPED = 0;
+	I2C_TWIM->EVENTS_ERROR = 0;
+	I2C_TWIM->SHORTS = TWIM_SHORTS_LASTTX_STARTRX_Msk | TWIM_SHORTS_LASTRX_STOP_Msk;
+	// The interrupt stays disabled in the NVIC, it only wakes up __WFE() (SEVONPEND)
+	NVIC_ClearPendingIRQ(I2C_TWIM_IRQn);
+	I2C_TWIM->INTENSET = TWIM_INTEN_STOPPED_Msk | TWIM_INTEN_ERROR_Msk;
+	i2c_async_active = true;
+	I2C_TWIM->TASKS_STARTTX = 1;
+	i2c_stats[dev].cpu_us += micros() - cpu_start;
+	return true;
+#else
+	bool result = i2c_read_regs(dev, addr, reg, reg_len, data, len);
+	if (callback != NULL)
+	{
+		callback(result, context);
+	}
+	return true;
+#endif
+}
+
+/**
+ * @brief Check if the running transfer is finished and call its callback
+ *
+ */
+void i2c_async_poll(void)
+{
+#ifdef NRF52_SERIES
+	// Only the task that started the transfer finishes it
+	if (i2c_async_active && (xSemaphoreGetMutexHolder(i2c_lock) == xTaskGetCurrentTaskHandle()))
+	{
+		i2c_async_check();
+	}
+#endif
+}
+
+/**
+ * @brief Sleep until the running transfer is finished
+ *
+ * @param timeout_ms maximum time to wait
+ * @return true no transfer running or transfer finished
+ * @return false transfer timed out and was stopped
+ */
+bool i2c_async_wait(uint32_t timeout_ms)
+{
+#ifdef NRF52_SERIES
+	// Only the task that started the transfer finishes it
+	if (!i2c_async_active || (xSemaphoreGetMutexHolder(i2c_lock) != xTaskGetCurrentTaskHandle()))
+	{
+		return true;
+	}
+	SCB->SCR |= SCB_SCR_SEVONPEND_Msk;
+	uint32_t wait_start = millis();
+	while (!i2c_async_check())
+	{
+		if ((millis() - wait_start) > timeout_ms)
+		{
+			MYLOG("I2C", "DMA transfer timeout");
+			I2C_TWIM->TASKS_STOP = 1;
+			// Wire must not start before the STOP is on the bus, a held SCL never lets it finish
+			uint32_t stop_start = millis();
+			while (!I2C_TWIM->EVENTS_STOPPED)
+			{
+				if ((millis() - stop_start) > I2C_STOP_TIMEOUT)
+				{
+					MYLOG("I2C", "STOP timeout");
+					i2c_stop_pending = true;
+					break;
+				}
+				__WFE();
+				NVIC_ClearPendingIRQ(I2C_TWIM_IRQn);
+			}
+			i2c_async_complete(false);
+			return false;
+		}
+		// Woken up by the TWIM event or the next system tick
+		__WFE();
+		NVIC_ClearPendingIRQ(I2C_TWIM_IRQn);
+	}
+#endif
+	return true;
+}
+
+/**
+ * @brief Read registers of a device in one transfer
+ *        The CPU sleeps while the EasyDMA does the transfer
+ *
+ * @param dev I2C_DEV_xxx
+ * @param addr I2C address
+ * @param reg register address, MSB first
+ * @param reg_len length of the register address, 1 to 4 bytes
+ * @param data buffer for the register values
+ * @param len number of bytes to read
+ * @return true if success
+ * @return false if the device did not answer
+ */
+bool i2c_read_regs(uint8_t dev, uint8_t addr, const uint8_t *reg, uint8_t reg_len, uint8_t *data, uint8_t len)
+{
+#ifdef NRF52_SERIES
+	bool result = false;
+	if (!i2c_read_async(dev, addr, reg, reg_len, data, len, i2c_read_done, &result))
+	{
+		return false;
+	}
+	i2c_async_wait(I2C_ASYNC_TIMEOUT);
+	return result;
+#else
+	bool result = false;
+	i2c_begin(dev);
+	Wire.beginTransmission(addr);
+	Wire.write(reg, reg_len);
+	if ((Wire.endTransmission(false) == 0) && (Wire.requestFrom(addr, len) == len))
+	{
+		for (uint8_t idx = 0; idx < len; idx++)
+		{
+			data[idx] = Wire.read();
+		}
+		result = true;
+	}
+	i2c_end(dev, 2 + reg_len + len);
+	if (!result)
+	{
+		i2c_stats[dev].errors++;
+		perf_i2c_error();
+	}
+	return result;
+#endif
+}
+
+/**
+ * @brief Read from a device without register address
+ *        For devices that deliver the result of a command, like the SHTC3
+ *
+ * @param dev I2C_DEV_xxx
+ * @param addr I2C address
+ * @param data buffer for the received bytes
+ * @param len number of bytes to read
+ * @return true if success
+ * @return false if the device did not answer
+ */
+bool i2c_read(uint8_t dev, uint8_t addr, uint8_t *data, uint8_t len)
+{
+	bool result = false;
+	i2c_begin(dev);
+	if (Wire.requestFrom(addr, len) == len)
+	{
+		for (uint8_t idx = 0; idx < len; idx++)
+		{
+			data[idx] = Wire.read();
+		}
+		result = true;
+	}
+	i2c_end(dev, 1 + len);
+	if (!result)
+	{
+		i2c_stats[dev].errors++;
+		perf_i2c_error();
+	}
+	return result;
+}
+
+/**
+ * @brief Write to a device in one transfer
+ *
+ * @param dev I2C_DEV_xxx
+ * @param addr I2C address
+ * @param data bytes to write, including the register address
+ * @param len number of bytes to write
+ * @return true if success
+ * @return false if the device did not answer
+ */
+bool i2c_write(uint8_t dev, uint8_t addr, const uint8_t *data, uint8_t len)
+{
+	i2c_begin(dev);
+	Wire.beginTransmission(addr);
+	Wire.write(data, len);
+	bool result = Wire.endTransmission() == 0;
+	i2c_end(dev, 1 + len);
+	if (!result)
+	{
+		i2c_stats[dev].errors++;
+		perf_i2c_error();
+	}
+	return result;
+}
+
+/**
+ * @brief Get the statistics of a device
+ *
+ * @param dev I2C_DEV_xxx
+ * @return i2c_stats_s* pointer to the statistics
+ */
+i2c_stats_s *i2c_get_stats(uint8_t dev)
+{
+	return &i2c_stats[dev];
+}
+
+/**
+ * @brief Clear the statistics of all devices
+ *
+ */
+void i2c_reset_stats(void)
+{
+	memset(i2c_stats, 0, sizeof(i2c_stats));
+}
+
+/**
+ * @brief Print the statistics of all devices
+ *        Format <device>:<transfers>:<bytes>:<bus time us>:<CPU busy us>:<clock switches>:<errors>
+ *
+ */
+void i2c_print_stats(void)
+{
+	for (uint8_t dev = 0; dev < I2C_DEV_NUM; dev++)
+	{
+		AT_PRINTF("%s:%ld:%ld:%ld:%ld:%ld:%ld\n", i2c_dev_name[dev], i2c_stats[dev].transfers, i2c_stats[dev].bytes,
+				  i2c_stats[dev].bus_us, i2c_stats[dev].cpu_us, i2c_stats[dev].clock_switches, i2c_stats[dev].errors);
+	}
+}
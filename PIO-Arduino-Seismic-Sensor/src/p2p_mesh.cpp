@@ -0,0 +1,396 @@
+/**
+ * @file p2p_mesh.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Flooding of shutoff and collapse alerts between P2P nodes
+ *        Without a gateway the neighbours of a node do not learn about its alerts.
+ *        In P2P mode each confirmed alert is sent as a small frame, every node that receives
+ *        it for the first time sends it again after a random backoff, until the TTL is used up.
+ *        A node that hears the same frame from MESH_SUPPRESS other nodes during its backoff
+ *        does not send it, its neighbours have it already.
+ *        Frame, MSB first:
+ *        'E' 'Q' <version> <origin ID 4 bytes> <seq 2 bytes> <TTL> <hops> <alert> <SI 2 bytes> <PGA 2 bytes>
+ *        The origin ID is the lower half of the DevEUI, SI and PGA are in 0.01 m/s and 0.01 m/s2
+ *        SI and PGA of an own alert are read when the alert comes, the higher of the instantaneous values
+ *        and the captured peaks of the running earthquake. savedSI and savedPGA are from the end of the last earthquake.
+ * @version 0.1
+ * @date 2023-03-26
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+
+/** Alert frame */
+#define MESH_MAGIC_1 'E'
+#define MESH_MAGIC_2 'Q'
+#define MESH_VERSION 1
+#define MESH_SIZE 16
+
+/** Offsets in the frame */
+#define MESH_POS_ORIGIN 3
+#define MESH_POS_SEQ 7
+#define MESH_POS_TTL 9
+#define MESH_POS_HOPS 10
+#define MESH_POS_ALERT 11
+#define MESH_POS_SI 12
+#define MESH_POS_PGA 14
+
+/** Number of frames remembered for the duplicate check */
+#define MESH_CACHE_SIZE 16
+
+/** Time a frame is remembered in ms */
+#define MESH_CACHE_TIME 60000
+
+/** Number of frames waiting for their backoff */
+#define MESH_QUEUE_SIZE 4
+
+/** Backoff before a frame is sent again, in time on air of one frame */
+#define MESH_BACKOFF_SLOTS 8
+
+/** Number of copies heard from other nodes that cancel the own rebroadcast */
+#define MESH_SUPPRESS 2
+
+/** Duplicate check entry */
+struct mesh_cache_s
+{
+	bool used;
+	uint32_t origin;
+	uint16_t seq;
+	uint32_t time;
+};
+
+/** Frame waiting for its backoff */
+struct mesh_queue_s
+{
+	bool used;
+	uint8_t copies;
+	uint32_t due;
+	uint8_t frame[MESH_SIZE];
+};
+
+/** Duplicate check, the oldest entry is replaced */
+static mesh_cache_s mesh_cache[MESH_CACHE_SIZE];
+static uint8_t mesh_cache_next = 0;
+
+/** Frames waiting to be sent */
+static mesh_queue_s mesh_queue[MESH_QUEUE_SIZE];
+
+/** Own ID and sequence number */
+static uint32_t mesh_origin = 0;
+static uint16_t mesh_seq = 0;
+
+/** Own alert waiting to be sent, set by the seismic task */
+static volatile uint8_t mesh_own_alert = 0;
+
+/** SI and PGA of the own alert, set by the seismic task */
+static float mesh_own_si = 0.0f;
+static float mesh_own_pga = 0.0f;
+
+/** Statistics */
+static uint32_t mesh_originated = 0;
+static uint32_t mesh_received = 0;
+static uint32_t mesh_duplicates = 0;
+static uint32_t mesh_relayed = 0;
+static uint32_t mesh_suppressed = 0;
+static uint32_t mesh_airtime_ms = 0;
+
+/**
+ * @brief Get a 16 bit value from a frame
+ *
+ * @param data position in the frame
+ * @return uint16_t value
+ */
+static uint16_t mesh_get16(const uint8_t *data)
+{
+	return ((uint16_t)data[0] << 8) | data[1];
+}
+
+/**
+ * @brief Get the TTL for own frames
+ *
+ * @return uint8_t TTL, 0 = flooding is off
+ */
+static uint8_t mesh_ttl(void)
+{
+	return g_app_settings.mesh_ttl;
+}
+
+/**
+ * @brief Check a frame against the duplicate cache and add it if it is new
+ *
+ * @param origin origin ID
+ * @param seq sequence number
+ * @return true frame was seen before
+ * @return false frame is new
+ */
+static bool mesh_seen(uint32_t origin, uint16_t seq)
+{
+	uint32_t now = millis();
+	for (uint8_t idx = 0; idx < MESH_CACHE_SIZE; idx++)
+	{
+		mesh_cache_s *entry = &mesh_cache[idx];
+		if (entry->used && (entry->origin == origin) && (entry->seq == seq) && ((now - entry->time) < MESH_CACHE_TIME))
+		{
+			return true;
+		}
+	}
+	mesh_cache[mesh_cache_next].origin = origin;
+	mesh_cache[mesh_cache_next].seq = seq;
+	mesh_cache[mesh_cache_next].time = now;
+	mesh_cache[mesh_cache_next].used = true;
+	mesh_cache_next = (mesh_cache_next + 1) % MESH_CACHE_SIZE;
+	return false;
+}
+
+/**
+ * @brief Set the scheduler to the earliest frame in the queue
+ *
+ */
+static void mesh_rearm(void)
+{
+	bool found = false;
+	uint32_t next = 0;
+	for (uint8_t idx = 0; idx < MESH_QUEUE_SIZE; idx++)
+	{
+		if (mesh_queue[idx].used && (!found || ((int32_t)(mesh_queue[idx].due - next) < 0)))
+		{
+			next = mesh_queue[idx].due;
+			found = true;
+		}
+	}
+	if (!found)
+	{
+		sched_stop(SCHED_MESH);
+		return;
+	}
+	int32_t delay_ms = (int32_t)(next - millis());
+	sched_start(SCHED_MESH, delay_ms > 0 ? delay_ms : 1, 0, 0);
+}
+
+/**
+ * @brief Put a frame in the queue
+ *
+ * @param frame frame to send
+ * @param delay_ms backoff in ms
+ * @return true frame is queued
+ * @return false queue is full
+ */
+static bool mesh_enqueue(const uint8_t *frame, uint32_t delay_ms)
+{
+	for (uint8_t idx = 0; idx < MESH_QUEUE_SIZE; idx++)
+	{
+		if (!mesh_queue[idx].used)
+		{
+			memcpy(mesh_queue[idx].frame, frame, MESH_SIZE);
+			mesh_queue[idx].copies = 0;
+			mesh_queue[idx].due = millis() + delay_ms;
+			mesh_queue[idx].used = true;
+			mesh_rearm();
+			return true;
+		}
+	}
+	MYLOG("MESH", "Queue full");
+	return false;
+}
+
+/**
+ * @brief Get a random backoff, a few times the time on air of one frame
+ *
+ * @return uint32_t backoff in ms
+ */
+static uint32_t mesh_backoff(void)
+{
+	uint32_t slot = p2p_airtime(MESH_SIZE) + 10;
+	return random(1, MESH_BACKOFF_SLOTS + 1) * slot;
+}
+
+/**
+ * @brief Get the own ID from the DevEUI and a random start sequence number
+ *
+ */
+void init_mesh(void)
+{
+	mesh_origin = ((uint32_t)g_lorawan_settings.node_device_eui[4] << 24) | ((uint32_t)g_lorawan_settings.node_device_eui[5] << 16) | ((uint32_t)g_lorawan_settings.node_device_eui[6] << 8) | g_lorawan_settings.node_device_eui[7];
+	memset(mesh_cache, 0, sizeof(mesh_cache));
+	memset(mesh_queue, 0, sizeof(mesh_queue));
+	// Neighbours may still remember the sequence numbers from before a reset
+	mesh_seq = random(0, 0x10000);
+}
+
+/**
+ * @brief Send an own alert to the neighbours, called by the seismic task
+ *        Only in P2P mode, the frame is built and sent by the loop
+ *        SI and PGA are read now, the earthquake is still running
+ *
+ * @param alert 1 = collapse, 2 = shutoff, 3 = both
+ */
+void mesh_send_alert(uint8_t alert)
+{
+	if (g_lorawan_settings.lorawan_enable || (mesh_ttl() == 0) || (alert == 0))
+	{
+		return;
+	}
+	float si = peakSI;
+	float pga = peakPGA;
+	float instant_si = 0.0f;
+	float instant_pga = 0.0f;
+	if (instant_rak12027(&instant_si, &instant_pga))
+	{
+		si = max(si, instant_si);
+		pga = max(pga, instant_pga);
+	}
+	taskENTER_CRITICAL();
+	if (mesh_own_alert == 0)
+	{
+		mesh_own_si = 0.0f;
+		mesh_own_pga = 0.0f;
+	}
+	mesh_own_alert |= alert;
+	mesh_own_si = max(mesh_own_si, si);
+	mesh_own_pga = max(mesh_own_pga, pga);
+	taskEXIT_CRITICAL();
+	api_wake_loop(P2P_MESH);
+}
+
+/**
+ * @brief Build the frame of an own alert and queue it without backoff
+ *
+ * @param alert 1 = collapse, 2 = shutoff, 3 = both
+ * @param own_si SI in m/s
+ * @param own_pga PGA in m/s2
+ */
+static void mesh_originate(uint8_t alert, float own_si, float own_pga)
+{
+	uint8_t frame[MESH_SIZE];
+	uint16_t si = (uint16_t)(own_si * 100.0f);
+	uint16_t pga = (uint16_t)(own_pga * 100.0f);
+	frame[0] = MESH_MAGIC_1;
+	frame[1] = MESH_MAGIC_2;
+	frame[2] = MESH_VERSION;
+	frame[MESH_POS_ORIGIN] = (uint8_t)(mesh_origin >> 24);
+	frame[MESH_POS_ORIGIN + 1] = (uint8_t)(mesh_origin >> 16);
+	frame[MESH_POS_ORIGIN + 2] = (uint8_t)(mesh_origin >> 8);
+	frame[MESH_POS_ORIGIN + 3] = (uint8_t)(mesh_origin);
+	frame[MESH_POS_SEQ] = (uint8_t)(mesh_seq >> 8);
+	frame[MESH_POS_SEQ + 1] = (uint8_t)(mesh_seq);
+	frame[MESH_POS_TTL] = mesh_ttl();
+	frame[MESH_POS_HOPS] = 0;
+	frame[MESH_POS_ALERT] = alert;
+	frame[MESH_POS_SI] = (uint8_t)(si >> 8);
+	frame[MESH_POS_SI + 1] = (uint8_t)(si);
+	frame[MESH_POS_PGA] = (uint8_t)(pga >> 8);
+	frame[MESH_POS_PGA + 1] = (uint8_t)(pga);
+
+	// Own frames coming back from the neighbours are duplicates
+	mesh_seen(mesh_origin, mesh_seq);
+	mesh_seq++;
+	if (mesh_enqueue(frame, 0))
+	{
+		mesh_originated++;
+	}
+}
+
+/**
+ * @brief Handle a P2P packet that might be an alert frame
+ *
+ * @param data received data
+ * @param len length of received data
+ * @return true packet was an alert frame
+ * @return false packet was something else
+ */
+bool handle_mesh_frame(uint8_t *data, uint8_t len)
+{
+	if ((len != MESH_SIZE) || (data[0] != MESH_MAGIC_1) || (data[1] != MESH_MAGIC_2) || (data[2] != MESH_VERSION))
+	{
+		return false;
+	}
+	uint32_t origin = ((uint32_t)data[MESH_POS_ORIGIN] << 24) | ((uint32_t)data[MESH_POS_ORIGIN + 1] << 16) | ((uint32_t)data[MESH_POS_ORIGIN + 2] << 8) | data[MESH_POS_ORIGIN + 3];
+	uint16_t seq = mesh_get16(&data[MESH_POS_SEQ]);
+
+	if (mesh_seen(origin, seq))
+	{
+		mesh_duplicates++;
+		// Count the copy for a rebroadcast that is still waiting
+		for (uint8_t idx = 0; idx < MESH_QUEUE_SIZE; idx++)
+		{
+			mesh_queue_s *entry = &mesh_queue[idx];
+			if (entry->used && (mesh_get16(&entry->frame[MESH_POS_SEQ]) == seq) && (memcmp(&entry->frame[MESH_POS_ORIGIN], &data[MESH_POS_ORIGIN], 4) == 0))
+			{
+				entry->copies++;
+			}
+		}
+		return true;
+	}
+	mesh_received++;
+	if ((mesh_ttl() != 0) && (data[MESH_POS_TTL] > 1))
+	{
+		data[MESH_POS_TTL]--;
+		data[MESH_POS_HOPS]++;
+		mesh_enqueue(data, mesh_backoff());
+	}
+
+	AT_PRINTF("+EVT:MESH:%08lX:%d:%d:%.2f:%.2f\n", origin, data[MESH_POS_ALERT], data[MESH_POS_HOPS],
+			  mesh_get16(&data[MESH_POS_SI]) / 100.0f, mesh_get16(&data[MESH_POS_PGA]) / 100.0f);
+	return true;
+}
+
+/**
+ * @brief Send the frames whose backoff is over
+ *        Called from the loop with the P2P_MESH event, all frames are handled by the loop
+ *
+ */
+void mesh_handler(void)
+{
+	taskENTER_CRITICAL();
+	uint8_t alert = mesh_own_alert;
+	float si = mesh_own_si;
+	float pga = mesh_own_pga;
+	mesh_own_alert = 0;
+	taskEXIT_CRITICAL();
+	if (alert != 0)
+	{
+		mesh_originate(alert, si, pga);
+	}
+
+	uint32_t now = millis();
+	for (uint8_t idx = 0; idx < MESH_QUEUE_SIZE; idx++)
+	{
+		mesh_queue_s *entry = &mesh_queue[idx];
+		if (!entry->used || ((int32_t)(entry->due - now) > 0))
+		{
+			continue;
+		}
+		entry->used = false;
+		bool own = entry->frame[MESH_POS_HOPS] == 0;
+		if (!own && (entry->copies >= MESH_SUPPRESS))
+		{
+			mesh_suppressed++;
+			continue;
+		}
+		if (!send_p2p_packet(entry->frame, MESH_SIZE))
+		{
+			// Radio is busy, try again after another backoff
+			entry->used = true;
+			entry->due = now + mesh_backoff();
+			continue;
+		}
+		mesh_airtime_ms += p2p_airtime(MESH_SIZE);
+		if (!own)
+		{
+			mesh_relayed++;
+		}
+		MYLOG("MESH", "Sent %s frame", own ? "own" : "relayed");
+	}
+	mesh_rearm();
+}
+
+/**
+ * @brief Print the settings and the statistics
+ *        <TTL>:<originated>:<received>:<duplicates>:<relayed>:<suppressed>:<airtime ms>
+ *
+ */
+void print_mesh(void)
+{
+	AT_PRINTF("%d:%ld:%ld:%ld:%ld:%ld:%ld\n", mesh_ttl(), mesh_originated, mesh_received, mesh_duplicates,
+			  mesh_relayed, mesh_suppressed, mesh_airtime_ms);
+}
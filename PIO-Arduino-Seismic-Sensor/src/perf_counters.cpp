@@ -0,0 +1,449 @@
+/**
+ * @file perf_counters.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Runtime counters to check a deployed device without a debug build
+ *        The counters are in RAM that is not cleared at a reset, so they survive
+ *        watchdog and soft resets. They are cleared after a power on.
+ *        All counters stop at their maximum instead of wrapping around.
+ *        Read with AT+PERF, reset with AT+PERF=0, or request a diagnostic uplink
+ *        with the downlink command DL_CMD_DIAG.
+ * @version 0.1
+ * @date 2023-03-24
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+
+/** Marks a valid counter block, "PERF" */
+#define PERF_MAGIC 0x50455246
+
+/** Increment when the layout of perf_counters_s changes */
+#define PERF_VERSION 1
+
+/** Version of the diagnostic uplink */
+#define PERF_UPLINK_VERSION 1
+
+/** Counter block */
+struct perf_counters_s
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t size;
+	uint32_t wakeups[16];						 // Per event bit of g_task_event_type
+	uint32_t d7s_irq[2];						 // INT1 and INT2
+	uint32_t i2c_transfers;						 // All devices
+	uint32_t i2c_bytes;							 // Bytes on the bus, including address and register bytes
+	uint32_t i2c_errors;						 // NACK or timeout
+	uint32_t uplinks[PERF_UP_NUM][PERF_RES_NUM]; // Per packet type and result of the send call
+	uint32_t tx_ack;							 // TX cycles finished successfully
+	uint32_t tx_nak;							 // TX cycles failed, e.g. no ACK for a confirmed packet
+	uint32_t retries;							 // Packets or requests sent again
+	uint32_t join_fails;						 // Failed join attempts
+	uint32_t resets[PERF_RESET_NUM];			 // Per reset cause
+	uint32_t awake_ms;							 // Time spent in the handlers
+	uint32_t awake_us;							 // Remainder of awake_ms
+	uint32_t handler_max_us[PERF_HANDLER_NUM];	 // Longest run of each handler
+	uint32_t irq_latency_max_us;				 // Longest time from a D7S interrupt to its handling
+	uint8_t last_reset;							 // PERF_RESET_xxx of the last reset
+};
+
+/** Counter block, not cleared by the startup code */
+static perf_counters_s perf __attribute__((section(".noinit")));
+
+/** Time of the last D7S interrupt, for the latency */
+static volatile uint32_t perf_irq_us = 0;
+
+/** Flag if a D7S interrupt is waiting for its handling */
+static volatile bool perf_irq_pending = false;
+
+/** Flag if a diagnostic uplink was requested */
+bool perf_uplink_pending = false;
+
+/** Names for AT+PERF */
+static const char *perf_up_name[PERF_UP_NUM] = {"STATUS", "ALERT", "ACK", "DUMP", "SYNC", "DIAG"};
+static const char *perf_reset_name[PERF_RESET_NUM] = {"POWER", "PIN", "WDT", "SOFT", "LOCKUP", "WAKE"};
+static const char *perf_handler_name[PERF_HANDLER_NUM] = {"APP", "LORA", "BLE", "SEIS"};
+
+/**
+ * @brief Add to a counter, stops at the maximum
+ *
+ * @param counter counter to change
+ * @param value value to add
+ */
+static inline void perf_add_unlocked(uint32_t *counter, uint32_t value)
+{
+	*counter = (*counter > 0xFFFFFFFFUL - value) ? 0xFFFFFFFFUL : *counter + value;
+}
+
+/**
+ * @brief Add to a counter from a task
+ *
+ * @param counter counter to change
+ * @param value value to add
+ */
+static void perf_add(uint32_t *counter, uint32_t value)
+{
+	taskENTER_CRITICAL();
+	perf_add_unlocked(counter, value);
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief Get the cause of the last reset
+ *
+ * @return uint8_t PERF_RESET_xxx
+ */
+static uint8_t perf_reset_cause(void)
+{
+#ifdef NRF52_SERIES
+	// Read and cleared by the core at startup
+	uint32_t reason = readResetReason();
+	if (reason & POWER_RESETREAS_DOG_Msk)
+	{
+		return PERF_RESET_WDT;
+	}
+	if (reason & POWER_RESETREAS_LOCKUP_Msk)
+	{
+		return PERF_RESET_LOCKUP;
+	}
+	if (reason & POWER_RESETREAS_SREQ_Msk)
+	{
+		return PERF_RESET_SOFT;
+	}
+	if (reason & POWER_RESETREAS_RESETPIN_Msk)
+	{
+		return PERF_RESET_PIN;
+	}
+	if (reason != 0)
+	{
+		// Wake up from System OFF by GPIO, LPCOMP, NFC or VBUS
+		return PERF_RESET_WAKE;
+	}
+#endif
+	return PERF_RESET_POWER;
+}
+
+/**
+ * @brief Check the counter block and count the reset
+ *        Call as early as possible
+ *
+ */
+void init_perf(void)
+{
+	uint8_t cause = perf_reset_cause();
+	// After a power on the RAM content is random
+	if ((cause == PERF_RESET_POWER) || (perf.magic != PERF_MAGIC) || (perf.version != PERF_VERSION) || (perf.size != sizeof(perf_counters_s)))
+	{
+		perf_reset();
+	}
+	perf.last_reset = cause;
+	perf_add(&perf.resets[cause], 1);
+}
+
+/**
+ * @brief Clear all counters
+ *
+ */
+void perf_reset(void)
+{
+	taskENTER_CRITICAL();
+	memset(&perf, 0, sizeof(perf_counters_s));
+	perf.magic = PERF_MAGIC;
+	perf.version = PERF_VERSION;
+	perf.size = sizeof(perf_counters_s);
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief Count the events of a wakeup
+ *
+ * @param events event bits handled by the caller
+ */
+void perf_wakeup(uint16_t events)
+{
+	taskENTER_CRITICAL();
+	for (uint8_t bit = 0; bit < 16; bit++)
+	{
+		if (events & (1 << bit))
+		{
+			perf_add_unlocked(&perf.wakeups[bit], 1);
+		}
+	}
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief Count a D7S interrupt
+ *        Called from the interrupt handlers
+ *
+ * @param line 1 for INT1, 2 for INT2
+ */
+void perf_irq(uint8_t line)
+{
+	UBaseType_t saved = taskENTER_CRITICAL_FROM_ISR();
+	perf_add_unlocked(&perf.d7s_irq[line - 1], 1);
+	if (!perf_irq_pending)
+	{
+		perf_irq_us = micros();
+		perf_irq_pending = true;
+	}
+	taskEXIT_CRITICAL_FROM_ISR(saved);
+}
+
+/**
+ * @brief Measure the time since the D7S interrupt
+ *        Called when the seismic handler starts
+ *
+ */
+void perf_irq_handled(void)
+{
+	if (!perf_irq_pending)
+	{
+		return;
+	}
+	uint32_t latency = micros() - perf_irq_us;
+	perf_irq_pending = false;
+	if (latency > perf.irq_latency_max_us)
+	{
+		perf.irq_latency_max_us = latency;
+	}
+}
+
+/**
+ * @brief Count an I2C transfer
+ *
+ * @param bytes bytes on the bus
+ */
+void perf_i2c(uint16_t bytes)
+{
+	taskENTER_CRITICAL();
+	perf_add_unlocked(&perf.i2c_transfers, 1);
+	perf_add_unlocked(&perf.i2c_bytes, bytes);
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief Count an I2C error
+ *
+ */
+void perf_i2c_error(void)
+{
+	perf_add(&perf.i2c_errors, 1);
+}
+
+/**
+ * @brief Count an uplink
+ *
+ * @param type PERF_UP_xxx
+ * @param result PERF_RES_xxx
+ */
+void perf_uplink(uint8_t type, uint8_t result)
+{
+	perf_add(&perf.uplinks[type][result], 1);
+}
+
+/**
+ * @brief Count a LoRaWAN uplink by the result of send_lora_packet()
+ *
+ * @param type PERF_UP_xxx
+ * @param result result of send_lora_packet()
+ * @return lmh_error_status the result, unchanged
+ */
+lmh_error_status perf_lora_uplink(uint8_t type, lmh_error_status result)
+{
+	perf_uplink(type, result == LMH_SUCCESS ? PERF_RES_QUEUED : (result == LMH_BUSY ? PERF_RES_BUSY : PERF_RES_ERROR));
+	return result;
+}
+
+/**
+ * @brief Count a finished TX cycle
+ *
+ * @param success true if the TX cycle finished successfully
+ */
+void perf_tx_done(bool success)
+{
+	perf_add(success ? &perf.tx_ack : &perf.tx_nak, 1);
+}
+
+/**
+ * @brief Count a packet or request that is sent again
+ *
+ */
+void perf_retry(void)
+{
+	perf_add(&perf.retries, 1);
+}
+
+/**
+ * @brief Count a failed join attempt
+ *
+ */
+void perf_join_fail(void)
+{
+	perf_add(&perf.join_fails, 1);
+}
+
+/**
+ * @brief Add the run time of a handler
+ *
+ * @param handler PERF_HANDLER_xxx
+ * @param start_us micros() when the handler started
+ */
+void perf_handler_done(uint8_t handler, uint32_t start_us)
+{
+	uint32_t elapsed = micros() - start_us;
+	taskENTER_CRITICAL();
+	// Split first, awake_us + elapsed can overflow for a run of more than 71 minutes
+	perf.awake_us += elapsed % 1000;
+	perf_add_unlocked(&perf.awake_ms, elapsed / 1000 + perf.awake_us / 1000);
+	perf.awake_us %= 1000;
+	if (elapsed > perf.handler_max_us[handler])
+	{
+		perf.handler_max_us[handler] = elapsed;
+	}
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief Print all counters
+ *        Each line is <group>:<values>
+ *
+ */
+void perf_print(void)
+{
+	perf_counters_s copy;
+	taskENTER_CRITICAL();
+	memcpy(&copy, &perf, sizeof(perf_counters_s));
+	taskEXIT_CRITICAL();
+
+	AT_PRINTF("UPTIME:%ld\n", millis() / 1000);
+	AT_PRINTF("WAKE");
+	for (uint8_t bit = 0; bit < 16; bit++)
+	{
+		AT_PRINTF(":%ld", copy.wakeups[bit]);
+	}
+	AT_PRINTF("\nIRQ:%ld:%ld:%ld\n", copy.d7s_irq[0], copy.d7s_irq[1], copy.irq_latency_max_us);
+	AT_PRINTF("I2C:%ld:%ld:%ld\n", copy.i2c_transfers, copy.i2c_bytes, copy.i2c_errors);
+	for (uint8_t type = 0; type < PERF_UP_NUM; type++)
+	{
+		AT_PRINTF("UP_%s:%ld:%ld:%ld\n", perf_up_name[type], copy.uplinks[type][PERF_RES_QUEUED], copy.uplinks[type][PERF_RES_BUSY], copy.uplinks[type][PERF_RES_ERROR]);
+	}
+	AT_PRINTF("TX:%ld:%ld\nRETRY:%ld\nJOIN_FAIL:%ld\n", copy.tx_ack, copy.tx_nak, copy.retries, copy.join_fails);
+	AT_PRINTF("RESET:%s", perf_reset_name[copy.last_reset]);
+	for (uint8_t cause = 0; cause < PERF_RESET_NUM; cause++)
+	{
+		AT_PRINTF(":%ld", copy.resets[cause]);
+	}
+	AT_PRINTF("\nAWAKE:%ld\nMAX_US", copy.awake_ms);
+	for (uint8_t handler = 0; handler < PERF_HANDLER_NUM; handler++)
+	{
+		AT_PRINTF(":%s=%ld", perf_handler_name[handler], copy.handler_max_us[handler]);
+	}
+	AT_PRINTF("\n");
+}
+
+/**
+ * @brief Add a counter to the uplink, big endian, limited to the field size
+ *
+ * @param packet packet buffer
+ * @param value counter value
+ * @param len field size 1, 2 or 4 bytes
+ * @return uint8_t number of bytes added
+ */
+static uint8_t perf_put(uint8_t *packet, uint32_t value, uint8_t len)
+{
+	uint32_t max = len == 4 ? 0xFFFFFFFFUL : (1UL << (len * 8)) - 1;
+	if (value > max)
+	{
+		value = max;
+	}
+	for (uint8_t idx = 0; idx < len; idx++)
+	{
+		packet[idx] = (uint8_t)(value >> ((len - 1 - idx) * 8));
+	}
+	return len;
+}
+
+/**
+ * @brief Request a diagnostic uplink, sent with the next wakeup
+ *
+ */
+void perf_request_uplink(void)
+{
+	perf_uplink_pending = true;
+}
+
+/**
+ * @brief Send the diagnostic uplink on PERF_FPORT
+ *        Summary of the counters, see README
+ *
+ * @return true uplink was enqueued or there was nothing to send
+ * @return false uplink could not be sent, will be retried
+ */
+bool send_perf_uplink(void)
+{
+	if (!perf_uplink_pending)
+	{
+		return true;
+	}
+	if (!g_lorawan_settings.lorawan_enable || !g_lpwan_has_joined)
+	{
+		perf_uplink_pending = false;
+		return true;
+	}
+
+	perf_counters_s copy;
+	taskENTER_CRITICAL();
+	memcpy(&copy, &perf, sizeof(perf_counters_s));
+	taskEXIT_CRITICAL();
+
+	// The sums stop at the maximum like the counters
+	uint32_t wakeups = 0;
+	for (uint8_t bit = 0; bit < 16; bit++)
+	{
+		perf_add_unlocked(&wakeups, copy.wakeups[bit]);
+	}
+	uint32_t resets = 0;
+	for (uint8_t cause = 0; cause < PERF_RESET_NUM; cause++)
+	{
+		perf_add_unlocked(&resets, copy.resets[cause]);
+	}
+	uint32_t queued = 0;
+	uint32_t failed = 0;
+	for (uint8_t type = 0; type < PERF_UP_NUM; type++)
+	{
+		perf_add_unlocked(&queued, copy.uplinks[type][PERF_RES_QUEUED]);
+		perf_add_unlocked(&failed, copy.uplinks[type][PERF_RES_BUSY]);
+		perf_add_unlocked(&failed, copy.uplinks[type][PERF_RES_ERROR]);
+	}
+
+	uint8_t packet[PERF_UPLINK_SIZE];
+	uint8_t pos = 0;
+	packet[pos++] = PERF_UPLINK_VERSION;
+	pos += perf_put(&packet[pos], millis() / 1000, 4);
+	pos += perf_put(&packet[pos], resets, 2);
+	packet[pos++] = copy.last_reset;
+	pos += perf_put(&packet[pos], wakeups, 4);
+	pos += perf_put(&packet[pos], copy.d7s_irq[0], 2);
+	pos += perf_put(&packet[pos], copy.d7s_irq[1], 2);
+	pos += perf_put(&packet[pos], copy.i2c_transfers, 4);
+	pos += perf_put(&packet[pos], copy.i2c_errors, 2);
+	pos += perf_put(&packet[pos], queued, 2);
+	pos += perf_put(&packet[pos], failed, 2);
+	pos += perf_put(&packet[pos], copy.tx_nak, 2);
+	pos += perf_put(&packet[pos], copy.retries, 2);
+	pos += perf_put(&packet[pos], copy.awake_ms / 1000, 4);
+	pos += perf_put(&packet[pos], copy.handler_max_us[PERF_HANDLER_APP] / 1000, 2);
+	pos += perf_put(&packet[pos], copy.handler_max_us[PERF_HANDLER_SEISMIC] / 1000, 2);
+	pos += perf_put(&packet[pos], copy.irq_latency_max_us / 1000, 2);
+
+	if (perf_lora_uplink(PERF_UP_DIAG, send_lora_packet(packet, pos, PERF_FPORT)) == LMH_BUSY)
+	{
+		MYLOG("PERF", "Diagnostic uplink not sent");
+		return false;
+	}
+	// Too big for the datarate will not get better, drop it
+	perf_uplink_pending = false;
+	return true;
+}
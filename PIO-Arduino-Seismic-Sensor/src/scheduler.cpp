@@ -0,0 +1,380 @@
+/**
+ * @file scheduler.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Wakeup scheduler for all one-shot and periodic jobs of the application
+ *        One timer is shared by all jobs. Each job has a due time and a tolerance,
+ *        it may run up to tolerance ms early. The timer is set to the earliest due time,
+ *        at the wakeup all jobs within their tolerance window run together.
+ *        Jobs are also run early by any other wakeup, e.g. a downlink or an interrupt
+ *        of the D7S, if their window is already open.
+ *        The heartbeat is a job too, the timer of the WisBlock API is not used.
+ *        The loop, the seismic task and the timer daemon change the jobs and the timer,
+ *        sched_mutex keeps the job table and the timer state consistent between them.
+ * @version 0.1
+ * @date 2023-03-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+
+/** Wakeup event of each job, index is SCHED_xxx */
+static const uint16_t sched_job_event[SCHED_JOB_NUM] = {
+	STATUS,			 // Follow-up packet
+	SEISMIC_CAPTURE, // SI and PGA polling
+	EVENT_DUMP,		 // Event journal pages
+	TIME_SYNC,		 // Clock sync request or beacon
+	PM_SAMPLE,		 // Particle sensor cycle
+	BLE_DATA,		 // BLE UART line timeout
+	BLE_TELEMETRY,	 // BLE telemetry notifications
+	USB_STREAM,		 // USB stream snapshots
+	P2P_MESH,		 // P2P alert rebroadcasts
+	STATUS,			 // Heartbeat packet
+	TIME_SYNC,		 // RTC resync, shares the event with the sync requests
+};
+
+/** Job entry */
+struct sched_job_s
+{
+	bool active;
+	uint32_t due;
+	uint32_t period;
+	uint32_t tolerance;
+};
+
+/** Job table */
+static sched_job_s sched_jobs[SCHED_JOB_NUM];
+
+/** The one timer of the scheduler */
+SoftwareTimer sched_timer;
+
+/** Due time the timer is set to */
+static uint32_t sched_timer_due = 0;
+
+/** Flag if the timer is running */
+static bool sched_timer_active = false;
+
+/** Mutex for the job table and the timer */
+static SemaphoreHandle_t sched_mutex = NULL;
+
+/** Jobs that ran since sched_take() was called for them, bit n is job n */
+static uint16_t sched_ran = 0;
+
+/** Statistics */
+static uint32_t sched_wakes = 0;
+static uint32_t sched_runs = 0;
+
+/**
+ * @brief Take the job table and the timer
+ *
+ */
+static void sched_lock(void)
+{
+	if (sched_mutex != NULL)
+	{
+		xSemaphoreTake(sched_mutex, portMAX_DELAY);
+	}
+}
+
+/**
+ * @brief Release the job table and the timer
+ *
+ */
+static void sched_unlock(void)
+{
+	if (sched_mutex != NULL)
+	{
+		xSemaphoreGive(sched_mutex);
+	}
+}
+
+/**
+ * @brief Collect the events of all jobs with an open window
+ *        One-shot jobs are removed, periodic jobs get their next due time
+ *        Called with sched_mutex taken
+ *
+ * @param now millis() of the wakeup
+ * @return uint16_t events of the jobs that are due
+ */
+static uint16_t sched_collect(uint32_t now)
+{
+	uint16_t events = 0;
+	for (uint8_t job = 0; job < SCHED_JOB_NUM; job++)
+	{
+		sched_job_s *entry = &sched_jobs[job];
+		// Signed difference handles the millis() overflow
+		if (!entry->active || ((int32_t)(entry->due - entry->tolerance - now) > 0))
+		{
+			continue;
+		}
+		events |= sched_job_event[job];
+		sched_ran |= 1 << job;
+		sched_runs++;
+		if (entry->period == 0)
+		{
+			entry->active = false;
+		}
+		else
+		{
+			entry->due += entry->period;
+			// Skip periods that were missed, the job runs only once per wakeup
+			if ((int32_t)(entry->due - now) <= 0)
+			{
+				entry->due = now + entry->period;
+			}
+		}
+	}
+	return events;
+}
+
+/**
+ * @brief Set the timer to the earliest due time of all jobs
+ *        Called with sched_mutex taken
+ *
+ */
+static void sched_rearm(void)
+{
+	bool found = false;
+	uint32_t next = 0;
+	uint32_t now = millis();
+	for (uint8_t job = 0; job < SCHED_JOB_NUM; job++)
+	{
+		if (sched_jobs[job].active && (!found || ((int32_t)(sched_jobs[job].due - next) < 0)))
+		{
+			next = sched_jobs[job].due;
+			found = true;
+		}
+	}
+
+	if (!found)
+	{
+		sched_timer.stop();
+		sched_timer_active = false;
+		return;
+	}
+	if (sched_timer_active && (next == sched_timer_due))
+	{
+		// Timer is already set to this time
+		return;
+	}
+	int32_t delay_ms = (int32_t)(next - now);
+	sched_timer.stop();
+	sched_timer.setPeriod(delay_ms > 0 ? delay_ms : 1);
+	sched_timer.start();
+	sched_timer_due = next;
+	sched_timer_active = true;
+}
+
+/**
+ * @brief Timer callback, wakes the loop with the events of all due jobs
+ *
+ * @param unused
+ *      Timer handle, not used
+ */
+static void sched_wakeup(TimerHandle_t unused)
+{
+	sched_lock();
+	sched_timer_active = false;
+	uint16_t events = sched_collect(millis());
+	sched_wakes++;
+	sched_rearm();
+	sched_unlock();
+	if ((events & SEISMIC_TASK_EVENTS) != 0)
+	{
+		seismic_notify(events & SEISMIC_TASK_EVENTS);
+	}
+	if ((events & ~SEISMIC_TASK_EVENTS) != 0)
+	{
+		api_wake_loop(events & ~SEISMIC_TASK_EVENTS);
+	}
+}
+
+/**
+ * @brief Initialize the scheduler timer
+ *
+ */
+void init_scheduler(void)
+{
+	memset(sched_jobs, 0, sizeof(sched_jobs));
+	sched_mutex = xSemaphoreCreateMutex();
+	sched_timer.begin(1000, sched_wakeup, NULL, false);
+}
+
+/**
+ * @brief Start or restart a job
+ *
+ * @param job SCHED_xxx
+ * @param delay_ms time until the job is due
+ * @param period_ms repeat interval, 0 for a one-shot job
+ * @param tolerance_ms time the job may run early to share a wakeup with another job
+ */
+void sched_start(uint8_t job, uint32_t delay_ms, uint32_t period_ms, uint32_t tolerance_ms)
+{
+	if (job >= SCHED_JOB_NUM)
+	{
+		return;
+	}
+	sched_lock();
+	sched_jobs[job].due = millis() + delay_ms;
+	sched_jobs[job].period = period_ms;
+	sched_jobs[job].tolerance = tolerance_ms > delay_ms ? delay_ms : tolerance_ms;
+	sched_jobs[job].active = true;
+	sched_rearm();
+	sched_unlock();
+}
+
+/**
+ * @brief Stop a job
+ *
+ * @param job SCHED_xxx
+ */
+void sched_stop(uint8_t job)
+{
+	if (job >= SCHED_JOB_NUM)
+	{
+		return;
+	}
+	sched_lock();
+	sched_jobs[job].active = false;
+	sched_rearm();
+	sched_unlock();
+}
+
+/**
+ * @brief Check if a job is waiting to run
+ *
+ * @param job SCHED_xxx
+ * @return true if the job is active
+ */
+bool sched_active(uint8_t job)
+{
+	return (job < SCHED_JOB_NUM) && sched_jobs[job].active;
+}
+
+/**
+ * @brief Get the time until a job is due
+ *
+ * @param job SCHED_xxx
+ * @return uint32_t time in ms, 0 if the job is not active or overdue
+ */
+uint32_t sched_remaining(uint8_t job)
+{
+	if (job >= SCHED_JOB_NUM)
+	{
+		return 0;
+	}
+	sched_lock();
+	int32_t remaining = (int32_t)(sched_jobs[job].due - millis());
+	bool active = sched_jobs[job].active;
+	sched_unlock();
+	return (active && (remaining > 0)) ? remaining : 0;
+}
+
+/**
+ * @brief Check if a job ran and clear the flag
+ *        For jobs that share their wakeup event with another job
+ *
+ * @param job SCHED_xxx
+ * @return true if the job ran since the last call
+ */
+bool sched_take(uint8_t job)
+{
+	if (job >= SCHED_JOB_NUM)
+	{
+		return false;
+	}
+	sched_lock();
+	bool ran = (sched_ran & (1 << job)) != 0;
+	sched_ran &= ~(1 << job);
+	sched_unlock();
+	return ran;
+}
+
+/**
+ * @brief Start the heartbeat with the interval of the battery profile
+ *        Restarts the interval from now, stops the heartbeat if the interval is 0
+ *
+ */
+void heartbeat_start(void)
+{
+	uint32_t period = get_heartbeat_time();
+	if (period == 0)
+	{
+		sched_stop(SCHED_HEARTBEAT);
+		return;
+	}
+	sched_start(SCHED_HEARTBEAT, period, period, SCHED_HEARTBEAT_TOLERANCE);
+}
+
+/**
+ * @brief Stop the heartbeat, e.g. during an earthquake
+ *
+ */
+void heartbeat_stop(void)
+{
+	sched_stop(SCHED_HEARTBEAT);
+}
+
+/**
+ * @brief Restart the heartbeat only if its interval changed or it is not running
+ *        The WisBlock API changes the interval with AT+SENDINT
+ *
+ */
+void heartbeat_check(void)
+{
+	uint32_t period = get_heartbeat_time();
+	if ((sched_active(SCHED_HEARTBEAT) != (period != 0)) || (sched_active(SCHED_HEARTBEAT) && (sched_jobs[SCHED_HEARTBEAT].period != period)))
+	{
+		heartbeat_start();
+	}
+}
+
+/**
+ * @brief Run jobs with an open window on a wakeup that came from somewhere else
+ *        Called from the loop at the start of the event handler
+ *
+ */
+void sched_service(void)
+{
+	sched_lock();
+	uint16_t events = sched_collect(millis());
+	if (events != 0)
+	{
+		sched_rearm();
+	}
+	sched_unlock();
+	if (events != 0)
+	{
+		if ((events & SEISMIC_TASK_EVENTS) != 0)
+		{
+			seismic_notify(events & SEISMIC_TASK_EVENTS);
+		}
+		g_task_event_type |= events & ~SEISMIC_TASK_EVENTS;
+	}
+}
+
+/**
+ * @brief Reset the scheduler statistics
+ *
+ */
+void sched_reset_stats(void)
+{
+	sched_wakes = 0;
+	sched_runs = 0;
+}
+
+/**
+ * @brief Print the scheduler statistics
+ *
+ */
+void sched_print_stats(void)
+{
+	AT_PRINTF("SCHED:%ld:%ld\n", sched_wakes, sched_runs);
+	for (uint8_t job = 0; job < SCHED_JOB_NUM; job++)
+	{
+		if (sched_jobs[job].active)
+		{
+			AT_PRINTF("JOB%d:%ld:%ld:%ld\n", job, (int32_t)(sched_jobs[job].due - millis()), sched_jobs[job].period, sched_jobs[job].tolerance);
+		}
+	}
+}
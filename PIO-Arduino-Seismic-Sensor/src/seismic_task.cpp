@@ -0,0 +1,281 @@
+/**
+ * @file seismic_task.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Task for the D7S interrupts and the SI/PGA capture
+ *        Runs with a higher priority than the loop, so an earthquake is handled
+ *        immediately, even if the loop is busy with BLE, LoRa or an AT command.
+ *        The task only prepares the packet, it is sent by the loop.
+ * @version 0.1
+ * @date 2023-03-20
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+
+/** Stack size of the task in words, the file system is used only by the loop */
+#define SEISMIC_TASK_STACK 1024
+
+/** Lowest free stack of the task in words, logged when it gets lower */
+static UBaseType_t seismic_stack_free = SEISMIC_TASK_STACK;
+
+/** Handle of the seismic task, NULL if the events are handled by the loop */
+static TaskHandle_t seismic_task_handle = NULL;
+
+/** Mutex for the packet, shared by the loop and the seismic task */
+static SemaphoreHandle_t payload_mutex = NULL;
+
+/**
+ * @brief Take the packet buffer g_solution_data
+ *
+ */
+void payload_lock(void)
+{
+	if (payload_mutex != NULL)
+	{
+		xSemaphoreTake(payload_mutex, portMAX_DELAY);
+	}
+}
+
+/**
+ * @brief Release the packet buffer g_solution_data
+ *
+ */
+void payload_unlock(void)
+{
+	if (payload_mutex != NULL)
+	{
+		xSemaphoreGive(payload_mutex);
+	}
+}
+
+/**
+ * @brief Handle the seismic events
+ *        Called from the seismic task, or from the loop if the task could not be started
+ *
+ * @param events SEISMIC_ALERT, SEISMIC_EVENT and/or SEISMIC_CAPTURE
+ */
+void seismic_handler(uint16_t events)
+{
+	perf_irq_handled();
+
+	// Seismic sensor alert (collapse or shut down interrupt)
+	if ((events & SEISMIC_ALERT) == SEISMIC_ALERT)
+	{
+		uint8_t alert = check_event_rak12027(true);
+		// Switch the output before anything else
+		shutoff_alert_check(alert);
+		// Tell the P2P neighbours
+		mesh_send_alert(alert);
+		usb_stream_state(alert);
+		// The loop reads the alert flags for the packet
+		payload_lock();
+		switch (alert)
+		{
+		case 1:
+			// Collapse alert
+			collapse_alert = true;
+			MYLOG("SEIS", "Earthquake collapse alert!");
+			break;
+		case 2:
+			// ShutDown alert
+			shutoff_alert = true;
+			MYLOG("SEIS", "Earthquake shutoff alert!");
+			break;
+		case 3:
+			// Collapse & ShutDown alert
+			collapse_alert = true;
+			shutoff_alert = true;
+			MYLOG("SEIS", "Earthquake collapse & shutoff alert!");
+			break;
+		default:
+			// False alert
+			digitalWrite(LED_BLUE, LOW);
+			MYLOG("SEIS", "Earthquake false alert!");
+			break;
+		}
+		payload_unlock();
+	}
+
+	// Handle Seismic Events
+	if ((events & SEISMIC_EVENT) == SEISMIC_EVENT)
+	{
+		MYLOG("SEIS", "Earthquake event");
+		uint8_t event = check_event_rak12027(false);
+		usb_stream_state(event);
+		switch (event)
+		{
+		case 4:
+			// Earthquake start
+			MYLOG("SEIS", "Earthquake start alert!");
+			read_rak12027(false);
+			event_log_start();
+			payload_lock();
+			earthquake_end = false;
+			g_solution_data.addPresence(LPP_CHANNEL_EQ_EVENT, true);
+			payload_unlock();
+			// Make sure no packet is sent while analyzing
+			heartbeat_stop();
+			sched_stop(SCHED_FOLLOW_UP);
+
+			// Start sampling SI and PGA if enabled
+			peakSI = 0.0;
+			peakPGA = 0.0;
+			if (g_app_settings.capture_rate != 0)
+			{
+				sched_start(SCHED_CAPTURE, g_app_settings.capture_rate, g_app_settings.capture_rate, g_app_settings.capture_rate / SCHED_CAPTURE_TOLERANCE_DIV);
+			}
+
+			// Shutoff without waiting for the D7S if an early warning announced a strong earthquake
+			ew_quake_start();
+			break;
+		case 5:
+			// Earthquake end
+			MYLOG("SEIS", "Earthquake end alert!");
+			sched_stop(SCHED_CAPTURE);
+			shutoff_quake_end();
+			payload_lock();
+			read_rak12027(true);
+			earthquake_end = true;
+			g_solution_data.addPresence(LPP_CHANNEL_EQ_EVENT, true);
+			g_solution_data.addPresence(LPP_CHANNEL_EQ_SHUTOFF, shutoff_alert);
+			g_solution_data.addPresence(LPP_CHANNEL_EQ_COLLAPSE, collapse_alert);
+
+			// Add the start time of the earthquake if the time is known
+			if (event_log_start_clock())
+			{
+				g_solution_data.addUnixTime(LPP_CHANNEL_EQ_TIME, event_log_start_time());
+				g_solution_data.addGenericSensor(LPP_CHANNEL_EQ_TIME_MS, event_log_start_ms());
+				g_solution_data.addGenericSensor(LPP_CHANNEL_EQ_TIME_ACC, event_log_start_uncertainty());
+			}
+			// Save the event in the journal, written by the loop
+			event_log_finish(max(savedSI, peakSI), max(savedPGA, peakPGA), shutoff_alert, collapse_alert, state_rak12027());
+
+			// Reset flags
+			shutoff_alert = false;
+			collapse_alert = false;
+			payload_unlock();
+			// Send another packet in 1 minute
+			sched_start(SCHED_FOLLOW_UP, 60000, 0, SCHED_FOLLOW_UP_TOLERANCE);
+			// Restart frequent sending, a heartbeat changed during the earthquake is taken now
+			heartbeat_start();
+
+			// Request packet sending from the loop
+			api_wake_loop(STATUS);
+			break;
+		case 6:
+			// Another D7S of the array started or ended, the earthquake continues
+			MYLOG("SEIS", "Earthquake continues");
+			break;
+		default:
+			// False alert
+			sched_stop(SCHED_CAPTURE);
+			payload_lock();
+			earthquake_end = true;
+			payload_unlock();
+			MYLOG("SEIS", "Earthquake false alert!");
+			break;
+		}
+	}
+
+	// Sample SI and PGA during an earthquake
+	if ((events & SEISMIC_CAPTURE) == SEISMIC_CAPTURE)
+	{
+		// An early warning starts the capture before the earthquake
+		if (earthquake_start || ew_armed())
+		{
+			capture_rak12027();
+		}
+		else
+		{
+			sched_stop(SCHED_CAPTURE);
+		}
+	}
+
+	// Finish the capture read before waiting for the next event
+	i2c_async_wait(I2C_ASYNC_TIMEOUT);
+}
+
+/**
+ * @brief Seismic task, waits for the notifications of the D7S interrupts and the scheduler
+ *
+ * @param unused
+ *      Task parameter, not used
+ */
+static void seismic_task(void *unused)
+{
+	uint32_t events;
+	for (;;)
+	{
+		if (xTaskNotifyWait(0, 0xFFFFFFFF, &events, portMAX_DELAY) == pdTRUE)
+		{
+			uint32_t perf_start = micros();
+			perf_wakeup(events & SEISMIC_TASK_EVENTS);
+			seismic_handler(events & SEISMIC_TASK_EVENTS);
+			perf_handler_done(PERF_HANDLER_SEISMIC, perf_start);
+			UBaseType_t stack_free = uxTaskGetStackHighWaterMark(NULL);
+			if (stack_free < seismic_stack_free)
+			{
+				seismic_stack_free = stack_free;
+				MYLOG("SEIS", "Stack free %ld words", stack_free);
+			}
+		}
+	}
+}
+
+/**
+ * @brief Start the seismic task
+ *        If the task cannot be started, the events are handled by the loop as before
+ *
+ * @return true if the task is running
+ */
+bool init_seismic_task(void)
+{
+	payload_mutex = xSemaphoreCreateMutex();
+	if (payload_mutex == NULL)
+	{
+		MYLOG("SEIS", "Could not create packet mutex");
+		return false;
+	}
+	if (xTaskCreate(seismic_task, "SEIS", SEISMIC_TASK_STACK, NULL, SEISMIC_TASK_PRIO, &seismic_task_handle) != pdPASS)
+	{
+		MYLOG("SEIS", "Could not start seismic task");
+		seismic_task_handle = NULL;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Send events to the seismic task
+ *        Falls back to the loop if the task is not running
+ *
+ * @param events SEISMIC_TASK_EVENTS
+ */
+void seismic_notify(uint16_t events)
+{
+	if (seismic_task_handle == NULL)
+	{
+		api_wake_loop(events);
+		return;
+	}
+	xTaskNotify(seismic_task_handle, events, eSetBits);
+}
+
+/**
+ * @brief Send events to the seismic task from an interrupt
+ *        Falls back to the loop if the task is not running
+ *
+ * @param events SEISMIC_TASK_EVENTS
+ */
+void seismic_notify_from_isr(uint16_t events)
+{
+	if (seismic_task_handle == NULL)
+	{
+		api_wake_loop(events);
+		return;
+	}
+	BaseType_t higher_prio_woken = pdFALSE;
+	xTaskNotifyFromISR(seismic_task_handle, events, eSetBits, &higher_prio_woken);
+	portYIELD_FROM_ISR(higher_prio_woken);
+}
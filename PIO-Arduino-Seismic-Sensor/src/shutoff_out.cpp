@@ -0,0 +1,292 @@
+/**
+ * @file shutoff_out.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Local shutoff output, e.g. a relay that stops a machine or closes a gas valve
+ *        The output is set in the INT1 interrupt as soon as enough D7S pulled INT1 low,
+ *        it does not wait for a task, the I2C bus, the LoRa stack or a join.
+ *        The seismic task reads the D7S afterwards. It confirms the output and starts the timer of the mode,
+ *        or switches the output off again if the D7S report no alert or the sensors do not agree on its type.
+ *        Worst case from INT1 to the output is the interrupt latency plus a few GPIO reads,
+ *        the confirmation waits for the I2C bus and is measured as well.
+ *        The GPIO is set with the build flag SHUTOFF_PIN, without it the output is not used.
+ *        Modes, set with AT+SHUTOFF:
+ *        SHUTOFF_LATCH  output stays on until AT+SHUTOFF is sent again
+ *        SHUTOFF_PULSE  output is on for the set time
+ *        SHUTOFF_AUTO   output is switched off the set time after the earthquake ended
+ * @version 0.1
+ * @date 2023-03-26
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+
+#ifndef SHUTOFF_ACTIVE
+#define SHUTOFF_ACTIVE HIGH // Level of the output when the shutoff is active
+#endif
+
+/** Flag if the output can be used */
+static bool shutoff_available = false;
+
+/** Flag if the output is on */
+static volatile bool shutoff_on = false;
+
+/** Flag if the output was switched by the interrupt and the seismic task did not confirm it yet */
+static volatile bool shutoff_unconfirmed = false;
+
+/** Time from the interrupt to the output of the unconfirmed switch in us */
+static volatile uint32_t shutoff_irq_latency = 0;
+
+/** Timer to switch the output off, runs in the timer task, not in the loop */
+SoftwareTimer shutoff_timer;
+
+/** micros() of the first INT1 that was not handled yet */
+static volatile uint32_t shutoff_irq_us = 0;
+
+/** Flag if shutoff_irq_us is valid */
+static volatile bool shutoff_irq_valid = false;
+
+/** Statistics */
+static uint32_t shutoff_count = 0;
+static uint32_t shutoff_last_us = 0;
+static uint32_t shutoff_max_us = 0;
+static uint32_t shutoff_confirm_max_us = 0; // INT1 until the seismic task read the D7S
+static uint32_t shutoff_rejected = 0;		// Switched by the interrupt, no alert after reading the D7S
+
+/**
+ * @brief Get the pulse length or the hold time after the earthquake
+ *
+ * @return uint32_t time in ms
+ */
+static uint32_t shutoff_time(void)
+{
+	if (g_app_settings.shutoff_time == 0)
+	{
+		return SHUTOFF_TIME_DEFAULT * 1000;
+	}
+	return g_app_settings.shutoff_time * 1000;
+}
+
+/**
+ * @brief Timer callback, switch the output off
+ *
+ * @param unused
+ */
+static void shutoff_timeout(TimerHandle_t unused)
+{
+	shutoff_release();
+}
+
+/**
+ * @brief Prepare the shutoff output
+ *        Must be called after the D7S are initialized, the output may not use one of their interrupt pins
+ *
+ */
+void init_shutoff(void)
+{
+	shutoff_timer.begin(1000, shutoff_timeout, NULL, false);
+#ifdef SHUTOFF_PIN
+	for (uint8_t sensor = 0; sensor < d7s_configured; sensor++)
+	{
+		if ((d7s_sensors[sensor].int1_pin == SHUTOFF_PIN) || (d7s_sensors[sensor].int2_pin == SHUTOFF_PIN))
+		{
+			MYLOG("SHUT", "Output pin is used by D7S %d, output disabled", sensor);
+			return;
+		}
+	}
+	pinMode(SHUTOFF_PIN, OUTPUT);
+	digitalWrite(SHUTOFF_PIN, !SHUTOFF_ACTIVE);
+	shutoff_available = true;
+	MYLOG("SHUT", "Output mode %d", g_app_settings.shutoff_mode);
+#else
+	MYLOG("SHUT", "No output pin");
+#endif
+}
+
+/**
+ * @brief Handle a D7S INT1, called from the interrupt
+ *        Switches the output if enough sensors agree, the timers are started by the seismic task
+ *
+ * @param irq_us micros() at the start of the interrupt
+ * @param agreed enough sensors pulled INT1 low within the voting window
+ */
+void shutoff_irq(uint32_t irq_us, bool agreed)
+{
+	if (!shutoff_irq_valid)
+	{
+		shutoff_irq_us = irq_us;
+		shutoff_irq_valid = true;
+	}
+	if (!agreed || !shutoff_available || (g_app_settings.shutoff_mode == SHUTOFF_OFF) || shutoff_on)
+	{
+		return;
+	}
+#ifdef SHUTOFF_PIN
+	digitalWrite(SHUTOFF_PIN, SHUTOFF_ACTIVE);
+#endif
+	shutoff_on = true;
+	shutoff_unconfirmed = true;
+	shutoff_irq_latency = micros() - irq_us;
+}
+
+/**
+ * @brief Switch the output on and start the timer of the mode
+ *        An output that was switched by the interrupt is counted with the latency of the interrupt
+ *
+ * @param latency time since the interrupt in us, for the statistics
+ */
+static void shutoff_switch_on(uint32_t latency)
+{
+	taskENTER_CRITICAL();
+#ifdef SHUTOFF_PIN
+	digitalWrite(SHUTOFF_PIN, SHUTOFF_ACTIVE);
+#endif
+	bool was_on = shutoff_on && !shutoff_unconfirmed;
+	if (shutoff_unconfirmed)
+	{
+		latency = shutoff_irq_latency;
+		shutoff_unconfirmed = false;
+	}
+	shutoff_on = true;
+	taskEXIT_CRITICAL();
+	if (g_app_settings.shutoff_mode == SHUTOFF_PULSE)
+	{
+		shutoff_timer.stop();
+		shutoff_timer.setPeriod(shutoff_time());
+		shutoff_timer.start();
+	}
+	else if (g_app_settings.shutoff_mode == SHUTOFF_AUTO)
+	{
+		// Released after the end of the earthquake
+		shutoff_timer.stop();
+	}
+	if (was_on)
+	{
+		return;
+	}
+	shutoff_count++;
+	shutoff_last_us = latency;
+	if (latency > shutoff_max_us)
+	{
+		shutoff_max_us = latency;
+	}
+	MYLOG("SHUT", "Output on after %ld us", latency);
+}
+
+/**
+ * @brief Handle the result of the INT1 check, called by the seismic task right after the D7S was read
+ *        Confirms or rejects an output that was switched by the interrupt
+ *
+ * @param alert 1 = collapse, 2 = shutoff, 3 = both, 0 = no confirmed alert
+ */
+void shutoff_alert_check(uint8_t alert)
+{
+	uint32_t now = micros();
+	taskENTER_CRITICAL();
+	uint32_t latency = shutoff_irq_valid ? now - shutoff_irq_us : 0;
+	// An INT1 that came during the read is checked with the next call
+	bool waiting = d7s_int1_waiting();
+	if (!waiting)
+	{
+		shutoff_irq_valid = false;
+	}
+	bool reject = (alert == 0) && shutoff_unconfirmed && !waiting;
+	if (reject)
+	{
+#ifdef SHUTOFF_PIN
+		digitalWrite(SHUTOFF_PIN, !SHUTOFF_ACTIVE);
+#endif
+		shutoff_on = false;
+		shutoff_unconfirmed = false;
+		shutoff_rejected++;
+	}
+	taskEXIT_CRITICAL();
+	if (reject)
+	{
+		MYLOG("SHUT", "Output off, alert not confirmed by the D7S");
+	}
+	if ((alert == 0) || !shutoff_available || (g_app_settings.shutoff_mode == SHUTOFF_OFF))
+	{
+		return;
+	}
+	if (latency > shutoff_confirm_max_us)
+	{
+		shutoff_confirm_max_us = latency;
+	}
+	shutoff_switch_on(latency);
+}
+
+/**
+ * @brief Switch the output at the start of an earthquake that was announced by an early warning
+ *        The D7S needs a few seconds for its shutoff judgement, the warning already confirmed the strength
+ *
+ */
+void shutoff_warning_start(void)
+{
+	if (!shutoff_available || (g_app_settings.shutoff_mode == SHUTOFF_OFF))
+	{
+		return;
+	}
+	MYLOG("SHUT", "Earthquake start after an early warning");
+	shutoff_switch_on(0);
+}
+
+/**
+ * @brief Start the hold time of SHUTOFF_AUTO at the end of the earthquake
+ *
+ */
+void shutoff_quake_end(void)
+{
+	if (shutoff_on && (g_app_settings.shutoff_mode == SHUTOFF_AUTO))
+	{
+		shutoff_timer.stop();
+		shutoff_timer.setPeriod(shutoff_time());
+		shutoff_timer.start();
+	}
+}
+
+/**
+ * @brief Switch the output off
+ *
+ */
+void shutoff_release(void)
+{
+	if (!shutoff_available)
+	{
+		return;
+	}
+	shutoff_timer.stop();
+	taskENTER_CRITICAL();
+#ifdef SHUTOFF_PIN
+	digitalWrite(SHUTOFF_PIN, !SHUTOFF_ACTIVE);
+#endif
+	bool was_on = shutoff_on;
+	shutoff_on = false;
+	shutoff_unconfirmed = false;
+	taskEXIT_CRITICAL();
+	if (was_on)
+	{
+		MYLOG("SHUT", "Output off");
+	}
+}
+
+/**
+ * @brief Check if the output is on
+ *
+ * @return true output is on
+ */
+bool shutoff_active(void)
+{
+	return shutoff_on;
+}
+
+/**
+ * @brief Print the settings, the state and the statistics
+ *        <mode>:<time s>:<pin ok>:<on>:<count>:<last latency us>:<max latency us>:<max confirm us>:<rejected>
+ *
+ */
+void print_shutoff(void)
+{
+	AT_PRINTF("%d:%ld:%d:%d:%ld:%ld:%ld:%ld:%ld\n", g_app_settings.shutoff_mode, shutoff_time() / 1000, shutoff_available ? 1 : 0,
+			  shutoff_on ? 1 : 0, shutoff_count, shutoff_last_us, shutoff_max_us, shutoff_confirm_max_us, shutoff_rejected);
+}
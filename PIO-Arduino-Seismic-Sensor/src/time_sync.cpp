@@ -0,0 +1,382 @@
+/**
+ * @file time_sync.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Get the time from the LoRaWAN network or from a P2P time beacon
+ *        LoRaWAN uses the application layer clock synchronization (TS003) on fPort 202
+ *        AppTimeReq  [0x01] [DeviceTime 4 bytes LE, GPS seconds] [Param: bit 4 AnsRequired, bits 0-3 token]
+ *        AppTimeAns  [0x01] [TimeCorrection 4 bytes LE, signed seconds] [Param: bits 0-3 token]
+ *        The answer has 1 second resolution, the network time is only good to about +/-1 second.
+ *        DeviceTimeReq (1/256 s) cannot be used, the LoRaMAC of SX126x-Arduino is LoRaWAN 1.0.2
+ *        without MLME_DEVICE_TIME and the MLME confirm callback belongs to LoRaMacHelper
+ *        P2P nodes with a time from the RTC or the network send a beacon, nodes synced from the
+ *        same beacon are aligned to about 20 ms
+ *        ['T'] ['B'] [version] [Unix time 6 bytes BE, ms] [uncertainty 2 bytes BE, ms]
+ * @version 0.1
+ * @date 2023-03-10
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "epoch_clock.h"
+
+/** Unix time of the GPS epoch 1980-01-06 */
+#define GPS_EPOCH_OFFSET 315964800UL
+
+/** DeviceTime sent while the clock has no Unix time, keeps the correction small enough for 32 bit */
+#define GPS_DEFAULT_TIME (clock_to_epoch(2023, 1, 1, 0, 0, 0) - GPS_EPOCH_OFFSET + GPS_LEAP_SECONDS)
+/** Leap seconds between GPS time and UTC */
+#define GPS_LEAP_SECONDS 18
+
+/** TS003 command IDs */
+#define TS003_APP_TIME 0x01
+#define TS003_FORCE_RESYNC 0x03
+#define TS003_ANS_REQUIRED 0x10
+
+/** P2P time beacon */
+#define BEACON_MAGIC_1 'T'
+#define BEACON_MAGIC_2 'B'
+#define BEACON_VERSION 1
+#define BEACON_SIZE 11
+
+/** LoRaWAN overhead of an uplink, MHDR + FHDR + FPort + MIC */
+#define LORAWAN_OVERHEAD 13
+
+/** Token of the last request */
+static uint8_t sync_token = 0;
+
+/** Requests without answer */
+static uint8_t sync_retries = 0;
+
+/** Flag if an answer is expected */
+static bool sync_pending = false;
+
+/** DeviceTime sent with the last request */
+static uint32_t sync_device_time = 0;
+
+/** millis() when the last request was sent */
+static uint32_t sync_millis = 0;
+
+/** Estimated time from sending the request until the end of the uplink in ms */
+static uint32_t sync_tx_delay = 0;
+
+/**
+ * @brief Calculate the time on air of a LoRa packet
+ *        Explicit header and CRC enabled
+ *
+ * @param sf spreading factor
+ * @param bw_khz bandwidth in kHz
+ * @param cr coding rate 1 = 4/5 to 4 = 4/8
+ * @param preamble preamble length in symbols
+ * @param len payload length
+ * @return uint32_t time on air in ms
+ */
+static uint32_t lora_airtime(uint8_t sf, uint16_t bw_khz, uint8_t cr, uint16_t preamble, uint8_t len)
+{
+	uint32_t symbol_us = ((uint32_t)1 << sf) * 1000 / bw_khz;
+	// Low datarate optimization is used for symbols of 16 ms and longer
+	int32_t bits_per_symbol = 4 * (sf - (symbol_us >= 16000 ? 2 : 0));
+	int32_t payload_bits = 8 * len - 4 * sf + 28 + 16;
+	uint32_t payload_symbols = 8;
+	if (payload_bits > 0)
+	{
+		payload_symbols += ((payload_bits + bits_per_symbol - 1) / bits_per_symbol) * (cr + 4);
+	}
+	// Preamble has 4.25 extra symbols
+	return ((preamble * 4 + 17) * symbol_us / 4 + payload_symbols * symbol_us) / 1000;
+}
+
+/**
+ * @brief Estimate the time on air of an uplink with the current datarate
+ *        DR0 is SF12 in most regions, US915 starts with SF10 and has SF8 with 500 kHz as DR4
+ *
+ * @param len payload length
+ * @return uint32_t time on air in ms
+ */
+static uint32_t uplink_airtime(uint8_t len)
+{
+	MibRequestConfirm_t mib_req;
+	mib_req.Type = MIB_CHANNELS_DATARATE;
+	LoRaMacMibGetRequestConfirm(&mib_req);
+	uint8_t datarate = mib_req.Param.ChannelsDatarate;
+
+	uint8_t sf = 7;
+	uint16_t bw = 125;
+	if (g_lorawan_settings.lora_region == LORAMAC_REGION_US915)
+	{
+		if (datarate >= 4)
+		{
+			sf = 8;
+			bw = 500;
+		}
+		else
+		{
+			sf = 10 - datarate;
+		}
+	}
+	else if (datarate == 6)
+	{
+		bw = 250;
+	}
+	else if (datarate < 6)
+	{
+		sf = 12 - datarate;
+	}
+	return lora_airtime(sf, bw, 1, 8, len + LORAWAN_OVERHEAD);
+}
+
+/**
+ * @brief Estimate the time on air of a P2P packet with the current settings
+ *
+ * @param len payload length
+ * @return uint32_t time on air in ms
+ */
+uint32_t p2p_airtime(uint8_t len)
+{
+	uint16_t bw = g_lorawan_settings.p2p_bandwidth == 2 ? 500 : (g_lorawan_settings.p2p_bandwidth == 1 ? 250 : 125);
+	return lora_airtime(g_lorawan_settings.p2p_sf, bw, g_lorawan_settings.p2p_cr, g_lorawan_settings.p2p_preamble_len, len);
+}
+
+/**
+ * @brief Initialize the timer for the sync requests
+ *        In P2P mode the beacon is started immediately
+ *
+ */
+void init_time_sync(void)
+{
+	if (!g_lorawan_settings.lorawan_enable)
+	{
+		start_time_sync(TIME_BEACON_INTERVAL);
+	}
+}
+
+/**
+ * @brief (Re)start the timer for the next request or beacon
+ *
+ * @param delay_ms time until the next request
+ */
+void start_time_sync(uint32_t delay_ms)
+{
+	// The exact time of a request does not matter, let it share a wakeup with other jobs
+	sched_start(SCHED_TIME_SYNC, delay_ms, 0, delay_ms / SCHED_TIME_SYNC_TOLERANCE_DIV);
+}
+
+/**
+ * @brief Send a P2P time beacon if the own time is from a good source
+ *        Nodes that got their time from a beacon do not forward it
+ *
+ */
+static void send_time_beacon(void)
+{
+	uint8_t source = get_clock_source();
+	if ((source != CLOCK_SRC_RTC) && (source != CLOCK_SRC_NETWORK))
+	{
+		return;
+	}
+	uint8_t beacon[BEACON_SIZE];
+	uint32_t uncertainty = get_clock_uncertainty();
+	uint64_t now_ms = get_clock_ms();
+	beacon[0] = BEACON_MAGIC_1;
+	beacon[1] = BEACON_MAGIC_2;
+	beacon[2] = BEACON_VERSION;
+	for (uint8_t idx = 0; idx < 6; idx++)
+	{
+		beacon[3 + idx] = (uint8_t)(now_ms >> (40 - idx * 8));
+	}
+	beacon[9] = uncertainty > 0xFFFF ? 0xFF : (uint8_t)(uncertainty >> 8);
+	beacon[10] = uncertainty > 0xFFFF ? 0xFF : (uint8_t)(uncertainty);
+	bool sent = send_p2p_packet(beacon, BEACON_SIZE);
+	perf_uplink(PERF_UP_SYNC, sent ? PERF_RES_QUEUED : PERF_RES_ERROR);
+	if (!sent)
+	{
+		MYLOG("TSYNC", "Beacon not sent");
+		return;
+	}
+	MYLOG("TSYNC", "Beacon sent, uncertainty %ld ms", uncertainty);
+}
+
+/**
+ * @brief Send an AppTimeReq
+ *
+ * @return true request was enqueued
+ * @return false request could not be sent
+ */
+static bool send_time_req(void)
+{
+	uint8_t request[6];
+	sync_token = (sync_token + 1) & 0x0F;
+	sync_millis = millis();
+	if (is_clock_valid())
+	{
+		sync_device_time = (uint32_t)(get_clock_ms() / 1000) - GPS_EPOCH_OFFSET + GPS_LEAP_SECONDS;
+	}
+	else
+	{
+		// Time since boot would wrap below the GPS epoch
+		sync_device_time = GPS_DEFAULT_TIME;
+	}
+	sync_tx_delay = uplink_airtime(sizeof(request));
+
+	request[0] = TS003_APP_TIME;
+	request[1] = (uint8_t)(sync_device_time);
+	request[2] = (uint8_t)(sync_device_time >> 8);
+	request[3] = (uint8_t)(sync_device_time >> 16);
+	request[4] = (uint8_t)(sync_device_time >> 24);
+	request[5] = TS003_ANS_REQUIRED | sync_token;
+
+	if (perf_lora_uplink(PERF_UP_SYNC, send_lora_packet(request, sizeof(request), TIME_SYNC_FPORT)) != LMH_SUCCESS)
+	{
+		MYLOG("TSYNC", "Request not sent");
+		return false;
+	}
+	MYLOG("TSYNC", "Request %d sent", sync_token);
+	sync_pending = true;
+	return true;
+}
+
+/**
+ * @brief Handle the TIME_SYNC event
+ *        LoRaWAN: send a request, retry a few times if no answer comes
+ *        P2P: send a beacon
+ *        Nothing is sent while an earthquake is active or sensor data is waiting
+ *
+ */
+void time_sync_handler(void)
+{
+	if (!g_lorawan_settings.lorawan_enable)
+	{
+		if (!earthquake_start)
+		{
+			send_time_beacon();
+		}
+		start_time_sync(TIME_BEACON_INTERVAL);
+		return;
+	}
+
+	if (!g_lpwan_has_joined)
+	{
+		// Restarted after the join
+		return;
+	}
+
+	if (earthquake_start || ((g_task_event_type & (STATUS | SEISMIC_EVENT | SEISMIC_ALERT)) != 0) || dl_ack_pending)
+	{
+		start_time_sync(TIME_SYNC_RETRY_INTERVAL);
+		return;
+	}
+
+	if (sync_retries >= TIME_SYNC_RETRIES)
+	{
+		MYLOG("TSYNC", "No answer from the network");
+		sync_retries = 0;
+		sync_pending = false;
+		start_time_sync(TIME_SYNC_INTERVAL);
+		return;
+	}
+
+	if (send_time_req())
+	{
+		if (sync_retries != 0)
+		{
+			perf_retry();
+		}
+		sync_retries++;
+	}
+	start_time_sync(TIME_SYNC_RETRY_INTERVAL);
+}
+
+/**
+ * @brief Handle a downlink on TIME_SYNC_FPORT
+ *        The correction is relative to the DeviceTime of the request, which the
+ *        network server compared with the time it received the uplink.
+ *        The correction has a resolution of 1 second. Depending on the server it is
+ *        rounded or truncated, the time is somewhere between -0.5 and +1 second of
+ *        DeviceTime + correction.
+ *
+ * @param data received data
+ * @param len length of received data
+ */
+void handle_time_sync_ans(uint8_t *data, uint8_t len)
+{
+	uint8_t offset = 0;
+	while (offset < len)
+	{
+		switch (data[offset])
+		{
+		case TS003_APP_TIME:
+		{
+			if ((offset + 6) > len)
+			{
+				return;
+			}
+			int32_t correction = (int32_t)((uint32_t)data[offset + 1] | ((uint32_t)data[offset + 2] << 8) | ((uint32_t)data[offset + 3] << 16) | ((uint32_t)data[offset + 4] << 24));
+			uint8_t token = data[offset + 5] & 0x0F;
+			offset += 6;
+			if (!sync_pending || (token != sync_token))
+			{
+				MYLOG("TSYNC", "Unexpected answer %d", token);
+				break;
+			}
+			sync_pending = false;
+			sync_retries = 0;
+
+			// Time at the end of the uplink was DeviceTime + correction, the middle of the possible range is used
+			uint64_t server_time_ms = ((uint64_t)sync_device_time + GPS_EPOCH_OFFSET - GPS_LEAP_SECONDS + correction) * 1000 + 250;
+			uint64_t reference_ms = server_time_ms + (millis() - sync_millis - sync_tx_delay);
+			MYLOG("TSYNC", "Correction %ld s, uplink %ld ms", correction, sync_tx_delay);
+			if (clock_sync(reference_ms, TIME_SYNC_UNCERTAINTY + TIME_SYNC_LATENCY, CLOCK_SRC_NETWORK, false))
+			{
+				write_rak12002((get_clock_ms() + 500) / 1000);
+			}
+			start_time_sync(TIME_SYNC_INTERVAL);
+			break;
+		}
+		case TS003_FORCE_RESYNC:
+			// Only the request is repeated, the number of transmissions is ignored
+			offset += 2;
+			MYLOG("TSYNC", "Resync requested");
+			sync_retries = 0;
+			start_time_sync(TIME_SYNC_JOIN_DELAY);
+			break;
+		default:
+			// Unsupported command, the length of the rest is unknown
+			MYLOG("TSYNC", "Unknown command %02X", data[offset]);
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Handle a P2P packet that might be a time beacon
+ *        The beacon has the time when it was sent, the time on air is added
+ *
+ * @param data received data
+ * @param len length of received data
+ * @return true packet was a time beacon
+ * @return false packet was something else
+ */
+bool handle_time_beacon(uint8_t *data, uint8_t len)
+{
+	if ((len != BEACON_SIZE) || (data[0] != BEACON_MAGIC_1) || (data[1] != BEACON_MAGIC_2) || (data[2] != BEACON_VERSION))
+	{
+		return false;
+	}
+	uint64_t beacon_ms = 0;
+	for (uint8_t idx = 0; idx < 6; idx++)
+	{
+		beacon_ms = (beacon_ms << 8) | data[3 + idx];
+	}
+	uint32_t uncertainty = ((uint32_t)data[9] << 8) | data[10];
+	if (uncertainty == 0xFFFF)
+	{
+		return true;
+	}
+	// The handling latency is somewhere between 0 and TIME_BEACON_LATENCY
+	uint64_t reference_ms = beacon_ms + p2p_airtime(BEACON_SIZE) + TIME_BEACON_LATENCY / 2;
+	MYLOG("TSYNC", "Beacon received, uncertainty %ld ms", uncertainty);
+	if (clock_sync(reference_ms, uncertainty + TIME_BEACON_LATENCY / 2, CLOCK_SRC_P2P, false))
+	{
+		write_rak12002((get_clock_ms() + 500) / 1000);
+	}
+	return true;
+}
@@ -0,0 +1,283 @@
+/**
+ * @file usb_stream.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Binary data stream over USB for shake table tests
+ *        Enabled with AT+STREAM=<interval>, works in release builds as well.
+ *        While the stream is on, MYLOG output to USB is suppressed.
+ *        Frame before encoding, little endian:
+ *        <type> <seq> <time ms uint32> <payload> <CRC16 uint16>
+ *        The frame is COBS encoded and starts and ends with 0x00, so text sent between
+ *        the frames, e.g. AT command replies, never merges with a frame.
+ *        STREAM_SNAPSHOT  instant SI uint16, instant PGA uint16, D7S state
+ *        STREAM_IRQ       interrupt 1 or 2, 3 or 4 for the second D7S, ..., pin level
+ *        STREAM_STATE     event code of check_event_rak12027(), TELEM_FLAG_xxx
+ *        STREAM_LOST      number of records lost because the queue was full uint16
+ *        Interrupt and state records are queued and sent with the next snapshot.
+ *        The reader is in tools/usb_stream_reader.cpp
+ * @version 0.1
+ * @date 2023-03-23
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+
+/** Number of queued interrupt and state records, must be a power of 2 */
+#define STREAM_QUEUE_SIZE 32
+
+/** Largest payload of a record */
+#define STREAM_PAYLOAD_MAX 5
+
+/** Frame header type, seq and time */
+#define STREAM_HEADER_SIZE 6
+
+/** Largest frame, header, payload and CRC */
+#define STREAM_FRAME_MAX (STREAM_HEADER_SIZE + STREAM_PAYLOAD_MAX + 2)
+
+/** Largest encoded frame, COBS adds one byte per 254 bytes and the two delimiters */
+#define STREAM_ENCODED_MAX (STREAM_FRAME_MAX + 3)
+
+/** Queued record */
+struct stream_record_s
+{
+	uint32_t time;
+	uint8_t type;
+	uint8_t len;
+	uint8_t payload[STREAM_PAYLOAD_MAX];
+};
+
+/** Queue of interrupt and state records, filled from the interrupts and the seismic task */
+static stream_record_s stream_queue[STREAM_QUEUE_SIZE];
+static volatile uint16_t stream_head = 0;
+static volatile uint16_t stream_tail = 0;
+
+/** Records lost since the last STREAM_LOST record */
+static volatile uint16_t stream_lost = 0;
+
+/** Sequence number of the frames, a gap shows lost frames */
+static uint8_t stream_seq = 0;
+
+/** Snapshot interval in ms, 0 if the stream is off */
+static uint16_t stream_interval = 0;
+
+/** Flag if the stream is on, suppresses MYLOG on USB */
+bool g_usb_stream = false;
+
+/**
+ * @brief CRC16 CCITT, same as the event journal
+ *
+ * @param data data to check
+ * @param len number of bytes
+ * @return uint16_t CRC
+ */
+static uint16_t stream_crc(const uint8_t *data, uint8_t len)
+{
+	uint16_t crc = 0xFFFF;
+	while (len--)
+	{
+		crc ^= (uint16_t)(*data++) << 8;
+		for (uint8_t bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+		}
+	}
+	return crc;
+}
+
+/**
+ * @brief COBS encode a frame and add the 0x00 delimiter
+ *
+ * @param src frame
+ * @param len size of the frame, less than 254 bytes
+ * @param dst encoded frame, at least len + 2 bytes
+ * @return uint8_t size of the encoded frame
+ */
+static uint8_t stream_cobs(const uint8_t *src, uint8_t len, uint8_t *dst)
+{
+	uint8_t code_pos = 0;
+	uint8_t out = 1;
+	uint8_t code = 1;
+	for (uint8_t idx = 0; idx < len; idx++)
+	{
+		if (src[idx] == 0)
+		{
+			dst[code_pos] = code;
+			code_pos = out++;
+			code = 1;
+		}
+		else
+		{
+			dst[out++] = src[idx];
+			code++;
+		}
+	}
+	dst[code_pos] = code;
+	dst[out++] = 0;
+	return out;
+}
+
+/**
+ * @brief Build a frame and send it over USB
+ *
+ * @param type STREAM_xxx
+ * @param time millis() of the record
+ * @param payload record data
+ * @param len size of the record data
+ */
+static void stream_send(uint8_t type, uint32_t time, const uint8_t *payload, uint8_t len)
+{
+	uint8_t frame[STREAM_FRAME_MAX];
+	uint8_t encoded[STREAM_ENCODED_MAX];
+
+	frame[0] = type;
+	frame[1] = stream_seq++;
+	frame[2] = (uint8_t)(time);
+	frame[3] = (uint8_t)(time >> 8);
+	frame[4] = (uint8_t)(time >> 16);
+	frame[5] = (uint8_t)(time >> 24);
+	memcpy(&frame[STREAM_HEADER_SIZE], payload, len);
+	uint8_t frame_len = STREAM_HEADER_SIZE + len;
+	uint16_t crc = stream_crc(frame, frame_len);
+	frame[frame_len++] = (uint8_t)(crc);
+	frame[frame_len++] = (uint8_t)(crc >> 8);
+
+	encoded[0] = 0;
+	Serial.write(encoded, stream_cobs(frame, frame_len, &encoded[1]) + 1);
+}
+
+/**
+ * @brief Add a record to the queue
+ *
+ * @param type STREAM_xxx
+ * @param payload record data
+ * @param len size of the record data
+ */
+static void stream_queue_add(uint8_t type, const uint8_t *payload, uint8_t len)
+{
+	if (((uint16_t)(stream_head - stream_tail)) >= STREAM_QUEUE_SIZE)
+	{
+		stream_lost++;
+		return;
+	}
+	stream_record_s *record = &stream_queue[stream_head & (STREAM_QUEUE_SIZE - 1)];
+	record->time = millis();
+	record->type = type;
+	record->len = len;
+	memcpy(record->payload, payload, len);
+	stream_head++;
+}
+
+/**
+ * @brief Queue an interrupt record
+ *        Called from the D7S interrupt handlers
+ *
+ * @param line 1 for INT1, 2 for INT2
+ * @param level pin level
+ */
+void usb_stream_irq(uint8_t line, uint8_t level)
+{
+	if (!g_usb_stream)
+	{
+		return;
+	}
+	uint8_t payload[2] = {line, level};
+	UBaseType_t saved = taskENTER_CRITICAL_FROM_ISR();
+	stream_queue_add(STREAM_IRQ, payload, 2);
+	taskEXIT_CRITICAL_FROM_ISR(saved);
+}
+
+/**
+ * @brief Queue a state record
+ *        Called from the seismic task after an event was checked
+ *
+ * @param code event code of check_event_rak12027()
+ */
+void usb_stream_state(uint8_t code)
+{
+	if (!g_usb_stream)
+	{
+		return;
+	}
+	uint8_t payload[2];
+	payload[0] = code;
+	payload[1] = (earthquake_start ? TELEM_FLAG_EARTHQUAKE : 0) |
+				 (shutoff_alert ? TELEM_FLAG_SHUTOFF : 0) |
+				 (collapse_alert ? TELEM_FLAG_COLLAPSE : 0) |
+				 (is_clock_valid() ? TELEM_FLAG_CLOCK : 0);
+	taskENTER_CRITICAL();
+	stream_queue_add(STREAM_STATE, payload, 2);
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief Send the queued records and a snapshot of the D7S
+ *        Called from the loop with the USB_STREAM event
+ *
+ */
+void usb_stream_handler(void)
+{
+	if (!g_usb_stream)
+	{
+		return;
+	}
+
+	// The queue is emptied only here, the records are copied out before sending
+	while (stream_tail != stream_head)
+	{
+		stream_record_s record = stream_queue[stream_tail & (STREAM_QUEUE_SIZE - 1)];
+		stream_tail++;
+		stream_send(record.type, record.time, record.payload, record.len);
+	}
+	if (stream_lost != 0)
+	{
+		taskENTER_CRITICAL();
+		uint8_t payload[2] = {(uint8_t)(stream_lost), (uint8_t)(stream_lost >> 8)};
+		stream_lost = 0;
+		taskEXIT_CRITICAL();
+		stream_send(STREAM_LOST, millis(), payload, 2);
+	}
+
+	float si = 0.0f;
+	float pga = 0.0f;
+	instant_rak12027(&si, &pga);
+	uint32_t time = millis();
+	uint16_t si_milli = (uint16_t)(si * 1000.0f + 0.5f);
+	uint16_t pga_milli = (uint16_t)(pga * 1000.0f + 0.5f);
+	uint8_t payload[5] = {(uint8_t)(si_milli), (uint8_t)(si_milli >> 8), (uint8_t)(pga_milli), (uint8_t)(pga_milli >> 8), state_rak12027()};
+	stream_send(STREAM_SNAPSHOT, time, payload, 5);
+}
+
+/**
+ * @brief Start or stop the stream
+ *
+ * @param interval_ms snapshot interval, 0 to stop
+ */
+void usb_stream_start(uint16_t interval_ms)
+{
+	stream_interval = interval_ms;
+	if (interval_ms == 0)
+	{
+		sched_stop(SCHED_USB_STREAM);
+		g_usb_stream = false;
+		return;
+	}
+	if (!g_usb_stream)
+	{
+		stream_head = 0;
+		stream_tail = 0;
+		stream_lost = 0;
+		stream_seq = 0;
+	}
+	g_usb_stream = true;
+	sched_start(SCHED_USB_STREAM, interval_ms, interval_ms, 0);
+}
+
+/**
+ * @brief Get the snapshot interval
+ *
+ * @return uint16_t interval in ms, 0 if the stream is off
+ */
+uint16_t usb_stream_interval(void)
+{
+	return stream_interval;
+}
@@ -9,106 +9,198 @@
  *
  */
 #include "app.h"
+#include "epoch_clock.h"
 #include <Adafruit_LittleFS.h>
 #include <InternalFileSystem.h>
 using namespace Adafruit_LittleFS_Namespace;
 
-/** Filename to save Seismic Sensor threshold setting */
+/** Filename of the old Seismic Sensor threshold setting, only used to migrate to the settings file */
 static const char sensitivy_name[] = "SEISM";
 
-/** File to save Seismic Sensor threshold setting */
-File sensitivy_sett(InternalFS);
+/** Filename to save the application settings */
+static const char app_settings_name[] = "APPSET";
 
-/** Flag for threshold level, default high threshold */
-uint8_t threshold_level = 0;
+/** File to save the application settings */
+File app_settings_file(InternalFS);
+
+/** Application settings, default high threshold, full payload, capture off */
+app_settings_s g_app_settings;
 
 /*****************************************
- * RTC AT commands
+ * AT command parameter parsing
+ * Single pass over the parameter string, the string is not changed
  *****************************************/
 
 /**
- * @brief Set RTC time
+ * @brief Parse the next parameter as unsigned number, decimal or 0x hex
+ *        The parameter ends with ':' or the end of the string, the separator is skipped
  *
- * @param str time as string, format <year>:<month>:<date>:<hour>:<minute>
- * @return int 0 if successful, otherwise error value
+ * @param pos position in the parameter string, moved to the next parameter
+ * @param min lowest valid value
+ * @param max highest valid value
+ * @param value parsed value
+ * @return int 0 if successful, AT_ERRNO_PARA_NUM if missing, AT_ERRNO_PARA_VAL if invalid
  */
-int at_set_rtc(char *str)
+static int at_param_uint(const char **pos, uint32_t min, uint32_t max, uint32_t *value)
 {
-	uint16_t year;
-	uint8_t month;
-	uint8_t date;
-	uint8_t hour;
-	uint8_t minute;
-
-	char *param;
-
-	param = strtok(str, ":");
+	const char *next = *pos;
+	if ((next == NULL) || (*next == 0) || (*next == ':'))
+	{
+		return AT_ERRNO_PARA_NUM;
+	}
+	uint8_t base = 10;
+	if ((next[0] == '0') && ((next[1] == 'x') || (next[1] == 'X')))
+	{
+		base = 16;
+		next += 2;
+	}
+	uint32_t result = 0;
+	uint8_t digits = 0;
+	for (; (*next != 0) && (*next != ':'); next++, digits++)
+	{
+		uint8_t digit;
+		if ((*next >= '0') && (*next <= '9'))
+		{
+			digit = *next - '0';
+		}
+		else if ((base == 16) && ((*next | 0x20) >= 'a') && ((*next | 0x20) <= 'f'))
+		{
+			digit = (*next | 0x20) - 'a' + 10;
+		}
+		else
+		{
+			return AT_ERRNO_PARA_VAL;
+		}
+		// Overflow check
+		if (result > (0xFFFFFFFFUL - digit) / base)
+		{
+			return AT_ERRNO_PARA_VAL;
+		}
+		result = result * base + digit;
+	}
+	if ((digits == 0) || (result < min) || (result > max))
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	*value = result;
+	*pos = (*next == ':') ? next + 1 : next;
+	return 0;
+}
 
-	// year:month:date:hour:minute
+/**
+ * @brief Check that all parameters were used
+ *
+ * @param pos position in the parameter string
+ * @return int 0 if at the end, AT_ERRNO_PARA_NUM if there are more parameters
+ */
+static int at_param_end(const char *pos)
+{
+	return ((pos == NULL) || (*pos == 0)) ? 0 : AT_ERRNO_PARA_NUM;
+}
 
-	if (param != NULL)
+/**
+ * @brief Parse a parameter string with only one number
+ *
+ * @param str parameter string
+ * @param min lowest valid value
+ * @param max highest valid value
+ * @param value parsed value
+ * @return int 0 if successful, otherwise error value
+ */
+static int at_param_single(const char *str, uint32_t min, uint32_t max, uint32_t *value)
+{
+	int result = at_param_uint(&str, min, max, value);
+	if (result != 0)
 	{
-		/* Check year */
-		year = strtoul(param, NULL, 0);
+		return result;
+	}
+	return at_param_end(str);
+}
 
-		if (year > 3000)
+/**
+ * @brief Parse the next parameter as hex bytes without 0x, e.g. a key
+ *        The parameter ends with ':' or the end of the string, the separator is skipped
+ *
+ * @param pos position in the parameter string, moved to the next parameter
+ * @param buffer parsed bytes, MSB first
+ * @param len number of bytes, the parameter must have 2 * len digits
+ * @return int 0 if successful, AT_ERRNO_PARA_NUM if missing, AT_ERRNO_PARA_VAL if invalid
+ */
+static int at_param_hex(const char **pos, uint8_t *buffer, uint8_t len)
+{
+	const char *next = *pos;
+	if ((next == NULL) || (*next == 0) || (*next == ':'))
+	{
+		return AT_ERRNO_PARA_NUM;
+	}
+	uint8_t digits = 0;
+	for (; (*next != 0) && (*next != ':'); next++, digits++)
+	{
+		uint8_t digit;
+		if ((*next >= '0') && (*next <= '9'))
+		{
+			digit = *next - '0';
+		}
+		else if (((*next | 0x20) >= 'a') && ((*next | 0x20) <= 'f'))
+		{
+			digit = (*next | 0x20) - 'a' + 10;
+		}
+		else
 		{
 			return AT_ERRNO_PARA_VAL;
 		}
-
-		/* Check month */
-		param = strtok(NULL, ":");
-		if (param != NULL)
+		if (digits >= len * 2)
 		{
-			month = strtoul(param, NULL, 0);
-
-			if ((month < 1) || (month > 12))
-			{
-				return AT_ERRNO_PARA_VAL;
-			}
-
-			// Check day
-			param = strtok(NULL, ":");
-			if (param != NULL)
-			{
-				date = strtoul(param, NULL, 0);
-
-				if ((date < 1) || (date > 31))
-				{
-					return AT_ERRNO_PARA_VAL;
-				}
-
-				// Check hour
-				param = strtok(NULL, ":");
-				if (param != NULL)
-				{
-					hour = strtoul(param, NULL, 0);
-
-					if (hour > 24)
-					{
-						return AT_ERRNO_PARA_VAL;
-					}
-
-					// Check minute
-					param = strtok(NULL, ":");
-					if (param != NULL)
-					{
-						minute = strtoul(param, NULL, 0);
-
-						if (minute > 59)
-						{
-							return AT_ERRNO_PARA_VAL;
-						}
-
-						set_rak12002(year, month, date, hour, minute);
-
-						return 0;
-					}
-				}
-			}
+			return AT_ERRNO_PARA_VAL;
 		}
+		buffer[digits / 2] = (digits & 1) ? (buffer[digits / 2] << 4) | digit : digit;
+	}
+	if (digits != len * 2)
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	*pos = (*next == ':') ? next + 1 : next;
+	return 0;
+}
+
+/*****************************************
+ * RTC AT commands
+ *****************************************/
+
+/**
+ * @brief Set RTC time
+ *
+ * @param str time as string, format <year>:<month>:<date>:<hour>:<minute>
+ * @return int 0 if successful, otherwise error value
+ */
+int at_set_rtc(char *str)
+{
+	// year:month:date:hour:minute
+	const char *pos = str;
+	uint32_t year;
+	uint32_t month;
+	uint32_t date;
+	uint32_t hour;
+	uint32_t minute;
+	int result;
+
+	// The RTC stores a 2 digit year
+	if (((result = at_param_uint(&pos, 2000, 2099, &year)) != 0) ||
+		((result = at_param_uint(&pos, 1, 12, &month)) != 0) ||
+		((result = at_param_uint(&pos, 1, 31, &date)) != 0) ||
+		((result = at_param_uint(&pos, 0, 23, &hour)) != 0) ||
+		((result = at_param_uint(&pos, 0, 59, &minute)) != 0) ||
+		((result = at_param_end(pos)) != 0))
+	{
+		return result;
+	}
+	if (date > clock_days_in_month(year, month))
+	{
+		return AT_ERRNO_PARA_VAL;
 	}
-	return AT_ERRNO_PARA_NUM;
+
+	set_rak12002(year, month, date, hour, minute);
+	return 0;
 }
 
 /**
@@ -124,12 +216,6 @@ int at_query_rtc(void)
 	return 0;
 }
 
-atcmd_t g_user_at_cmd_list_rtc[] = {
-	/*|    CMD    |     AT+CMD?      |    AT+CMD=?    |  AT+CMD=value |  AT+CMD  | AT permission*/
-	// RTC commands
-	{"+RTC", "Get/Set RTC time and date", at_query_rtc, at_set_rtc, at_query_rtc, "RW"},
-};
-
 /*****************************************
  * Seismic Sensor threshold setting AT commands
  *****************************************/
@@ -142,23 +228,15 @@ atcmd_t g_user_at_cmd_list_rtc[] = {
  */
 int at_set_threshold(char *str)
 {
-	long threshold_request = strtol(str, NULL, 0);
-	if (threshold_request == 1)
-	{
-		threshold_level = 1;
-		save_threshold_settings(threshold_level);
-		threshold_rak12027(threshold_level);
-	}
-	else if (threshold_request == 0)
+	uint32_t threshold_request;
+	int result = at_param_single(str, 0, 1, &threshold_request);
+	if (result != 0)
 	{
-		threshold_level = 0;
-		save_threshold_settings(threshold_level);
-		threshold_rak12027(threshold_level);
-	}
-	else
-	{
-		return AT_ERRNO_PARA_VAL;
+		return result;
 	}
+	g_app_settings.threshold = threshold_request;
+	save_app_settings();
+	threshold_rak12027(g_app_settings.threshold);
 	return 0;
 }
 
@@ -170,97 +248,556 @@ int at_set_threshold(char *str)
 int at_query_threshold(void)
 {
 	// Wet calibration value query
-	AT_PRINTF("threshold is %s", threshold_level == 1 ? "low" : "high");
+	AT_PRINTF("threshold is %s", g_app_settings.threshold == 1 ? "low" : "high");
 	return 0;
 }
 
 /**
- * @brief Read saved setting for precision and packet format
+ * @brief Read saved application settings
+ *        If no settings are found, the threshold is taken
+ *        from the old threshold file and the settings are saved
  *
  */
-void read_threshold_settings(void)
+void read_app_settings(void)
 {
+	app_settings_s read_settings;
+	if (app_settings_file.open(app_settings_name, FILE_O_READ))
+	{
+		int read_len = app_settings_file.read(&read_settings, sizeof(app_settings_s));
+		app_settings_file.close();
+		// Settings saved by an older version are shorter, the new values keep their defaults
+		if ((read_len > 0) && (read_settings.valid_mark == APP_SETTINGS_MARK))
+		{
+			memcpy(&g_app_settings, &read_settings, sizeof(app_settings_s));
+			MYLOG("USR_AT", "Settings found, threshold %s", g_app_settings.threshold == 1 ? "low" : "high");
+			return;
+		}
+	}
+
+	g_app_settings = app_settings_s();
 	if (InternalFS.exists(sensitivy_name))
 	{
-		threshold_level = 1;
-		MYLOG("USR_AT", "File found, threshold set low");
+		g_app_settings.threshold = 1;
+		InternalFS.remove(sensitivy_name);
+		MYLOG("USR_AT", "Old threshold file found, threshold set low");
 	}
 	else
 	{
-		threshold_level = 0;
-		MYLOG("USR_AT", "File not found, threshold set high");
+		MYLOG("USR_AT", "No settings found, using defaults");
 	}
-	save_threshold_settings(threshold_level);
+	save_app_settings();
 }
 
 /**
- * @brief Save the GPS settings
+ * @brief Save the application settings
  *
  */
-void save_threshold_settings(uint8_t sens_level)
+void save_app_settings(void)
 {
-	if (threshold_level == 1)
+	InternalFS.remove(app_settings_name);
+	if (!app_settings_file.open(app_settings_name, FILE_O_WRITE))
 	{
-		sensitivy_sett.open(sensitivy_name, FILE_O_WRITE);
-		sensitivy_sett.write("1");
-		sensitivy_sett.close();
-		MYLOG("USR_AT", "Created File for threshold set low");
+		MYLOG("USR_AT", "Could not save settings");
+		return;
 	}
-	else
+	app_settings_file.write((uint8_t *)&g_app_settings, sizeof(app_settings_s));
+	app_settings_file.close();
+	MYLOG("USR_AT", "Saved settings");
+}
+
+/*****************************************
+ * Event journal AT commands
+ *****************************************/
+
+/**
+ * @brief Print the records of the event journal in a time range
+ *
+ * @param from start of the time range
+ * @param to end of the time range, 0 to 0xFFFFFFFF prints all records
+ */
+static void print_evlog(uint32_t from, uint32_t to)
+{
+	event_record_s record;
+	for (uint16_t pos = 0; pos < event_log_count(); pos++)
 	{
-		InternalFS.remove(sensitivy_name);
-		MYLOG("USR_AT", "Remove File for threshold set high");
+		if (event_log_in_range(pos, from, to) && event_log_get(pos, &record))
+		{
+			AT_PRINTF("%ld:%ld.%03d:%d:%d:%.3f:%.3f:%s%s:%d\n", record.seq, record.timestamp, record.time_ms, record.time_uncertainty, record.duration,
+					  record.peak_si / 1000.0, record.peak_pga / 1000.0,
+					  (record.flags & EVLOG_FLAG_SHUTOFF) ? "S" : "-",
+					  (record.flags & EVLOG_FLAG_COLLAPSE) ? "C" : "-",
+					  record.d7s_state);
+		}
 	}
 }
 
-atcmd_t g_user_at_cmd_list_threshold[] = {
-	/*|    CMD    |     AT+CMD?      |    AT+CMD=?    |  AT+CMD=value |  AT+CMD  | AT permission */
-	// Seismic threshold commands
-	{"+SENS", "Set Seismic threshold 1 = low, 0 = high", at_query_threshold, at_set_threshold, at_query_threshold, "RW"},
-};
+/**
+ * @brief List records of the event journal in a time range
+ *
+ * @param str time range as string, format <from>:<to> in seconds
+ * @return int 0 if successful, otherwise error value
+ */
+int at_exec_evlog(char *str)
+{
+	const char *pos = str;
+	uint32_t from;
+	uint32_t to;
+	int result;
+
+	if (((result = at_param_uint(&pos, 0, 0xFFFFFFFF, &from)) != 0) ||
+		((result = at_param_uint(&pos, from, 0xFFFFFFFF, &to)) != 0) ||
+		((result = at_param_end(pos)) != 0))
+	{
+		return result;
+	}
 
-/** Number of user defined AT commands */
-uint8_t g_user_at_cmd_num = 0;
+	uint16_t first;
+	uint16_t num = event_log_find(from, to, &first);
+	AT_PRINTF("%d events\n", num);
+	print_evlog(from, to);
+	return 0;
+}
 
-/** Pointer to the combined user AT command structure */
-atcmd_t *g_user_at_cmd_list;
+/**
+ * @brief List all records of the event journal
+ *
+ * @return int 0
+ */
+int at_list_evlog(void)
+{
+	AT_PRINTF("%d events\n", event_log_count());
+	print_evlog(0, 0xFFFFFFFF);
+	return 0;
+}
 
 /**
- * @brief Initialize the user defined AT command list
+ * @brief Get number of records in the event journal
  *
+ * @return int 0
  */
-void init_user_at(void)
+int at_query_evlog(void)
 {
-	uint16_t index_next_cmds = 0;
-	uint16_t required_structure_size = 0;
+	AT_PRINTF("%d of %d events", event_log_count(), EVENT_LOG_SLOTS);
+	return 0;
+}
 
-	// Get required size of structure
-	required_structure_size += sizeof(g_user_at_cmd_list_threshold);
+/*****************************************
+ * I2C bus statistics AT commands
+ *****************************************/
 
-	MYLOG("USR_AT", "Structure size %d threshold", required_structure_size);
+/**
+ * @brief Print the I2C bus statistics per device
+ *
+ * @return int 0
+ */
+int at_query_i2c(void)
+{
+	i2c_print_stats();
+	return 0;
+}
 
-	if (has_rak12002)
+/**
+ * @brief Reset the I2C bus statistics
+ *
+ * @param str 0 to reset
+ * @return int 0 if successful, otherwise error value
+ */
+int at_exec_i2c(char *str)
+{
+	uint32_t reset;
+	int result = at_param_single(str, 0, 0, &reset);
+	if (result != 0)
 	{
-		required_structure_size += sizeof(g_user_at_cmd_list_rtc);
+		return result;
+	}
+	i2c_reset_stats();
+	return 0;
+}
+
+/*****************************************
+ * Wakeup scheduler AT commands
+ *****************************************/
+
+/**
+ * @brief Print the wakeup scheduler statistics and active jobs
+ *
+ * @return int 0
+ */
+int at_query_sched(void)
+{
+	sched_print_stats();
+	return 0;
+}
 
-		MYLOG("USR_AT", "Structure size %d RTC", required_structure_size);
+/**
+ * @brief Reset the wakeup scheduler statistics
+ *
+ * @param str 0 to reset
+ * @return int 0 if successful, otherwise error value
+ */
+int at_exec_sched(char *str)
+{
+	uint32_t reset;
+	int result = at_param_single(str, 0, 0, &reset);
+	if (result != 0)
+	{
+		return result;
 	}
-	// Reserve memory for the structure
-	g_user_at_cmd_list = (atcmd_t *)malloc(required_structure_size);
+	sched_reset_stats();
+	return 0;
+}
 
-	// Add AT commands to structure
-	MYLOG("USR_AT", "Adding threshold AT commands");
-	g_user_at_cmd_num += sizeof(g_user_at_cmd_list_threshold) / sizeof(atcmd_t);
-	memcpy((void *)&g_user_at_cmd_list[index_next_cmds], (void *)g_user_at_cmd_list_threshold, sizeof(g_user_at_cmd_list_threshold));
-	index_next_cmds += sizeof(g_user_at_cmd_list_threshold) / sizeof(atcmd_t);
-	MYLOG("USR_AT", "Index after adding threshold check %d", index_next_cmds);
+/*****************************************
+ * Battery profile AT commands
+ *****************************************/
 
-	if (has_rak12002)
+/**
+ * @brief Print the battery profile, filtered voltage and heartbeat
+ *
+ * @return int 0
+ */
+int at_query_profile(void)
+{
+	print_batt_profile();
+	return 0;
+}
+
+/*****************************************
+ * BLE telemetry AT commands
+ *****************************************/
+
+/**
+ * @brief Print the BLE telemetry notification interval and state
+ *
+ * @return int 0
+ */
+int at_query_telem(void)
+{
+	print_ble_telemetry();
+	return 0;
+}
+
+/**
+ * @brief Set the BLE telemetry notification interval
+ *
+ * @param str interval in ms, 100 to 25500 in steps of 100, 0 for the default
+ * @return int 0 if successful, otherwise error value
+ */
+int at_set_telem(char *str)
+{
+	uint32_t interval;
+	int result = at_param_single(str, 0, 25500, &interval);
+	if (result != 0)
+	{
+		return result;
+	}
+	if ((interval % 100) != 0)
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	g_app_settings.telemetry_rate = interval / 100;
+	save_app_settings();
+	ble_telemetry_interval_changed();
+	return 0;
+}
+
+/*****************************************
+ * USB stream AT commands
+ *****************************************/
+
+/**
+ * @brief Print the USB stream snapshot interval
+ *
+ * @return int 0
+ */
+int at_query_stream(void)
+{
+	AT_PRINTF("%d", usb_stream_interval());
+	return 0;
+}
+
+/**
+ * @brief Start or stop the USB stream
+ *
+ * @param str snapshot interval in ms, 10 to 60000, 0 to stop
+ * @return int 0 if successful, otherwise error value
+ */
+int at_set_stream(char *str)
+{
+	uint32_t interval;
+	int result = at_param_single(str, 0, 60000, &interval);
+	if (result != 0)
+	{
+		return result;
+	}
+	if ((interval != 0) && (interval < STREAM_INTERVAL_MIN))
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	usb_stream_start(interval);
+	return 0;
+}
+
+/*****************************************
+ * D7S array AT commands
+ *****************************************/
+
+/**
+ * @brief Print the voting settings and the state of each D7S
+ *
+ * @return int 0
+ */
+int at_query_d7s(void)
+{
+	print_d7s_array();
+	return 0;
+}
+
+/**
+ * @brief Set the voting of the D7S array
+ *
+ * @param str <votes>:<window>, votes 0 = majority, window in ms 100 to 25500, 0 = default
+ * @return int 0 if successful, otherwise error value
+ */
+int at_set_d7s(char *str)
+{
+	uint32_t votes;
+	uint32_t window;
+	const char *pos = str;
+	int result;
+	if (((result = at_param_uint(&pos, 0, D7S_MAX_SENSORS, &votes)) != 0) ||
+		((result = at_param_uint(&pos, 0, 25500, &window)) != 0) ||
+		((result = at_param_end(pos)) != 0))
+	{
+		return result;
+	}
+	if ((window % 100) != 0)
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	g_app_settings.vote_k = votes;
+	g_app_settings.vote_window = window / 100;
+	save_app_settings();
+	return 0;
+}
+
+/*****************************************
+ * Shutoff output AT commands
+ *****************************************/
+
+/**
+ * @brief Print the shutoff output settings and statistics
+ *
+ * @return int 0
+ */
+int at_query_shutoff(void)
+{
+	print_shutoff();
+	return 0;
+}
+
+/**
+ * @brief Set the shutoff output mode, a latched output is switched off
+ *
+ * @param str <mode>:<time>, mode 0 = off, 1 = latch, 2 = pulse, 3 = auto reset, time in s, 0 = default
+ * @return int 0 if successful, otherwise error value
+ */
+int at_set_shutoff(char *str)
+{
+	uint32_t mode;
+	uint32_t time;
+	const char *pos = str;
+	int result;
+	if (((result = at_param_uint(&pos, SHUTOFF_OFF, SHUTOFF_AUTO, &mode)) != 0) ||
+		((result = at_param_uint(&pos, 0, 255, &time)) != 0) ||
+		((result = at_param_end(pos)) != 0))
 	{
-		MYLOG("USR_AT", "Adding RTC user AT commands");
-		g_user_at_cmd_num += sizeof(g_user_at_cmd_list_rtc) / sizeof(atcmd_t);
-		memcpy((void *)&g_user_at_cmd_list[index_next_cmds], (void *)g_user_at_cmd_list_rtc, sizeof(g_user_at_cmd_list_rtc));
-		index_next_cmds += sizeof(g_user_at_cmd_list_rtc) / sizeof(atcmd_t);
-		MYLOG("USR_AT", "Index after adding RTC %d", index_next_cmds);
+		return result;
 	}
+	shutoff_release();
+	g_app_settings.shutoff_mode = mode;
+	g_app_settings.shutoff_time = time;
+	save_app_settings();
+	return 0;
+}
+
+/*****************************************
+ * P2P alert flooding AT commands
+ *****************************************/
+
+/**
+ * @brief Print the P2P alert flooding settings and statistics
+ *
+ * @return int 0
+ */
+int at_query_mesh(void)
+{
+	print_mesh();
+	return 0;
+}
+
+/**
+ * @brief Set the hops of own P2P alerts
+ *
+ * @param str TTL 1 to 15, 0 = alerts are not sent or relayed
+ * @return int 0 if successful, otherwise error value
+ */
+int at_set_mesh(char *str)
+{
+	uint32_t ttl;
+	int result = at_param_single(str, 0, 15, &ttl);
+	if (result != 0)
+	{
+		return result;
+	}
+	g_app_settings.mesh_ttl = ttl;
+	save_app_settings();
+	return 0;
+}
+
+/*****************************************
+ * Early warning AT commands
+ *****************************************/
+
+/**
+ * @brief Print the multicast session and the early warning statistics
+ *
+ * @return int 0
+ */
+int at_query_mcast(void)
+{
+	print_early_warning();
+	return 0;
+}
+
+/**
+ * @brief Set the multicast session of the early warnings
+ *        The session is linked again right away if the device has joined
+ *
+ * @param str <address>:<network session key>:<application session key> in hex, 0 = off
+ * @return int 0 if successful, otherwise error value
+ */
+int at_set_mcast(char *str)
+{
+	uint8_t addr[4];
+	uint8_t nwk_skey[16];
+	uint8_t app_skey[16];
+	const char *pos = str;
+	int result;
+
+	if ((str[0] == '0') && (str[1] == 0))
+	{
+		g_app_settings.mc_dev_addr = 0;
+		memset(g_app_settings.mc_nwk_skey, 0, 16);
+		memset(g_app_settings.mc_app_skey, 0, 16);
+	}
+	else
+	{
+		if (((result = at_param_hex(&pos, addr, 4)) != 0) ||
+			((result = at_param_hex(&pos, nwk_skey, 16)) != 0) ||
+			((result = at_param_hex(&pos, app_skey, 16)) != 0) ||
+			((result = at_param_end(pos)) != 0))
+		{
+			return result;
+		}
+		g_app_settings.mc_dev_addr = ((uint32_t)addr[0] << 24) | ((uint32_t)addr[1] << 16) | ((uint32_t)addr[2] << 8) | addr[3];
+		if (g_app_settings.mc_dev_addr == 0)
+		{
+			return AT_ERRNO_PARA_VAL;
+		}
+		memcpy(g_app_settings.mc_nwk_skey, nwk_skey, 16);
+		memcpy(g_app_settings.mc_app_skey, app_skey, 16);
+	}
+	save_app_settings();
+	init_early_warning();
+	return 0;
+}
+
+/*****************************************
+ * Performance counter AT commands
+ *****************************************/
+
+/**
+ * @brief Print the performance counters
+ *
+ * @return int 0
+ */
+int at_query_perf(void)
+{
+	perf_print();
+	return 0;
+}
+
+/**
+ * @brief Reset the performance counters
+ *
+ * @param str 0 to reset
+ * @return int 0 if successful, otherwise error value
+ */
+int at_exec_perf(char *str)
+{
+	uint32_t reset;
+	int result = at_param_single(str, 0, 0, &reset);
+	if (result != 0)
+	{
+		return result;
+	}
+	perf_reset();
+	return 0;
+}
+
+/*****************************************
+ * AT command table
+ *****************************************/
+
+/** All user AT commands, fixed at compile time, the RTC commands must be the last entry */
+atcmd_t g_user_at_cmd_list_all[] = {
+	/*|    CMD    |     AT+CMD?      |    AT+CMD=?    |  AT+CMD=value |  AT+CMD  | AT permission */
+	// Seismic threshold commands
+	{"+SENS", "Set Seismic threshold 1 = low, 0 = high", at_query_threshold, at_set_threshold, at_query_threshold, "RW"},
+	// Event journal commands
+	{"+EVLOG", "List event journal, <from>:<to> time range in seconds", at_query_evlog, at_exec_evlog, at_list_evlog, "RW"},
+	// I2C bus statistics commands
+	{"+I2C", "I2C bus statistics <device>:<transfers>:<bytes>:<bus us>:<CPU us>:<clock switches>:<errors>, 0 to reset", at_query_i2c, at_exec_i2c, at_query_i2c, "RW"},
+	// Wakeup scheduler commands
+	{"+SCHED", "Wakeup scheduler SCHED:<timer wakeups>:<jobs run>, JOB<n>:<due in ms>:<period>:<tolerance>, 0 to reset", at_query_sched, at_exec_sched, at_query_sched, "RW"},
+	// Battery profile commands
+	{"+PROFILE", "Battery profile <profile>:<battery mV>:<heartbeat s>", at_query_profile, NULL, at_query_profile, "R"},
+	// BLE telemetry commands
+	{"+TELEM", "BLE telemetry interval in ms <interval>:<state>, 100 to 25500, 0 = default", at_query_telem, at_set_telem, at_query_telem, "RW"},
+	// USB stream commands
+	{"+STREAM", "Binary USB stream, snapshot interval in ms, 10 to 60000, 0 = off", at_query_stream, at_set_stream, at_query_stream, "RW"},
+	// D7S array commands
+	{"+D7S", "D7S array <sensors>:<votes>:<window ms>, set <votes>:<window ms>, 0 = majority / default", at_query_d7s, at_set_d7s, at_query_d7s, "RW"},
+	// Shutoff output commands
+	{"+SHUTOFF", "Shutoff output <mode>:<time s>:<pin ok>:<on>:<count>:<last us>:<max us>:<max confirm us>:<rejected>, set <mode>:<time s>, also releases the output", at_query_shutoff, at_set_shutoff, at_query_shutoff, "RW"},
+	// P2P alert flooding commands
+	{"+MESH", "P2P alerts <TTL>:<sent>:<received>:<duplicates>:<relayed>:<suppressed>:<airtime ms>, set <TTL>, 0 = off", at_query_mesh, at_set_mesh, at_query_mesh, "RW"},
+	// Early warning commands
+	{"+MCAST", "Early warning multicast <address>:<linked>:<class C>:<armed>:<received>:<invalid>:<last origin>:<last SI>:<last ETA s>, set <address>:<NwkSKey>:<AppSKey> in hex, 0 = off", at_query_mcast, at_set_mcast, at_query_mcast, "RW"},
+	// Performance counter commands
+	{"+PERF", "Performance counters, kept over resets, 0 to reset", at_query_perf, at_exec_perf, at_query_perf, "RW"},
+	// RTC commands
+	{"+RTC", "Get/Set RTC time and date", at_query_rtc, at_set_rtc, at_query_rtc, "RW"},
+};
+
+/** Number of user AT commands without the RTC commands */
+#define USER_AT_CMD_NUM_NO_RTC (sizeof(g_user_at_cmd_list_all) / sizeof(atcmd_t) - 1)
+static_assert(sizeof(g_user_at_cmd_list_all) / sizeof(atcmd_t) <= 255, "Too many user AT commands");
+
+/** Number of user defined AT commands */
+uint8_t g_user_at_cmd_num = 0;
+
+/** Pointer to the user AT command table */
+atcmd_t *g_user_at_cmd_list = g_user_at_cmd_list_all;
+
+/**
+ * @brief Initialize the user defined AT command list
+ *
+ */
+void init_user_at(void)
+{
+	// The RTC commands are only available if the RTC was found
+	g_user_at_cmd_num = has_rak12002 ? USER_AT_CMD_NUM_NO_RTC + 1 : USER_AT_CMD_NUM_NO_RTC;
+	MYLOG("USR_AT", "%d user AT commands", g_user_at_cmd_num);
 }
@@ -23,6 +23,70 @@ union latLong_s
 	int8_t val8[4];
 };
 
+/**
+ * @brief Create the packet buffer with a reserved header in front of the payload
+ *        The add functions write behind the header, a P2P packet is sent from the
+ *        same buffer without copying the payload
+ *
+ * @param size largest payload size
+ */
+WisCayenne::WisCayenne(uint8_t size) : CayenneLPP(size)
+{
+	uint8_t *frame = (uint8_t *)malloc(size + WIS_HEADER_SIZE);
+	if (frame != NULL)
+	{
+		free(_buffer);
+		_frame = frame;
+		_buffer = &_frame[WIS_HEADER_SIZE];
+	}
+}
+
+/**
+ * @brief Give the start of the allocated buffer back to CayenneLPP, it frees it
+ *
+ */
+WisCayenne::~WisCayenne()
+{
+	if (_frame != NULL)
+	{
+		_buffer = _frame;
+	}
+}
+
+/**
+ * @brief Get the packet with a header in front of the payload
+ *        If the buffer with the reserved header could not be allocated, the payload is moved
+ *        behind the header inside the buffer of CayenneLPP. The packet must be reset after it is sent.
+ *
+ * @param header WIS_HEADER_SIZE bytes, e.g. the DevEUI
+ * @return uint8_t* start of the header, NULL if the payload and the header do not fit
+ */
+uint8_t *WisCayenne::getFrame(const uint8_t *header)
+{
+	if (_frame == NULL)
+	{
+		if ((_buffer == NULL) || (getFrameSize() > _maxsize))
+		{
+			return NULL;
+		}
+		memmove(&_buffer[WIS_HEADER_SIZE], _buffer, _cursor);
+		memcpy(_buffer, header, WIS_HEADER_SIZE);
+		return _buffer;
+	}
+	memcpy(_frame, header, WIS_HEADER_SIZE);
+	return _frame;
+}
+
+/**
+ * @brief Get the size of the packet with the header
+ *
+ * @return uint16_t header and payload size
+ */
+uint16_t WisCayenne::getFrameSize(void)
+{
+	return getSize() + WIS_HEADER_SIZE;
+}
+
 /**
  * @brief Add GNSS data in Cayenne LPP standard format
  *
@@ -26,10 +26,14 @@
 #define LPP_GPST_SIZE 10
 #define LPP_VOC_SIZE 2
 
+// Space in front of the payload for the DevEUI of P2P packets
+#define WIS_HEADER_SIZE 8
+
 class WisCayenne : public CayenneLPP
 {
 public:
-	WisCayenne(uint8_t size) : CayenneLPP(size) {}
+	WisCayenne(uint8_t size);
+	~WisCayenne();
 
 	uint8_t addGNSS_4(uint8_t channel, int32_t latitude, int32_t longitude, int32_t altitude);
 	uint8_t addGNSS_6(uint8_t channel, int32_t latitude, int32_t longitude, int32_t altitude);
@@ -37,6 +41,10 @@ public:
 	uint8_t addGNSS_T(int32_t latitude, int32_t longitude, int16_t altitude, float accuracy, int8_t sats);
 	uint8_t addVoc_index(uint8_t channel, uint32_t voc_index);
 
-private:
+	uint8_t *getFrame(const uint8_t *header);
+	uint16_t getFrameSize(void);
+
+protected:
+	uint8_t *_frame = NULL;
 };
 #endif
\ No newline at end of file
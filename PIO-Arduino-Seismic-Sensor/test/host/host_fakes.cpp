@@ -0,0 +1,1078 @@
+/**
+ * @file host_fakes.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Simulated hardware and libraries for the host tests
+ *        All functions are weak, a test can replace them with its own version.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "host_fakes.h"
+#include <WisBlock-API-V2.h>
+#include <Wire.h>
+#include <CayenneLPP.h>
+#include <SparkFun_SHTC3.h>
+#include <InternalFileSystem.h>
+#include <map>
+#include <stdarg.h>
+
+#define HOST_WEAK __attribute__((weak))
+
+using namespace Adafruit_LittleFS_Namespace;
+
+/*****************************************
+ * Time
+ *****************************************/
+
+uint64_t host_us = 0;
+
+void host_set_ms(uint32_t ms)
+{
+	host_us = (uint64_t)ms * 1000;
+}
+
+void host_advance_ms(uint32_t ms)
+{
+	host_us += (uint64_t)ms * 1000;
+}
+
+void host_advance_us(uint64_t us)
+{
+	host_us += us;
+}
+
+HOST_WEAK unsigned long millis(void)
+{
+	return (uint32_t)(host_us / 1000);
+}
+
+HOST_WEAK unsigned long micros(void)
+{
+	return (uint32_t)host_us;
+}
+
+HOST_WEAK void delay(unsigned long ms)
+{
+	host_advance_ms(ms);
+}
+
+HOST_WEAK void delayMicroseconds(unsigned int us)
+{
+	host_advance_us(us);
+}
+
+HOST_WEAK void yield(void)
+{
+}
+
+HOST_WEAK long random(long max)
+{
+	return max > 0 ? rand() % max : 0;
+}
+
+HOST_WEAK long random(long min, long max)
+{
+	return max > min ? min + rand() % (max - min) : min;
+}
+
+HOST_WEAK void randomSeed(unsigned long seed)
+{
+	srand(seed);
+}
+
+/*****************************************
+ * GPIO
+ *****************************************/
+
+uint8_t host_pin_mode[HOST_PINS];
+uint8_t host_pin_level[HOST_PINS];
+void (*host_pin_isr[HOST_PINS])(void);
+
+/**
+ * @brief Change the level of an input and call its interrupt handler
+ *
+ * @param pin GPIO
+ * @param level new level
+ */
+void host_pin_set(uint8_t pin, uint8_t level)
+{
+	bool changed = host_pin_level[pin] != level;
+	host_pin_level[pin] = level;
+	if (changed && (host_pin_isr[pin] != NULL))
+	{
+		host_pin_isr[pin]();
+	}
+}
+
+HOST_WEAK void pinMode(uint32_t pin, uint32_t mode)
+{
+	host_pin_mode[pin] = mode;
+	if (mode == INPUT_PULLUP)
+	{
+		host_pin_level[pin] = HIGH;
+	}
+}
+
+HOST_WEAK void digitalWrite(uint32_t pin, uint32_t level)
+{
+	host_pin_level[pin] = level;
+}
+
+HOST_WEAK int digitalRead(uint32_t pin)
+{
+	return host_pin_level[pin];
+}
+
+HOST_WEAK void attachInterrupt(uint32_t pin, void (*handler)(void), int mode)
+{
+	host_pin_isr[pin] = handler;
+}
+
+HOST_WEAK void detachInterrupt(uint32_t pin)
+{
+	host_pin_isr[pin] = NULL;
+}
+
+HOST_WEAK uint32_t analogRead(uint32_t pin)
+{
+	return 0;
+}
+
+HOST_WEAK void analogReference(uint8_t ref)
+{
+}
+
+HOST_WEAK void analogReadResolution(uint8_t bits)
+{
+}
+
+/*****************************************
+ * Serial
+ *****************************************/
+
+HardwareSerial Serial;
+std::string host_serial;
+
+HOST_WEAK int Print::printf(const char *format, ...)
+{
+	char line[512];
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+	if (this == &Serial)
+	{
+		host_serial += line;
+		if (getenv("HOST_VERBOSE") != NULL)
+		{
+			fputs(line, stdout);
+		}
+	}
+	return len;
+}
+
+HOST_WEAK size_t Print::write(uint8_t data)
+{
+	return write(&data, 1);
+}
+
+HOST_WEAK size_t Print::write(const uint8_t *data, size_t len)
+{
+	if (this == &Serial)
+	{
+		host_serial.append((const char *)data, len);
+	}
+	return len;
+}
+
+HOST_WEAK size_t Print::print(const char *str)
+{
+	return printf("%s", str);
+}
+
+HOST_WEAK size_t Print::println(const char *str)
+{
+	return printf("%s\n", str);
+}
+
+HOST_WEAK void Print::flush(void)
+{
+}
+
+HOST_WEAK int Stream::available(void)
+{
+	return 0;
+}
+
+HOST_WEAK int Stream::read(void)
+{
+	return -1;
+}
+
+HOST_WEAK void HardwareSerial::begin(unsigned long baud)
+{
+}
+
+HOST_WEAK HardwareSerial::operator bool(void)
+{
+	return true;
+}
+
+/*****************************************
+ * File system
+ *****************************************/
+
+Adafruit_LittleFS InternalFS;
+
+/** Files by name */
+static std::map<std::string, std::vector<uint8_t> > host_files;
+
+/** Bytes that can be written before the power is cut, -1 = no power cut */
+static long host_fs_budget = -1;
+
+/** Flag if the power was cut */
+static bool host_fs_cut = false;
+
+void host_fs_format(void)
+{
+	host_files.clear();
+	host_fs_budget = -1;
+	host_fs_cut = false;
+}
+
+std::vector<uint8_t> &host_fs_file(const char *name)
+{
+	return host_files[name];
+}
+
+bool host_fs_exists(const char *name)
+{
+	return host_files.find(name) != host_files.end();
+}
+
+void host_fs_power_cut(long bytes)
+{
+	host_fs_budget = bytes;
+	host_fs_cut = false;
+}
+
+bool host_fs_is_cut(void)
+{
+	return host_fs_cut;
+}
+
+void host_fs_power_on(void)
+{
+	host_fs_budget = -1;
+	host_fs_cut = false;
+}
+
+HOST_WEAK bool Adafruit_LittleFS::begin(void)
+{
+	return true;
+}
+
+HOST_WEAK bool Adafruit_LittleFS::exists(const char *name)
+{
+	return host_fs_exists(name);
+}
+
+HOST_WEAK bool Adafruit_LittleFS::remove(const char *name)
+{
+	return host_files.erase(name) != 0;
+}
+
+HOST_WEAK bool Adafruit_LittleFS::rename(const char *from, const char *to)
+{
+	if (!host_fs_exists(from))
+	{
+		return false;
+	}
+	host_files[to] = host_files[from];
+	host_files.erase(from);
+	return true;
+}
+
+HOST_WEAK File Adafruit_LittleFS::open(const char *name, uint8_t mode)
+{
+	File file(*this);
+	file.open(name, mode);
+	return file;
+}
+
+HOST_WEAK File::File(Adafruit_LittleFS &fs)
+{
+	_name[0] = 0;
+	_pos = 0;
+	_open = false;
+	_write = false;
+}
+
+HOST_WEAK bool File::open(const char *name, uint8_t mode)
+{
+	if ((mode == FILE_O_READ) && !host_fs_exists(name))
+	{
+		return false;
+	}
+	snprintf(_name, sizeof(_name), "%s", name);
+	_write = mode == FILE_O_WRITE;
+	// Like the Adafruit library, a file opened for writing is positioned at its end
+	_pos = _write ? host_files[_name].size() : 0;
+	_open = true;
+	return true;
+}
+
+HOST_WEAK int File::read(void *data, uint16_t len)
+{
+	if (!_open)
+	{
+		return -1;
+	}
+	std::vector<uint8_t> &content = host_files[_name];
+	if (_pos >= content.size())
+	{
+		return 0;
+	}
+	uint32_t num = content.size() - _pos < len ? content.size() - _pos : len;
+	memcpy(data, &content[_pos], num);
+	_pos += num;
+	return num;
+}
+
+HOST_WEAK int File::read(void)
+{
+	uint8_t data;
+	return read(&data, 1) == 1 ? data : -1;
+}
+
+HOST_WEAK size_t File::write(uint8_t data)
+{
+	return write(&data, 1);
+}
+
+HOST_WEAK size_t File::write(const uint8_t *data, size_t len)
+{
+	if (!_open || !_write)
+	{
+		return 0;
+	}
+	std::vector<uint8_t> &content = host_files[_name];
+	size_t written = 0;
+	while (written < len)
+	{
+		if (host_fs_cut || (host_fs_budget == 0))
+		{
+			host_fs_cut = true;
+			// The CPU continues until the voltage is too low, but nothing reaches the flash
+			return len;
+		}
+		if (host_fs_budget > 0)
+		{
+			host_fs_budget--;
+		}
+		if (_pos >= content.size())
+		{
+			content.resize(_pos + 1, 0);
+		}
+		content[_pos++] = data[written++];
+	}
+	return written;
+}
+
+HOST_WEAK size_t File::write(const char *str)
+{
+	return write((const uint8_t *)str, strlen(str));
+}
+
+HOST_WEAK bool File::seek(uint32_t pos)
+{
+	if (!_open)
+	{
+		return false;
+	}
+	_pos = pos;
+	return true;
+}
+
+HOST_WEAK uint32_t File::position(void)
+{
+	return _pos;
+}
+
+HOST_WEAK uint32_t File::size(void)
+{
+	return _open ? host_files[_name].size() : 0;
+}
+
+HOST_WEAK bool File::truncate(uint32_t size)
+{
+	if (!_open || !_write)
+	{
+		return false;
+	}
+	host_files[_name].resize(size);
+	return true;
+}
+
+HOST_WEAK void File::close(void)
+{
+	_open = false;
+}
+
+HOST_WEAK void File::flush(void)
+{
+}
+
+HOST_WEAK File::operator bool(void)
+{
+	return _open;
+}
+
+/*****************************************
+ * I2C
+ *****************************************/
+
+TwoWire Wire;
+host_i2c_dev_t host_i2c_device = NULL;
+uint32_t host_i2c_clock = 100000;
+uint32_t host_i2c_wire_transfers = 0;
+uint32_t host_i2c_dma_transfers = 0;
+uint64_t host_i2c_wire_busy_us = 0;
+bool host_i2c_dma_hang = false;
+bool host_i2c_stop_hang = false;
+uint32_t host_i2c_wire_cut = 0;
+
+/** Current Wire transfer */
+static uint8_t host_wire_addr = 0;
+static uint8_t host_wire_tx[64];
+static size_t host_wire_tx_len = 0;
+static uint8_t host_wire_rx[64];
+static size_t host_wire_rx_len = 0;
+static size_t host_wire_rx_pos = 0;
+
+uint64_t host_i2c_bus_time_us(size_t bytes)
+{
+	// 9 clocks per byte, start and stop take about one byte
+	return ((bytes + 1) * 9 * 1000000ULL + host_i2c_clock - 1) / host_i2c_clock;
+}
+
+static NRF_TWIM_Type host_twim;
+
+/**
+ * @brief Run a transfer on the simulated bus
+ *        Wire waits in a busy loop until the transfer is finished
+ *        Wire of the nRF52 core uses the same TWIM as the EasyDMA transfers. It starts a transfer
+ *        and waits for TXSTARTED, LASTTX, RXSTARTED, LASTRX, SUSPENDED or STOPPED without clearing
+ *        them first. An event left over from an earlier transfer, or a STOP still running, ends the
+ *        wait too early and the transfer is cut after the address.
+ *
+ * @return true device answered
+ */
+static bool host_wire_transfer(uint8_t addr, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len)
+{
+	host_i2c_wire_transfers++;
+	bool stale = host_twim.EVENTS_TXSTARTED || host_twim.EVENTS_LASTTX || host_twim.EVENTS_RXSTARTED || host_twim.EVENTS_LASTRX ||
+				 host_twim.EVENTS_SUSPENDED || host_twim.EVENTS_STOPPED || host_twim.TASKS_STOP;
+	// Wire clears the events it waited for
+	host_twim.EVENTS_TXSTARTED = 0;
+	host_twim.EVENTS_LASTTX = 0;
+	host_twim.EVENTS_RXSTARTED = 0;
+	host_twim.EVENTS_LASTRX = 0;
+	host_twim.EVENTS_SUSPENDED = 0;
+	host_twim.EVENTS_STOPPED = 0;
+	if (stale && !host_i2c_stop_hang)
+	{
+		host_twim.TASKS_STOP = 0;
+	}
+	if (stale)
+	{
+		host_i2c_wire_cut++;
+		host_advance_us(host_i2c_bus_time_us(1));
+		// Wire reports success for a write, a read gets no bytes
+		return rx_len == 0;
+	}
+	uint64_t bus_us = host_i2c_bus_time_us(1 + tx_len + (rx_len != 0 ? 1 + rx_len : 0));
+	host_advance_us(bus_us);
+	host_i2c_wire_busy_us += bus_us;
+	if (host_i2c_device == NULL)
+	{
+		return false;
+	}
+	return host_i2c_device(addr, tx, tx_len, rx, rx_len);
+}
+
+HOST_WEAK void TwoWire::begin(void)
+{
+	host_i2c_clock = 100000;
+}
+
+HOST_WEAK void TwoWire::setClock(uint32_t clock)
+{
+	host_i2c_clock = clock;
+}
+
+HOST_WEAK void TwoWire::beginTransmission(uint8_t addr)
+{
+	host_wire_addr = addr;
+	host_wire_tx_len = 0;
+}
+
+HOST_WEAK size_t TwoWire::write(uint8_t data)
+{
+	return write(&data, 1);
+}
+
+HOST_WEAK size_t TwoWire::write(const uint8_t *data, size_t len)
+{
+	if (host_wire_tx_len + len > sizeof(host_wire_tx))
+	{
+		len = sizeof(host_wire_tx) - host_wire_tx_len;
+	}
+	memcpy(&host_wire_tx[host_wire_tx_len], data, len);
+	host_wire_tx_len += len;
+	return len;
+}
+
+HOST_WEAK uint8_t TwoWire::endTransmission(bool stop)
+{
+	if (!stop)
+	{
+		// Repeated start, the register address is sent together with the read
+		return 0;
+	}
+	bool result = host_wire_transfer(host_wire_addr, host_wire_tx, host_wire_tx_len, NULL, 0);
+	host_wire_tx_len = 0;
+	return result ? 0 : 2;
+}
+
+HOST_WEAK uint8_t TwoWire::requestFrom(uint8_t addr, uint8_t len, bool stop)
+{
+	if (len > sizeof(host_wire_rx))
+	{
+		len = sizeof(host_wire_rx);
+	}
+	bool result = host_wire_transfer(addr, host_wire_tx, host_wire_tx_len, host_wire_rx, len);
+	host_wire_tx_len = 0;
+	host_wire_rx_pos = 0;
+	host_wire_rx_len = result ? len : 0;
+	return host_wire_rx_len;
+}
+
+HOST_WEAK int TwoWire::available(void)
+{
+	return host_wire_rx_len - host_wire_rx_pos;
+}
+
+HOST_WEAK int TwoWire::read(void)
+{
+	return host_wire_rx_pos < host_wire_rx_len ? host_wire_rx[host_wire_rx_pos++] : -1;
+}
+
+/*****************************************
+ * TWIM EasyDMA
+ *****************************************/
+
+NRF_TWIM_Type *NRF_TWIM0 = &host_twim;
+static SCB_Type host_scb;
+SCB_Type *SCB = &host_scb;
+
+/**
+ * @brief Sleep until an event, a started TWIM transfer finishes while the CPU sleeps
+ *        The transfer raises the same events as the TWIM: TXSTARTED, LASTTX, RXSTARTED, LASTRX
+ *        and STOPPED, or TXSTARTED and ERROR for a NACK of the address
+ *
+ */
+HOST_WEAK void __WFE(void)
+{
+	if (host_twim.TASKS_STARTTX != 0)
+	{
+		host_twim.TASKS_STARTTX = 0;
+		host_i2c_dma_transfers++;
+		host_twim.EVENTS_TXSTARTED = 1;
+		if (host_i2c_dma_hang)
+		{
+			// Register address sent, the device stretches the clock of the read
+			host_advance_us(host_i2c_bus_time_us(2 + host_twim.TXD.MAXCNT));
+			host_twim.EVENTS_LASTTX = 1;
+			host_twim.EVENTS_RXSTARTED = 1;
+			return;
+		}
+		host_advance_us(host_i2c_bus_time_us(2 + host_twim.TXD.MAXCNT + host_twim.RXD.MAXCNT));
+		bool result = (host_i2c_device != NULL) &&
+					  host_i2c_device(host_twim.ADDRESS, (const uint8_t *)host_twim.TXD.PTR, host_twim.TXD.MAXCNT,
+									  (uint8_t *)host_twim.RXD.PTR, host_twim.RXD.MAXCNT);
+		host_twim.RXD.AMOUNT = result ? host_twim.RXD.MAXCNT : 0;
+		host_twim.EVENTS_LASTTX = result ? 1 : 0;
+		host_twim.EVENTS_RXSTARTED = result ? 1 : 0;
+		host_twim.EVENTS_LASTRX = result ? 1 : 0;
+		host_twim.EVENTS_ERROR = result ? 0 : 1;
+		host_twim.ERRORSRC = result ? 0 : 2;
+		host_twim.EVENTS_STOPPED = result ? 1 : 0;
+		return;
+	}
+	if ((host_twim.TASKS_STOP != 0) && !host_i2c_stop_hang)
+	{
+		host_twim.TASKS_STOP = 0;
+		host_advance_us(host_i2c_bus_time_us(1));
+		host_twim.EVENTS_STOPPED = 1;
+		return;
+	}
+	// Next system tick
+	host_advance_ms(1);
+}
+
+HOST_WEAK void __SEV(void)
+{
+}
+
+HOST_WEAK void __DSB(void)
+{
+}
+
+HOST_WEAK void __disable_irq(void)
+{
+}
+
+HOST_WEAK void __enable_irq(void)
+{
+}
+
+HOST_WEAK void NVIC_ClearPendingIRQ(IRQn_Type irq)
+{
+}
+
+HOST_WEAK void NVIC_DisableIRQ(IRQn_Type irq)
+{
+}
+
+HOST_WEAK uint32_t readResetReason(void)
+{
+	return 0;
+}
+
+/*****************************************
+ * FreeRTOS
+ *****************************************/
+
+TaskHandle_t host_current_task = (TaskHandle_t)1;
+uint32_t host_sem_deadlocks = 0;
+uint32_t host_critical_sections = 0;
+int host_critical_depth = 0;
+
+HOST_WEAK BaseType_t xTaskCreate(void (*task)(void *), const char *name, uint32_t stack, void *param, UBaseType_t prio, TaskHandle_t *handle)
+{
+	static uintptr_t next_task = 2;
+	if (handle != NULL)
+	{
+		*handle = (TaskHandle_t)next_task;
+	}
+	next_task++;
+	return pdPASS;
+}
+
+HOST_WEAK BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, int action, BaseType_t *woken)
+{
+	return pdPASS;
+}
+
+HOST_WEAK BaseType_t xTaskNotifyWait(uint32_t clear_entry, uint32_t clear_exit, uint32_t *value, TickType_t wait)
+{
+	return pdFALSE;
+}
+
+HOST_WEAK BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, int action)
+{
+	return pdPASS;
+}
+
+HOST_WEAK TickType_t xTaskGetTickCount(void)
+{
+	return millis();
+}
+
+HOST_WEAK UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+	return 0;
+}
+
+HOST_WEAK TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	return host_current_task;
+}
+
+static SemaphoreHandle_t host_sem_create(int type, int count)
+{
+	host_sem_s *sem = new host_sem_s;
+	sem->type = type;
+	sem->count = count;
+	sem->owner = NULL;
+	sem->depth = 0;
+	return sem;
+}
+
+HOST_WEAK SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	return host_sem_create(HOST_SEM_MUTEX, 1);
+}
+
+HOST_WEAK SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+	return host_sem_create(HOST_SEM_RECURSIVE, 1);
+}
+
+HOST_WEAK SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+	return host_sem_create(HOST_SEM_BINARY, 0);
+}
+
+HOST_WEAK BaseType_t xSemaphoreTake(SemaphoreHandle_t handle, TickType_t wait)
+{
+	host_sem_s *sem = (host_sem_s *)handle;
+	if (sem->count == 0)
+	{
+		// Only one task runs, nobody could give the semaphore
+		if (wait == portMAX_DELAY)
+		{
+			host_sem_deadlocks++;
+		}
+		return pdFALSE;
+	}
+	sem->count--;
+	sem->owner = host_current_task;
+	return pdTRUE;
+}
+
+HOST_WEAK BaseType_t xSemaphoreGive(SemaphoreHandle_t handle)
+{
+	host_sem_s *sem = (host_sem_s *)handle;
+	if (sem->count != 0)
+	{
+		return pdFALSE;
+	}
+	if ((sem->type == HOST_SEM_MUTEX) && (sem->owner != host_current_task))
+	{
+		// Only the owner can give a mutex
+		return pdFALSE;
+	}
+	sem->count++;
+	sem->owner = NULL;
+	return pdTRUE;
+}
+
+HOST_WEAK BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t handle, TickType_t wait)
+{
+	host_sem_s *sem = (host_sem_s *)handle;
+	if ((sem->depth != 0) && (sem->owner == host_current_task))
+	{
+		sem->depth++;
+		return pdTRUE;
+	}
+	if (xSemaphoreTake(handle, wait) != pdTRUE)
+	{
+		return pdFALSE;
+	}
+	sem->depth = 1;
+	return pdTRUE;
+}
+
+HOST_WEAK BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t handle)
+{
+	host_sem_s *sem = (host_sem_s *)handle;
+	if ((sem->depth == 0) || (sem->owner != host_current_task))
+	{
+		return pdFALSE;
+	}
+	if (--sem->depth != 0)
+	{
+		return pdTRUE;
+	}
+	return xSemaphoreGive(handle);
+}
+
+HOST_WEAK TaskHandle_t xSemaphoreGetMutexHolder(SemaphoreHandle_t handle)
+{
+	host_sem_s *sem = (host_sem_s *)handle;
+	return sem->count == 0 ? sem->owner : NULL;
+}
+
+HOST_WEAK void taskENTER_CRITICAL(void)
+{
+	host_critical_sections++;
+	host_critical_depth++;
+}
+
+HOST_WEAK void taskEXIT_CRITICAL(void)
+{
+	host_critical_depth--;
+}
+
+HOST_WEAK UBaseType_t taskENTER_CRITICAL_FROM_ISR(void)
+{
+	taskENTER_CRITICAL();
+	return 0;
+}
+
+HOST_WEAK void taskEXIT_CRITICAL_FROM_ISR(UBaseType_t state)
+{
+	taskEXIT_CRITICAL();
+}
+
+/*****************************************
+ * Software timer
+ *****************************************/
+
+HOST_WEAK void SoftwareTimer::begin(uint32_t ms, void (*callback)(TimerHandle_t), void *id, bool repeating)
+{
+	_callback = callback;
+	_period = ms;
+	_repeating = repeating;
+	_running = false;
+}
+
+HOST_WEAK void SoftwareTimer::start(void)
+{
+	_running = true;
+}
+
+HOST_WEAK void SoftwareTimer::stop(void)
+{
+	_running = false;
+}
+
+HOST_WEAK void SoftwareTimer::setPeriod(uint32_t ms)
+{
+	// Like xTimerChangePeriod() this starts the timer
+	_period = ms;
+	_running = true;
+}
+
+HOST_WEAK void SoftwareTimer::reset(void)
+{
+	_running = true;
+}
+
+/**
+ * @brief Call the timer callback like the timer daemon does when the period is over
+ *
+ */
+HOST_WEAK void SoftwareTimer::fire(void)
+{
+	if (!_repeating)
+	{
+		_running = false;
+	}
+	if (_callback != NULL)
+	{
+		_callback(this);
+	}
+}
+
+/*****************************************
+ * WisBlock API and LoRaWAN
+ *****************************************/
+
+s_lorawan_settings g_lorawan_settings;
+volatile uint16_t g_task_event_type = 0;
+uint8_t g_rx_lora_data[256];
+uint8_t g_rx_data_len = 0;
+int16_t g_last_rssi = 0;
+int8_t g_last_snr = 0;
+bool g_join_result = false;
+bool g_lpwan_has_joined = false;
+bool g_rx_fin_result = false;
+bool g_enable_ble = false;
+bool g_ble_uart_is_connected = false;
+uint16_t g_sw_ver_1 = 1;
+uint16_t g_sw_ver_2 = 0;
+uint16_t g_sw_ver_3 = 0;
+char g_ble_dev_name[10] = "RAK-SEIS";
+
+std::vector<std::vector<uint8_t> > host_lora_tx;
+std::vector<uint8_t> host_lora_fport;
+std::vector<std::vector<uint8_t> > host_p2p_tx;
+lmh_error_status host_lora_result = LMH_SUCCESS;
+uint8_t host_lora_max_payload = 222;
+uint16_t host_wake_events = 0;
+
+HOST_WEAK void api_wake_loop(uint16_t reason)
+{
+	host_wake_events |= reason;
+	g_task_event_type |= reason;
+}
+
+HOST_WEAK void api_timer_stop(void)
+{
+}
+
+HOST_WEAK void api_timer_restart(uint32_t ms)
+{
+}
+
+HOST_WEAK void api_timer_start(void)
+{
+}
+
+HOST_WEAK void save_settings(void)
+{
+}
+
+HOST_WEAK lmh_error_status send_lora_packet(uint8_t *data, uint8_t size, uint8_t fport)
+{
+	if (host_lora_result == LMH_SUCCESS)
+	{
+		host_lora_tx.push_back(std::vector<uint8_t>(data, data + size));
+		host_lora_fport.push_back(fport);
+	}
+	return host_lora_result;
+}
+
+HOST_WEAK bool send_p2p_packet(uint8_t *data, uint8_t size)
+{
+	host_p2p_tx.push_back(std::vector<uint8_t>(data, data + size));
+	return true;
+}
+
+HOST_WEAK float read_batt(void)
+{
+	return 4000.0f;
+}
+
+HOST_WEAK LoRaMacStatus_t LoRaMacQueryTxPossible(uint8_t size, LoRaMacTxInfo_t *txInfo)
+{
+	txInfo->MaxPossiblePayload = host_lora_max_payload;
+	txInfo->CurrentPayloadSize = size;
+	return size <= host_lora_max_payload ? LORAMAC_STATUS_OK : LORAMAC_STATUS_LENGTH_ERROR;
+}
+
+HOST_WEAK LoRaMacStatus_t LoRaMacMulticastChannelLink(MulticastParams_t *channelParam)
+{
+	return LORAMAC_STATUS_OK;
+}
+
+HOST_WEAK LoRaMacStatus_t LoRaMacMulticastChannelUnlink(MulticastParams_t *channelParam)
+{
+	return LORAMAC_STATUS_OK;
+}
+
+/*****************************************
+ * CayenneLPP, same encoding as the library
+ *****************************************/
+
+HOST_WEAK CayenneLPP::CayenneLPP(uint8_t size) : _maxsize(size), _cursor(0), _error(0)
+{
+	_buffer = (uint8_t *)malloc(size);
+}
+
+HOST_WEAK CayenneLPP::~CayenneLPP()
+{
+	free(_buffer);
+}
+
+HOST_WEAK void CayenneLPP::reset(void)
+{
+	_cursor = 0;
+	_error = 0;
+}
+
+HOST_WEAK uint8_t CayenneLPP::getSize(void)
+{
+	return _cursor;
+}
+
+HOST_WEAK uint8_t *CayenneLPP::getBuffer(void)
+{
+	return _buffer;
+}
+
+HOST_WEAK uint8_t CayenneLPP::copy(uint8_t *dst)
+{
+	memcpy(dst, _buffer, _cursor);
+	return _cursor;
+}
+
+HOST_WEAK uint8_t CayenneLPP::getError(void)
+{
+	return _error;
+}
+
+/**
+ * @brief Add a value MSB first
+ *
+ * @return uint8_t new size, 0 if the buffer is full
+ */
+static uint8_t host_lpp_add(uint8_t *buffer, uint8_t maxsize, uint8_t &cursor, uint8_t &error, uint8_t channel, uint8_t type, uint32_t value, uint8_t size)
+{
+	if ((cursor + size + 2) > maxsize)
+	{
+		error = LPP_ERROR_OVERFLOW;
+		return 0;
+	}
+	buffer[cursor++] = channel;
+	buffer[cursor++] = type;
+	for (uint8_t idx = size; idx > 0; idx--)
+	{
+		buffer[cursor++] = (uint8_t)(value >> ((idx - 1) * 8));
+	}
+	return cursor;
+}
+
+HOST_WEAK uint8_t CayenneLPP::addDigitalInput(uint8_t channel, uint32_t value)
+{
+	return host_lpp_add(_buffer, _maxsize, _cursor, _error, channel, 0, value, 1);
+}
+
+HOST_WEAK uint8_t CayenneLPP::addAnalogInput(uint8_t channel, float value)
+{
+	return host_lpp_add(_buffer, _maxsize, _cursor, _error, channel, 2, (uint32_t)(int32_t)(value * 100), 2);
+}
+
+HOST_WEAK uint8_t CayenneLPP::addPresence(uint8_t channel, uint32_t value)
+{
+	return host_lpp_add(_buffer, _maxsize, _cursor, _error, channel, 102, value, 1);
+}
+
+HOST_WEAK uint8_t CayenneLPP::addVoltage(uint8_t channel, float value)
+{
+	return host_lpp_add(_buffer, _maxsize, _cursor, _error, channel, 116, (uint32_t)(value * 100), 2);
+}
+
+HOST_WEAK uint8_t CayenneLPP::addTemperature(uint8_t channel, float value)
+{
+	return host_lpp_add(_buffer, _maxsize, _cursor, _error, channel, 103, (uint32_t)(int32_t)(value * 10), 2);
+}
+
+HOST_WEAK uint8_t CayenneLPP::addRelativeHumidity(uint8_t channel, float value)
+{
+	return host_lpp_add(_buffer, _maxsize, _cursor, _error, channel, 104, (uint32_t)(value * 2), 1);
+}
+
+HOST_WEAK uint8_t CayenneLPP::addPercentage(uint8_t channel, uint32_t value)
+{
+	return host_lpp_add(_buffer, _maxsize, _cursor, _error, channel, 120, value, 1);
+}
+
+HOST_WEAK uint8_t CayenneLPP::addUnixTime(uint8_t channel, uint32_t value)
+{
+	return host_lpp_add(_buffer, _maxsize, _cursor, _error, channel, 133, value, 4);
+}
+
+HOST_WEAK uint8_t CayenneLPP::addGenericSensor(uint8_t channel, float value)
+{
+	return host_lpp_add(_buffer, _maxsize, _cursor, _error, channel, 100, (uint32_t)value, 4);
+}
+
+HOST_WEAK uint8_t CayenneLPP::addConcentration(uint8_t channel, uint32_t value)
+{
+	return host_lpp_add(_buffer, _maxsize, _cursor, _error, channel, 125, value, 2);
+}
+
+/*****************************************
+ * SHTC3 library, only the presence check is used
+ *****************************************/
+
+HOST_WEAK SHTC3_Status_TypeDef SHTC3::begin(TwoWire &w)
+{
+	return SHTC3_Status_Nominal;
+}
@@ -0,0 +1,99 @@
+/**
+ * @file host_fakes.h
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Control of the simulated hardware for the host tests
+ *        All fakes are weak, a test can replace any of them with its own version.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef HOST_FAKES_H
+#define HOST_FAKES_H
+
+#include <Arduino.h>
+#include <WisBlock-API-V2.h>
+#include <string>
+#include <vector>
+
+/** Simulated time in us, millis() and micros() are derived from it */
+extern uint64_t host_us;
+void host_set_ms(uint32_t ms);
+void host_advance_ms(uint32_t ms);
+void host_advance_us(uint64_t us);
+
+/** Simulated GPIO */
+#define HOST_PINS 64
+extern uint8_t host_pin_mode[HOST_PINS];
+extern uint8_t host_pin_level[HOST_PINS];
+extern void (*host_pin_isr[HOST_PINS])(void);
+void host_pin_set(uint8_t pin, uint8_t level);
+
+/** Output of Serial, printed to stdout as well if HOST_VERBOSE is set */
+extern std::string host_serial;
+
+/** File system in RAM
+ *  The files are written without the copy-on-write of LittleFS, every byte goes to the "flash" right away.
+ *  That is the worst case for a power loss, a record can be cut at any byte.
+ */
+void host_fs_format(void);
+std::vector<uint8_t> &host_fs_file(const char *name);
+bool host_fs_exists(const char *name);
+/** Cut the power after n more bytes were written, -1 = no power cut */
+void host_fs_power_cut(long bytes);
+/** Flag if the power was cut, all writes after the cut are lost */
+bool host_fs_is_cut(void);
+/** Power comes back, the files keep what was written before the cut */
+void host_fs_power_on(void);
+
+/** Simulated I2C device
+ *  Called for each transfer with the written bytes and a buffer for the read bytes, returns false for a NACK
+ */
+typedef bool (*host_i2c_dev_t)(uint8_t addr, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len);
+extern host_i2c_dev_t host_i2c_device;
+/** Bus clock set with Wire.setClock() */
+extern uint32_t host_i2c_clock;
+/** Transfers of Wire and the TWIM */
+extern uint32_t host_i2c_wire_transfers;
+extern uint32_t host_i2c_dma_transfers;
+/** Time the CPU waited in a busy loop for Wire in us */
+extern uint64_t host_i2c_wire_busy_us;
+/** Time of one transfer on the bus at the current clock, start and stop bits included */
+uint64_t host_i2c_bus_time_us(size_t bytes);
+/** The device stretches the clock of a TWIM transfer forever, the transfer never finishes */
+extern bool host_i2c_dma_hang;
+/** SCL is held low, a STOP of the TWIM never finishes */
+extern bool host_i2c_stop_hang;
+/** Wire transfers cut short because events of an earlier TWIM transfer were still set */
+extern uint32_t host_i2c_wire_cut;
+
+/** FreeRTOS, only one task runs at a time on the host */
+#define HOST_SEM_BINARY 0
+#define HOST_SEM_MUTEX 1
+#define HOST_SEM_RECURSIVE 2
+struct host_sem_s
+{
+	int type;
+	int count;
+	TaskHandle_t owner;
+	int depth;
+};
+/** Task that calls the FreeRTOS functions */
+extern TaskHandle_t host_current_task;
+/** Number of xSemaphoreTake() calls that would block forever */
+extern uint32_t host_sem_deadlocks;
+/** Number of times taskENTER_CRITICAL() was called */
+extern uint32_t host_critical_sections;
+/** Depth of the critical sections */
+extern int host_critical_depth;
+
+/** LoRaWAN and P2P */
+extern std::vector<std::vector<uint8_t> > host_lora_tx;
+extern std::vector<uint8_t> host_lora_fport;
+extern std::vector<std::vector<uint8_t> > host_p2p_tx;
+extern lmh_error_status host_lora_result;
+extern uint8_t host_lora_max_payload;
+extern uint16_t host_wake_events;
+
+#endif // HOST_FAKES_H
@@ -0,0 +1,51 @@
+/**
+ * @file Adafruit_LittleFS.h
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host replacement of the LittleFS file system, the files are kept in RAM, declarations only, the functions are in host_fakes.cpp
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#pragma once
+#include <Arduino.h>
+#define FILE_O_READ 0
+#define FILE_O_WRITE 1
+namespace Adafruit_LittleFS_Namespace
+{
+	class Adafruit_LittleFS;
+	class File : public Stream
+	{
+	public:
+		File(Adafruit_LittleFS &fs);
+		bool open(const char *name, uint8_t mode);
+		int read(void *data, uint16_t len);
+		int read(void);
+		size_t write(uint8_t data);
+		size_t write(const uint8_t *data, size_t len);
+		size_t write(const char *str);
+		bool seek(uint32_t pos);
+		uint32_t position(void);
+		uint32_t size(void);
+		bool truncate(uint32_t size);
+		void close(void);
+		void flush(void);
+		operator bool(void);
+
+	private:
+		char _name[32];
+		uint32_t _pos;
+		bool _open;
+		bool _write;
+	};
+	class Adafruit_LittleFS
+	{
+	public:
+		bool begin(void);
+		bool exists(const char *name);
+		bool remove(const char *name);
+		bool rename(const char *from, const char *to);
+		File open(const char *name, uint8_t mode);
+	};
+}
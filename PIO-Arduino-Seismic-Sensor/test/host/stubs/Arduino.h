@@ -0,0 +1,232 @@
+/**
+ * @file Arduino.h
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host replacement of the Arduino core, FreeRTOS and the nRF52 registers used by the application
+ *        Only declarations, the functions are in host_fakes.cpp
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+
+// The application is written for the RAK4631
+#define NRF52_SERIES 1
+#define NRF52840_XXAA 1
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define INPUT_PULLDOWN 3
+#define FALLING 2
+#define RISING 3
+#define CHANGE 4
+
+#define LED_GREEN 35
+#define LED_BLUE 36
+#define WB_IO1 17
+#define WB_IO2 34
+#define WB_IO3 21
+#define WB_IO4 4
+#define WB_IO5 9
+#define WB_IO6 10
+#define WB_A0 5
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield(void);
+void pinMode(uint32_t pin, uint32_t mode);
+void digitalWrite(uint32_t pin, uint32_t level);
+int digitalRead(uint32_t pin);
+void attachInterrupt(uint32_t pin, void (*handler)(void), int mode);
+void detachInterrupt(uint32_t pin);
+uint32_t analogRead(uint32_t pin);
+void analogReference(uint8_t ref);
+void analogReadResolution(uint8_t bits);
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+// Templates like the Arduino core, macros would break the C++ library
+template <class T, class L>
+auto min(const T &a, const L &b) -> decltype((b < a) ? b : a)
+{
+	return (b < a) ? b : a;
+}
+
+template <class T, class L>
+auto max(const T &a, const L &b) -> decltype((b < a) ? b : a)
+{
+	return (a < b) ? b : a;
+}
+
+class String
+{
+public:
+	String(const char *s = "") {}
+	void toUpperCase(void) {}
+	const char *c_str(void) const { return ""; }
+};
+
+class Print
+{
+public:
+	size_t write(uint8_t data);
+	size_t write(const uint8_t *data, size_t len);
+	size_t print(const char *str);
+	size_t println(const char *str);
+	int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+	void flush(void);
+};
+
+class Stream : public Print
+{
+public:
+	using Print::write;
+	int available(void);
+	int read(void);
+	size_t readBytes(uint8_t *data, size_t len);
+};
+
+class HardwareSerial : public Stream
+{
+public:
+	void begin(unsigned long baud);
+	operator bool(void);
+};
+
+extern HardwareSerial Serial;
+
+// FreeRTOS
+typedef void *TimerHandle_t;
+typedef void *TaskHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef void *QueueHandle_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xffffffff
+#define pdMS_TO_TICKS(x) (x)
+#define portYIELD_FROM_ISR(x) (void)(x)
+#define TASK_PRIO_LOW 1
+#define TASK_PRIO_NORMAL 2
+#define TASK_PRIO_HIGH 3
+#define configMINIMAL_STACK_SIZE 128
+enum
+{
+	eNoAction = 0,
+	eSetBits = 1
+};
+BaseType_t xTaskCreate(void (*task)(void *), const char *name, uint32_t stack, void *param, UBaseType_t prio, TaskHandle_t *handle);
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, int action, BaseType_t *woken);
+BaseType_t xTaskNotifyWait(uint32_t clear_entry, uint32_t clear_exit, uint32_t *value, TickType_t wait);
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, int action);
+TickType_t xTaskGetTickCount(void);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t sem, TickType_t wait);
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t sem);
+TaskHandle_t xSemaphoreGetMutexHolder(SemaphoreHandle_t sem);
+void taskENTER_CRITICAL(void);
+void taskEXIT_CRITICAL(void);
+UBaseType_t taskENTER_CRITICAL_FROM_ISR(void);
+void taskEXIT_CRITICAL_FROM_ISR(UBaseType_t state);
+
+// Adafruit nRF52 core
+class SoftwareTimer
+{
+public:
+	void begin(uint32_t ms, void (*callback)(TimerHandle_t), void *id = NULL, bool repeating = true);
+	void start(void);
+	void stop(void);
+	void setPeriod(uint32_t ms);
+	void reset(void);
+	bool isRunning(void) { return _running; }
+	uint32_t getPeriod(void) { return _period; }
+	void fire(void);
+
+private:
+	void (*_callback)(TimerHandle_t) = NULL;
+	uint32_t _period = 0;
+	bool _running = false;
+	bool _repeating = true;
+};
+
+// nRF52 registers
+void __WFE(void);
+void __SEV(void);
+void __DSB(void);
+void __disable_irq(void);
+void __enable_irq(void);
+#define __NOP()
+
+typedef struct
+{
+	volatile uintptr_t PTR; // 32 bit on the nRF52, a host pointer does not fit into 32 bit
+	volatile uint32_t MAXCNT;
+	volatile uint32_t AMOUNT;
+	volatile uint32_t LIST;
+} TWIM_DMA_Type;
+
+typedef struct
+{
+	volatile uint32_t TASKS_STARTRX, TASKS_STARTTX, TASKS_STOP, TASKS_SUSPEND, TASKS_RESUME;
+	volatile uint32_t EVENTS_STOPPED, EVENTS_ERROR, EVENTS_SUSPENDED, EVENTS_RXSTARTED, EVENTS_TXSTARTED, EVENTS_LASTRX, EVENTS_LASTTX;
+	volatile uint32_t SHORTS, INTEN, INTENSET, INTENCLR, ERRORSRC, ENABLE, FREQUENCY, ADDRESS;
+	TWIM_DMA_Type RXD, TXD;
+} NRF_TWIM_Type;
+
+extern NRF_TWIM_Type *NRF_TWIM0;
+#define TWIM_SHORTS_LASTTX_STARTRX_Msk (1UL << 7)
+#define TWIM_SHORTS_LASTTX_STOP_Msk (1UL << 9)
+#define TWIM_SHORTS_LASTRX_STOP_Msk (1UL << 12)
+#define TWIM_INTEN_STOPPED_Msk (1UL << 1)
+#define TWIM_INTEN_ERROR_Msk (1UL << 9)
+
+typedef enum
+{
+	SPIM0_SPIS0_TWIM0_TWIS0_SPI0_TWI0_IRQn = 3
+} IRQn_Type;
+void NVIC_ClearPendingIRQ(IRQn_Type irq);
+void NVIC_DisableIRQ(IRQn_Type irq);
+
+typedef struct
+{
+	volatile uint32_t SCR;
+} SCB_Type;
+extern SCB_Type *SCB;
+#define SCB_SCR_SEVONPEND_Msk (1UL << 4)
+
+uint32_t readResetReason(void);
+#define POWER_RESETREAS_RESETPIN_Msk 0x1
+#define POWER_RESETREAS_DOG_Msk 0x2
+#define POWER_RESETREAS_SREQ_Msk 0x4
+#define POWER_RESETREAS_LOCKUP_Msk 0x8
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,16 @@
+/**
+ * @file CayenneLPP.h
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host replacement of the CayenneLPP library, declarations only, the functions are in host_fakes.cpp
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#pragma once
+#include <Arduino.h>
+#define LPP_ERROR_OVERFLOW 1
+class CayenneLPP { public: CayenneLPP(uint8_t size); ~CayenneLPP(); void reset(); uint8_t getSize(); uint8_t *getBuffer(); uint8_t copy(uint8_t*); uint8_t getError();
+ uint8_t addDigitalInput(uint8_t, uint32_t); uint8_t addAnalogInput(uint8_t, float); uint8_t addPresence(uint8_t, uint32_t); uint8_t addVoltage(uint8_t, float); uint8_t addTemperature(uint8_t, float); uint8_t addRelativeHumidity(uint8_t, float); uint8_t addPercentage(uint8_t, uint32_t); uint8_t addUnixTime(uint8_t, uint32_t); uint8_t addGenericSensor(uint8_t, float); uint8_t addConcentration(uint8_t, uint32_t);
+protected: uint8_t *_buffer; uint8_t _maxsize; uint8_t _cursor; uint8_t _error; };
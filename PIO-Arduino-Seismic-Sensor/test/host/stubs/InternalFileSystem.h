@@ -0,0 +1,13 @@
+/**
+ * @file InternalFileSystem.h
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host replacement of the internal flash file system, declarations only, the functions are in host_fakes.cpp
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#pragma once
+#include <Adafruit_LittleFS.h>
+extern Adafruit_LittleFS_Namespace::Adafruit_LittleFS InternalFS;
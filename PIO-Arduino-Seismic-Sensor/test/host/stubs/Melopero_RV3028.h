@@ -0,0 +1,13 @@
+/**
+ * @file Melopero_RV3028.h
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host replacement of the Melopero RV3028 library, declarations only, the functions are in host_fakes.cpp
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#pragma once
+#include <Wire.h>
+class Melopero_RV3028 { public: void initI2C(TwoWire &w = Wire); void useEEPROM(bool); void writeToRegister(uint8_t, uint8_t); uint8_t readFromRegister(uint8_t); void set24HourMode(); void setTime(uint16_t, uint8_t, uint8_t, uint8_t, uint8_t, uint8_t, uint8_t); uint8_t getYear(); uint8_t getMonth(); uint8_t getWeekday(); uint8_t getDate(); uint8_t getHour(); uint8_t getMinute(); uint8_t getSecond(); };
@@ -0,0 +1,17 @@
+/**
+ * @file RAK12027_D7S.h
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host replacement of the RAK12027 D7S library, declarations only, the functions are in host_fakes.cpp
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#pragma once
+#include <Arduino.h>
+#include <Wire.h>
+enum { NORMAL_MODE=1, NORMAL_MODE_NOT_IN_STANBY, INITIAL_INSTALLATION_MODE, OFFSET_ACQUISITION_MODE, SELFTEST_MODE };
+typedef enum { THRESHOLD_HIGH = 0, THRESHOLD_LOW = 1 } D7S_threshold_t;
+typedef enum { FORCE_YZ=0, FORCE_XZ, FORCE_XY, AUTO_SWITCH, SWITCH_AT_INSTALLATION } D7S_axis_settings_t;
+class RAK_D7S { public: RAK_D7S(TwoWire &w = Wire, uint8_t addr = 0x55); bool begin(); uint8_t getState(); uint8_t getAxisInUse(); void setThreshold(D7S_threshold_t); void setAxis(D7S_axis_settings_t); float getLastestSI(uint8_t); float getLastestPGA(uint8_t); float getInstantaneusSI(); float getInstantaneusPGA(); void initialize(); bool isReady(); uint8_t isInCollapse(); uint8_t isInShutoff(); void resetEvents(); bool isEarthquakeOccuring(); void selftest(); uint8_t getSelftestResult(); void clearEarthquakeData(); };
@@ -0,0 +1,14 @@
+/**
+ * @file SparkFun_SHTC3.h
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host replacement of the SparkFun SHTC3 library, declarations only, the functions are in host_fakes.cpp
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#pragma once
+#include <Wire.h>
+typedef enum { SHTC3_Status_Nominal = 0, SHTC3_Status_Error, SHTC3_Status_CRC_Fail } SHTC3_Status_TypeDef;
+class SHTC3 { public: SHTC3_Status_TypeDef lastStatus; SHTC3_Status_TypeDef begin(TwoWire &w = Wire); SHTC3_Status_TypeDef update(); SHTC3_Status_TypeDef sleep(bool); SHTC3_Status_TypeDef wake(bool); float toDegC(); float toPercent(); };
@@ -0,0 +1,26 @@
+/**
+ * @file Wire.h
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host replacement of the Wire library, declarations only, the functions are in host_fakes.cpp
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#pragma once
+#include <Arduino.h>
+class TwoWire : public Stream
+{
+public:
+	void begin(void);
+	void setClock(uint32_t clock);
+	void beginTransmission(uint8_t addr);
+	uint8_t endTransmission(bool stop = true);
+	uint8_t requestFrom(uint8_t addr, uint8_t len, bool stop = true);
+	size_t write(uint8_t data);
+	size_t write(const uint8_t *data, size_t len);
+	int available(void);
+	int read(void);
+};
+extern TwoWire Wire;
@@ -0,0 +1,70 @@
+/**
+ * @file WisBlock-API-V2.h
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host replacement of the WisBlock API and the parts of the LoRaWAN and BLE stacks used by the application, declarations only, the functions are in host_fakes.cpp
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#pragma once
+#include <Arduino.h>
+#define STATUS 0b0000000000000001
+#define N_STATUS 0b1111111111111110
+#define BLE_CONFIG 0b0000000000000010
+#define BLE_DATA 0b0000000000000100
+#define N_BLE_DATA 0b1111111111111011
+#define LORA_DATA 0b0000000000001000
+#define N_LORA_DATA 0b1111111111110111
+#define LORA_TX_FIN 0b0000000000010000
+#define N_LORA_TX_FIN 0b1111111111101111
+#define AT_CMD 0b0000000000100000
+#define LORA_JOIN_FIN 0b0000000001000000
+#define N_LORA_JOIN_FIN 0b1111111110111111
+#define AT_ERRNO_PARA_VAL 5
+#define AT_ERRNO_PARA_NUM 6
+#define AT_ERRNO_NOSUPP 3
+#define AT_ERRNO_NOALLOW 4
+#define AT_ERRNO_SYS 7
+#define AT_PRINTF(...) Serial.printf(__VA_ARGS__)
+#define PRINTF(...) Serial.printf(__VA_ARGS__)
+typedef enum { LMH_SUCCESS = 0, LMH_BUSY = -1, LMH_ERROR = -2 } lmh_error_status;
+typedef enum { CLASS_A, CLASS_B, CLASS_C } DeviceClass_t;
+struct s_lorawan_settings { uint8_t valid_mark_1; uint8_t valid_mark_2; bool auto_join; bool otaa_enabled; uint8_t node_device_eui[8]; uint8_t node_app_eui[8]; uint8_t node_app_key[16]; uint8_t node_nws_key[16]; uint8_t node_apps_key[16]; uint32_t node_dev_addr; uint32_t send_repeat_time; bool adr_enabled; bool public_network; bool duty_cycle_enabled; uint8_t join_trials; uint8_t tx_power; uint8_t data_rate; uint8_t lora_class; uint8_t subband_channels; uint8_t app_port; int confirmed_msg_enabled; uint8_t lora_region; bool lorawan_enable; uint32_t p2p_frequency; uint8_t p2p_tx_power; uint8_t p2p_bandwidth; uint8_t p2p_sf; uint8_t p2p_cr; uint8_t p2p_preamble_len; uint16_t p2p_symbol_timeout; bool resetRequest; };
+extern s_lorawan_settings g_lorawan_settings;
+typedef struct atcmd_s { const char *cmd_name; const char *cmd_desc; int (*query_cmd)(void); int (*exec_cmd)(char *str); int (*exec_cmd_no_para)(void); const char *permission; } atcmd_t;
+extern volatile uint16_t g_task_event_type;
+extern uint8_t g_rx_lora_data[256]; extern uint8_t g_rx_data_len; extern int16_t g_last_rssi; extern int8_t g_last_snr;
+extern bool g_join_result; extern bool g_lpwan_has_joined; extern bool g_rx_fin_result; extern bool g_enable_ble; extern bool g_ble_uart_is_connected;
+extern uint16_t g_sw_ver_1, g_sw_ver_2, g_sw_ver_3;
+extern char g_ble_dev_name[];
+void api_wake_loop(uint16_t); void api_timer_stop(); void api_timer_restart(uint32_t); void api_timer_start(); void api_log_settings(); void api_reset();
+void save_settings(); bool get_settings(); void at_serial_input(uint8_t);
+lmh_error_status send_lora_packet(uint8_t *data, uint8_t size, uint8_t fport = 0);
+bool send_p2p_packet(uint8_t *data, uint8_t size);
+float read_batt(); void restart_advertising(uint16_t); int lmh_join();
+class BLEUart : public Stream { public: size_t write(const uint8_t*, size_t); using Stream::read; int read(uint8_t*, uint16_t); int available(); void flush(); };
+extern BLEUart g_ble_uart;
+typedef enum { LORAMAC_STATUS_OK = 0, LORAMAC_STATUS_BUSY, LORAMAC_STATUS_LENGTH_ERROR = 8 } LoRaMacStatus_t;
+typedef struct { uint8_t MaxPossiblePayload; uint8_t CurrentPayloadSize; } LoRaMacTxInfo_t;
+LoRaMacStatus_t LoRaMacQueryTxPossible(uint8_t size, LoRaMacTxInfo_t *txInfo);
+typedef enum { MIB_CHANNELS_DATARATE = 1 } Mib_t;
+typedef struct { Mib_t Type; union { int8_t ChannelsDatarate; } Param; } MibRequestConfirm_t;
+LoRaMacStatus_t LoRaMacMibGetRequestConfirm(MibRequestConfirm_t *mibGet);
+enum { LORAMAC_REGION_AS923 = 0, LORAMAC_REGION_AU915, LORAMAC_REGION_CN470, LORAMAC_REGION_CN779, LORAMAC_REGION_EU433, LORAMAC_REGION_EU868, LORAMAC_REGION_KR920, LORAMAC_REGION_IN865, LORAMAC_REGION_US915 };
+#define CHR_PROPS_READ 0x02
+#define CHR_PROPS_NOTIFY 0x10
+#define SECMODE_OPEN 1
+#define SECMODE_NO_ACCESS 0
+class BLEUuid { public: BLEUuid(const uint8_t*); BLEUuid(uint16_t); };
+class BLEService { public: BLEService(BLEUuid); uint32_t begin(); };
+class BLECharacteristic; typedef void (*write_cccd_cb_t)(uint16_t, BLECharacteristic*, uint16_t);
+class BLECharacteristic { public: BLECharacteristic(BLEUuid); void setProperties(uint8_t); void setPermission(int, int); void setFixedLen(uint16_t); void setUserDescriptor(const char*); void setCccdWriteCallback(write_cccd_cb_t, bool=false); uint32_t begin(); uint16_t write(const void*, uint16_t); bool notify(const void*, uint16_t); bool notifyEnabled(); };
+class BLEConnection { public: bool requestConnectionParameter(uint16_t, uint16_t=0, uint16_t=200); uint16_t getConnectionInterval(); };
+class AdafruitBluefruit { public: BLEConnection *Connection(uint16_t); bool connected(); };
+extern AdafruitBluefruit Bluefruit;
+extern bool g_enable_ble;
+typedef struct sMulticastParams { uint32_t Address; uint8_t NwkSKey[16]; uint8_t AppSKey[16]; uint32_t DownLinkCounter; struct sMulticastParams *Next; } MulticastParams_t;
+LoRaMacStatus_t LoRaMacMulticastChannelLink(MulticastParams_t *channelParam);
+LoRaMacStatus_t LoRaMacMulticastChannelUnlink(MulticastParams_t *channelParam);
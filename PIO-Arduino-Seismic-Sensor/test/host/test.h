@@ -0,0 +1,60 @@
+/**
+ * @file test.h
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Minimal test framework for the host tests
+ *        A failed check prints the location and the test returns a non-zero exit code for ctest.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+/** Number of failed checks */
+static int test_failed = 0;
+
+/** Number of checks */
+static int test_checks = 0;
+
+#define CHECK(cond)                                                             \
+	do                                                                          \
+	{                                                                           \
+		test_checks++;                                                          \
+		if (!(cond))                                                            \
+		{                                                                       \
+			test_failed++;                                                      \
+			printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);     \
+		}                                                                       \
+	} while (0)
+
+#define CHECK_EQ(a, b)                                                                          \
+	do                                                                                          \
+	{                                                                                           \
+		test_checks++;                                                                          \
+		long long _a = (long long)(a);                                                          \
+		long long _b = (long long)(b);                                                          \
+		if (_a != _b)                                                                           \
+		{                                                                                       \
+			test_failed++;                                                                      \
+			printf("%s:%d: CHECK_EQ(%s, %s) failed, %lld != %lld\n", __FILE__, __LINE__, #a, #b, \
+				   _a, _b);                                                                     \
+		}                                                                                       \
+	} while (0)
+
+/** Run a test function */
+#define RUN(test)                         \
+	do                                    \
+	{                                     \
+		int _failed = test_failed;        \
+		test();                           \
+		printf("%s %s\n", _failed == test_failed ? "PASS" : "FAIL", #test); \
+	} while (0)
+
+/** Result for main() */
+#define TEST_RESULT() (printf("%d checks, %d failed\n", test_checks, test_failed), test_failed != 0 ? 1 : 0)
+
+#endif // TEST_H
@@ -0,0 +1,215 @@
+/**
+ * @file test_battery.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host test of the battery sampling with noisy ADC traces
+ *        The ADC reads have white noise, quantization steps and single spikes.
+ *        The median and the EMA must give a steady voltage and state of charge.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "host_fakes.h"
+#include "test.h"
+#include <math.h>
+
+app_settings_s g_app_settings;
+bool earthquake_start = false;
+
+/** Voltage of the simulated battery in mV */
+static float sim_batt_mv = 3800.0f;
+
+/** White noise of the ADC in mV, standard deviation */
+static float sim_noise_mv = 0.0f;
+
+/** Probability of a spike in a read, e.g. a load step of the radio or a sensor */
+static float sim_spike_rate = 0.0f;
+
+/** Size of a spike in mV */
+static float sim_spike_mv = -600.0f;
+
+/** ADC reads */
+static uint32_t sim_reads = 0;
+
+/** Sum of the reads of the current sample, for the comparison with a plain average */
+static float sim_read_sum = 0.0f;
+
+/** Step of the 12 bit ADC with 3.0 V reference and the 1.73 divider of the RAK4631 in mV */
+#define SIM_ADC_STEP (3000.0f / 4096.0f * 1.73f)
+
+/**
+ * @brief Gaussian noise, Box-Muller
+ *
+ * @return float noise with standard deviation 1
+ */
+static float sim_gauss(void)
+{
+	float u1 = (rand() + 1.0f) / (RAND_MAX + 2.0f);
+	float u2 = (rand() + 1.0f) / (RAND_MAX + 2.0f);
+	return sqrtf(-2.0f * logf(u1)) * cosf(2.0f * (float)M_PI * u2);
+}
+
+/**
+ * @brief ADC read of the battery voltage
+ *
+ * @return float battery voltage in mV
+ */
+float read_batt(void)
+{
+	sim_reads++;
+	float mv = sim_batt_mv + sim_noise_mv * sim_gauss();
+	if ((float)rand() / RAND_MAX < sim_spike_rate)
+	{
+		mv += sim_spike_mv;
+	}
+	mv = floorf(mv / SIM_ADC_STEP) * SIM_ADC_STEP;
+	sim_read_sum += mv;
+	return mv;
+}
+
+void heartbeat_start(void)
+{
+}
+
+/** Statistics of a trace */
+struct trace_s
+{
+	float max_error;   // Largest difference of the filtered voltage to the battery
+	float rms_error;   // RMS difference of the filtered voltage to the battery
+	uint8_t soc_min;   // Smallest state of charge
+	uint8_t soc_max;   // Largest state of charge
+	uint32_t soc_jumps; // Changes of the state of charge between two heartbeats
+	float avg_rms_error; // RMS error of the same EMA on the average instead of the median of the reads
+};
+
+/**
+ * @brief Take samples at a constant battery voltage
+ *
+ * @param samples number of heartbeats
+ * @return trace_s statistics after the filter settled
+ */
+static trace_s run_trace(uint32_t samples)
+{
+	// Settle the filter without noise
+	float noise = sim_noise_mv;
+	float spikes = sim_spike_rate;
+	sim_noise_mv = 0.0f;
+	sim_spike_rate = 0.0f;
+	for (int idx = 0; idx < 200; idx++)
+	{
+		sample_batt();
+	}
+	sim_noise_mv = noise;
+	sim_spike_rate = spikes;
+
+	trace_s trace = {0.0f, 0.0f, 100, 0, 0, 0.0f};
+	double sum = 0;
+	double avg_sum = 0;
+	float avg_filtered = get_batt_mv();
+	uint8_t last_soc = get_batt_soc();
+	for (uint32_t idx = 0; idx < samples; idx++)
+	{
+		sim_read_sum = 0.0f;
+		sample_batt();
+		float error = fabsf(get_batt_mv() - sim_batt_mv);
+		sum += error * error;
+		avg_filtered += (sim_read_sum / 5 - avg_filtered) / BATT_FILTER_DIV;
+		avg_sum += (avg_filtered - sim_batt_mv) * (avg_filtered - sim_batt_mv);
+		trace.max_error = error > trace.max_error ? error : trace.max_error;
+		uint8_t soc = get_batt_soc();
+		trace.soc_min = soc < trace.soc_min ? soc : trace.soc_min;
+		trace.soc_max = soc > trace.soc_max ? soc : trace.soc_max;
+		trace.soc_jumps += soc != last_soc ? 1 : 0;
+		last_soc = soc;
+	}
+	trace.rms_error = sqrt(sum / samples);
+	trace.avg_rms_error = sqrt(avg_sum / samples);
+	return trace;
+}
+
+/**
+ * @brief White noise is reduced by the median and the EMA
+ *
+ */
+static void test_noise(void)
+{
+	srand(1);
+	sim_batt_mv = 3800.0f;
+	sim_noise_mv = 30.0f;
+	sim_spike_rate = 0.0f;
+	sim_reads = 0;
+	trace_s trace = run_trace(5000);
+	CHECK_EQ(sim_reads, 5 * 5200);
+	printf("Noise 30 mV: RMS error %.1f mV, max error %.1f mV, SoC %d ... %d%%\n", trace.rms_error, trace.max_error,
+		   trace.soc_min, trace.soc_max);
+	// One read has an RMS error of 30 mV, the filter reduces it by more than 3
+	CHECK(trace.rms_error < 10.0f);
+	CHECK(trace.max_error < 35.0f);
+	// 3800 mV is 50%, 30 mV are 10% on this part of the curve
+	CHECK(trace.soc_min >= 44);
+	CHECK(trace.soc_max <= 56);
+}
+
+/**
+ * @brief Single spikes are removed by the median
+ *
+ */
+static void test_spikes(void)
+{
+	srand(2);
+	sim_batt_mv = 3700.0f;
+	sim_noise_mv = 0.0f;
+	// Every 10th read is a spike
+	sim_spike_rate = 0.1f;
+	trace_s trace = run_trace(5000);
+	printf("Spikes: RMS error %.1f mV (%.1f mV with the average of the reads), max error %.1f mV, SoC %d ... %d%%\n",
+		   trace.rms_error, trace.avg_rms_error, trace.max_error, trace.soc_min, trace.soc_max);
+	// Only samples with 3 or more spikes in 5 reads get through, less than 1%
+	CHECK(trace.rms_error < 20.0f);
+	CHECK(trace.rms_error * 3 < trace.avg_rms_error);
+
+	// Without spikes the result is only off by the quantization
+	sim_spike_rate = 0.0f;
+	trace = run_trace(100);
+	CHECK(trace.max_error < SIM_ADC_STEP);
+	CHECK_EQ(trace.soc_jumps, 0);
+}
+
+/**
+ * @brief The filtered voltage follows a slow discharge, the state of charge goes down steadily
+ *
+ */
+static void test_discharge(void)
+{
+	srand(3);
+	sim_noise_mv = 20.0f;
+	sim_spike_rate = 0.02f;
+	sim_batt_mv = 4150.0f;
+	run_trace(10);
+	uint8_t last = get_batt_soc();
+	uint32_t raises = 0;
+	for (uint32_t beat = 0; beat < 4000; beat++)
+	{
+		sim_batt_mv = 4150.0f - 850.0f * beat / 4000;
+		sample_batt();
+		uint8_t soc = get_batt_soc();
+		raises += soc > last ? 1 : 0;
+		// No jumps of more than a few percent between two heartbeats
+		CHECK(abs(soc - last) <= 5);
+		last = soc;
+	}
+	printf("Discharge: SoC went up %ld times in 4000 heartbeats\n", (long)raises);
+	CHECK(last <= 3);
+	// The battery goes down 0.2 mV per heartbeat, the noise moves the SoC up now and then
+	CHECK(raises < 400);
+}
+
+int main(void)
+{
+	RUN(test_noise);
+	RUN(test_spikes);
+	RUN(test_discharge);
+	return TEST_RESULT();
+}
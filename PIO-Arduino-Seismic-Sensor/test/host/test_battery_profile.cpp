@@ -0,0 +1,203 @@
+/**
+ * @file test_battery_profile.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host test of the battery profiles with synthetic discharge curves
+ *        The battery is discharged and charged again over many heartbeats, the ADC reads have noise.
+ *        The profile must follow the battery without switching back and forth.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "host_fakes.h"
+#include "test.h"
+#include <math.h>
+
+app_settings_s g_app_settings;
+bool earthquake_start = false;
+
+/** Voltage of the simulated battery in mV */
+static float sim_batt_mv = 4200.0f;
+
+/** Noise of the ADC reads in mV, peak */
+static float sim_noise_mv = 0.0f;
+
+/**
+ * @brief ADC read of the battery with noise
+ *
+ * @return float battery voltage in mV
+ */
+float read_batt(void)
+{
+	return sim_batt_mv + sim_noise_mv * (2.0f * rand() / RAND_MAX - 1.0f);
+}
+
+/** Heartbeat times set by the profile module */
+static std::vector<uint32_t> timer_restarts;
+
+void heartbeat_start(void)
+{
+	timer_restarts.push_back(get_heartbeat_time());
+}
+
+/** One profile change of a run */
+struct change_s
+{
+	uint8_t profile;
+	float battery;
+};
+
+/**
+ * @brief Take a sample after each heartbeat and follow the profile
+ *
+ * @param from start voltage
+ * @param to end voltage
+ * @param heartbeats number of heartbeats
+ * @param changes profile changes
+ */
+static void run_curve(float from, float to, uint32_t heartbeats, std::vector<change_s> &changes)
+{
+	for (uint32_t beat = 0; beat <= heartbeats; beat++)
+	{
+		sim_batt_mv = from + (to - from) * beat / heartbeats;
+		uint8_t profile = get_batt_profile();
+		sample_batt();
+		update_batt_profile();
+		if (get_batt_profile() != profile)
+		{
+			change_s change = {get_batt_profile(), sim_batt_mv};
+			changes.push_back(change);
+		}
+	}
+}
+
+/**
+ * @brief Slow discharge from full to empty, then charged by the solar panel
+ *
+ */
+static void test_discharge_charge(void)
+{
+	srand(1);
+	sim_noise_mv = 40.0f;
+	g_lorawan_settings.send_repeat_time = 600000;
+	g_app_settings.payload_format = PAYLOAD_FULL;
+	timer_restarts.clear();
+
+	std::vector<change_s> changes;
+	run_curve(4200.0f, 3200.0f, 2000, changes);
+	// One change per threshold, no switching back and forth
+	CHECK_EQ(changes.size(), 2);
+	CHECK_EQ(changes[0].profile, BATT_PROFILE_CONSERVE);
+	CHECK_EQ(changes[1].profile, BATT_PROFILE_CRITICAL);
+	// The EMA lags a few mV behind on a slow discharge
+	CHECK(fabs(changes[0].battery - BATT_CONSERVE_MV) < 25);
+	CHECK(fabs(changes[1].battery - BATT_CRITICAL_MV) < 25);
+	CHECK_EQ(timer_restarts.size(), 2);
+	CHECK_EQ(timer_restarts[0], 1200000);
+	CHECK_EQ(timer_restarts[1], 2400000);
+	CHECK_EQ(get_heartbeat_time(), 2400000);
+	CHECK(!is_full_payload());
+	CHECK(!is_ble_allowed());
+	// The configured heartbeat is not changed
+	CHECK_EQ(g_lorawan_settings.send_repeat_time, 600000);
+
+	changes.clear();
+	run_curve(3200.0f, 4200.0f, 2000, changes);
+	CHECK_EQ(changes.size(), 2);
+	CHECK_EQ(changes[0].profile, BATT_PROFILE_CONSERVE);
+	CHECK_EQ(changes[1].profile, BATT_PROFILE_NORMAL);
+	CHECK(fabs(changes[0].battery - (BATT_CRITICAL_MV + BATT_HYSTERESIS)) < 25);
+	CHECK(fabs(changes[1].battery - (BATT_CONSERVE_MV + BATT_HYSTERESIS)) < 25);
+	CHECK_EQ(get_heartbeat_time(), 600000);
+	CHECK(is_full_payload());
+	CHECK(is_ble_allowed());
+}
+
+/**
+ * @brief Battery hovers around a threshold, the hysteresis keeps the profile
+ *
+ */
+static void test_hover(void)
+{
+	srand(2);
+	sim_noise_mv = 40.0f;
+	std::vector<change_s> changes;
+	// Settle above the threshold
+	run_curve(3650.0f, 3650.0f, 100, changes);
+	changes.clear();
+	for (int cycle = 0; cycle < 20; cycle++)
+	{
+		// Day and night, the battery swings +-60 mV around the threshold
+		run_curve(BATT_CONSERVE_MV + 60.0f, BATT_CONSERVE_MV - 60.0f, 72, changes);
+		run_curve(BATT_CONSERVE_MV - 60.0f, BATT_CONSERVE_MV + 60.0f, 72, changes);
+	}
+	CHECK_EQ(changes.size(), 1);
+	CHECK_EQ(get_batt_profile(), BATT_PROFILE_CONSERVE);
+}
+
+/**
+ * @brief A sudden drop, like a cold night, ends in the critical profile within a few heartbeats
+ *        and the heartbeat is not restarted during an earthquake
+ *
+ */
+static void test_drop(void)
+{
+	sim_noise_mv = 0.0f;
+	std::vector<change_s> changes;
+	run_curve(4000.0f, 4000.0f, 100, changes);
+	CHECK_EQ(get_batt_profile(), BATT_PROFILE_NORMAL);
+
+	// A single bad sample does not change the profile
+	changes.clear();
+	run_curve(3300.0f, 3300.0f, 1, changes);
+	CHECK_EQ(get_batt_profile(), BATT_PROFILE_NORMAL);
+
+	timer_restarts.clear();
+	earthquake_start = true;
+	run_curve(3300.0f, 3300.0f, 40, changes);
+	earthquake_start = false;
+	CHECK_EQ(get_batt_profile(), BATT_PROFILE_CRITICAL);
+	// The filtered voltage passes the conserve threshold on the way down
+	CHECK_EQ(changes.size(), 2);
+	CHECK_EQ(timer_restarts.size(), 0);
+}
+
+/**
+ * @brief The state of charge follows the discharge curve
+ *
+ */
+static void test_soc(void)
+{
+	sim_noise_mv = 0.0f;
+	std::vector<change_s> changes;
+	uint8_t last = 100;
+	for (float mv = 4300.0f; mv >= 2900.0f; mv -= 10.0f)
+	{
+		run_curve(mv, mv, 60, changes);
+		uint8_t soc = get_batt_soc();
+		CHECK(soc <= last);
+		last = soc;
+		if (mv >= 4200.0f)
+		{
+			CHECK_EQ(soc, 100);
+		}
+		if (mv <= 3000.0f)
+		{
+			CHECK_EQ(soc, 0);
+		}
+	}
+	run_curve(3800.0f, 3800.0f, 100, changes);
+	// The filter approaches the voltage from below
+	CHECK(get_batt_soc() >= 49 && get_batt_soc() <= 50);
+}
+
+int main(void)
+{
+	RUN(test_discharge_charge);
+	RUN(test_hover);
+	RUN(test_drop);
+	RUN(test_soc);
+	return TEST_RESULT();
+}
@@ -0,0 +1,360 @@
+/**
+ * @file test_ble_rx.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host simulation of AT commands received over BLE UART
+ *        A central streams a config script, 4 packets per connection interval, into the BLE UART FIFO.
+ *        The old handler read the FIFO byte by byte with delay(5), the ring buffer handles complete lines.
+ *        The command throughput and the longest time the loop is blocked by one wakeup are compared.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "host_fakes.h"
+#include "test.h"
+#include <deque>
+
+/** Size of the BLE UART FIFO of the Bluefruit library */
+#define SIM_FIFO_SIZE 256
+
+/** Connection interval in ms, packets per connection event and bytes per packet */
+#define SIM_CONN_INTERVAL 15
+#define SIM_PACKETS 4
+#define SIM_PACKET_SIZE 20
+
+/** Time the AT command parser needs for a command in us */
+#define SIM_COMMAND_US 10000
+
+/** Time the AT command parser needs for a byte in us */
+#define SIM_BYTE_US 2
+
+/** Simulated central */
+struct sim_central_s
+{
+	std::string script;	  // Data to send
+	size_t sent;		  // Bytes sent
+	bool paused;		  // Central got +EVT:BLE_BUSY
+	uint32_t next_packet; // millis() of the next connection event
+	uint32_t lost;		  // Bytes that did not fit into the FIFO
+	uint32_t busy;		  // +EVT:BLE_BUSY received
+	uint32_t ready;		  // +EVT:BLE_READY received
+};
+
+static sim_central_s sim_central;
+
+/** BLE UART FIFO */
+static std::deque<uint8_t> sim_fifo;
+
+/** Lines received by the AT command parser */
+static std::vector<std::string> sim_lines;
+static std::string sim_line;
+
+/** Due time of the line timeout job */
+static bool sim_timeout_running = false;
+static uint32_t sim_timeout_due = 0;
+
+BLEUart g_ble_uart;
+
+int BLEUart::available(void)
+{
+	return (int)sim_fifo.size();
+}
+
+int BLEUart::read(uint8_t *data, uint16_t len)
+{
+	uint16_t num = 0;
+	while ((num < len) && !sim_fifo.empty())
+	{
+		data[num++] = sim_fifo.front();
+		sim_fifo.pop_front();
+	}
+	return num;
+}
+
+int Stream::read(void)
+{
+	if (sim_fifo.empty())
+	{
+		return -1;
+	}
+	uint8_t data = sim_fifo.front();
+	sim_fifo.pop_front();
+	return data;
+}
+
+size_t BLEUart::write(const uint8_t *data, size_t len)
+{
+	std::string text((const char *)data, len);
+	if (text == "+EVT:BLE_BUSY\n")
+	{
+		sim_central.paused = true;
+		sim_central.busy++;
+	}
+	else if (text == "+EVT:BLE_READY\n")
+	{
+		sim_central.paused = false;
+		sim_central.ready++;
+	}
+	return len;
+}
+
+void at_serial_input(uint8_t cmd)
+{
+	host_advance_us(SIM_BYTE_US);
+	if (cmd == '\n')
+	{
+		if (!sim_line.empty())
+		{
+			sim_lines.push_back(sim_line);
+			host_advance_us(SIM_COMMAND_US);
+		}
+		sim_line.clear();
+		return;
+	}
+	sim_line += (char)cmd;
+}
+
+void sched_start(uint8_t job, uint32_t delay_ms, uint32_t period_ms, uint32_t tolerance_ms)
+{
+	CHECK_EQ(job, SCHED_BLE_RX);
+	sim_timeout_running = true;
+	sim_timeout_due = millis() + delay_ms;
+}
+
+void sched_stop(uint8_t job)
+{
+	sim_timeout_running = false;
+}
+
+/**
+ * @brief The central sends the packets of the connection events until now
+ *        The BLE stack runs in its own task, it fills the FIFO while the loop is blocked
+ *
+ */
+static void sim_central_run(void)
+{
+	while ((int32_t)(millis() - sim_central.next_packet) >= 0)
+	{
+		sim_central.next_packet += SIM_CONN_INTERVAL;
+		if (sim_central.paused || (sim_central.sent == sim_central.script.size()))
+		{
+			continue;
+		}
+		size_t len = sim_central.script.size() - sim_central.sent;
+		len = len > SIM_PACKETS * SIM_PACKET_SIZE ? SIM_PACKETS * SIM_PACKET_SIZE : len;
+		for (size_t idx = 0; idx < len; idx++)
+		{
+			if (sim_fifo.size() < SIM_FIFO_SIZE)
+			{
+				sim_fifo.push_back(sim_central.script[sim_central.sent + idx]);
+			}
+			else
+			{
+				sim_central.lost++;
+			}
+		}
+		sim_central.sent += len;
+		api_wake_loop(BLE_DATA);
+	}
+}
+
+void delay(unsigned long ms)
+{
+	host_advance_ms(ms);
+	sim_central_run();
+}
+
+/**
+ * @brief The handler before the ring buffer
+ *
+ */
+static void ble_rx_handler_old(void)
+{
+	while (g_ble_uart.available() > 0)
+	{
+		at_serial_input(uint8_t(g_ble_uart.read()));
+		delay(5);
+	}
+	at_serial_input(uint8_t('\n'));
+}
+
+/** Result of a run */
+struct sim_result_s
+{
+	uint32_t duration_ms; // Time until the last command was handled
+	uint32_t stall_ms;	  // Longest handler call
+	uint32_t wakeups;	  // Handler calls
+};
+
+/**
+ * @brief Run the loop until the central has sent everything and the buffers are empty
+ *
+ * @param script data the central sends
+ * @param old use the handler before the ring buffer
+ * @return sim_result_s timing of the run
+ */
+static sim_result_s sim_run(const std::string &script, bool old)
+{
+	sim_central = sim_central_s();
+	sim_central.script = script;
+	sim_central.next_packet = millis();
+	sim_fifo.clear();
+	sim_lines.clear();
+	sim_line.clear();
+	g_task_event_type = 0;
+	sim_result_s result = {0, 0, 0};
+	uint32_t start = millis();
+	uint32_t last = start;
+	while ((millis() - start) < 600000)
+	{
+		sim_central_run();
+		if (sim_timeout_running && ((int32_t)(millis() - sim_timeout_due) >= 0))
+		{
+			sim_timeout_running = false;
+			api_wake_loop(BLE_DATA);
+		}
+		if (g_task_event_type & BLE_DATA)
+		{
+			g_task_event_type &= N_BLE_DATA;
+			uint64_t call = host_us;
+			old ? ble_rx_handler_old() : ble_rx_handler();
+			uint32_t stall = (uint32_t)((host_us - call) / 1000);
+			result.stall_ms = stall > result.stall_ms ? stall : result.stall_ms;
+			result.wakeups++;
+			last = millis();
+			continue;
+		}
+		if ((sim_central.sent == script.size()) && sim_fifo.empty() && !sim_timeout_running)
+		{
+			break;
+		}
+		host_advance_ms(1);
+	}
+	result.duration_ms = last - start;
+	return result;
+}
+
+/**
+ * @brief Config script with numbered commands
+ *
+ * @param num number of commands
+ * @return std::string script with CR LF line ends
+ */
+static std::string make_script(uint16_t num)
+{
+	std::string script;
+	char line[64];
+	for (uint16_t idx = 0; idx < num; idx++)
+	{
+		snprintf(line, sizeof(line), "AT+CFG=%04d,abcdefghijklmnopqrstuvwxyz\r\n", idx);
+		script += line;
+	}
+	return script;
+}
+
+/**
+ * @brief Check that the parser got the commands of the script in order
+ *
+ * @param num number of commands
+ * @return uint16_t number of correct commands
+ */
+static uint16_t correct_lines(uint16_t num)
+{
+	uint16_t correct = 0;
+	char line[64];
+	for (uint16_t idx = 0; (idx < num) && (idx < sim_lines.size()); idx++)
+	{
+		snprintf(line, sizeof(line), "AT+CFG=%04d,abcdefghijklmnopqrstuvwxyz", idx);
+		correct += sim_lines[idx] == line ? 1 : 0;
+	}
+	return correct;
+}
+
+/**
+ * @brief One command, the loop is blocked by the per byte delay before
+ *
+ */
+static void test_single_command(void)
+{
+	std::string command = "AT+BAND=4\r\n";
+	sim_result_s old = sim_run(command, true);
+	CHECK_EQ(sim_lines.size(), 1);
+	sim_result_s ring = sim_run(command, false);
+	CHECK_EQ(sim_lines.size(), 1);
+	CHECK(sim_lines[0] == "AT+BAND=4");
+	printf("One command: loop blocked %ld ms before, %ld ms with the ring buffer\n", (long)old.stall_ms,
+		   (long)ring.stall_ms);
+	CHECK(old.stall_ms >= 5 * (command.size() - 1));
+	CHECK(ring.stall_ms <= SIM_COMMAND_US / 1000 + 1);
+}
+
+/**
+ * @brief A config script faster than the commands are handled
+ *        The central is paused and continues, no byte is lost and no wakeup handles more than 4 commands
+ *
+ */
+static void test_script(void)
+{
+	uint16_t num = 200;
+	std::string script = make_script(num);
+	sim_result_s old = sim_run(script, true);
+	uint16_t old_correct = correct_lines(num);
+	uint32_t old_lost = sim_central.lost;
+	sim_result_s ring = sim_run(script, false);
+	uint16_t ring_correct = correct_lines(num);
+	printf("Script of %d commands before: %d correct, %ld bytes lost, %ld ms, loop blocked up to %ld ms\n", num,
+		   old_correct, (long)old_lost, (long)old.duration_ms, (long)old.stall_ms);
+	printf("Script of %d commands after: %d correct, %ld ms, %.1f commands/s, loop blocked up to %ld ms, %ld wakeups, "
+		   "%ld pauses\n",
+		   num, ring_correct, (long)ring.duration_ms, num * 1000.0 / ring.duration_ms, (long)ring.stall_ms,
+		   (long)ring.wakeups, (long)sim_central.busy);
+	CHECK_EQ(sim_lines.size(), num);
+	CHECK_EQ(ring_correct, num);
+	CHECK_EQ(sim_central.lost, 0);
+	// The commands are handled faster than the central sends, so it was paused
+	CHECK(sim_central.busy > 0);
+	CHECK_EQ(sim_central.busy, sim_central.ready);
+	CHECK(!sim_central.paused);
+	// 4 commands per wakeup at most
+	CHECK(ring.stall_ms <= 4 * (SIM_COMMAND_US / 1000 + 1));
+	// The parser is the limit, not the BLE UART
+	CHECK(ring.duration_ms <= num * (SIM_COMMAND_US / 1000 + 1) * 11U / 10);
+	CHECK(old.stall_ms > 10 * ring.stall_ms);
+}
+
+/**
+ * @brief A command without line end is handled after the timeout
+ *
+ */
+static void test_no_line_end(void)
+{
+	sim_run("AT+VER?", false);
+	CHECK_EQ(sim_lines.size(), 1);
+	CHECK(sim_lines[0] == "AT+VER?");
+	CHECK(!sim_timeout_running);
+}
+
+/**
+ * @brief A line longer than the high water mark is dropped completely, the next line is handled
+ *
+ */
+static void test_long_line(void)
+{
+	std::string script(700, 'X');
+	script += "\r\nAT+VER?\r\n";
+	sim_run(script, false);
+	CHECK_EQ(sim_lines.size(), 1);
+	CHECK(sim_lines[0] == "AT+VER?");
+	CHECK_EQ(sim_central.lost, 0);
+}
+
+int main(void)
+{
+	RUN(test_single_command);
+	RUN(test_script);
+	RUN(test_no_line_end);
+	RUN(test_long_line);
+	return TEST_RESULT();
+}
@@ -0,0 +1,385 @@
+/**
+ * @file test_ble_telemetry.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host test of the BLE telemetry service
+ *        The values are checked byte by byte as the client receives them,
+ *        only changed values are notified. The time on air of a notification cycle
+ *        is estimated for the connection interval the device requests.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "host_fakes.h"
+#include "test.h"
+#include <map>
+
+app_settings_s g_app_settings;
+bool earthquake_start = false;
+bool shutoff_alert = false;
+bool collapse_alert = false;
+float peakSI = 0.0f;
+float peakPGA = 0.0f;
+
+/** Values of the simulated sensors */
+static uint8_t sim_state = 0;
+static float sim_si = 0.0f;
+static float sim_pga = 0.0f;
+static bool sim_clock = false;
+static float sim_batt_mv = 3900.0f;
+static uint8_t sim_soc = 70;
+static uint8_t sim_profile = BATT_PROFILE_NORMAL;
+
+uint8_t state_rak12027(void)
+{
+	return sim_state;
+}
+
+bool instant_rak12027(float *si, float *pga)
+{
+	*si = sim_si;
+	*pga = sim_pga;
+	return true;
+}
+
+bool is_clock_valid(void)
+{
+	return sim_clock;
+}
+
+float get_batt_mv(void)
+{
+	return sim_batt_mv;
+}
+
+uint8_t get_batt_soc(void)
+{
+	return sim_soc;
+}
+
+uint8_t get_batt_profile(void)
+{
+	return sim_profile;
+}
+
+/** Telemetry job of the scheduler */
+static bool sim_job = false;
+static uint32_t sim_job_period = 0;
+
+void sched_start(uint8_t job, uint32_t delay_ms, uint32_t period_ms, uint32_t tolerance_ms)
+{
+	CHECK_EQ(job, SCHED_TELEMETRY);
+	sim_job = true;
+	sim_job_period = period_ms;
+}
+
+void sched_stop(uint8_t job)
+{
+	CHECK_EQ(job, SCHED_TELEMETRY);
+	sim_job = false;
+}
+
+bool sched_active(uint8_t job)
+{
+	return sim_job;
+}
+
+/** One characteristic as the client sees it */
+struct sim_char_s
+{
+	uint16_t fixed_len;
+	bool subscribed;
+	bool notify_fails;
+	write_cccd_cb_t cccd_cb;
+	std::vector<std::vector<uint8_t> > notified;
+	std::vector<uint8_t> value;
+};
+
+static std::map<BLECharacteristic *, sim_char_s> sim_chars;
+
+/** Connection interval requested by the device in units of 1.25 ms */
+static uint16_t sim_conn_interval = 0;
+
+BLEUuid::BLEUuid(const uint8_t *uuid)
+{
+}
+
+BLEService::BLEService(BLEUuid uuid)
+{
+}
+
+uint32_t BLEService::begin(void)
+{
+	return 0;
+}
+
+BLECharacteristic::BLECharacteristic(BLEUuid uuid)
+{
+}
+
+void BLECharacteristic::setProperties(uint8_t props)
+{
+	CHECK_EQ(props, CHR_PROPS_READ | CHR_PROPS_NOTIFY);
+}
+
+void BLECharacteristic::setPermission(int read, int write)
+{
+}
+
+void BLECharacteristic::setFixedLen(uint16_t len)
+{
+	sim_chars[this].fixed_len = len;
+}
+
+void BLECharacteristic::setUserDescriptor(const char *descriptor)
+{
+}
+
+void BLECharacteristic::setCccdWriteCallback(write_cccd_cb_t callback, bool use_adafruit_cb)
+{
+	sim_chars[this].cccd_cb = callback;
+}
+
+uint32_t BLECharacteristic::begin(void)
+{
+	return 0;
+}
+
+uint16_t BLECharacteristic::write(const void *data, uint16_t len)
+{
+	CHECK_EQ(len, sim_chars[this].fixed_len);
+	sim_chars[this].value.assign((const uint8_t *)data, (const uint8_t *)data + len);
+	return len;
+}
+
+bool BLECharacteristic::notify(const void *data, uint16_t len)
+{
+	sim_char_s &chr = sim_chars[this];
+	CHECK_EQ(len, chr.fixed_len);
+	if (chr.notify_fails)
+	{
+		return false;
+	}
+	chr.value.assign((const uint8_t *)data, (const uint8_t *)data + len);
+	chr.notified.push_back(chr.value);
+	return true;
+}
+
+bool BLECharacteristic::notifyEnabled(void)
+{
+	return sim_chars[this].subscribed;
+}
+
+bool BLEConnection::requestConnectionParameter(uint16_t conn_interval, uint16_t slave_latency, uint16_t sup_timeout)
+{
+	sim_conn_interval = conn_interval;
+	return true;
+}
+
+static BLEConnection sim_connection;
+
+BLEConnection *AdafruitBluefruit::Connection(uint16_t conn_hdl)
+{
+	return &sim_connection;
+}
+
+AdafruitBluefruit Bluefruit;
+
+extern BLECharacteristic telem_state_char;
+extern BLECharacteristic telem_si_pga_char;
+extern BLECharacteristic telem_flags_char;
+extern BLECharacteristic telem_batt_char;
+
+/**
+ * @brief The client enables or disables the notifications of a characteristic
+ *
+ * @param chr characteristic
+ * @param enable true to subscribe
+ */
+static void sim_subscribe(BLECharacteristic *chr, bool enable)
+{
+	sim_chars[chr].subscribed = enable;
+	sim_chars[chr].cccd_cb(1, chr, enable ? 1 : 0);
+}
+
+/**
+ * @brief Clear the notifications the client received
+ *
+ */
+static void sim_clear(void)
+{
+	for (std::map<BLECharacteristic *, sim_char_s>::iterator it = sim_chars.begin(); it != sim_chars.end(); ++it)
+	{
+		it->second.notified.clear();
+	}
+}
+
+/**
+ * @brief 16 bit value of a notification, little endian
+ *
+ */
+static uint16_t le16(const std::vector<uint8_t> &value, uint8_t pos)
+{
+	return value[pos] | (value[pos + 1] << 8);
+}
+
+/**
+ * @brief SI/PGA are packed in 0.001 units and limited to 16 bit
+ *
+ */
+static void test_encoder(void)
+{
+	sim_subscribe(&telem_si_pga_char, true);
+	CHECK(sim_job);
+	CHECK_EQ(sim_job_period, TELEM_DEFAULT_INTERVAL);
+
+	sim_si = 0.1234f;
+	sim_pga = 2.5f;
+	peakSI = 70.0f;
+	peakPGA = -1.0f;
+	ble_telemetry_handler();
+	sim_char_s &si_pga = sim_chars[&telem_si_pga_char];
+	CHECK_EQ(si_pga.notified.size(), 1);
+	std::vector<uint8_t> &value = si_pga.notified[0];
+	CHECK_EQ(value.size(), 8);
+	CHECK_EQ(value[0], 0x7B);
+	CHECK_EQ(value[1], 0x00);
+	CHECK_EQ(le16(value, 2), 2500);
+	CHECK_EQ(le16(value, 4), 0xFFFF);
+	CHECK_EQ(le16(value, 6), 0);
+
+	// Values without a subscription can be read
+	sim_state = 2;
+	sim_batt_mv = 3912.4f;
+	ble_telemetry_handler();
+	CHECK_EQ(sim_chars[&telem_state_char].notified.size(), 0);
+	CHECK_EQ(sim_chars[&telem_state_char].value.size(), 1);
+	CHECK_EQ(sim_chars[&telem_state_char].value[0], 2);
+	std::vector<uint8_t> &batt = sim_chars[&telem_batt_char].value;
+	CHECK_EQ(batt.size(), 4);
+	CHECK_EQ(le16(batt, 0), 3912);
+	CHECK_EQ(batt[2], 70);
+	CHECK_EQ(batt[3], BATT_PROFILE_NORMAL);
+
+	// The flags
+	earthquake_start = true;
+	collapse_alert = true;
+	sim_clock = true;
+	g_lpwan_has_joined = true;
+	ble_telemetry_handler();
+	CHECK_EQ(sim_chars[&telem_flags_char].value[0],
+			 TELEM_FLAG_EARTHQUAKE | TELEM_FLAG_COLLAPSE | TELEM_FLAG_CLOCK | TELEM_FLAG_JOINED);
+	earthquake_start = false;
+	collapse_alert = false;
+
+	sim_subscribe(&telem_si_pga_char, false);
+	CHECK(!sim_job);
+}
+
+/**
+ * @brief SI/PGA is sent with every cycle, the other values only if they changed
+ *
+ */
+static void test_changes_only(void)
+{
+	sim_subscribe(&telem_state_char, true);
+	sim_subscribe(&telem_si_pga_char, true);
+	sim_subscribe(&telem_flags_char, true);
+	sim_subscribe(&telem_batt_char, true);
+	sim_clear();
+
+	// First cycle after the subscription has all values
+	ble_telemetry_handler();
+	CHECK_EQ(sim_chars[&telem_state_char].notified.size(), 1);
+	CHECK_EQ(sim_chars[&telem_si_pga_char].notified.size(), 1);
+	CHECK_EQ(sim_chars[&telem_flags_char].notified.size(), 1);
+	CHECK_EQ(sim_chars[&telem_batt_char].notified.size(), 1);
+
+	for (int cycle = 0; cycle < 10; cycle++)
+	{
+		ble_telemetry_handler();
+	}
+	CHECK_EQ(sim_chars[&telem_state_char].notified.size(), 1);
+	CHECK_EQ(sim_chars[&telem_si_pga_char].notified.size(), 11);
+	CHECK_EQ(sim_chars[&telem_flags_char].notified.size(), 1);
+	CHECK_EQ(sim_chars[&telem_batt_char].notified.size(), 1);
+
+	// A change of the D7S state, the notification is lost and sent again with the next cycle
+	sim_state = 3;
+	sim_chars[&telem_state_char].notify_fails = true;
+	ble_telemetry_handler();
+	CHECK_EQ(sim_chars[&telem_state_char].notified.size(), 1);
+	sim_chars[&telem_state_char].notify_fails = false;
+	ble_telemetry_handler();
+	CHECK_EQ(sim_chars[&telem_state_char].notified.size(), 2);
+	CHECK_EQ(sim_chars[&telem_state_char].notified[1][0], 3);
+	ble_telemetry_handler();
+	CHECK_EQ(sim_chars[&telem_state_char].notified.size(), 2);
+
+	// The client disconnects, the next cycle stops the job
+	sim_chars[&telem_state_char].subscribed = false;
+	sim_chars[&telem_si_pga_char].subscribed = false;
+	sim_chars[&telem_flags_char].subscribed = false;
+	sim_chars[&telem_batt_char].subscribed = false;
+	ble_telemetry_handler();
+	CHECK(!sim_job);
+}
+
+/**
+ * @brief Time on air of a notification on the 1M PHY in us
+ *        Preamble, access address, header, L2CAP and ATT header, CRC, then the empty packet of the central
+ *
+ * @param len value size
+ * @return uint32_t time including both inter frame spaces
+ */
+static uint32_t notify_air_us(uint8_t len)
+{
+	return (1 + 4 + 2 + 4 + 3 + len + 3) * 8 + 150 + (1 + 4 + 2 + 3) * 8 + 150;
+}
+
+/**
+ * @brief Connection interval requested for each notification interval and the resulting throughput
+ *        With one notification per connection event all changed values of a cycle are sent before the next cycle
+ *
+ */
+static void test_throughput(void)
+{
+	uint32_t cycle_air = notify_air_us(1) + notify_air_us(8) + notify_air_us(1) + notify_air_us(4);
+	uint8_t rates[] = {1, 2, 5, 10, 50, 100, 255};
+	for (uint8_t rate : rates)
+	{
+		g_app_settings.telemetry_rate = rate;
+		sim_subscribe(&telem_si_pga_char, true);
+		uint32_t interval = rate * 100;
+		CHECK_EQ(sim_job_period, interval);
+		float conn_ms = sim_conn_interval * 1.25f;
+		CHECK(conn_ms >= TELEM_CONN_MIN - 1.25f);
+		CHECK(conn_ms <= TELEM_CONN_MAX);
+		// The 4 values fit into the connection events of one cycle
+		uint32_t events = (uint32_t)(interval / conn_ms);
+		CHECK(events >= 4);
+		// Payload of the values, SI/PGA every cycle, all values in the worst case
+		float typical = 8 * 1000.0f / interval;
+		float worst = 14 * 1000.0f / interval;
+		printf("Interval %5ld ms: connection interval %6.2f ms, %3ld events per cycle, %6.1f ... %6.1f byte/s, "
+			   "%4ld us on air per cycle (%.2f%%)\n",
+			   (long)interval, conn_ms, (long)events, typical, worst, (long)cycle_air, cycle_air * 0.1f / interval);
+		sim_subscribe(&telem_si_pga_char, false);
+	}
+	g_app_settings.telemetry_rate = 0;
+	// Even the shortest interval keeps the radio busy for a small part of the cycle only
+	CHECK(cycle_air < 100000 / 20);
+}
+
+int main(void)
+{
+	g_enable_ble = true;
+	init_ble_telemetry();
+	CHECK_EQ(sim_chars.size(), 4);
+	RUN(test_encoder);
+	RUN(test_changes_only);
+	RUN(test_throughput);
+	return TEST_RESULT();
+}
@@ -0,0 +1,306 @@
+/**
+ * @file test_d7s_array.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host test of the D7S array, multiplexer detection and k-of-n alert voting
+ *        The bus has an SHTC3 at 0x70 like every RAK1901 setup, the TCA9548 is optional.
+ *        A device that acknowledges the channel mask but does not read it back is not a multiplexer.
+ *        The test is built with three sensors, RAK12027_SLOT_1=3 and RAK12027_SLOT_2=0.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "host_fakes.h"
+#include "test.h"
+
+app_settings_s g_app_settings;
+
+void perf_i2c(uint16_t bytes)
+{
+}
+
+void perf_i2c_error(void)
+{
+}
+
+/** Same value as in d7s_array.cpp */
+#define SIM_MUX_ADDR 0x71
+
+/** Address of the SHTC3 of the RAK1901, default address of the TCA9548 */
+#define SIM_SHTC3_ADDR 0x70
+
+/** Devices on the simulated bus */
+static bool sim_shtc3 = true;
+static bool sim_mux = false;
+/** Device on the multiplexer address that acknowledges everything and reads 0xFF */
+static bool sim_ack_only = false;
+
+/** Control register of the TCA9548 and number of writes to it */
+static uint8_t sim_mux_control = 0;
+static uint32_t sim_mux_writes = 0;
+
+/** Writes to the SHTC3 */
+static uint32_t sim_shtc3_writes = 0;
+
+/**
+ * @brief SHTC3, TCA9548 or a device that only acknowledges on the I2C bus
+ *
+ */
+static bool sim_bus(uint8_t addr, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len)
+{
+	uint8_t value = 0xFF;
+	if ((addr == SIM_SHTC3_ADDR) && sim_shtc3)
+	{
+		sim_shtc3_writes += tx_len != 0 ? 1 : 0;
+		value = 0x87;
+	}
+	else if ((addr == SIM_MUX_ADDR) && sim_mux)
+	{
+		if (tx_len != 0)
+		{
+			sim_mux_control = tx[tx_len - 1];
+			sim_mux_writes++;
+		}
+		value = sim_mux_control;
+	}
+	else if ((addr != SIM_MUX_ADDR) || !sim_ack_only)
+	{
+		return false;
+	}
+	for (size_t idx = 0; idx < rx_len; idx++)
+	{
+		rx[idx] = value;
+	}
+	return true;
+}
+
+/** INT1 pins of the three sensors, Slot C, Slot D and Slot A */
+static const uint8_t sim_int1_pins[3] = {WB_IO3, WB_IO5, WB_IO1};
+
+/**
+ * @brief Start the array with all sensors present and the interrupt lines idle
+ *
+ */
+static void sim_start(void)
+{
+	for (uint8_t pin : sim_int1_pins)
+	{
+		host_pin_level[pin] = HIGH;
+	}
+	uint8_t num = init_d7s_array();
+	for (uint8_t sensor = 0; sensor < num; sensor++)
+	{
+		d7s_set_present(sensor);
+	}
+}
+
+/**
+ * @brief The multiplexer is found on its own address, the SHTC3 is not touched
+ *
+ */
+static void test_mux_found(void)
+{
+	sim_mux = true;
+	sim_shtc3_writes = 0;
+	CHECK_EQ(init_d7s_array(), 3);
+	CHECK_EQ(sim_mux_control, 0x01);
+	CHECK_EQ(sim_shtc3_writes, 0);
+
+	// Switch the channel only when the sensor changes
+	uint32_t writes = sim_mux_writes;
+	d7s_select(0);
+	CHECK_EQ(sim_mux_writes, writes);
+	d7s_select(2);
+	CHECK_EQ(sim_mux_control, 0x04);
+	d7s_select(2);
+	CHECK_EQ(sim_mux_writes, writes + 1);
+	d7s_select(1);
+	CHECK_EQ(sim_mux_control, 0x02);
+	sim_mux = false;
+}
+
+/**
+ * @brief SHTC3 at 0x70 and no multiplexer, only the first D7S is used
+ *        The SHTC3 would acknowledge a channel mask on 0x70
+ *
+ */
+static void test_shtc3_no_mux(void)
+{
+	sim_mux = false;
+	sim_shtc3 = true;
+	sim_shtc3_writes = 0;
+	CHECK_EQ(init_d7s_array(), 1);
+	CHECK_EQ(sim_shtc3_writes, 0);
+	// Nothing is written to select a channel
+	uint32_t writes = sim_mux_writes;
+	d7s_select(1);
+	CHECK_EQ(sim_mux_writes, writes);
+	CHECK_EQ(sim_shtc3_writes, 0);
+}
+
+/**
+ * @brief A device that acknowledges the channel mask without reading it back is not taken
+ *
+ */
+static void test_ack_only(void)
+{
+	sim_ack_only = true;
+	CHECK_EQ(init_d7s_array(), 1);
+	sim_ack_only = false;
+}
+
+/**
+ * @brief Default majority, the alerts must come within the window, collapse and shutoff are counted apart
+ *
+ */
+static void test_vote_majority(void)
+{
+	sim_mux = true;
+	g_app_settings.vote_k = 0;
+	g_app_settings.vote_window = 0;
+	host_set_ms(100000);
+	sim_start();
+	CHECK_EQ(d7s_num, 3);
+	CHECK_EQ(d7s_votes_needed(), 2);
+	CHECK_EQ(d7s_vote_window(), D7S_VOTE_WINDOW_DEFAULT);
+
+	// One sensor alone is not enough
+	CHECK_EQ(d7s_vote(0, 0x02), 0);
+	// A collapse of another sensor does not confirm the shutoff
+	host_advance_ms(1000);
+	CHECK_EQ(d7s_vote(1, 0x01), 0);
+	// Second shutoff within the window
+	host_advance_ms(1000);
+	CHECK_EQ(d7s_vote(2, 0x02), 0x02);
+	// Both types from the last sensor
+	CHECK_EQ(d7s_vote(2, 0x03), 0x03);
+
+	// Votes out of the window are not counted
+	d7s_clear_votes();
+	CHECK_EQ(d7s_vote(0, 0x02), 0);
+	host_advance_ms(D7S_VOTE_WINDOW_DEFAULT + 1);
+	CHECK_EQ(d7s_vote(1, 0x02), 0);
+	// The window is set in 100 ms
+	g_app_settings.vote_window = 50;
+	CHECK_EQ(d7s_vote_window(), 5000);
+	CHECK_EQ(d7s_vote(1, 0x02), 0x02);
+	g_app_settings.vote_window = 0;
+	d7s_clear_votes();
+	sim_mux = false;
+}
+
+/**
+ * @brief k set with AT+D7S, limited to the present sensors, a failed sensor does not count
+ *
+ */
+static void test_vote_k(void)
+{
+	sim_mux = true;
+	host_set_ms(200000);
+	sim_start();
+	g_app_settings.vote_k = 3;
+	CHECK_EQ(d7s_votes_needed(), 3);
+	CHECK_EQ(d7s_vote(0, 0x02), 0);
+	CHECK_EQ(d7s_vote(1, 0x02), 0);
+	CHECK_EQ(d7s_vote(2, 0x02), 0x02);
+
+	g_app_settings.vote_k = 1;
+	d7s_clear_votes();
+	CHECK_EQ(d7s_vote(1, 0x01), 0x01);
+
+	// Sensor 2 failed at startup, k is limited to the 2 present sensors
+	init_d7s_array();
+	d7s_set_present(0);
+	d7s_set_present(1);
+	g_app_settings.vote_k = 3;
+	CHECK_EQ(d7s_votes_needed(), 2);
+	g_app_settings.vote_k = 0;
+	CHECK_EQ(d7s_votes_needed(), 2);
+	CHECK_EQ(d7s_present_mask(), 0x03);
+	// Its vote is not counted
+	CHECK_EQ(d7s_vote(2, 0x02), 0);
+	CHECK_EQ(d7s_vote(0, 0x02), 0);
+	CHECK_EQ(d7s_vote(1, 0x02), 0x02);
+	d7s_clear_votes();
+	sim_mux = false;
+}
+
+/**
+ * @brief One sensor with a wrong high reading does not change the reported value
+ *
+ */
+static void test_agreed_value(void)
+{
+	sim_mux = true;
+	sim_start();
+	g_app_settings.vote_k = 0;
+	float values[D7S_MAX_SENSORS] = {0.4f, 9.9f, 0.6f, 0.0f};
+	CHECK(d7s_agreed_value(values) == 0.6f);
+	g_app_settings.vote_k = 1;
+	CHECK(d7s_agreed_value(values) == 9.9f);
+	g_app_settings.vote_k = 3;
+	CHECK(d7s_agreed_value(values) == 0.4f);
+
+	// The faulty sensor failed at startup
+	g_app_settings.vote_k = 0;
+	init_d7s_array();
+	d7s_set_present(0);
+	d7s_set_present(2);
+	CHECK(d7s_agreed_value(values) == 0.4f);
+	sim_mux = false;
+}
+
+/**
+ * @brief INT1 of the sensors, the interrupt marks the sensors and checks the votes before the registers are read
+ *
+ */
+static void test_int1_vote(void)
+{
+	sim_mux = true;
+	g_app_settings.vote_k = 0;
+	host_set_ms(300000);
+	sim_start();
+	d7s_clear_votes();
+
+	// Missed edge, all present sensors are checked
+	CHECK(!d7s_int1_waiting());
+	CHECK_EQ(d7s_take_pending(true), 0x07);
+
+	host_pin_level[sim_int1_pins[1]] = LOW;
+	CHECK_EQ(d7s_int1_isr(), 0x02);
+	CHECK(d7s_int1_waiting());
+	CHECK(!d7s_int1_agreed());
+	// Still low, no new INT1
+	CHECK_EQ(d7s_int1_isr(), 0x00);
+	CHECK_EQ(d7s_sensors[1].int1_count, 1);
+
+	host_advance_ms(500);
+	host_pin_level[sim_int1_pins[2]] = LOW;
+	CHECK_EQ(d7s_int1_isr(), 0x04);
+	CHECK(d7s_int1_agreed());
+	CHECK_EQ(d7s_take_pending(true), 0x06);
+	CHECK(!d7s_int1_waiting());
+
+	// The votes are too old
+	host_advance_ms(D7S_VOTE_WINDOW_DEFAULT + 1);
+	CHECK(!d7s_int1_agreed());
+	sim_start();
+	d7s_clear_votes();
+	sim_mux = false;
+}
+
+int main(void)
+{
+	host_i2c_device = sim_bus;
+	init_i2c_bus();
+	RUN(test_mux_found);
+	RUN(test_shtc3_no_mux);
+	RUN(test_ack_only);
+	RUN(test_vote_majority);
+	RUN(test_vote_k);
+	RUN(test_agreed_value);
+	RUN(test_int1_vote);
+	return TEST_RESULT();
+}
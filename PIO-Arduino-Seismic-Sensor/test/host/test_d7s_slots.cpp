@@ -0,0 +1,209 @@
+/**
+ * @file test_d7s_slots.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host test of the D7S slot table and the slot detection
+ *        Each of the six slots is set from the settings and checked against the pins of the WisBlock Base.
+ *        A simulated D7S pulls its INT2 low during the calibration in each slot.
+ *        The test is built with SHUTOFF_PIN=WB_IO5, the shutoff relay and the SET pin of the particle sensor
+ *        must never get a pull-up while the probe runs.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "host_fakes.h"
+#include "test.h"
+
+app_settings_s g_app_settings;
+
+/** Flag if the simulated TCA9548 answers */
+static bool sim_mux = false;
+
+/** Control register of the simulated TCA9548 */
+static uint8_t sim_mux_control = 0;
+
+bool i2c_write(uint8_t dev, uint8_t addr, const uint8_t *data, uint8_t len)
+{
+	sim_mux_control = data[0];
+	return sim_mux;
+}
+
+bool i2c_read(uint8_t dev, uint8_t addr, uint8_t *data, uint8_t len)
+{
+	data[0] = sim_mux_control;
+	return sim_mux;
+}
+
+/** INT1 and INT2 of each slot, from the WisBlock Base schematic */
+static const uint8_t sim_slot_pins[D7S_SLOTS][2] = {
+	{WB_IO1, WB_IO2}, // Slot A
+	{WB_IO2, WB_IO1}, // Slot B
+	{WB_IO3, WB_IO4}, // Slot C
+	{WB_IO5, WB_IO6}, // Slot D
+	{WB_IO4, WB_IO3}, // Slot E
+	{WB_IO6, WB_IO5}, // Slot F
+};
+
+/** GPIOs of the slots */
+static const uint8_t sim_pins[] = {WB_IO1, WB_IO2, WB_IO3, WB_IO4, WB_IO5, WB_IO6};
+
+/**
+ * @brief All slot GPIOs back to the state after a reset
+ *
+ */
+static void sim_reset_pins(void)
+{
+	for (uint8_t pin : sim_pins)
+	{
+		host_pin_mode[pin] = INPUT;
+		host_pin_level[pin] = LOW;
+	}
+}
+
+/**
+ * @brief Calibrate a D7S with the slot detection
+ *
+ * @param sensor sensor index
+ * @param slot slot of the simulated D7S
+ * @return true the detected slot must be saved
+ */
+static bool sim_calibrate(uint8_t sensor, uint8_t slot)
+{
+	d7s_probe_start(sensor);
+	// The D7S pulls INT2 low while it calibrates
+	host_pin_level[sim_slot_pins[slot][1]] = LOW;
+	d7s_probe_sample();
+	host_pin_level[sim_slot_pins[slot][1]] = HIGH;
+	d7s_probe_sample();
+	return d7s_probe_end(sensor);
+}
+
+/**
+ * @brief The slot from the settings selects the pins, all six slots
+ *
+ */
+static void test_mapping(void)
+{
+	sim_mux = false;
+	for (uint8_t slot = 0; slot < D7S_SLOTS; slot++)
+	{
+		g_app_settings.d7s_slot[0] = slot;
+		CHECK_EQ(init_d7s_array(), 1);
+		CHECK_EQ(d7s_sensors[0].slot, slot);
+		CHECK_EQ(d7s_sensors[0].int1_pin, sim_slot_pins[slot][0]);
+		CHECK_EQ(d7s_sensors[0].int2_pin, sim_slot_pins[slot][1]);
+	}
+	// Without a detected slot the build flag is used
+	g_app_settings.d7s_slot[0] = D7S_SLOT_UNKNOWN;
+	init_d7s_array();
+	CHECK_EQ(d7s_sensors[0].slot, RAK12027_SLOT);
+	CHECK_EQ(d7s_sensors[0].int1_pin, sim_slot_pins[RAK12027_SLOT][0]);
+	// A broken setting does not index outside the table
+	g_app_settings.d7s_slot[0] = D7S_SLOTS;
+	init_d7s_array();
+	CHECK_EQ(d7s_sensors[0].slot, RAK12027_SLOT);
+}
+
+/**
+ * @brief A D7S in each slot, slots with their INT2 on a driven GPIO keep the build flag slot
+ *
+ */
+static void test_probe(void)
+{
+	sim_mux = false;
+	for (uint8_t slot = 0; slot < D7S_SLOTS; slot++)
+	{
+		g_app_settings.d7s_slot[0] = D7S_SLOT_UNKNOWN;
+		init_d7s_array();
+		sim_reset_pins();
+		// The D7S line is pulled up by the probe only, it is idle high
+		bool changed = sim_calibrate(0, slot);
+		uint8_t int2 = sim_slot_pins[slot][1];
+		// WB_IO2 powers the sensors, WB_IO5 is the relay, WB_IO6 the fan of the particle sensor
+		bool reserved = (int2 == WB_IO2) || (int2 == SHUTOFF_PIN) || (int2 == PM_SET_PIN);
+		printf("D7S in Slot %c: %s\n", 'A' + slot, reserved ? "not probed" : "detected");
+		if (reserved)
+		{
+			CHECK(!changed);
+			CHECK_EQ(d7s_sensors[0].slot, RAK12027_SLOT);
+			CHECK_EQ(g_app_settings.d7s_slot[0], D7S_SLOT_UNKNOWN);
+		}
+		else
+		{
+			CHECK(changed);
+			CHECK_EQ(d7s_sensors[0].slot, slot);
+			CHECK_EQ(d7s_sensors[0].int1_pin, sim_slot_pins[slot][0]);
+			CHECK_EQ(d7s_sensors[0].int2_pin, int2);
+			CHECK_EQ(g_app_settings.d7s_slot[0], slot);
+		}
+		// The driven GPIOs never got a pull-up, the probed ones are released
+		CHECK(host_pin_mode[WB_IO2] != INPUT_PULLUP);
+		CHECK(host_pin_mode[SHUTOFF_PIN] != INPUT_PULLUP);
+		CHECK(host_pin_mode[PM_SET_PIN] != INPUT_PULLUP);
+		for (uint8_t pin : sim_pins)
+		{
+			CHECK(host_pin_mode[pin] != INPUT_PULLUP);
+		}
+	}
+	// Same slot again, nothing to save
+	g_app_settings.d7s_slot[0] = 2;
+	init_d7s_array();
+	sim_reset_pins();
+	CHECK(!sim_calibrate(0, 2));
+	CHECK_EQ(d7s_sensors[0].slot, 2);
+}
+
+/**
+ * @brief The relay pin is not pulled up while the probe runs
+ *
+ */
+static void test_relay_quiet(void)
+{
+	sim_mux = false;
+	g_app_settings.d7s_slot[0] = D7S_SLOT_UNKNOWN;
+	init_d7s_array();
+	sim_reset_pins();
+	d7s_probe_start(0);
+	CHECK_EQ(host_pin_level[SHUTOFF_PIN], LOW);
+	CHECK_EQ(host_pin_level[PM_SET_PIN], LOW);
+	CHECK_EQ(host_pin_level[WB_IO2], LOW);
+	// The free INT2 pins of Slot B, C and E are probed
+	CHECK_EQ(host_pin_mode[WB_IO1], INPUT_PULLUP);
+	CHECK_EQ(host_pin_mode[WB_IO3], INPUT_PULLUP);
+	CHECK_EQ(host_pin_mode[WB_IO4], INPUT_PULLUP);
+	d7s_probe_end(0);
+}
+
+/**
+ * @brief Two sensors, the pins of the running sensor are not probed for the second
+ *
+ */
+static void test_second_sensor(void)
+{
+	sim_mux = true;
+	g_app_settings.d7s_slot[0] = D7S_SLOT_UNKNOWN;
+	g_app_settings.d7s_slot[1] = D7S_SLOT_UNKNOWN;
+	CHECK_EQ(init_d7s_array(), 2);
+	sim_reset_pins();
+	CHECK(sim_calibrate(0, 2));
+	d7s_set_present(0);
+	// A second D7S in Slot E uses the pins of Slot C swapped, it cannot be told apart
+	CHECK(!sim_calibrate(1, 4));
+	CHECK_EQ(d7s_sensors[1].slot, RAK12027_SLOT_1);
+	// In Slot B it is found
+	CHECK(sim_calibrate(1, 1));
+	CHECK_EQ(d7s_sensors[1].slot, 1);
+	CHECK_EQ(g_app_settings.d7s_slot[1], 1);
+	sim_mux = false;
+}
+
+int main(void)
+{
+	RUN(test_mapping);
+	RUN(test_probe);
+	RUN(test_relay_quiet);
+	RUN(test_second_sensor);
+	return TEST_RESULT();
+}
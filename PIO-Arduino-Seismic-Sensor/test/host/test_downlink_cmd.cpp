@@ -0,0 +1,529 @@
+/**
+ * @file test_downlink_cmd.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host test of the batched downlink commands
+ *        Round trip of encoded command batches and a fuzz test against a reference parser.
+ *        Built with AddressSanitizer and UBSan, reads outside of the frame stop the test.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "host_fakes.h"
+#include "test.h"
+
+app_settings_s g_app_settings;
+bool earthquake_start = false;
+
+/** Calls of the application functions */
+static int calls_threshold = 0;
+static int calls_calib = 0;
+static int calls_save = 0;
+static int calls_dump = 0;
+static int calls_resume = 0;
+static int calls_diag = 0;
+static int calls_timer = 0;
+static uint32_t last_dump_from = 0;
+static uint32_t last_dump_to = 0;
+static uint32_t last_resume = 0;
+static uint32_t last_resume_last = 0;
+
+void threshold_rak12027(uint8_t new_threshold)
+{
+	calls_threshold++;
+}
+
+bool calib_rak12027(void)
+{
+	calls_calib++;
+	return true;
+}
+
+void save_app_settings(void)
+{
+	calls_save++;
+}
+
+void heartbeat_start(void)
+{
+	calls_timer++;
+}
+
+void heartbeat_stop(void)
+{
+	calls_timer++;
+}
+
+uint32_t get_heartbeat_time(void)
+{
+	return g_lorawan_settings.send_repeat_time;
+}
+
+uint16_t start_event_dump(uint32_t from, uint32_t to)
+{
+	calls_dump++;
+	last_dump_from = from;
+	last_dump_to = to;
+	return 3;
+}
+
+uint16_t resume_event_dump(uint32_t seq, uint32_t last)
+{
+	calls_resume++;
+	last_resume = seq;
+	last_resume_last = last;
+	return 2;
+}
+
+void perf_request_uplink(void)
+{
+	calls_diag++;
+}
+
+lmh_error_status perf_lora_uplink(uint8_t type, lmh_error_status result)
+{
+	return result;
+}
+
+void sched_start(uint8_t job, uint32_t delay_ms, uint32_t period_ms, uint32_t tolerance_ms)
+{
+}
+
+/** Commands of one frame */
+struct batch_s
+{
+	uint8_t mask;
+	uint8_t threshold;
+	uint32_t heartbeat;
+	uint16_t capture_rate;
+	uint8_t payload_format;
+	uint32_t dump_from;
+	uint32_t dump_to;
+	uint32_t dump_resume;
+	uint32_t dump_resume_last;
+};
+
+/**
+ * @brief Reset the device state before a frame
+ *
+ */
+static void reset_device(void)
+{
+	g_app_settings = app_settings_s();
+	g_app_settings.threshold = 0;
+	g_app_settings.capture_rate = 500;
+	g_app_settings.payload_format = PAYLOAD_FULL;
+	g_lorawan_settings.send_repeat_time = 120000;
+	g_lorawan_settings.lorawan_enable = true;
+	g_lpwan_has_joined = true;
+	earthquake_start = false;
+	calls_threshold = calls_calib = calls_save = calls_dump = calls_resume = calls_diag = calls_timer = 0;
+	host_lora_tx.clear();
+	host_lora_fport.clear();
+}
+
+static void put_value(std::vector<uint8_t> &frame, uint32_t value, uint8_t len)
+{
+	for (int idx = len - 1; idx >= 0; idx--)
+	{
+		frame.push_back((uint8_t)(value >> (idx * 8)));
+	}
+}
+
+/**
+ * @brief Encode a batch as the server does, commands in a random order
+ *
+ * @param seq sequence number
+ * @param batch commands
+ * @return std::vector<uint8_t> frame
+ */
+static std::vector<uint8_t> encode(uint8_t seq, const batch_s &batch)
+{
+	uint8_t types[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+	for (int idx = 7; idx > 0; idx--)
+	{
+		int other = rand() % (idx + 1);
+		uint8_t swap = types[idx];
+		types[idx] = types[other];
+		types[other] = swap;
+	}
+	std::vector<uint8_t> frame;
+	frame.push_back(seq);
+	for (uint8_t type : types)
+	{
+		if ((batch.mask & (1 << (type - 1))) == 0)
+		{
+			continue;
+		}
+		frame.push_back(type);
+		switch (type)
+		{
+		case DL_CMD_THRESHOLD:
+			frame.push_back(1);
+			put_value(frame, batch.threshold, 1);
+			break;
+		case DL_CMD_HEARTBEAT:
+			frame.push_back(4);
+			put_value(frame, batch.heartbeat, 4);
+			break;
+		case DL_CMD_CAPTURE_RATE:
+			frame.push_back(2);
+			put_value(frame, batch.capture_rate, 2);
+			break;
+		case DL_CMD_PAYLOAD_FORMAT:
+			frame.push_back(1);
+			put_value(frame, batch.payload_format, 1);
+			break;
+		case DL_CMD_LOG_DUMP:
+			frame.push_back(8);
+			put_value(frame, batch.dump_from, 4);
+			put_value(frame, batch.dump_to, 4);
+			break;
+		case DL_CMD_DUMP_RESUME:
+			frame.push_back(batch.dump_resume_last != 0 ? 8 : 4);
+			put_value(frame, batch.dump_resume, 4);
+			if (batch.dump_resume_last != 0)
+			{
+				put_value(frame, batch.dump_resume_last, 4);
+			}
+			break;
+		default:
+			frame.push_back(0);
+			break;
+		}
+	}
+	return frame;
+}
+
+/**
+ * @brief Random valid batch
+ *
+ * @return batch_s commands
+ */
+static batch_s random_batch(void)
+{
+	batch_s batch;
+	batch.mask = rand() & 0xFF;
+	if ((batch.mask & 0x60) == 0x60)
+	{
+		// Either a dump or a resume
+		batch.mask &= ~(rand() & 1 ? 0x20 : 0x40);
+	}
+	batch.threshold = rand() & 1;
+	batch.heartbeat = rand() % 4 == 0 ? 0 : 30 + rand() % 2147453;
+	batch.capture_rate = rand() % 4 == 0 ? 0 : 100 + rand() % 65435;
+	batch.payload_format = rand() & 1;
+	batch.dump_from = rand();
+	batch.dump_to = batch.dump_from + rand() % 100000;
+	batch.dump_resume = rand();
+	batch.dump_resume_last = rand() & 1 ? batch.dump_resume + rand() % 100 : 0;
+	return batch;
+}
+
+/**
+ * @brief Get the acknowledge that was sent
+ *
+ * @return std::vector<uint8_t> acknowledge, empty if none
+ */
+static std::vector<uint8_t> sent_ack(void)
+{
+	host_lora_tx.clear();
+	CHECK(send_downlink_ack());
+	if (host_lora_tx.empty())
+	{
+		return std::vector<uint8_t>();
+	}
+	CHECK_EQ(host_lora_fport.back(), DL_CMD_FPORT);
+	return host_lora_tx.back();
+}
+
+static void test_round_trip(void)
+{
+	srand(1);
+	for (int run = 0; run < 20000; run++)
+	{
+		reset_device();
+		batch_s batch = random_batch();
+		uint8_t seq = run & 0xFF;
+		std::vector<uint8_t> frame = encode(seq, batch);
+		bool result = handle_downlink_cmd(frame.data(), frame.size());
+		if (frame.size() < 2)
+		{
+			// Empty batch is a malformed frame
+			CHECK(!result);
+			continue;
+		}
+		CHECK(result);
+		std::vector<uint8_t> ack = sent_ack();
+		bool dump = batch.mask & 0x60;
+		CHECK_EQ(ack.size(), dump ? 5 : 3);
+		CHECK_EQ(ack[0], seq);
+		CHECK_EQ(ack[1], DL_ACK_OK);
+		CHECK_EQ(ack[2], batch.mask);
+		if (batch.mask & 0x01)
+		{
+			CHECK_EQ(g_app_settings.threshold, batch.threshold);
+		}
+		if (batch.mask & 0x02)
+		{
+			CHECK_EQ(g_lorawan_settings.send_repeat_time, batch.heartbeat * 1000);
+		}
+		if (batch.mask & 0x08)
+		{
+			CHECK_EQ(g_app_settings.capture_rate, batch.capture_rate);
+		}
+		if (batch.mask & 0x10)
+		{
+			CHECK_EQ(g_app_settings.payload_format, batch.payload_format);
+		}
+		CHECK_EQ(calls_calib, (batch.mask & 0x04) ? 1 : 0);
+		CHECK_EQ(calls_dump, (batch.mask & 0x20) ? 1 : 0);
+		CHECK_EQ(calls_resume, (batch.mask & 0x40) ? 1 : 0);
+		CHECK_EQ(calls_diag, (batch.mask & 0x80) ? 1 : 0);
+		// All settings are saved with one write
+		CHECK_EQ(calls_save, (batch.mask & 0x19) ? 1 : 0);
+		if (batch.mask & 0x20)
+		{
+			CHECK_EQ(last_dump_from, batch.dump_from);
+			CHECK_EQ(last_dump_to, batch.dump_to);
+			CHECK_EQ(ack[4], 3);
+		}
+		if (batch.mask & 0x40)
+		{
+			CHECK_EQ(last_resume, batch.dump_resume);
+			CHECK_EQ(last_resume_last, batch.dump_resume_last);
+			CHECK_EQ(ack[4], 2);
+		}
+	}
+}
+
+/**
+ * @brief Reference parser, written from the protocol description
+ *
+ * @param frame frame data with the sequence number
+ * @param len frame length
+ * @param mask applied commands
+ * @return uint8_t DL_ACK_xxx status
+ */
+static uint8_t reference_parse(const uint8_t *frame, size_t len, uint8_t *mask)
+{
+	static const int value_len[9] = {-1, 1, 4, 0, 2, 1, 8, 4, 0};
+	*mask = 0;
+	if (len < 2)
+	{
+		return DL_ACK_MALFORMED;
+	}
+	size_t pos = 1;
+	while (pos < len)
+	{
+		if (pos + 2 > len || pos + 2 + frame[pos + 1] > len)
+		{
+			return DL_ACK_MALFORMED;
+		}
+		uint8_t type = frame[pos];
+		uint8_t vlen = frame[pos + 1];
+		const uint8_t *value = &frame[pos + 2];
+		if ((type == 0) || (type > 8))
+		{
+			return DL_ACK_UNKNOWN;
+		}
+		if ((vlen != value_len[type]) && !((type == DL_CMD_DUMP_RESUME) && (vlen == 8)))
+		{
+			return DL_ACK_INVALID;
+		}
+		uint32_t v = 0;
+		for (int idx = 0; idx < vlen && idx < 4; idx++)
+		{
+			v = (v << 8) | value[idx];
+		}
+		switch (type)
+		{
+		case DL_CMD_THRESHOLD:
+		case DL_CMD_PAYLOAD_FORMAT:
+			if (v > 1)
+			{
+				return DL_ACK_INVALID;
+			}
+			break;
+		case DL_CMD_HEARTBEAT:
+			if ((v != 0) && ((v < 30) || (v > 2147483)))
+			{
+				return DL_ACK_INVALID;
+			}
+			break;
+		case DL_CMD_CAPTURE_RATE:
+			if ((v != 0) && (v < 100))
+			{
+				return DL_ACK_INVALID;
+			}
+			break;
+		case DL_CMD_LOG_DUMP:
+		{
+			uint32_t to = ((uint32_t)value[4] << 24) | ((uint32_t)value[5] << 16) | ((uint32_t)value[6] << 8) | value[7];
+			if ((to < v) || (*mask & 0x40))
+			{
+				return DL_ACK_INVALID;
+			}
+			break;
+		}
+		case DL_CMD_DUMP_RESUME:
+		{
+			uint32_t last = vlen == 8 ? ((uint32_t)value[4] << 24) | ((uint32_t)value[5] << 16) | ((uint32_t)value[6] << 8) | value[7] : 0;
+			if (((last != 0) && (last < v)) || (*mask & 0x20))
+			{
+				return DL_ACK_INVALID;
+			}
+			break;
+		}
+		}
+		if (*mask & (1 << (type - 1)))
+		{
+			return DL_ACK_INVALID;
+		}
+		*mask |= 1 << (type - 1);
+		pos += 2 + vlen;
+	}
+	return DL_ACK_OK;
+}
+
+/**
+ * @brief Change some bytes of a frame
+ *
+ * @param frame frame to change
+ */
+static void mutate(std::vector<uint8_t> &frame)
+{
+	int changes = 1 + rand() % 3;
+	for (int idx = 0; idx < changes; idx++)
+	{
+		switch (rand() % 4)
+		{
+		case 0:
+			if (!frame.empty())
+			{
+				frame[rand() % frame.size()] = rand();
+			}
+			break;
+		case 1:
+			if (!frame.empty())
+			{
+				frame.resize(rand() % frame.size());
+			}
+			break;
+		case 2:
+			frame.push_back(rand());
+			break;
+		default:
+			if (!frame.empty())
+			{
+				frame[rand() % frame.size()] ^= 1 << (rand() % 8);
+			}
+			break;
+		}
+	}
+}
+
+static void test_fuzz(void)
+{
+	srand(2);
+	for (int run = 0; run < 200000; run++)
+	{
+		reset_device();
+		std::vector<uint8_t> frame;
+		if (run % 3 == 0)
+		{
+			// Random bytes
+			int len = rand() % 40;
+			for (int idx = 0; idx < len; idx++)
+			{
+				frame.push_back(rand() % 3 == 0 ? rand() % 10 : rand());
+			}
+		}
+		else
+		{
+			frame = encode(run, random_batch());
+			mutate(frame);
+		}
+		if (frame.size() > 242)
+		{
+			frame.resize(242);
+		}
+		// Exact sized heap copy, ASan catches every read behind the frame
+		uint8_t *data = (uint8_t *)malloc(frame.size() + 1);
+		if (!frame.empty())
+		{
+			memcpy(data, frame.data(), frame.size());
+		}
+		app_settings_s before = g_app_settings;
+		uint32_t heartbeat_before = g_lorawan_settings.send_repeat_time;
+
+		bool result = handle_downlink_cmd(data, frame.size());
+		free(data);
+
+		uint8_t mask;
+		uint8_t status = reference_parse(frame.data(), frame.size(), &mask);
+		CHECK_EQ(result, status == DL_ACK_OK);
+		std::vector<uint8_t> ack = sent_ack();
+		CHECK(ack.size() >= 3);
+		if (ack.size() < 3)
+		{
+			continue;
+		}
+		CHECK_EQ(ack[1], status);
+		if (status == DL_ACK_OK)
+		{
+			CHECK_EQ(ack[2], mask);
+		}
+		else
+		{
+			// Nothing is applied from a rejected frame
+			CHECK(memcmp(&before, &g_app_settings, sizeof(app_settings_s)) == 0);
+			CHECK_EQ(g_lorawan_settings.send_repeat_time, heartbeat_before);
+			CHECK_EQ(calls_calib + calls_dump + calls_resume + calls_diag + calls_save + calls_threshold, 0);
+			CHECK(ack[2] <= frame.size());
+		}
+	}
+}
+
+static void test_busy(void)
+{
+	reset_device();
+	earthquake_start = true;
+	uint8_t frame[] = {7, DL_CMD_THRESHOLD, 1, 1};
+	CHECK(!handle_downlink_cmd(frame, sizeof(frame)));
+	std::vector<uint8_t> ack = sent_ack();
+	CHECK_EQ(ack.size(), 3);
+	CHECK_EQ(ack[1], DL_ACK_BUSY);
+	CHECK_EQ(calls_threshold, 0);
+
+	// Other settings are allowed during an earthquake
+	uint8_t format[] = {8, DL_CMD_PAYLOAD_FORMAT, 1, PAYLOAD_COMPACT};
+	CHECK(handle_downlink_cmd(format, sizeof(format)));
+	CHECK_EQ(g_app_settings.payload_format, PAYLOAD_COMPACT);
+
+	// The heartbeat is stored, the timer stays stopped until the end of the earthquake
+	uint8_t heartbeat[] = {9, DL_CMD_HEARTBEAT, 4, 0, 0, 0x0E, 0x10};
+	CHECK(handle_downlink_cmd(heartbeat, sizeof(heartbeat)));
+	CHECK_EQ(g_lorawan_settings.send_repeat_time, 3600000UL);
+	CHECK_EQ(calls_timer, 0);
+	uint8_t off[] = {10, DL_CMD_HEARTBEAT, 4, 0, 0, 0, 0};
+	CHECK(handle_downlink_cmd(off, sizeof(off)));
+	CHECK_EQ(g_lorawan_settings.send_repeat_time, 0);
+	CHECK_EQ(calls_timer, 0);
+
+	// Outside of an earthquake it is applied at once
+	earthquake_start = false;
+	uint8_t again[] = {11, DL_CMD_HEARTBEAT, 4, 0, 0, 0x0E, 0x10};
+	CHECK(handle_downlink_cmd(again, sizeof(again)));
+	CHECK_EQ(calls_timer, 1);
+}
+
+int main(void)
+{
+	RUN(test_round_trip);
+	RUN(test_fuzz);
+	RUN(test_busy);
+	return TEST_RESULT();
+}
@@ -0,0 +1,363 @@
+/**
+ * @file test_early_warning.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host test of the early warnings with a simulated network server
+ *        The server sends warnings to the multicast group, the simulated LoRaMAC accepts a multicast frame
+ *        only with the keys of the linked session and a new counter, like the LoRaMAC of the RAK4631.
+ *        Warnings sent as a unicast downlink on the warning port, replays and frames after a multicast
+ *        frame on another port must be rejected. The shutoff output is switched by shutoff_out.cpp.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "host_fakes.h"
+#include "test.h"
+
+app_settings_s g_app_settings;
+bool earthquake_start = false;
+d7s_sensor_s d7s_sensors[D7S_MAX_SENSORS];
+uint8_t d7s_configured = 0;
+
+bool d7s_int1_waiting(void)
+{
+	return false;
+}
+
+/** Capture job of the scheduler */
+static bool sim_capture = false;
+
+bool sched_active(uint8_t job)
+{
+	return (job == SCHED_CAPTURE) && sim_capture;
+}
+
+void sched_start(uint8_t job, uint32_t delay_ms, uint32_t period_ms, uint32_t tolerance_ms)
+{
+	CHECK_EQ(job, SCHED_CAPTURE);
+	sim_capture = true;
+}
+
+/** Multicast session linked to the simulated LoRaMAC */
+static MulticastParams_t *sim_session = NULL;
+
+LoRaMacStatus_t LoRaMacMulticastChannelLink(MulticastParams_t *channelParam)
+{
+	sim_session = channelParam;
+	return LORAMAC_STATUS_OK;
+}
+
+LoRaMacStatus_t LoRaMacMulticastChannelUnlink(MulticastParams_t *channelParam)
+{
+	CHECK(channelParam == sim_session);
+	sim_session = NULL;
+	return LORAMAC_STATUS_OK;
+}
+
+/** Multicast group of the simulated network server */
+static const uint32_t sim_mc_addr = 0x01AB2345;
+static const uint8_t sim_nwk_skey[16] = {0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6,
+										 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C};
+static const uint8_t sim_app_skey[16] = {0x3C, 0x4F, 0xCF, 0x09, 0x88, 0x15, 0xF7, 0xAB,
+										 0xA6, 0xD2, 0xAE, 0x28, 0x16, 0x15, 0x7E, 0x2B};
+
+/** Frame counter of the multicast group */
+static uint32_t sim_mc_fcnt = 0;
+
+/**
+ * @brief Warning frame
+ *
+ * @param origin ID of the site
+ * @param si expected SI in 0.001 m/s
+ * @param eta time until the waves arrive in 100 ms
+ * @return std::vector<uint8_t> frame
+ */
+static std::vector<uint8_t> sim_warning(uint32_t origin, uint16_t si, uint16_t eta)
+{
+	uint8_t frame[] = {'E', 'W', 1, (uint8_t)(origin >> 24), (uint8_t)(origin >> 16), (uint8_t)(origin >> 8),
+					   (uint8_t)origin, (uint8_t)(si >> 8), (uint8_t)si, (uint8_t)(eta >> 8), (uint8_t)eta};
+	return std::vector<uint8_t>(frame, frame + sizeof(frame));
+}
+
+/**
+ * @brief Hand a received downlink to the application, like lora_data_handler
+ *
+ * @param fport port of the downlink
+ * @param frame payload
+ * @return true a warning was accepted
+ */
+static bool sim_deliver(uint8_t fport, const std::vector<uint8_t> &frame)
+{
+	memcpy(g_rx_lora_data, frame.data(), frame.size());
+	g_rx_data_len = frame.size();
+	if (fport == EW_FPORT)
+	{
+		return handle_early_warning(g_rx_lora_data, g_rx_data_len);
+	}
+	ew_other_downlink();
+	return false;
+}
+
+/**
+ * @brief Multicast downlink, the LoRaMAC drops it without the session keys or with an old counter
+ *
+ * @param nwk_skey key of the MIC
+ * @param fcnt frame counter
+ * @param fport port
+ * @param frame payload
+ * @return true a warning was accepted
+ */
+static bool sim_multicast_raw(const uint8_t *nwk_skey, uint32_t fcnt, uint8_t fport, const std::vector<uint8_t> &frame)
+{
+	if ((sim_session == NULL) || (sim_session->Address != sim_mc_addr) || (memcmp(sim_session->NwkSKey, nwk_skey, 16) != 0))
+	{
+		return false;
+	}
+	if ((fcnt < sim_session->DownLinkCounter) || ((fcnt == sim_session->DownLinkCounter) && (fcnt != 0)))
+	{
+		return false;
+	}
+	sim_session->DownLinkCounter = fcnt;
+	return sim_deliver(fport, frame);
+}
+
+/**
+ * @brief The network server sends to the multicast group with the next counter
+ *
+ * @param fport port
+ * @param frame payload
+ * @return true a warning was accepted
+ */
+static bool sim_multicast(uint8_t fport, const std::vector<uint8_t> &frame)
+{
+	sim_mc_fcnt++;
+	return sim_multicast_raw(sim_nwk_skey, sim_mc_fcnt, fport, frame);
+}
+
+/**
+ * @brief Multicast session in the settings and a join
+ *
+ */
+static void sim_join(void)
+{
+	g_lorawan_settings.lorawan_enable = true;
+	g_lorawan_settings.lora_class = CLASS_C;
+	g_lpwan_has_joined = true;
+	g_app_settings.mc_dev_addr = sim_mc_addr;
+	memcpy(g_app_settings.mc_nwk_skey, sim_nwk_skey, 16);
+	memcpy(g_app_settings.mc_app_skey, sim_app_skey, 16);
+	init_early_warning();
+}
+
+/**
+ * @brief Output, warning and capture back to idle
+ *
+ */
+static void sim_idle(void)
+{
+	shutoff_release();
+	host_advance_ms(24 * 3600 * 1000UL);
+	CHECK(!ew_armed());
+	earthquake_start = false;
+	sim_capture = false;
+	host_serial.clear();
+}
+
+/**
+ * @brief Start of the local earthquake, like the seismic task
+ *
+ */
+static void sim_quake_start(void)
+{
+	earthquake_start = true;
+	ew_quake_start();
+}
+
+/**
+ * @brief Session is linked after the join with the keys of the settings
+ *
+ */
+static void test_link(void)
+{
+	host_set_ms(1000);
+	g_app_settings.shutoff_mode = SHUTOFF_LATCH;
+	init_shutoff();
+	CHECK_EQ(host_pin_level[SHUTOFF_PIN], LOW);
+
+	g_lpwan_has_joined = false;
+	g_lorawan_settings.lorawan_enable = true;
+	init_early_warning();
+	CHECK(sim_session == NULL);
+	// Without a linked session no warning is accepted
+	std::vector<uint8_t> warning = sim_warning(0x05712A01, 80, 100);
+	CHECK(!sim_deliver(EW_FPORT, warning));
+	CHECK(!ew_armed());
+
+	sim_join();
+	CHECK(sim_session != NULL);
+	if (sim_session != NULL)
+	{
+		CHECK_EQ(sim_session->Address, sim_mc_addr);
+		CHECK_EQ(sim_session->DownLinkCounter, 0);
+		CHECK(memcmp(sim_session->AppSKey, sim_app_skey, 16) == 0);
+	}
+	CHECK(sim_multicast(EW_FPORT, warning));
+	sim_idle();
+}
+
+/**
+ * @brief A warning of the multicast group arms the capture and the shutoff output
+ *
+ */
+static void test_multicast(void)
+{
+	CHECK(sim_multicast(EW_FPORT, sim_warning(0x05712A01, 80, 100)));
+	CHECK(ew_armed());
+	CHECK(sim_capture);
+	CHECK(host_serial.find("+EVT:EW:05712A01:0.080:10.0") != std::string::npos);
+	CHECK_EQ(host_pin_level[SHUTOFF_PIN], LOW);
+	host_advance_ms(9000);
+	sim_quake_start();
+	CHECK(shutoff_active());
+	CHECK_EQ(host_pin_level[SHUTOFF_PIN], HIGH);
+	sim_idle();
+}
+
+/**
+ * @brief Warnings that did not come over the multicast session are rejected
+ *
+ */
+static void test_unauthenticated(void)
+{
+	std::vector<uint8_t> warning = sim_warning(0x05712A01, 500, 50);
+
+	// Unicast downlink on the warning port
+	CHECK(!sim_deliver(EW_FPORT, warning));
+	CHECK(!ew_armed());
+	CHECK(!sim_capture);
+	CHECK(host_serial.find("+EVT:EW") == std::string::npos);
+
+	// Multicast with other keys, the MIC check of the LoRaMAC drops it
+	uint8_t other_key[16];
+	memcpy(other_key, sim_nwk_skey, 16);
+	other_key[0] ^= 1;
+	CHECK(!sim_multicast_raw(other_key, sim_mc_fcnt + 1, EW_FPORT, warning));
+
+	// A multicast frame on another port does not validate the next unicast warning
+	CHECK(!sim_multicast(DL_CMD_FPORT, std::vector<uint8_t>(4, 0)));
+	CHECK(!sim_deliver(EW_FPORT, warning));
+	CHECK(!ew_armed());
+
+	// Replay of the last warning of the group
+	CHECK(sim_multicast(EW_FPORT, warning));
+	CHECK(ew_armed());
+	sim_idle();
+	CHECK(!sim_multicast_raw(sim_nwk_skey, sim_mc_fcnt, EW_FPORT, warning));
+	CHECK(!sim_deliver(EW_FPORT, warning));
+	CHECK(!ew_armed());
+
+	// A new join keeps the counter of the session, the old warning is still refused
+	sim_join();
+	CHECK_EQ(sim_session->DownLinkCounter, sim_mc_fcnt);
+	CHECK(!sim_multicast_raw(sim_nwk_skey, sim_mc_fcnt, EW_FPORT, warning));
+	CHECK(!ew_armed());
+
+	// New keys start a new session
+	g_app_settings.mc_app_skey[0] ^= 1;
+	init_early_warning();
+	CHECK_EQ(sim_session->DownLinkCounter, 0);
+	sim_join();
+
+	// Broken frame over the session
+	CHECK(!sim_multicast(EW_FPORT, std::vector<uint8_t>(warning.begin(), warning.end() - 1)));
+	CHECK(!ew_armed());
+
+	// The output was never switched
+	sim_quake_start();
+	CHECK(!shutoff_active());
+	sim_idle();
+}
+
+/**
+ * @brief Level and arm window of the shutoff output
+ *
+ */
+static void test_prearm(void)
+{
+	uint16_t level = (uint16_t)(EW_SHUTOFF_SI * 1000 + 0.5);
+
+	// Just below the shutoff level the capture starts, the output waits for the D7S
+	CHECK(sim_multicast(EW_FPORT, sim_warning(1, level - 1, 20)));
+	CHECK(ew_armed());
+	CHECK(sim_capture);
+	sim_quake_start();
+	CHECK(!shutoff_active());
+	sim_idle();
+
+	// At the shutoff level
+	CHECK(sim_multicast(EW_FPORT, sim_warning(1, level, 20)));
+	sim_quake_start();
+	CHECK(shutoff_active());
+	sim_idle();
+
+	// A weaker warning of another site does not disarm the output or shorten the window
+	CHECK(sim_multicast(EW_FPORT, sim_warning(1, 200, 600)));
+	host_advance_ms(1000);
+	CHECK(sim_multicast(EW_FPORT, sim_warning(2, 10, 10)));
+	host_advance_ms(2000 + 30000);
+	CHECK(ew_armed());
+	sim_quake_start();
+	CHECK(shutoff_active());
+	sim_idle();
+
+	// The window ends 30 s after the ETA
+	CHECK(sim_multicast(EW_FPORT, sim_warning(1, 200, 100)));
+	host_advance_ms(10000 + 30000 - 1);
+	CHECK(ew_armed());
+	host_advance_ms(1);
+	CHECK(!ew_armed());
+	sim_quake_start();
+	CHECK(!shutoff_active());
+	sim_idle();
+
+	// The local earthquake started before the warning arrived
+	sim_quake_start();
+	CHECK(!shutoff_active());
+	CHECK(sim_multicast(EW_FPORT, sim_warning(1, 200, 0)));
+	CHECK(shutoff_active());
+	CHECK_EQ(host_pin_level[SHUTOFF_PIN], HIGH);
+	sim_idle();
+
+	// Output switched off in the settings
+	g_app_settings.shutoff_mode = SHUTOFF_OFF;
+	CHECK(sim_multicast(EW_FPORT, sim_warning(1, 200, 20)));
+	sim_quake_start();
+	CHECK(!shutoff_active());
+	CHECK_EQ(host_pin_level[SHUTOFF_PIN], LOW);
+	g_app_settings.shutoff_mode = SHUTOFF_LATCH;
+	sim_idle();
+}
+
+/**
+ * @brief AT+MCAST? counts the rejected frames as invalid
+ *
+ */
+static void test_print(void)
+{
+	host_serial.clear();
+	print_early_warning();
+	CHECK(host_serial.find("01AB2345:1:1:0:") == 0);
+	printf("AT+MCAST? %s", host_serial.c_str());
+}
+
+int main(void)
+{
+	RUN(test_link);
+	RUN(test_multicast);
+	RUN(test_unauthenticated);
+	RUN(test_prearm);
+	RUN(test_print);
+	return TEST_RESULT();
+}
@@ -0,0 +1,408 @@
+/**
+ * @file test_event_dump.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host simulation of an event journal dump over a lossy uplink
+ *        The simulated server collects the pages, finds lost pages from the "records left" counter
+ *        and requests them again with the resume command until the history is complete.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "host_fakes.h"
+#include "test.h"
+#include <map>
+
+// Used by event_dump.cpp
+bool earthquake_start = false;
+bool dl_ack_pending = false;
+
+void sched_start(uint8_t job, uint32_t delay_ms, uint32_t period_ms, uint32_t tolerance_ms)
+{
+}
+
+void sched_stop(uint8_t job)
+{
+}
+
+lmh_error_status perf_lora_uplink(uint8_t type, lmh_error_status result)
+{
+	return result;
+}
+
+void perf_retry(void)
+{
+}
+
+/** Page received by the server */
+struct page_s
+{
+	uint32_t seq;
+	uint16_t left;
+	uint16_t num;
+};
+
+/** One dump or resume request of the server */
+struct request_s
+{
+	uint32_t first;			 // Sequence number of the first requested record, 0 for a new dump
+	uint32_t last;			 // Sequence number of the last requested record, 0 up to the end
+	uint16_t expected;		 // Number of records from the acknowledge
+	std::vector<page_s> pages; // Pages received for this request
+};
+
+/** Simulated application server */
+struct server_s
+{
+	std::map<uint32_t, uint32_t> records; // seq -> timestamp
+	uint32_t frames;
+	uint32_t lost;
+	uint32_t duplicates;
+	uint32_t requests;
+};
+
+/**
+ * @brief Receive the pages sent for a request, drop some of them
+ *
+ * @param server server state
+ * @param request request the pages belong to
+ * @param loss loss rate 0 ... 1
+ */
+static void server_receive(server_s &server, request_s &request, double loss)
+{
+	for (std::vector<uint8_t> &data : host_lora_tx)
+	{
+		server.frames++;
+		if ((double)rand() / RAND_MAX < loss)
+		{
+			server.lost++;
+			continue;
+		}
+		page_s page;
+		page.seq = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+		page.left = ((uint16_t)data[4] << 8) | data[5];
+		page.num = (data.size() - DUMP_HEADER_SIZE) / DUMP_RECORD_SIZE;
+		for (uint16_t idx = 0; idx < page.num; idx++)
+		{
+			const uint8_t *rec = &data[DUMP_HEADER_SIZE + idx * DUMP_RECORD_SIZE];
+			uint32_t timestamp = ((uint32_t)rec[0] << 24) | ((uint32_t)rec[1] << 16) | ((uint32_t)rec[2] << 8) | rec[3];
+			if (server.records.count(page.seq + idx))
+			{
+				server.duplicates++;
+			}
+			server.records[page.seq + idx] = timestamp;
+		}
+		request.pages.push_back(page);
+	}
+	host_lora_tx.clear();
+}
+
+/**
+ * @brief Find the gaps of a request
+ *        The "records left" counter must go down by the records of each page,
+ *        otherwise pages were lost in between. Records outside of the time range
+ *        can be between two pages, so a gap is only known from the counter.
+ *
+ * @param request finished request
+ * @param gaps requests for the missing records
+ */
+static void server_gaps(request_s &request, std::vector<request_s> &gaps)
+{
+	uint16_t left = request.expected;
+	uint32_t cursor = request.first;
+	for (page_s &page : request.pages)
+	{
+		if (page.left + page.num != left)
+		{
+			// Records between the last good page and this page are missing
+			request_s gap = request_s();
+			gap.first = cursor;
+			gap.last = page.seq - 1;
+			gaps.push_back(gap);
+		}
+		left = page.left;
+		cursor = page.seq + page.num;
+	}
+	if (left != 0)
+	{
+		// The end is missing
+		request_s gap = request_s();
+		gap.first = cursor;
+		gap.last = request.last;
+		gaps.push_back(gap);
+	}
+}
+
+/**
+ * @brief Send the pages of the running dump, like the scheduler does
+ *
+ */
+static void device_send_pages(void)
+{
+	for (int page = 0; page < 200; page++)
+	{
+		size_t sent = host_lora_tx.size();
+		send_event_dump();
+		if (host_lora_tx.size() == sent)
+		{
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Run the dump of a time range until the server has all records
+ *
+ * @param from start of the range
+ * @param to end of the range
+ * @param loss loss rate of the uplink
+ * @param max_payload maximum payload of the datarate
+ * @param server server state
+ */
+static void run_dump(uint32_t from, uint32_t to, double loss, uint8_t max_payload, server_s &server)
+{
+	server = server_s();
+	host_lora_max_payload = max_payload;
+	host_lora_tx.clear();
+
+	std::vector<request_s> pending(1, request_s());
+	pending[0].expected = start_event_dump(from, to);
+	bool first = true;
+	while (!pending.empty() && (server.requests < 1000))
+	{
+		request_s request = pending.front();
+		pending.erase(pending.begin());
+		server.requests++;
+		if (!first)
+		{
+			request.expected = resume_event_dump(request.first, request.last);
+		}
+		first = false;
+		device_send_pages();
+		server_receive(server, request, loss);
+		server_gaps(request, pending);
+	}
+}
+
+/**
+ * @brief Fill the journal, some records have no Unix time
+ *
+ * @param num number of records
+ */
+static void fill(uint16_t num)
+{
+	host_fs_format();
+	CHECK(init_event_log());
+	for (uint16_t idx = 0; idx < num; idx++)
+	{
+		event_record_s record;
+		memset(&record, 0, sizeof(record));
+		bool rtc = idx % 5 != 0;
+		record.timestamp = rtc ? 1680000000 + idx * 600 : 30 + idx;
+		record.flags = rtc ? EVLOG_FLAG_RTC : 0;
+		event_log_add(&record);
+	}
+}
+
+/**
+ * @brief Check that the server got exactly the records of the range
+ *
+ * @param server server state
+ * @param from start of the range
+ * @param to end of the range
+ */
+static void check_complete(server_s &server, uint32_t from, uint32_t to)
+{
+	uint16_t first;
+	uint16_t num = event_log_find(from, to, &first);
+	CHECK_EQ(server.records.size(), num);
+	for (uint16_t pos = 0; pos < event_log_count(); pos++)
+	{
+		uint32_t seq = event_log_first_seq() + pos;
+		event_record_s record;
+		CHECK(event_log_get(pos, &record));
+		if (event_log_in_range(pos, from, to))
+		{
+			CHECK(server.records.count(seq) == 1);
+			CHECK_EQ(server.records[seq], record.timestamp);
+		}
+		else
+		{
+			CHECK(server.records.count(seq) == 0);
+		}
+	}
+}
+
+static void test_no_loss(void)
+{
+	fill(EVENT_LOG_SLOTS);
+	server_s server;
+	uint8_t payloads[] = {51, 115, 222};
+	for (uint8_t max_payload : payloads)
+	{
+		run_dump(0, 0xFFFFFFFF, 0.0, max_payload, server);
+		check_complete(server, 0, 0xFFFFFFFF);
+		// Full pages only, the minimum number of frames
+		uint16_t per_page = (max_payload - DUMP_HEADER_SIZE) / DUMP_RECORD_SIZE;
+		CHECK_EQ(server.frames, (EVENT_LOG_SLOTS + per_page - 1) / per_page);
+		CHECK_EQ(server.duplicates, 0);
+	}
+}
+
+static void test_loss(void)
+{
+	fill(EVENT_LOG_SLOTS + 20);
+	server_s server;
+	double losses[] = {0.1, 0.3, 0.5};
+	for (double loss : losses)
+	{
+		srand(1);
+		uint32_t frames = 0;
+		uint32_t lost = 0;
+		uint32_t duplicates = 0;
+		for (int run = 0; run < 50; run++)
+		{
+			run_dump(0, 0xFFFFFFFF, loss, 51, server);
+			check_complete(server, 0, 0xFFFFFFFF);
+			frames += server.frames;
+			lost += server.lost;
+			duplicates += server.duplicates;
+		}
+		// Only lost pages are sent again, a gap can need one more page if the page borders move
+		uint16_t per_page = (51 - DUMP_HEADER_SIZE) / DUMP_RECORD_SIZE;
+		uint32_t minimum = 50 * ((EVENT_LOG_SLOTS + per_page - 1) / per_page);
+		printf("loss %.0f%%: %ld frames, minimum %ld / (1 - loss) = %ld, %ld lost, %ld duplicate records\n", loss * 100,
+			   (long)frames, (long)minimum, (long)(minimum / (1 - loss)), (long)lost, (long)duplicates);
+		CHECK_EQ(duplicates, 0);
+		CHECK(frames <= minimum / (1 - loss) * 1.1);
+	}
+}
+
+static void test_range_loss(void)
+{
+	fill(EVENT_LOG_SLOTS);
+	server_s server;
+	srand(3);
+	for (int run = 0; run < 50; run++)
+	{
+		uint32_t from = 1680000000 + (rand() % 60) * 600;
+		uint32_t to = from + (rand() % 60) * 600;
+		run_dump(from, to, 0.25, 51, server);
+		check_complete(server, from, to);
+	}
+}
+
+/**
+ * @brief New earthquakes overwrite the oldest records while the pages are sent
+ *        Every page must have the records of the sequence numbers in its header
+ *
+ */
+static void test_ring_advance(void)
+{
+	fill(EVENT_LOG_SLOTS);
+	std::map<uint32_t, uint32_t> written;
+	for (uint16_t pos = 0; pos < event_log_count(); pos++)
+	{
+		event_record_s record;
+		CHECK(event_log_get(pos, &record));
+		written[record.seq] = record.timestamp;
+	}
+	host_lora_max_payload = 51;
+	host_lora_tx.clear();
+	server_s server = server_s();
+	request_s request = request_s();
+	request.expected = start_event_dump(0, 0xFFFFFFFF);
+	CHECK_EQ(request.expected, EVENT_LOG_SLOTS);
+
+	uint32_t time = 1690000000;
+	for (int page = 0; page < 200; page++)
+	{
+		size_t sent = host_lora_tx.size();
+		send_event_dump();
+		if (host_lora_tx.size() == sent)
+		{
+			break;
+		}
+		// Three earthquakes between two pages
+		for (int quake = 0; quake < 3; quake++)
+		{
+			event_record_s record;
+			memset(&record, 0, sizeof(record));
+			record.timestamp = time++;
+			record.flags = EVLOG_FLAG_RTC;
+			CHECK(event_log_add(&record));
+			written[event_log_first_seq() + event_log_count() - 1] = record.timestamp;
+		}
+	}
+	server_receive(server, request, 0.0);
+	CHECK(server.records.size() > 0);
+	CHECK_EQ(server.duplicates, 0);
+	for (std::map<uint32_t, uint32_t>::iterator it = server.records.begin(); it != server.records.end(); ++it)
+	{
+		CHECK_EQ(it->second, written[it->first]);
+	}
+	// The records that were overwritten before their page was sent are skipped
+	CHECK(server.records.size() < EVENT_LOG_SLOTS);
+}
+
+/**
+ * @brief A record with a CRC error keeps its place in the page and is sent with all bytes 0xFF
+ *        The records around it are sent as stored
+ *
+ */
+static void test_unreadable(void)
+{
+	fill(12);
+	// Corrupt the record with the sequence number 6, slot 5 of the fresh journal
+	std::vector<uint8_t> &file = host_fs_file("EVLOG2");
+	CHECK(file.size() >= 6 * sizeof(event_record_s));
+	file[5 * sizeof(event_record_s) + 4] ^= 0x55;
+	event_record_s record;
+	CHECK(!event_log_get_seq(6, &record));
+
+	// All records in one page
+	host_lora_max_payload = 242;
+	host_lora_tx.clear();
+	CHECK_EQ(start_event_dump(0, 0xFFFFFFFF), 12);
+	device_send_pages();
+	CHECK_EQ(host_lora_tx.size(), 1);
+	if (host_lora_tx.size() != 1)
+	{
+		return;
+	}
+	std::vector<uint8_t> &data = host_lora_tx[0];
+	CHECK_EQ(data.size(), DUMP_HEADER_SIZE + 12 * DUMP_RECORD_SIZE);
+	for (uint32_t seq = 1; seq <= 12; seq++)
+	{
+		const uint8_t *rec = &data[DUMP_HEADER_SIZE + (seq - 1) * DUMP_RECORD_SIZE];
+		if (seq == 6)
+		{
+			for (uint8_t idx = 0; idx < DUMP_RECORD_SIZE; idx++)
+			{
+				CHECK_EQ(rec[idx], 0xFF);
+			}
+			continue;
+		}
+		CHECK(event_log_get_seq(seq, &record));
+		uint32_t timestamp = ((uint32_t)rec[0] << 24) | ((uint32_t)rec[1] << 16) | ((uint32_t)rec[2] << 8) | rec[3];
+		CHECK_EQ(timestamp, record.timestamp);
+		CHECK_EQ(rec[14], record.flags);
+		CHECK(rec[14] != 0xFF);
+	}
+	host_lora_tx.clear();
+}
+
+int main(void)
+{
+	g_lorawan_settings.lorawan_enable = true;
+	g_lpwan_has_joined = true;
+	init_event_dump();
+	RUN(test_no_loss);
+	RUN(test_loss);
+	RUN(test_range_loss);
+	RUN(test_ring_advance);
+	RUN(test_unreadable);
+	return TEST_RESULT();
+}
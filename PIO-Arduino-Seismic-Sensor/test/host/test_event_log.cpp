@@ -0,0 +1,413 @@
+/**
+ * @file test_event_log.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host test of the event journal and its dump
+ *        Power loss at every byte of a record write, search in unsorted timestamps
+ *        and the pages of a dump with a time range.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "host_fakes.h"
+#include "test.h"
+
+// Used by event_dump.cpp
+bool earthquake_start = false;
+bool dl_ack_pending = false;
+
+void sched_start(uint8_t job, uint32_t delay_ms, uint32_t period_ms, uint32_t tolerance_ms)
+{
+}
+
+void sched_stop(uint8_t job)
+{
+}
+
+lmh_error_status perf_lora_uplink(uint8_t type, lmh_error_status result)
+{
+	return result;
+}
+
+void perf_retry(void)
+{
+}
+
+/**
+ * @brief Add a record with a given time
+ *
+ * @param timestamp start time
+ * @param rtc true if the time is a Unix time
+ * @return true record written
+ */
+static bool add_record(uint32_t timestamp, bool rtc)
+{
+	event_record_s record;
+	memset(&record, 0, sizeof(record));
+	record.timestamp = timestamp;
+	record.flags = rtc ? EVLOG_FLAG_RTC : 0;
+	record.peak_si = timestamp & 0xFFFF;
+	record.duration = 10;
+	return event_log_add(&record);
+}
+
+/**
+ * @brief Check that the journal has consecutive valid records
+ *
+ * @param last_seq expected sequence number of the newest record
+ * @param num expected number of records
+ */
+static void check_journal(uint32_t last_seq, uint16_t num)
+{
+	CHECK_EQ(event_log_count(), num);
+	CHECK_EQ(event_log_first_seq(), num == 0 ? 0 : last_seq - num + 1);
+	event_record_s record;
+	for (uint16_t pos = 0; pos < event_log_count(); pos++)
+	{
+		CHECK(event_log_get(pos, &record));
+		CHECK_EQ(record.seq, last_seq - num + 1 + pos);
+	}
+}
+
+/**
+ * @brief Cut the power at every byte of a record write and restart
+ *        The records written before must survive, the cut record is either complete or gone
+ *        and the next record continues the sequence.
+ *
+ * @param before number of records written before the power cut
+ */
+static void power_cut_at(uint16_t before)
+{
+	for (long cut = 0; cut <= (long)sizeof(event_record_s); cut++)
+	{
+		host_fs_format();
+		CHECK(init_event_log());
+		for (uint16_t idx = 0; idx < before; idx++)
+		{
+			add_record(1000 + idx, true);
+		}
+		uint16_t num = before > EVENT_LOG_SLOTS ? EVENT_LOG_SLOTS : before;
+
+		host_fs_power_cut(cut);
+		add_record(5000, true);
+		CHECK_EQ(host_fs_is_cut(), cut < (long)sizeof(event_record_s));
+		host_fs_power_on();
+
+		// Restart
+		CHECK(init_event_log());
+		if (cut == (long)sizeof(event_record_s))
+		{
+			// Complete record
+			check_journal(before + 1, num < EVENT_LOG_SLOTS ? num + 1 : num);
+		}
+		else if ((before < EVENT_LOG_SLOTS) || (cut == 0))
+		{
+			// Cut record is ignored
+			check_journal(before, num);
+		}
+		else
+		{
+			// The cut record overwrote the oldest record, both are lost
+			check_journal(before, num - 1);
+		}
+
+		// The next record continues after the newest valid record
+		uint16_t count = event_log_count();
+		uint32_t last_seq = count == 0 ? 0 : event_log_first_seq() + count - 1;
+		CHECK(add_record(6000, true));
+		CHECK(init_event_log());
+		check_journal(last_seq + 1, count < EVENT_LOG_SLOTS ? count + 1 : count);
+	}
+}
+
+static void test_power_cut(void)
+{
+	power_cut_at(0);
+	power_cut_at(5);
+	power_cut_at(EVENT_LOG_SLOTS - 1);
+	power_cut_at(EVENT_LOG_SLOTS + 3);
+}
+
+/**
+ * @brief Power cuts in a row without a complete write between them
+ *
+ */
+static void test_repeated_power_cut(void)
+{
+	host_fs_format();
+	CHECK(init_event_log());
+	for (uint16_t idx = 0; idx < 10; idx++)
+	{
+		add_record(1000 + idx, true);
+	}
+	for (long cut = 1; cut < (long)sizeof(event_record_s); cut += 3)
+	{
+		host_fs_power_cut(cut);
+		add_record(2000, true);
+		host_fs_power_on();
+		CHECK(init_event_log());
+		check_journal(10, 10);
+	}
+	CHECK(add_record(3000, true));
+	CHECK(init_event_log());
+	check_journal(11, 11);
+}
+
+/**
+ * @brief Fill the ring with records that are not in time order
+ *        Records before the first sync have the seconds since boot, a sync can move the clock backwards
+ *
+ * @param num number of records
+ */
+static void fill_unsorted(uint16_t num)
+{
+	host_fs_format();
+	CHECK(init_event_log());
+	uint32_t time = 1680000000;
+	for (uint16_t idx = 0; idx < num; idx++)
+	{
+		switch (idx % 7)
+		{
+		case 0:
+			// Seconds since boot
+			add_record(60 + idx, false);
+			break;
+		case 3:
+			// Clock was set back
+			time -= 5000;
+			add_record(time, true);
+			break;
+		default:
+			time += 1000 + (idx * 37) % 500;
+			add_record(time, true);
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Compare the search with a check of every record
+ *
+ * @param from start of the range
+ * @param to end of the range
+ */
+static void check_range(uint32_t from, uint32_t to)
+{
+	uint16_t expected = 0;
+	uint16_t expected_first = 0;
+	event_record_s record;
+	for (uint16_t pos = 0; pos < event_log_count(); pos++)
+	{
+		CHECK(event_log_get(pos, &record));
+		bool all = (from == 0) && (to == 0xFFFFFFFF);
+		bool match = all || ((record.flags & EVLOG_FLAG_RTC) && (record.timestamp >= from) && (record.timestamp <= to));
+		CHECK_EQ(event_log_in_range(pos, from, to), match);
+		if (match)
+		{
+			if (expected == 0)
+			{
+				expected_first = pos;
+			}
+			expected++;
+		}
+	}
+	uint16_t first;
+	CHECK_EQ(event_log_find(from, to, &first), expected);
+	if (expected != 0)
+	{
+		CHECK_EQ(first, expected_first);
+	}
+}
+
+static void test_find_unsorted(void)
+{
+	uint16_t sizes[] = {0, 1, 20, EVENT_LOG_SLOTS, EVENT_LOG_SLOTS + 50};
+	for (uint16_t size : sizes)
+	{
+		fill_unsorted(size);
+		check_range(0, 0xFFFFFFFF);
+		check_range(0, 1000);
+		check_range(1, 0xFFFFFFFF);
+		check_range(1680000000, 1680020000);
+		check_range(1680010000, 1680010000);
+		check_range(1680050000, 1680000000);
+		for (uint32_t from = 1679990000; from < 1680100000; from += 7919)
+		{
+			check_range(from, from + 15000);
+		}
+		// Same result after a restart
+		CHECK(init_event_log());
+		check_range(1680000000, 1680020000);
+	}
+}
+
+/**
+ * @brief Send a dump and check its pages
+ *
+ * @param from start of the range
+ * @param to end of the range
+ * @param max_payload maximum payload size of the datarate
+ */
+static void check_dump(uint32_t from, uint32_t to, uint8_t max_payload)
+{
+	uint16_t first;
+	uint16_t expected = event_log_find(from, to, &first);
+	host_lora_tx.clear();
+	host_lora_max_payload = max_payload;
+	CHECK_EQ(start_event_dump(from, to), expected);
+
+	uint16_t received = 0;
+	uint32_t next_seq = 0;
+	for (uint16_t page_num = 0; page_num < 500; page_num++)
+	{
+		size_t pages = host_lora_tx.size();
+		send_event_dump();
+		if (host_lora_tx.size() == pages)
+		{
+			break;
+		}
+		std::vector<uint8_t> &page = host_lora_tx.back();
+		CHECK(page.size() <= max_payload);
+		CHECK_EQ((page.size() - DUMP_HEADER_SIZE) % DUMP_RECORD_SIZE, 0);
+		uint32_t seq = ((uint32_t)page[0] << 24) | ((uint32_t)page[1] << 16) | ((uint32_t)page[2] << 8) | page[3];
+		uint16_t left = ((uint16_t)page[4] << 8) | page[5];
+		uint16_t num = (page.size() - DUMP_HEADER_SIZE) / DUMP_RECORD_SIZE;
+		CHECK(seq >= next_seq);
+		for (uint16_t idx = 0; idx < num; idx++)
+		{
+			// Records of a page have consecutive sequence numbers
+			uint16_t pos = seq + idx - event_log_first_seq();
+			CHECK(event_log_in_range(pos, from, to));
+			const uint8_t *data = &page[DUMP_HEADER_SIZE + idx * DUMP_RECORD_SIZE];
+			uint32_t timestamp = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+			event_record_s record;
+			CHECK(event_log_get(pos, &record));
+			CHECK_EQ(timestamp, record.timestamp);
+		}
+		received += num;
+		CHECK_EQ(left, expected - received);
+		next_seq = seq + num;
+	}
+	CHECK_EQ(received, expected);
+}
+
+static void test_dump_range(void)
+{
+	g_lorawan_settings.lorawan_enable = true;
+	g_lpwan_has_joined = true;
+	init_event_dump();
+	fill_unsorted(EVENT_LOG_SLOTS + 10);
+	check_dump(0, 0xFFFFFFFF, 222);
+	check_dump(0, 0xFFFFFFFF, 51);
+	check_dump(1680000000, 1680030000, 51);
+	check_dump(1680000000, 1680030000, 22);
+	check_dump(1, 1000, 222);
+	check_dump(2000000000, 2000000001, 222);
+}
+
+/**
+ * @brief The seismic task hands the record over, only the loop writes the file
+ *
+ */
+static void test_handover(void)
+{
+	host_fs_format();
+	CHECK(init_event_log());
+	host_set_ms(1000);
+	event_log_start();
+	host_advance_ms(42000);
+
+	// Seismic task, any write to the file would cut the power
+	host_fs_power_cut(0);
+	event_log_finish(0.5f, 0.25f, true, false, 3);
+	CHECK(!host_fs_is_cut());
+	CHECK_EQ(event_log_count(), 0);
+	host_fs_power_on();
+
+	// Loop
+	event_log_flush();
+	CHECK_EQ(event_log_count(), 1);
+	event_record_s record;
+	CHECK(event_log_get_seq(1, &record));
+	CHECK_EQ(record.duration, 42);
+	CHECK_EQ(record.peak_si, 500);
+	CHECK_EQ(record.peak_pga, 250);
+	CHECK(record.flags & EVLOG_FLAG_SHUTOFF);
+	CHECK(!(record.flags & EVLOG_FLAG_COLLAPSE));
+	CHECK_EQ(record.d7s_state, 3);
+	event_log_flush();
+	CHECK_EQ(event_log_count(), 1);
+
+	// More earthquakes than the queue holds before the loop runs, the oldest are kept
+	for (uint8_t idx = 0; idx < EVENT_LOG_PENDING + 2; idx++)
+	{
+		event_log_start();
+		host_advance_ms(1000 * (idx + 1));
+		event_log_finish(0.1f, 0.1f, false, false, idx);
+	}
+	event_log_flush();
+	CHECK_EQ(event_log_count(), 1 + EVENT_LOG_PENDING);
+	for (uint8_t idx = 0; idx < EVENT_LOG_PENDING; idx++)
+	{
+		CHECK(event_log_get_seq(2 + idx, &record));
+		CHECK_EQ(record.d7s_state, idx);
+		CHECK_EQ(record.duration, idx + 1);
+	}
+	CHECK(!event_log_get_seq(0, &record));
+	CHECK(!event_log_get_seq(2 + EVENT_LOG_PENDING, &record));
+}
+
+/**
+ * @brief The time base of a record is the one of its start time
+ *        A sync during the earthquake does not flag the uptime as Unix time, a start at millis() 0 is kept
+ *
+ */
+static void test_start_clock(void)
+{
+	host_fs_format();
+	CHECK(init_event_log());
+	event_record_s record;
+
+	// Start right after the boot, no Unix time yet
+	host_set_ms(0);
+	CHECK(!is_clock_valid());
+	event_log_start();
+	CHECK(!event_log_start_clock());
+	host_advance_ms(20000);
+	// Time sync while the earthquake is going on
+	CHECK(clock_sync(1680000000000ULL, 50, CLOCK_SRC_NETWORK, false));
+	CHECK(is_clock_valid());
+	host_advance_ms(5000);
+	event_log_finish(0.2f, 0.1f, false, false, 1);
+	CHECK(!event_log_start_clock());
+	event_log_flush();
+	CHECK(event_log_get_seq(1, &record));
+	CHECK_EQ(record.timestamp, 0);
+	CHECK_EQ(record.duration, 25);
+	CHECK(!(record.flags & EVLOG_FLAG_RTC));
+
+	// Next earthquake with the synced clock
+	host_advance_ms(60000);
+	event_log_start();
+	CHECK(event_log_start_clock());
+	host_advance_ms(3000);
+	event_log_finish(0.2f, 0.1f, false, false, 1);
+	event_log_flush();
+	CHECK(event_log_get_seq(2, &record));
+	CHECK_EQ(record.timestamp, 1680000000UL + 65);
+	CHECK_EQ(record.duration, 3);
+	CHECK(record.flags & EVLOG_FLAG_RTC);
+}
+
+int main(void)
+{
+	RUN(test_power_cut);
+	RUN(test_repeated_power_cut);
+	RUN(test_find_unsorted);
+	RUN(test_dump_range);
+	RUN(test_handover);
+	RUN(test_start_clock);
+	return TEST_RESULT();
+}
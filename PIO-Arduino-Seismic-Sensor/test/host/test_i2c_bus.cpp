@@ -0,0 +1,530 @@
+/**
+ * @file test_i2c_bus.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host test of the I2C bus manager with a simulated bus
+ *        The transfers of a heartbeat and of an earthquake event are replayed once with
+ *        plain Wire calls like before the bus manager (the SHTC3 library left the bus at 100 kHz)
+ *        and once through the bus manager. The bus time of both is printed and compared.
+ *        The register reads with the TWIM EasyDMA are checked for the CPU busy time per read.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "host_fakes.h"
+#include "test.h"
+
+/** I2C addresses of the simulated devices */
+#define SIM_D7S_ADDR 0x55
+#define SIM_SHTC3_ADDR 0x70
+#define SIM_RTC_ADDR 0x52
+#define SIM_PMSA_ADDR 0x12
+#define SIM_NACK_ADDR 0x13
+
+/** Bytes counted by perf_i2c() */
+static uint32_t perf_bytes = 0;
+
+void perf_i2c(uint16_t bytes)
+{
+	perf_bytes += bytes;
+}
+
+void perf_i2c_error(void)
+{
+}
+
+/**
+ * @brief All simulated devices answer, the read data is a counter
+ *
+ */
+static bool sim_device(uint8_t addr, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len)
+{
+	for (size_t idx = 0; idx < rx_len; idx++)
+	{
+		rx[idx] = (uint8_t)idx;
+	}
+	return (addr == SIM_D7S_ADDR) || (addr == SIM_SHTC3_ADDR) || (addr == SIM_RTC_ADDR) || (addr == SIM_PMSA_ADDR);
+}
+
+/** Bytes of the last write that reached a device */
+static std::vector<uint8_t> sim_written;
+
+/**
+ * @brief Simulated devices that keep the bytes of the last write
+ *
+ */
+static bool sim_device_log(uint8_t addr, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len)
+{
+	if (rx_len == 0)
+	{
+		sim_written.assign(tx, tx + tx_len);
+	}
+	return sim_device(addr, tx, tx_len, rx, rx_len);
+}
+
+/**
+ * @brief Register read of the D7S library, 16 bit register address, 1 byte value
+ *
+ */
+static void wire_read8(uint8_t addr, uint16_t reg)
+{
+	Wire.beginTransmission(addr);
+	Wire.write((uint8_t)(reg >> 8));
+	Wire.write((uint8_t)reg);
+	Wire.endTransmission(false);
+	Wire.requestFrom(addr, (uint8_t)1);
+	Wire.read();
+}
+
+/**
+ * @brief Register write of the D7S library
+ *
+ */
+static void wire_write8(uint8_t addr, uint16_t reg, uint8_t value)
+{
+	Wire.beginTransmission(addr);
+	Wire.write((uint8_t)(reg >> 8));
+	Wire.write((uint8_t)reg);
+	Wire.write(value);
+	Wire.endTransmission();
+}
+
+/**
+ * @brief Read n bytes from a register with Wire
+ *
+ */
+static void wire_read_regs(uint8_t addr, const uint8_t *reg, uint8_t reg_len, uint8_t len)
+{
+	Wire.beginTransmission(addr);
+	Wire.write(reg, reg_len);
+	Wire.endTransmission(false);
+	Wire.requestFrom(addr, len);
+	while (Wire.available())
+	{
+		Wire.read();
+	}
+}
+
+/** SHTC3 commands */
+static const uint8_t shtc3_wakeup[2] = {0x35, 0x17};
+static const uint8_t shtc3_measure[2] = {0x78, 0x66};
+static const uint8_t shtc3_sleep[2] = {0xB0, 0x98};
+
+/** Number of D7S polls during an earthquake, INT2 start, 10 captures, INT1 shutoff, INT2 end */
+#define SIM_EVENT_CAPTURES 10
+
+/**
+ * @brief Heartbeat before the bus manager, everything with Wire at the clock the SHTC3 library left
+ *
+ */
+static void heartbeat_before(void)
+{
+	Wire.beginTransmission(SIM_SHTC3_ADDR);
+	Wire.write(shtc3_wakeup, 2);
+	Wire.endTransmission();
+	Wire.beginTransmission(SIM_SHTC3_ADDR);
+	Wire.write(shtc3_measure, 2);
+	Wire.endTransmission();
+	Wire.requestFrom(SIM_SHTC3_ADDR, (uint8_t)6);
+	while (Wire.available())
+	{
+		Wire.read();
+	}
+	Wire.beginTransmission(SIM_SHTC3_ADDR);
+	Wire.write(shtc3_sleep, 2);
+	Wire.endTransmission();
+	// RTC read with the Melopero library, one transfer per register
+	uint8_t reg = 0;
+	for (reg = 0; reg < 7; reg++)
+	{
+		wire_read_regs(SIM_RTC_ADDR, &reg, 1, 1);
+	}
+}
+
+/**
+ * @brief Heartbeat through the bus manager, same calls as RAK1901_temp.cpp and RAK12002_rtc.cpp
+ *
+ */
+static void heartbeat_after(void)
+{
+	i2c_begin(I2C_DEV_SHTC3);
+	CHECK(i2c_write(I2C_DEV_SHTC3, SIM_SHTC3_ADDR, shtc3_wakeup, 2));
+	CHECK(i2c_write(I2C_DEV_SHTC3, SIM_SHTC3_ADDR, shtc3_measure, 2));
+	i2c_end(I2C_DEV_SHTC3, 0);
+	uint8_t data[15];
+	i2c_begin(I2C_DEV_SHTC3);
+	CHECK(i2c_read(I2C_DEV_SHTC3, SIM_SHTC3_ADDR, data, 6));
+	CHECK(i2c_write(I2C_DEV_SHTC3, SIM_SHTC3_ADDR, shtc3_sleep, 2));
+	i2c_end(I2C_DEV_SHTC3, 0);
+	// One burst read of the time and status registers
+	uint8_t reg = 0;
+	CHECK(i2c_read_regs(I2C_DEV_RTC, SIM_RTC_ADDR, &reg, 1, data, 15));
+}
+
+/**
+ * @brief Earthquake event before the bus manager
+ *        Status checks and resets with the D7S library, SI and PGA with two register reads each
+ *
+ */
+static void event_before(void)
+{
+	// INT2 earthquake start
+	wire_read8(SIM_D7S_ADDR, 0x1000);
+	for (int capture = 0; capture < SIM_EVENT_CAPTURES; capture++)
+	{
+		for (uint16_t reg = 0x2000; reg < 0x2004; reg++)
+		{
+			wire_read8(SIM_D7S_ADDR, reg);
+		}
+	}
+	// INT1 shutoff, check collapse and shutoff, reset the events
+	wire_read8(SIM_D7S_ADDR, 0x1001);
+	wire_read8(SIM_D7S_ADDR, 0x1001);
+	wire_read8(SIM_D7S_ADDR, 0x1004);
+	wire_write8(SIM_D7S_ADDR, 0x1004, 0x80);
+	// INT2 earthquake end, reset the events
+	wire_read8(SIM_D7S_ADDR, 0x1000);
+	wire_read8(SIM_D7S_ADDR, 0x1004);
+	wire_write8(SIM_D7S_ADDR, 0x1004, 0x80);
+}
+
+/**
+ * @brief Earthquake event through the bus manager, same calls as RAK12027_seismic.cpp
+ *        The library calls are grouped into sessions, SI and PGA are read in one transfer
+ *
+ */
+static void event_after(void)
+{
+	i2c_begin(I2C_DEV_D7S);
+	wire_read8(SIM_D7S_ADDR, 0x1000);
+	i2c_end(I2C_DEV_D7S, 5);
+	for (int capture = 0; capture < SIM_EVENT_CAPTURES; capture++)
+	{
+		uint8_t reg_addr[2] = {0x20, 0x00};
+		uint8_t data[4];
+		CHECK(i2c_read_regs(I2C_DEV_D7S, SIM_D7S_ADDR, reg_addr, 2, data, 4));
+	}
+	i2c_begin(I2C_DEV_D7S);
+	wire_read8(SIM_D7S_ADDR, 0x1001);
+	wire_read8(SIM_D7S_ADDR, 0x1001);
+	wire_read8(SIM_D7S_ADDR, 0x1004);
+	wire_write8(SIM_D7S_ADDR, 0x1004, 0x80);
+	i2c_end(I2C_DEV_D7S, 3 * 5 + 4);
+	i2c_begin(I2C_DEV_D7S);
+	wire_read8(SIM_D7S_ADDR, 0x1000);
+	wire_read8(SIM_D7S_ADDR, 0x1004);
+	wire_write8(SIM_D7S_ADDR, 0x1004, 0x80);
+	i2c_end(I2C_DEV_D7S, 2 * 5 + 4);
+}
+
+/**
+ * @brief Run a sequence and return its time on the bus
+ *
+ */
+static uint64_t bus_time(void (*sequence)(void))
+{
+	uint64_t start = host_us;
+	sequence();
+	return host_us - start;
+}
+
+/**
+ * @brief Bus time per heartbeat and per earthquake before and after the bus manager
+ *
+ */
+static void test_bus_time(void)
+{
+	host_i2c_device = sim_device;
+
+	// Before: init_rak1901() dropped the whole bus to 100 kHz
+	Wire.begin();
+	Wire.setClock(400000);
+	Wire.begin();
+	uint64_t heartbeat_old = bus_time(heartbeat_before);
+	uint64_t event_old = bus_time(event_before);
+
+	// After: the bus manager switches the clock per device
+	// The SHTC3 library restarts Wire
+	Wire.begin();
+	i2c_clock_changed();
+	uint64_t heartbeat_new = bus_time(heartbeat_after);
+	uint64_t event_new = bus_time(event_after);
+	uint64_t heartbeat_next = bus_time(heartbeat_after);
+
+	printf("Heartbeat: %ld us before, %ld us after\n", (long)heartbeat_old, (long)heartbeat_new);
+	printf("Earthquake: %ld us before, %ld us after\n", (long)event_old, (long)event_new);
+	CHECK(heartbeat_new < heartbeat_old);
+	CHECK(heartbeat_next == heartbeat_new);
+	// The D7S runs at 400 kHz again and SI/PGA need one transfer instead of four
+	CHECK(event_new * 4 < event_old);
+}
+
+/**
+ * @brief The clock is switched only when the next device needs another speed
+ *
+ */
+static void test_clock_switches(void)
+{
+	host_i2c_device = sim_device;
+	event_after();
+	i2c_reset_stats();
+	CHECK_EQ(host_i2c_clock, 400000);
+
+	// Several D7S sessions, no switch
+	event_after();
+	event_after();
+	CHECK_EQ(i2c_get_stats(I2C_DEV_D7S)->clock_switches, 0);
+
+	// SHTC3 needs 100 kHz, the RTC 400 kHz, the D7S keeps it
+	heartbeat_after();
+	CHECK_EQ(i2c_get_stats(I2C_DEV_SHTC3)->clock_switches, 1);
+	CHECK_EQ(i2c_get_stats(I2C_DEV_RTC)->clock_switches, 1);
+	event_after();
+	CHECK_EQ(i2c_get_stats(I2C_DEV_D7S)->clock_switches, 0);
+	CHECK_EQ(host_i2c_clock, 400000);
+
+	// Nested sessions switch once
+	i2c_begin(I2C_DEV_SHTC3);
+	i2c_begin(I2C_DEV_SHTC3);
+	CHECK_EQ(host_i2c_clock, 100000);
+	uint8_t data[6];
+	CHECK(i2c_read(I2C_DEV_SHTC3, SIM_SHTC3_ADDR, data, 6));
+	i2c_end(I2C_DEV_SHTC3, 0);
+	i2c_end(I2C_DEV_SHTC3, 0);
+	CHECK_EQ(i2c_get_stats(I2C_DEV_SHTC3)->clock_switches, 2);
+}
+
+/**
+ * @brief Bytes and bus time per device match the simulated bus
+ *
+ */
+static void test_statistics(void)
+{
+	host_i2c_device = sim_device;
+	i2c_reset_stats();
+	perf_bytes = 0;
+
+	uint64_t start = host_us;
+	for (int heartbeat = 0; heartbeat < 5; heartbeat++)
+	{
+		heartbeat_after();
+	}
+	uint64_t elapsed = host_us - start;
+	i2c_stats_s *shtc3 = i2c_get_stats(I2C_DEV_SHTC3);
+	i2c_stats_s *rtc = i2c_get_stats(I2C_DEV_RTC);
+	// Address byte, command or register, data, read address
+	CHECK_EQ(shtc3->transfers, 5 * 4);
+	CHECK_EQ(shtc3->bytes, 5 * (3 + 3 + 7 + 3));
+	CHECK_EQ(rtc->transfers, 5);
+	CHECK_EQ(rtc->bytes, 5 * (2 + 1 + 15));
+	CHECK_EQ(perf_bytes, shtc3->bytes + rtc->bytes);
+	CHECK_EQ(shtc3->bus_us + rtc->bus_us, elapsed);
+	CHECK_EQ(shtc3->errors + rtc->errors, 0);
+
+	// A device that does not answer is counted
+	uint8_t data[2];
+	CHECK(!i2c_read(I2C_DEV_PMSA, SIM_NACK_ADDR, data, 2));
+	CHECK_EQ(i2c_get_stats(I2C_DEV_PMSA)->errors, 1);
+
+	i2c_reset_stats();
+	CHECK_EQ(i2c_get_stats(I2C_DEV_SHTC3)->bytes, 0);
+}
+
+/** Result of an asynchronous read */
+static int async_done = 0;
+static bool async_success = false;
+
+static void async_callback(bool success, void *context)
+{
+	async_done++;
+	async_success = success;
+	*(int *)context += 1;
+}
+
+/**
+ * @brief CPU busy time of a read with Wire and with the EasyDMA
+ *        Wire waits in a busy loop for the whole transfer, the EasyDMA only needs the CPU
+ *        to start the transfer and to handle the result.
+ *
+ */
+static void test_dma_cpu_busy(void)
+{
+	host_i2c_device = sim_device;
+	struct
+	{
+		const char *name;
+		uint8_t dev;
+		uint8_t addr;
+		uint8_t reg_len;
+		uint8_t len;
+	} reads[] = {
+		{"D7S SI/PGA", I2C_DEV_D7S, SIM_D7S_ADDR, 2, 4},
+		{"RTC time", I2C_DEV_RTC, SIM_RTC_ADDR, 1, 15},
+		{"PMSA frame", I2C_DEV_PMSA, SIM_PMSA_ADDR, 1, 32},
+	};
+	printf("%-12s %10s %10s %10s\n", "Read", "bus us", "Wire CPU", "DMA CPU");
+	for (auto &read : reads)
+	{
+		uint8_t reg[2] = {0, 0};
+		uint8_t data[32];
+
+		// Blocking Wire read of the same registers
+		i2c_reset_stats();
+		i2c_begin(read.dev);
+		wire_read_regs(read.addr, reg, read.reg_len, read.len);
+		i2c_end(read.dev, 2 + read.reg_len + read.len);
+		uint32_t wire_cpu = i2c_get_stats(read.dev)->cpu_us;
+
+		i2c_reset_stats();
+		uint32_t dma_before = host_i2c_dma_transfers;
+		CHECK(i2c_read_regs(read.dev, read.addr, reg, read.reg_len, data, read.len));
+		CHECK_EQ(host_i2c_dma_transfers, dma_before + 1);
+		i2c_stats_s *stats = i2c_get_stats(read.dev);
+		CHECK_EQ(stats->transfers, 1);
+		CHECK_EQ(stats->bytes, 2 + read.reg_len + read.len);
+		CHECK_EQ(data[read.len - 1], read.len - 1);
+		printf("%-12s %10ld %10ld %10ld\n", read.name, (long)stats->bus_us, (long)wire_cpu, (long)stats->cpu_us);
+		CHECK(stats->bus_us > 0);
+		CHECK_EQ(wire_cpu, stats->bus_us);
+		CHECK(stats->cpu_us * 10 < stats->bus_us);
+	}
+}
+
+/**
+ * @brief Asynchronous read with a callback, the CPU works while the transfer runs
+ *
+ */
+static void test_async_read(void)
+{
+	host_i2c_device = sim_device;
+	i2c_reset_stats();
+	uint8_t reg[2] = {0x20, 0x00};
+	uint8_t data[4] = {0xFF, 0xFF, 0xFF, 0xFF};
+	int calls = 0;
+	async_done = 0;
+	CHECK(i2c_read_async(I2C_DEV_D7S, SIM_D7S_ADDR, reg, 2, data, 4, async_callback, &calls));
+	CHECK_EQ(async_done, 0);
+
+	// The callback is only called by the task that started the transfer
+	TaskHandle_t loop_task = host_current_task;
+	host_current_task = (TaskHandle_t)2;
+	i2c_async_poll();
+	CHECK(i2c_async_wait(I2C_ASYNC_TIMEOUT));
+	CHECK_EQ(async_done, 0);
+	host_current_task = loop_task;
+
+	// Nothing finished yet, the transfer completes while the CPU sleeps
+	i2c_async_poll();
+	CHECK_EQ(async_done, 0);
+	CHECK(i2c_async_wait(I2C_ASYNC_TIMEOUT));
+	CHECK_EQ(async_done, 1);
+	CHECK_EQ(calls, 1);
+	CHECK(async_success);
+	CHECK_EQ(data[3], 3);
+	CHECK_EQ(i2c_get_stats(I2C_DEV_D7S)->transfers, 1);
+
+	// The next session waits for a running transfer
+	CHECK(i2c_read_async(I2C_DEV_D7S, SIM_D7S_ADDR, reg, 2, data, 4, async_callback, &calls));
+	i2c_begin(I2C_DEV_SHTC3);
+	CHECK_EQ(async_done, 2);
+	i2c_end(I2C_DEV_SHTC3, 0);
+
+	// A device that does not answer
+	CHECK(!i2c_read_regs(I2C_DEV_PMSA, SIM_NACK_ADDR, reg, 1, data, 4));
+	CHECK_EQ(i2c_get_stats(I2C_DEV_PMSA)->errors, 1);
+	CHECK(i2c_read_async(I2C_DEV_PMSA, SIM_NACK_ADDR, reg, 1, data, 4, async_callback, &calls));
+	CHECK(i2c_async_wait(I2C_ASYNC_TIMEOUT));
+	CHECK(!async_success);
+	CHECK_EQ(i2c_get_stats(I2C_DEV_PMSA)->errors, 2);
+
+	// Wrong parameters
+	CHECK(!i2c_read_async(I2C_DEV_D7S, SIM_D7S_ADDR, reg, 0, data, 4, NULL, NULL));
+	CHECK(!i2c_read_async(I2C_DEV_D7S, SIM_D7S_ADDR, reg, 2, data, 0, NULL, NULL));
+
+	// The bus is free again
+	CHECK_EQ(host_sem_deadlocks, 0);
+}
+
+/**
+ * @brief Write the D7S mode register with Wire, like the D7S library, and check what the device got
+ *
+ * @return true all bytes reached the device
+ */
+static bool wire_write_checked(void)
+{
+	sim_written.clear();
+	uint32_t cut = host_i2c_wire_cut;
+	i2c_begin(I2C_DEV_D7S);
+	wire_write8(SIM_D7S_ADDR, 0x1004, 0x80);
+	i2c_end(I2C_DEV_D7S, 4);
+	const uint8_t expected[3] = {0x10, 0x04, 0x80};
+	return (host_i2c_wire_cut == cut) && (sim_written == std::vector<uint8_t>(expected, expected + 3));
+}
+
+/**
+ * @brief Wire right after a transfer with the EasyDMA
+ *        Wire shares the TWIM and waits for events without clearing them first.
+ *        The events of the finished, failed or timed out DMA transfer must be cleared,
+ *        and the STOP of a timed out transfer must be finished before Wire starts.
+ *
+ */
+static void test_wire_after_async(void)
+{
+	host_i2c_device = sim_device_log;
+	uint8_t reg[2] = {0x20, 0x00};
+	uint8_t data[4];
+
+	// Finished transfer
+	CHECK(i2c_read_regs(I2C_DEV_D7S, SIM_D7S_ADDR, reg, 2, data, 4));
+	CHECK(wire_write_checked());
+
+	// Asynchronous transfer finished by the next session
+	int calls = 0;
+	async_done = 0;
+	CHECK(i2c_read_async(I2C_DEV_D7S, SIM_D7S_ADDR, reg, 2, data, 4, async_callback, &calls));
+	CHECK(wire_write_checked());
+	CHECK_EQ(async_done, 1);
+
+	// NACK of the address
+	CHECK(!i2c_read_regs(I2C_DEV_PMSA, SIM_NACK_ADDR, reg, 1, data, 4));
+	CHECK(wire_write_checked());
+
+	// Device stretches the clock, the transfer times out and is stopped
+	host_i2c_dma_hang = true;
+	uint64_t start_us = host_us;
+	CHECK(i2c_read_async(I2C_DEV_D7S, SIM_D7S_ADDR, reg, 2, data, 4, async_callback, &calls));
+	CHECK(!i2c_async_wait(I2C_ASYNC_TIMEOUT));
+	CHECK(!async_success);
+	host_i2c_dma_hang = false;
+	CHECK(wire_write_checked());
+	CHECK(host_us - start_us < (I2C_ASYNC_TIMEOUT + I2C_STOP_TIMEOUT + 3) * 1000ULL);
+
+	// SCL held low, the wait for the STOP is limited too
+	host_i2c_dma_hang = true;
+	host_i2c_stop_hang = true;
+	start_us = host_us;
+	CHECK(i2c_read_async(I2C_DEV_D7S, SIM_D7S_ADDR, reg, 2, data, 4, async_callback, &calls));
+	CHECK(!i2c_async_wait(I2C_ASYNC_TIMEOUT));
+	CHECK(host_us - start_us <= (I2C_ASYNC_TIMEOUT + I2C_STOP_TIMEOUT + 3) * 1000ULL);
+	host_i2c_dma_hang = false;
+	host_i2c_stop_hang = false;
+	// Bus released, the pending STOP finishes
+	__WFE();
+	CHECK(wire_write_checked());
+	CHECK_EQ(host_sem_deadlocks, 0);
+	host_i2c_device = sim_device;
+}
+
+int main(void)
+{
+	init_i2c_bus();
+	RUN(test_bus_time);
+	RUN(test_clock_switches);
+	RUN(test_statistics);
+	RUN(test_dma_cpu_busy);
+	RUN(test_async_read);
+	RUN(test_wire_after_async);
+	return TEST_RESULT();
+}
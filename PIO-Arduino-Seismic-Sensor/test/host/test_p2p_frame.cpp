@@ -0,0 +1,242 @@
+/**
+ * @file test_p2p_frame.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host test of the P2P packet with the DevEUI in front of the payload
+ *        The frame of WisCayenne must be the same as the copy of DevEUI and payload that was sent before,
+ *        with the reserved header space and without it, if its allocation failed.
+ *        The stack used by the send is compared with the copy into a buffer on the stack.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "host_fakes.h"
+#include "test.h"
+
+/** DevEUI of the simulated node */
+static const uint8_t sim_eui[8] = {0xAC, 0x1F, 0x09, 0xFF, 0xFE, 0x05, 0x71, 0x2A};
+
+/** Stack address inside the radio send */
+static uintptr_t sim_send_sp = 0;
+
+bool send_p2p_packet(uint8_t *data, uint8_t size)
+{
+	volatile uint8_t marker = 0;
+	sim_send_sp = (uintptr_t)&marker;
+	host_p2p_tx.push_back(std::vector<uint8_t>(data, data + size));
+	return true;
+}
+
+/**
+ * @brief WisCayenne after a failed allocation of the buffer with the header space
+ *        The buffer is given back to CayenneLPP without header space
+ *
+ */
+class SimCayenne : public WisCayenne
+{
+public:
+	SimCayenne(uint8_t size) : WisCayenne(size)
+	{
+		_buffer = _frame;
+		_frame = NULL;
+	}
+};
+
+/**
+ * @brief Values of an alert packet, like the seismic task adds them
+ *
+ * @param packet packet to fill
+ */
+static void fill_alert(WisCayenne &packet)
+{
+	packet.reset();
+	packet.addPresence(LPP_CHANNEL_EQ_EVENT, true);
+	packet.addPresence(LPP_CHANNEL_EQ_SHUTOFF, true);
+	packet.addPresence(LPP_CHANNEL_EQ_COLLAPSE, false);
+	packet.addAnalogInput(LPP_CHANNEL_EQ_SI, 12.3);
+	packet.addAnalogInput(LPP_CHANNEL_EQ_PGA, 45.6);
+	packet.addUnixTime(LPP_CHANNEL_EQ_TIME, 1679990400);
+	packet.addVoltage(LPP_CHANNEL_BATT, 3.95);
+	packet.addGNSS_6(LPP_CHANNEL_GPS, 144123456, 1209876543, 12345);
+}
+
+/**
+ * @brief Fill the packet up to the given size with digital inputs of 3 and VOC values of 4 bytes
+ *
+ * @param packet packet to fill
+ * @param size payload size, 1, 2 and 5 cannot be reached
+ * @return true the packet has the size
+ */
+static bool fill_size(WisCayenne &packet, uint16_t size)
+{
+	packet.reset();
+	uint16_t voc = size % 3;
+	if (size < voc * (LPP_VOC_SIZE + 2))
+	{
+		return false;
+	}
+	for (uint16_t idx = 0; idx < voc; idx++)
+	{
+		packet.addVoc_index(idx, idx);
+	}
+	for (uint16_t idx = 0; idx < (size - voc * (LPP_VOC_SIZE + 2)) / 3; idx++)
+	{
+		packet.addDigitalInput(idx, idx);
+	}
+	return packet.getSize() == size;
+}
+
+/**
+ * @brief Frame as it was sent before, DevEUI and payload copied into a new buffer
+ *
+ * @param packet packet
+ * @return std::vector<uint8_t> frame
+ */
+static std::vector<uint8_t> copy_frame(WisCayenne &packet)
+{
+	std::vector<uint8_t> frame(sim_eui, sim_eui + 8);
+	frame.insert(frame.end(), packet.getBuffer(), packet.getBuffer() + packet.getSize());
+	return frame;
+}
+
+/**
+ * @brief Send the packet like app_event_handler
+ *
+ * @param packet packet
+ * @return true the frame was sent
+ */
+static bool send_frame(WisCayenne &packet)
+{
+	uint8_t *frame = packet.getFrame(sim_eui);
+	bool sent = (frame != NULL) && (packet.getFrameSize() <= 255) && send_p2p_packet(frame, packet.getFrameSize());
+	packet.reset();
+	return sent;
+}
+
+/**
+ * @brief Send the packet with the copy on the stack, like app_event_handler before
+ *
+ * @param packet packet
+ * @return true the frame was sent
+ */
+static bool __attribute__((noinline)) send_copy(WisCayenne &packet)
+{
+	uint8_t packet_buffer[packet.getSize() + 8];
+	memcpy(packet_buffer, sim_eui, 8);
+	memcpy(&packet_buffer[8], packet.getBuffer(), packet.getSize());
+	bool sent = send_p2p_packet(packet_buffer, packet.getSize() + 8);
+	packet.reset();
+	return sent;
+}
+
+/**
+ * @brief Send the packet from its buffer
+ *
+ * @param packet packet
+ * @return true the frame was sent
+ */
+static bool __attribute__((noinline)) send_in_place(WisCayenne &packet)
+{
+	return send_frame(packet);
+}
+
+/**
+ * @brief The frame is the copy of DevEUI and payload, with and without the header space
+ *
+ */
+static void test_equivalence(void)
+{
+	WisCayenne packet(255);
+	SimCayenne no_header(255);
+	WisCayenne *packets[] = {&packet, &no_header};
+	for (WisCayenne *sim : packets)
+	{
+		// Alert packet and packets up to the P2P limit
+		for (uint16_t size = 0; size <= 255 - 8; size++)
+		{
+			if (size == 0)
+			{
+				fill_alert(*sim);
+			}
+			else if (!fill_size(*sim, size))
+			{
+				continue;
+			}
+			std::vector<uint8_t> expected = copy_frame(*sim);
+			host_p2p_tx.clear();
+			CHECK(send_frame(*sim));
+			CHECK_EQ(host_p2p_tx.size(), 1);
+			if (host_p2p_tx.size() == 1)
+			{
+				CHECK(host_p2p_tx[0] == expected);
+			}
+		}
+		// The next packet after a send starts empty in both cases
+		fill_alert(*sim);
+		std::vector<uint8_t> expected = copy_frame(*sim);
+		host_p2p_tx.clear();
+		CHECK(send_frame(*sim));
+		CHECK(host_p2p_tx.size() == 1 && host_p2p_tx[0] == expected);
+	}
+}
+
+/**
+ * @brief A frame over the P2P limit is not sent, the old copy cut it to 8 bit
+ *
+ */
+static void test_too_big(void)
+{
+	WisCayenne packet(255);
+	SimCayenne no_header(255);
+	WisCayenne *packets[] = {&packet, &no_header};
+	for (WisCayenne *sim : packets)
+	{
+		// The largest frame that is sent
+		CHECK(fill_size(*sim, 255 - 8));
+		host_p2p_tx.clear();
+		CHECK(send_frame(*sim));
+		CHECK(host_p2p_tx.size() == 1 && host_p2p_tx[0].size() == 255);
+		// One byte more
+		CHECK(fill_size(*sim, 255 - 7));
+		host_p2p_tx.clear();
+		CHECK(!send_frame(*sim));
+		CHECK(host_p2p_tx.empty());
+		CHECK_EQ(sim->getSize(), 0);
+	}
+}
+
+/**
+ * @brief The stack at the radio send is the payload size smaller than with the copy
+ *
+ */
+static void test_stack(void)
+{
+	WisCayenne packet(255);
+	CHECK(fill_size(packet, 240));
+	volatile uint8_t marker = 0;
+	uintptr_t base = (uintptr_t)&marker;
+
+	CHECK(send_copy(packet));
+	uintptr_t copy_depth = base - sim_send_sp;
+	CHECK(fill_size(packet, 240));
+	CHECK(send_in_place(packet));
+	uintptr_t frame_depth = base - sim_send_sp;
+	printf("Stack at the send: copy %ld bytes, frame %ld bytes\n", (long)copy_depth, (long)frame_depth);
+	CHECK(frame_depth + 240 + 8 <= copy_depth);
+
+	// Without the header space the payload is moved in its buffer, no copy on the stack either
+	SimCayenne no_header(255);
+	CHECK(fill_size(no_header, 240));
+	CHECK(send_in_place(no_header));
+	CHECK_EQ(base - sim_send_sp, frame_depth);
+}
+
+int main(void)
+{
+	RUN(test_equivalence);
+	RUN(test_too_big);
+	RUN(test_stack);
+	return TEST_RESULT();
+}
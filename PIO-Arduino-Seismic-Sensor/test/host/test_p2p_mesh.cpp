@@ -0,0 +1,543 @@
+/**
+ * @file test_p2p_mesh.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host test of the alert flooding between P2P nodes
+ *        p2p_mesh.cpp keeps its state in static variables, the test includes it once per node
+ *        into its own namespace, so several nodes run side by side through the same fakes.
+ *        A frame that a node sends is received by its neighbours after the handler of the node returned.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "host_fakes.h"
+#include "test.h"
+
+namespace mesh_node_0
+{
+#include "p2p_mesh.cpp"
+}
+namespace mesh_node_1
+{
+#include "p2p_mesh.cpp"
+}
+namespace mesh_node_2
+{
+#include "p2p_mesh.cpp"
+}
+namespace mesh_node_3
+{
+#include "p2p_mesh.cpp"
+}
+namespace mesh_node_4
+{
+#include "p2p_mesh.cpp"
+}
+
+app_settings_s g_app_settings;
+
+/** Same values as in p2p_mesh.cpp */
+#define SIM_MESH_SIZE 16
+#define SIM_CACHE_TIME 60000
+#define SIM_SUPPRESS 2
+#define SIM_QUEUE_SIZE 4
+
+/** Time on air of one frame */
+#define SIM_AIRTIME 40
+
+/** Functions of one node */
+struct sim_node_s
+{
+	void (*init)(void);
+	void (*send_alert)(uint8_t alert);
+	bool (*handle)(uint8_t *data, uint8_t len);
+	void (*handler)(void);
+	void (*print)(void);
+};
+
+#define SIM_NODE(n) {mesh_node_##n::init_mesh, mesh_node_##n::mesh_send_alert, mesh_node_##n::handle_mesh_frame, mesh_node_##n::mesh_handler, mesh_node_##n::print_mesh}
+
+static const sim_node_s sim_nodes[] = {SIM_NODE(0), SIM_NODE(1), SIM_NODE(2), SIM_NODE(3), SIM_NODE(4)};
+
+#define SIM_NODE_NUM (sizeof(sim_nodes) / sizeof(sim_nodes[0]))
+
+/** State of the fakes per node */
+struct sim_state_s
+{
+	bool active;		// SCHED_MESH is running
+	uint32_t due;		// Due time of SCHED_MESH
+	uint8_t busy;		// Sends that fail because the radio is busy
+	uint8_t neighbours; // Nodes in range, bit n is node n
+};
+
+static sim_state_s sim_state[SIM_NODE_NUM];
+
+/** Node that runs at the moment */
+static uint8_t sim_current = 0;
+
+/** Frame on the air */
+struct sim_air_s
+{
+	uint8_t from;
+	uint32_t time;
+	std::vector<uint8_t> frame;
+};
+
+/** Frames sent, not yet received */
+static std::vector<sim_air_s> sim_air;
+
+/** All frames sent */
+static std::vector<sim_air_s> sim_sent;
+
+/** Values of the simulated D7S */
+float peakSI = 0.0f;
+float peakPGA = 0.0f;
+static float sim_instant_si = 0.0f;
+static float sim_instant_pga = 0.0f;
+static bool sim_instant_ok = true;
+
+bool instant_rak12027(float *si, float *pga)
+{
+	*si = sim_instant_si;
+	*pga = sim_instant_pga;
+	return sim_instant_ok;
+}
+
+uint32_t p2p_airtime(uint8_t len)
+{
+	return SIM_AIRTIME;
+}
+
+void sched_start(uint8_t job, uint32_t delay_ms, uint32_t period_ms, uint32_t tolerance_ms)
+{
+	CHECK_EQ(job, SCHED_MESH);
+	sim_state[sim_current].active = true;
+	sim_state[sim_current].due = millis() + delay_ms;
+}
+
+void sched_stop(uint8_t job)
+{
+	CHECK_EQ(job, SCHED_MESH);
+	sim_state[sim_current].active = false;
+}
+
+bool send_p2p_packet(uint8_t *data, uint8_t size)
+{
+	if (sim_state[sim_current].busy != 0)
+	{
+		sim_state[sim_current].busy--;
+		return false;
+	}
+	sim_air_s air = {sim_current, (uint32_t)millis(), std::vector<uint8_t>(data, data + size)};
+	sim_air.push_back(air);
+	sim_sent.push_back(air);
+	return true;
+}
+
+/** Statistics of a node, same order as print_mesh() */
+struct sim_stats_s
+{
+	long ttl;
+	long originated;
+	long received;
+	long duplicates;
+	long relayed;
+	long suppressed;
+	long airtime;
+};
+
+/** Statistics of each node at the start of a test, the module never clears them */
+static sim_stats_s sim_base[SIM_NODE_NUM];
+
+/**
+ * @brief Read the statistics of a node
+ *
+ * @param node node index
+ * @return sim_stats_s statistics since the reset
+ */
+static sim_stats_s sim_read_stats(uint8_t node)
+{
+	sim_stats_s stats = {};
+	host_serial.clear();
+	sim_current = node;
+	sim_nodes[node].print();
+	sscanf(host_serial.c_str(), "%ld:%ld:%ld:%ld:%ld:%ld:%ld", &stats.ttl, &stats.originated, &stats.received,
+		   &stats.duplicates, &stats.relayed, &stats.suppressed, &stats.airtime);
+	return stats;
+}
+
+/**
+ * @brief Get the statistics of a node
+ *
+ * @param node node index
+ * @return sim_stats_s statistics since the start of the test
+ */
+static sim_stats_s sim_stats(uint8_t node)
+{
+	sim_stats_s stats = sim_read_stats(node);
+	stats.originated -= sim_base[node].originated;
+	stats.received -= sim_base[node].received;
+	stats.duplicates -= sim_base[node].duplicates;
+	stats.relayed -= sim_base[node].relayed;
+	stats.suppressed -= sim_base[node].suppressed;
+	stats.airtime -= sim_base[node].airtime;
+	return stats;
+}
+
+/**
+ * @brief Give a frame to a node like the P2P RX callback
+ *
+ * @param node node index
+ * @param frame received frame, a copy is handled
+ */
+static void sim_receive(uint8_t node, const std::vector<uint8_t> &frame)
+{
+	std::vector<uint8_t> data = frame;
+	sim_current = node;
+	CHECK(sim_nodes[node].handle(data.data(), data.size()));
+}
+
+/**
+ * @brief Hand the frames on the air to the neighbours of their sender
+ *
+ */
+static void sim_deliver(void)
+{
+	while (!sim_air.empty())
+	{
+		sim_air_s air = sim_air.front();
+		sim_air.erase(sim_air.begin());
+		for (uint8_t node = 0; node < SIM_NODE_NUM; node++)
+		{
+			if (sim_state[air.from].neighbours & (1 << node))
+			{
+				sim_receive(node, air.frame);
+			}
+		}
+	}
+}
+
+/**
+ * @brief Run the mesh jobs of all nodes until a time
+ *
+ * @param end millis() at the end
+ */
+static void sim_run(uint32_t end)
+{
+	while (true)
+	{
+		int8_t next = -1;
+		for (uint8_t node = 0; node < SIM_NODE_NUM; node++)
+		{
+			if (sim_state[node].active && ((next < 0) || ((int32_t)(sim_state[node].due - sim_state[next].due) < 0)))
+			{
+				next = node;
+			}
+		}
+		if ((next < 0) || ((int32_t)(sim_state[next].due - end) > 0))
+		{
+			break;
+		}
+		if ((int32_t)(sim_state[next].due - millis()) > 0)
+		{
+			host_set_ms(sim_state[next].due);
+		}
+		sim_state[next].active = false;
+		sim_current = next;
+		sim_nodes[next].handler();
+		sim_deliver();
+	}
+	host_set_ms(end);
+}
+
+/**
+ * @brief Own alert of a node, from the seismic task to the loop
+ *
+ * @param node node index
+ * @param alert 1 = collapse, 2 = shutoff, 3 = both
+ */
+static void sim_alert(uint8_t node, uint8_t alert)
+{
+	sim_current = node;
+	g_task_event_type = 0;
+	sim_nodes[node].send_alert(alert);
+	CHECK_EQ(g_task_event_type, P2P_MESH);
+	sim_nodes[node].handler();
+	sim_deliver();
+}
+
+/**
+ * @brief Start all nodes, each with its own DevEUI and no neighbours
+ *
+ */
+static void sim_start(void)
+{
+	host_set_ms(millis() + 2 * SIM_CACHE_TIME);
+	sim_air.clear();
+	sim_sent.clear();
+	g_app_settings.mesh_ttl = MESH_TTL_DEFAULT;
+	g_lorawan_settings.lorawan_enable = false;
+	for (uint8_t node = 0; node < SIM_NODE_NUM; node++)
+	{
+		memset(&sim_state[node], 0, sizeof(sim_state[node]));
+		g_lorawan_settings.node_device_eui[7] = node + 1;
+		sim_current = node;
+		sim_nodes[node].init();
+		sim_base[node] = sim_read_stats(node);
+	}
+	sim_instant_si = 0.0f;
+	sim_instant_pga = 0.0f;
+	sim_instant_ok = true;
+	peakSI = 0.0f;
+	peakPGA = 0.0f;
+}
+
+/**
+ * @brief Connect two nodes
+ *
+ */
+static void sim_link(uint8_t node_a, uint8_t node_b)
+{
+	sim_state[node_a].neighbours |= 1 << node_b;
+	sim_state[node_b].neighbours |= 1 << node_a;
+}
+
+/**
+ * @brief Build a frame like a node with the given ID
+ *
+ * @param origin last byte of the origin ID
+ * @param seq sequence number
+ * @param ttl hops left
+ * @return std::vector<uint8_t> frame
+ */
+static std::vector<uint8_t> sim_frame(uint8_t origin, uint16_t seq, uint8_t ttl)
+{
+	std::vector<uint8_t> frame = {'E', 'Q', 1, 0, 0, 0, origin, (uint8_t)(seq >> 8), (uint8_t)seq, ttl, 0, 2, 0, 10, 0, 20};
+	return frame;
+}
+
+/**
+ * @brief Line of 5 nodes, the TTL of 3 reaches 3 hops, every node handles the alert once
+ *
+ */
+static void test_chain_ttl(void)
+{
+	sim_start();
+	for (uint8_t node = 0; node < SIM_NODE_NUM - 1; node++)
+	{
+		sim_link(node, node + 1);
+	}
+	sim_alert(0, 2);
+	sim_run(millis() + 10000);
+
+	// Own frame, relays of node 1 and 2, node 3 gets the last hop
+	CHECK_EQ(sim_sent.size(), 3);
+	CHECK_EQ(sim_stats(0).originated, 1);
+	CHECK_EQ(sim_stats(1).received, 1);
+	CHECK_EQ(sim_stats(1).relayed, 1);
+	CHECK_EQ(sim_stats(2).received, 1);
+	CHECK_EQ(sim_stats(2).relayed, 1);
+	CHECK_EQ(sim_stats(3).received, 1);
+	CHECK_EQ(sim_stats(3).relayed, 0);
+	CHECK_EQ(sim_stats(4).received, 0);
+	if (sim_sent.size() == 3)
+	{
+		CHECK_EQ(sim_sent[0].frame[SIM_MESH_SIZE - 7], MESH_TTL_DEFAULT);
+		CHECK_EQ(sim_sent[2].frame[SIM_MESH_SIZE - 7], 1);
+		CHECK_EQ(sim_sent[2].frame[SIM_MESH_SIZE - 6], 2);
+	}
+
+	// The relays coming back are duplicates, also the own frame at the origin
+	CHECK_EQ(sim_stats(0).duplicates, 1);
+	CHECK_EQ(sim_stats(1).duplicates, 1);
+	CHECK_EQ(sim_stats(0).airtime, SIM_AIRTIME);
+}
+
+/**
+ * @brief A frame is a duplicate for the cache time, then it is new again
+ *
+ */
+static void test_duplicates(void)
+{
+	sim_start();
+	std::vector<uint8_t> frame = sim_frame(0x20, 0x1234, 1);
+	sim_receive(4, frame);
+	sim_receive(4, frame);
+	CHECK_EQ(sim_stats(4).received, 1);
+	CHECK_EQ(sim_stats(4).duplicates, 1);
+
+	// Same origin, next sequence number
+	sim_receive(4, sim_frame(0x20, 0x1235, 1));
+	CHECK_EQ(sim_stats(4).received, 2);
+
+	host_advance_ms(SIM_CACHE_TIME - 1);
+	sim_receive(4, frame);
+	CHECK_EQ(sim_stats(4).duplicates, 2);
+	host_advance_ms(SIM_CACHE_TIME);
+	sim_receive(4, frame);
+	CHECK_EQ(sim_stats(4).received, 3);
+
+	// Other packets are not taken
+	std::vector<uint8_t> beacon = {'T', 'B', 0x01, 0, 0, 0, 0, 0, 0, 0, 0};
+	sim_current = 4;
+	CHECK(!sim_nodes[4].handle(beacon.data(), beacon.size()));
+	frame[2] = 2;
+	CHECK(!sim_nodes[4].handle(frame.data(), frame.size()));
+	CHECK_EQ(sim_stats(4).received, 3);
+}
+
+/**
+ * @brief All nodes in range of each other, after MESH_SUPPRESS relays the others stay quiet
+ *
+ */
+static void test_suppress(void)
+{
+	sim_start();
+	for (uint8_t node_a = 0; node_a < SIM_NODE_NUM; node_a++)
+	{
+		for (uint8_t node_b = node_a + 1; node_b < SIM_NODE_NUM; node_b++)
+		{
+			sim_link(node_a, node_b);
+		}
+	}
+	sim_alert(0, 1);
+	sim_run(millis() + 10000);
+
+	long relayed = 0;
+	long suppressed = 0;
+	for (uint8_t node = 1; node < SIM_NODE_NUM; node++)
+	{
+		sim_stats_s stats = sim_stats(node);
+		CHECK_EQ(stats.received, 1);
+		relayed += stats.relayed;
+		suppressed += stats.suppressed;
+	}
+	CHECK_EQ(relayed, SIM_SUPPRESS);
+	CHECK_EQ(suppressed, SIM_NODE_NUM - 1 - SIM_SUPPRESS);
+	CHECK_EQ(sim_sent.size(), 1 + SIM_SUPPRESS);
+	// The own frame is never suppressed
+	CHECK_EQ(sim_stats(0).originated, 1);
+}
+
+/**
+ * @brief More new frames than the queue holds, the rest is shown but not relayed
+ *
+ */
+static void test_queue_full(void)
+{
+	sim_start();
+	sim_link(4, 3);
+	for (uint8_t origin = 0; origin <= SIM_QUEUE_SIZE; origin++)
+	{
+		sim_receive(4, sim_frame(0x30 + origin, 1, 3));
+	}
+	CHECK_EQ(sim_stats(4).received, SIM_QUEUE_SIZE + 1);
+	sim_run(millis() + 10000);
+	CHECK_EQ(sim_stats(4).relayed, SIM_QUEUE_SIZE);
+	CHECK_EQ(sim_stats(3).received, SIM_QUEUE_SIZE);
+
+	// The queue is free again
+	sim_receive(4, sim_frame(0x40, 1, 3));
+	sim_run(millis() + 10000);
+	CHECK_EQ(sim_stats(4).relayed, SIM_QUEUE_SIZE + 1);
+}
+
+/**
+ * @brief Radio busy, own and relayed frames are sent after another backoff
+ *
+ */
+static void test_busy_radio(void)
+{
+	sim_start();
+	g_app_settings.mesh_ttl = 2;
+	sim_link(0, 1);
+	sim_link(1, 2);
+	sim_state[0].busy = 1;
+	sim_state[1].busy = 2;
+	uint32_t start = millis();
+	sim_alert(0, 2);
+	CHECK(sim_sent.empty());
+	CHECK(sim_state[0].active);
+	sim_run(millis() + 10000);
+
+	CHECK_EQ(sim_sent.size(), 2);
+	if (sim_sent.size() == 2)
+	{
+		// After at least one backoff slot
+		CHECK(sim_sent[0].time - start >= SIM_AIRTIME + 10);
+		CHECK_EQ(sim_sent[1].from, 1);
+	}
+	CHECK_EQ(sim_state[1].busy, 0);
+	CHECK_EQ(sim_stats(0).originated, 1);
+	CHECK_EQ(sim_stats(1).relayed, 1);
+	CHECK_EQ(sim_stats(2).received, 1);
+	// Failed sends use no airtime
+	CHECK_EQ(sim_stats(0).airtime, SIM_AIRTIME);
+	CHECK_EQ(sim_stats(1).airtime, SIM_AIRTIME);
+	CHECK(!sim_state[0].active);
+	CHECK(!sim_state[1].active);
+}
+
+/**
+ * @brief SI and PGA of an own alert are read when the alert comes
+ *        The higher of the instantaneous value and the peak of the running earthquake
+ *
+ */
+static void test_alert_values(void)
+{
+	sim_start();
+	sim_link(0, 1);
+	sim_current = 0;
+	g_task_event_type = 0;
+	sim_instant_si = 0.3f;
+	sim_instant_pga = 2.5f;
+	peakSI = 0.8f;
+	peakPGA = 1.0f;
+	sim_nodes[0].send_alert(2);
+	// A second alert before the loop ran is sent in the same frame
+	sim_instant_si = 1.2f;
+	sim_nodes[0].send_alert(1);
+	sim_nodes[0].handler();
+	CHECK_EQ(sim_sent.size(), 1);
+	if (sim_sent.size() == 1)
+	{
+		std::vector<uint8_t> &frame = sim_sent[0].frame;
+		CHECK_EQ(frame[11], 3);
+		CHECK_EQ((frame[12] << 8) | frame[13], 120);
+		CHECK_EQ((frame[14] << 8) | frame[15], 250);
+	}
+
+	// The D7S did not answer, the captured peak is sent
+	sim_instant_ok = false;
+	sim_nodes[0].send_alert(2);
+	sim_nodes[0].handler();
+	CHECK_EQ(sim_sent.size(), 2);
+	if (sim_sent.size() == 2)
+	{
+		CHECK_EQ((sim_sent[1].frame[12] << 8) | sim_sent[1].frame[13], 80);
+		CHECK_EQ((sim_sent[1].frame[14] << 8) | sim_sent[1].frame[15], 100);
+	}
+
+	// LoRaWAN mode or TTL 0, nothing is sent
+	g_task_event_type = 0;
+	g_app_settings.mesh_ttl = 0;
+	sim_nodes[0].send_alert(2);
+	g_app_settings.mesh_ttl = MESH_TTL_DEFAULT;
+	g_lorawan_settings.lorawan_enable = true;
+	sim_nodes[0].send_alert(2);
+	g_lorawan_settings.lorawan_enable = false;
+	CHECK_EQ(g_task_event_type, 0);
+}
+
+int main(void)
+{
+	RUN(test_chain_ttl);
+	RUN(test_duplicates);
+	RUN(test_suppress);
+	RUN(test_queue_full);
+	RUN(test_busy_radio);
+	RUN(test_alert_values);
+	return TEST_RESULT();
+}
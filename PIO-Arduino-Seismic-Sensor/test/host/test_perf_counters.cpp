@@ -0,0 +1,253 @@
+/**
+ * @file test_perf_counters.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host test of the runtime counters at their limits
+ *        The counter block is in retained RAM, the test includes perf_counters.cpp to preset it
+ *        close to the maximum, like a device that runs for years. All counters and the sums of
+ *        the diagnostic uplink must stop at the maximum instead of wrapping to a small value.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "perf_counters.cpp"
+#include "host_fakes.h"
+#include "test.h"
+
+/** Reset reason the simulated POWER peripheral reports */
+static uint32_t sim_reset_reason = 0;
+
+uint32_t readResetReason(void)
+{
+	return sim_reset_reason;
+}
+
+/**
+ * @brief Read a big endian field of the diagnostic uplink
+ *
+ * @param packet uplink
+ * @param pos position of the field
+ * @param len field size
+ * @return uint32_t value
+ */
+static uint32_t get_field(const std::vector<uint8_t> &packet, uint8_t pos, uint8_t len)
+{
+	uint32_t value = 0;
+	for (uint8_t idx = 0; idx < len; idx++)
+	{
+		value = (value << 8) | packet[pos + idx];
+	}
+	return value;
+}
+
+/**
+ * @brief Send the diagnostic uplink and return it
+ *
+ * @return std::vector<uint8_t> uplink, empty if nothing was sent
+ */
+static std::vector<uint8_t> diag_uplink(void)
+{
+	g_lorawan_settings.lorawan_enable = true;
+	g_lpwan_has_joined = true;
+	host_lora_result = LMH_SUCCESS;
+	host_lora_tx.clear();
+	host_lora_fport.clear();
+	perf_request_uplink();
+	CHECK(send_perf_uplink());
+	CHECK(!perf_uplink_pending);
+	if (host_lora_tx.size() != 1)
+	{
+		return std::vector<uint8_t>();
+	}
+	CHECK_EQ(host_lora_fport[0], PERF_FPORT);
+	return host_lora_tx[0];
+}
+
+/**
+ * @brief Counters stop at the maximum
+ *
+ */
+static void test_saturate(void)
+{
+	perf_reset();
+	perf.i2c_transfers = 0xFFFFFFFEUL;
+	perf.i2c_bytes = 0xFFFFFFF0UL;
+	perf_i2c(10);
+	CHECK_EQ(perf.i2c_transfers, 0xFFFFFFFFUL);
+	CHECK_EQ(perf.i2c_bytes, 0xFFFFFFFAUL);
+	perf_i2c(10);
+	perf_i2c(0xFFFF);
+	CHECK_EQ(perf.i2c_transfers, 0xFFFFFFFFUL);
+	CHECK_EQ(perf.i2c_bytes, 0xFFFFFFFFUL);
+
+	perf.d7s_irq[1] = 0xFFFFFFFFUL;
+	perf_irq(2);
+	perf_irq_handled();
+	CHECK_EQ(perf.d7s_irq[1], 0xFFFFFFFFUL);
+	CHECK_EQ(perf.d7s_irq[0], 0);
+
+	perf.wakeups[3] = 0xFFFFFFFFUL;
+	perf_wakeup(0x0009);
+	CHECK_EQ(perf.wakeups[3], 0xFFFFFFFFUL);
+	CHECK_EQ(perf.wakeups[0], 1);
+
+	perf.uplinks[PERF_UP_ALERT][PERF_RES_BUSY] = 0xFFFFFFFFUL;
+	perf.retries = 0xFFFFFFFFUL;
+	perf.join_fails = 0xFFFFFFFFUL;
+	perf.tx_nak = 0xFFFFFFFFUL;
+	perf_uplink(PERF_UP_ALERT, PERF_RES_BUSY);
+	perf_retry();
+	perf_join_fail();
+	perf_tx_done(false);
+	CHECK_EQ(perf.uplinks[PERF_UP_ALERT][PERF_RES_BUSY], 0xFFFFFFFFUL);
+	CHECK_EQ(perf.retries, 0xFFFFFFFFUL);
+	CHECK_EQ(perf.join_fails, 0xFFFFFFFFUL);
+	CHECK_EQ(perf.tx_nak, 0xFFFFFFFFUL);
+	CHECK_EQ(perf.tx_ack, 0);
+}
+
+/**
+ * @brief Time awake and the handler times over the wrap of micros() and for very long runs
+ *
+ */
+static void test_awake(void)
+{
+	perf_reset();
+	// micros() wraps during the handler
+	host_us = 0xFFFFFF00ULL;
+	uint32_t start = micros();
+	host_advance_us(1500);
+	perf_handler_done(PERF_HANDLER_APP, start);
+	CHECK_EQ(perf.handler_max_us[PERF_HANDLER_APP], 1500);
+	CHECK_EQ(perf.awake_ms, 1);
+	CHECK_EQ(perf.awake_us, 500);
+
+	// A run of almost 72 minutes, awake_us + elapsed would overflow
+	start = micros();
+	host_advance_us(0xFFFFFFFFULL);
+	perf_handler_done(PERF_HANDLER_SEISMIC, start);
+	CHECK_EQ(perf.handler_max_us[PERF_HANDLER_SEISMIC], 0xFFFFFFFFUL);
+	CHECK_EQ(perf.awake_ms, 1 + 0xFFFFFFFFULL / 1000 + (500 + 0xFFFFFFFFULL % 1000) / 1000);
+	CHECK_EQ(perf.awake_us, (500 + 0xFFFFFFFFULL % 1000) % 1000);
+
+	// awake_ms stops at the maximum
+	perf.awake_ms = 0xFFFFFFFFUL - 1;
+	start = micros();
+	host_advance_us(5000);
+	perf_handler_done(PERF_HANDLER_APP, start);
+	CHECK_EQ(perf.awake_ms, 0xFFFFFFFFUL);
+
+	// Interrupt latency over the wrap of micros()
+	host_us = 0x1FFFFFF00ULL;
+	perf_irq(1);
+	host_advance_us(700);
+	perf_irq_handled();
+	CHECK_EQ(perf.irq_latency_max_us, 700);
+}
+
+/**
+ * @brief The sums of the diagnostic uplink stop at the maximum of the field
+ *        Before they wrapped, a full reset counter and one more reset sent 0 resets
+ *
+ */
+static void test_uplink_sums(void)
+{
+	perf_reset();
+	perf.resets[PERF_RESET_POWER] = 0xFFFFFFFFUL;
+	perf.resets[PERF_RESET_WDT] = 1;
+	perf.uplinks[PERF_UP_STATUS][PERF_RES_QUEUED] = 0xFFFFFFFFUL;
+	perf.uplinks[PERF_UP_DIAG][PERF_RES_QUEUED] = 1;
+	perf.uplinks[PERF_UP_ALERT][PERF_RES_BUSY] = 0x80000000UL;
+	perf.uplinks[PERF_UP_ALERT][PERF_RES_ERROR] = 0x80000000UL;
+	perf.wakeups[0] = 0xFFFFFFFFUL;
+	perf.wakeups[15] = 2;
+	perf.awake_ms = 0xFFFFFFFFUL;
+
+	std::vector<uint8_t> packet = diag_uplink();
+	CHECK(packet.size() <= PERF_UPLINK_SIZE);
+	if (packet.size() < 38)
+	{
+		CHECK(false);
+		return;
+	}
+	// Layout of the README, version, uptime, resets, last reset, wakeups, ...
+	CHECK_EQ(packet[0], PERF_UPLINK_VERSION);
+	CHECK_EQ(get_field(packet, 5, 2), 0xFFFF);
+	CHECK_EQ(get_field(packet, 8, 4), 0xFFFFFFFFUL);
+	CHECK_EQ(get_field(packet, 22, 2), 0xFFFF);
+	CHECK_EQ(get_field(packet, 24, 2), 0xFFFF);
+	CHECK_EQ(get_field(packet, 30, 4), 0xFFFFFFFFUL / 1000);
+	// The counters themselves are unchanged by the uplink, except the uplink counter
+	CHECK_EQ(perf.resets[PERF_RESET_POWER], 0xFFFFFFFFUL);
+	CHECK_EQ(perf.uplinks[PERF_UP_DIAG][PERF_RES_QUEUED], 2);
+
+	// A device that sent few uplinks reports the exact sums
+	perf_reset();
+	perf.resets[PERF_RESET_PIN] = 3;
+	perf.resets[PERF_RESET_WDT] = 4;
+	perf.uplinks[PERF_UP_STATUS][PERF_RES_QUEUED] = 100;
+	perf.uplinks[PERF_UP_ALERT][PERF_RES_ERROR] = 5;
+	packet = diag_uplink();
+	CHECK(packet.size() >= 26);
+	if (packet.size() >= 26)
+	{
+		CHECK_EQ(get_field(packet, 5, 2), 7);
+		CHECK_EQ(get_field(packet, 22, 2), 100);
+		CHECK_EQ(get_field(packet, 24, 2), 5);
+	}
+}
+
+/**
+ * @brief AT+PERF prints the full 32 bit values
+ *
+ */
+static void test_print(void)
+{
+	perf_reset();
+	perf.i2c_bytes = 0xFFFFFFFFUL;
+	host_serial.clear();
+	perf_print();
+	CHECK(host_serial.find("I2C:0:4294967295:0\n") != std::string::npos);
+}
+
+/**
+ * @brief The block survives a watchdog reset and is cleared after a power on or a layout change
+ *
+ */
+static void test_retention(void)
+{
+	perf_reset();
+	perf.retries = 0xFFFFFFFFUL;
+	perf.resets[PERF_RESET_WDT] = 0xFFFFFFFFUL;
+
+	sim_reset_reason = POWER_RESETREAS_DOG_Msk;
+	init_perf();
+	CHECK_EQ(perf.retries, 0xFFFFFFFFUL);
+	CHECK_EQ(perf.resets[PERF_RESET_WDT], 0xFFFFFFFFUL);
+	CHECK_EQ(perf.last_reset, PERF_RESET_WDT);
+
+	// Firmware with another layout
+	perf.version = PERF_VERSION + 1;
+	sim_reset_reason = POWER_RESETREAS_SREQ_Msk;
+	init_perf();
+	CHECK_EQ(perf.retries, 0);
+	CHECK_EQ(perf.resets[PERF_RESET_SOFT], 1);
+
+	perf.retries = 5;
+	sim_reset_reason = 0;
+	init_perf();
+	CHECK_EQ(perf.retries, 0);
+	CHECK_EQ(perf.resets[PERF_RESET_POWER], 1);
+	CHECK_EQ(perf.last_reset, PERF_RESET_POWER);
+}
+
+int main(void)
+{
+	RUN(test_saturate);
+	RUN(test_awake);
+	RUN(test_uplink_sums);
+	RUN(test_print);
+	RUN(test_retention);
+	return TEST_RESULT();
+}
@@ -0,0 +1,399 @@
+/**
+ * @file test_pm.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host test of the RAK12039 sampling cycle with a simulated PMSA003I
+ *        The simulated sensor delivers a stream of big endian frames, some of them damaged.
+ *        The cycle is driven through the PM_SAMPLE events the scheduler would send.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "RAK12039_PMSA003I.h"
+#include "host_fakes.h"
+#include "test.h"
+#include <deque>
+
+WisCayenne g_solution_data(255);
+
+/** Same values as in RAK12039_pm.cpp */
+#define SIM_SET_PIN WB_IO6
+#define SIM_WARMUP_TIME 30000
+#define SIM_WARMUP_TOLERANCE 5000
+#define SIM_SAMPLE_MARGIN 5000
+
+void perf_i2c(uint16_t bytes)
+{
+}
+
+void perf_i2c_error(void)
+{
+}
+
+/** Heartbeat time the cycle is planned for */
+static uint32_t sim_heartbeat = 0;
+
+uint32_t get_heartbeat_time(void)
+{
+	return sim_heartbeat;
+}
+
+/** Time until the heartbeat job is due, 0 if it is not running */
+static uint32_t sim_heartbeat_remaining = 0;
+
+uint32_t sched_remaining(uint8_t job)
+{
+	CHECK_EQ(job, SCHED_HEARTBEAT);
+	return sim_heartbeat_remaining;
+}
+
+/** Last request to the scheduler, 0 if the job was stopped */
+static uint32_t sched_delay = 0;
+static uint32_t sched_tolerance = 0;
+static bool sched_running = false;
+
+void sched_start(uint8_t job, uint32_t delay_ms, uint32_t period_ms, uint32_t tolerance_ms)
+{
+	CHECK_EQ(job, SCHED_PM);
+	sched_delay = delay_ms;
+	sched_tolerance = tolerance_ms;
+	sched_running = true;
+}
+
+void sched_stop(uint8_t job)
+{
+	CHECK_EQ(job, SCHED_PM);
+	sched_running = false;
+}
+
+/** Frame errors of the simulated sensor */
+enum sim_error_e
+{
+	SIM_OK = 0,
+	SIM_NACK,
+	SIM_CHECKSUM,
+	SIM_HEADER
+};
+
+/** One frame of the stream */
+struct sim_frame_s
+{
+	uint16_t pm10;
+	uint16_t pm25;
+	uint16_t pm100;
+	sim_error_e error;
+};
+
+/** Frames the sensor delivers, the last frame repeats if the stream is empty */
+static std::deque<sim_frame_s> sim_stream;
+static sim_frame_s sim_last = {0, 0, 0, SIM_OK};
+static bool sim_present = true;
+static uint8_t sim_reg = 0;
+static uint32_t sim_frames_read = 0;
+
+/**
+ * @brief Build a raw frame like the sensor sends it
+ *
+ * @param frame values and error of the frame
+ * @param raw buffer for the 32 bytes
+ */
+static void sim_build(const sim_frame_s &frame, uint8_t *raw)
+{
+	uint16_t values[13] = {frame.pm10, frame.pm25, frame.pm100, frame.pm10, frame.pm25, frame.pm100,
+						   1000, 300, 100, 20, 5, 1, 0};
+	raw[0] = 0x42;
+	raw[1] = 0x4D;
+	raw[2] = 0x00;
+	raw[3] = 28;
+	for (uint8_t idx = 0; idx < 12; idx++)
+	{
+		raw[4 + idx * 2] = values[idx] >> 8;
+		raw[5 + idx * 2] = values[idx];
+	}
+	raw[28] = 0x80; // Version
+	raw[29] = 0x00; // Error code
+	uint16_t sum = 0;
+	for (uint8_t idx = 0; idx < 30; idx++)
+	{
+		sum += raw[idx];
+	}
+	raw[30] = sum >> 8;
+	raw[31] = sum;
+	if (frame.error == SIM_CHECKSUM)
+	{
+		raw[10] ^= 0x04;
+	}
+	else if (frame.error == SIM_HEADER)
+	{
+		raw[1] = 0x00;
+	}
+}
+
+/**
+ * @brief PMSA003I on the I2C bus, register 0 starts the frame
+ *
+ */
+static bool sim_pmsa(uint8_t addr, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len)
+{
+	if (!sim_present || (addr != PMSA003I_DEV_ADDR))
+	{
+		return false;
+	}
+	if (tx_len != 0)
+	{
+		sim_reg = tx[0];
+	}
+	if (rx_len == 0)
+	{
+		return true;
+	}
+	uint8_t raw[sizeof(PMSA_Data_t)];
+	if (rx_len == sizeof(PMSA_Data_t))
+	{
+		if (!sim_stream.empty())
+		{
+			sim_last = sim_stream.front();
+			sim_stream.pop_front();
+		}
+		sim_frames_read++;
+		if (sim_last.error == SIM_NACK)
+		{
+			return false;
+		}
+	}
+	sim_build(sim_last, raw);
+	for (size_t idx = 0; idx < rx_len; idx++)
+	{
+		rx[idx] = (sim_reg + idx) < sizeof(raw) ? raw[sim_reg + idx] : 0;
+	}
+	return true;
+}
+
+/**
+ * @brief Run the PM_SAMPLE events until the scheduler is stopped or a long wait is scheduled
+ *
+ * @return uint32_t number of events
+ */
+static uint32_t run_cycle(void)
+{
+	uint32_t events = 0;
+	while (sched_running && (events < 100))
+	{
+		host_advance_ms(sched_delay);
+		handle_rak12039();
+		events++;
+		if (sched_running && (sched_delay > SIM_WARMUP_TIME + SIM_WARMUP_TOLERANCE))
+		{
+			break;
+		}
+	}
+	return events;
+}
+
+/**
+ * @brief Get a PM value from the payload
+ *
+ * @param channel LPP channel
+ * @return int value or -1 if the channel is missing
+ */
+static int lpp_value(uint8_t channel)
+{
+	uint8_t *data = g_solution_data.getBuffer();
+	for (uint8_t pos = 0; pos + 4 <= g_solution_data.getSize(); pos += 4)
+	{
+		if ((data[pos] == channel) && (data[pos + 1] == LPP_VOC))
+		{
+			return (data[pos + 2] << 8) | data[pos + 3];
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief The frame is converted in place, damaged frames are found
+ *
+ */
+static void test_parse(void)
+{
+	PMSA_Data_t frame;
+	sim_frame_s values = {12, 345, 4567, SIM_OK};
+	sim_build(values, (uint8_t *)&frame);
+	CHECK(RAK_PMSA003I::parseDate(&frame));
+	CHECK_EQ(frame.header, 0x424D);
+	CHECK_EQ(frame.date_len, 28);
+	CHECK_EQ(frame.pm10_env, 12);
+	CHECK_EQ(frame.pm25_env, 345);
+	CHECK_EQ(frame.pm100_env, 4567);
+	CHECK_EQ(frame.particles_03um, 1000);
+	CHECK_EQ(frame.version, 0x80);
+	CHECK_EQ(frame.error_code, 0);
+
+	values.error = SIM_CHECKSUM;
+	sim_build(values, (uint8_t *)&frame);
+	CHECK(!RAK_PMSA003I::parseDate(&frame));
+	values.error = SIM_HEADER;
+	sim_build(values, (uint8_t *)&frame);
+	CHECK(!RAK_PMSA003I::parseDate(&frame));
+}
+
+/**
+ * @brief One duty cycled burst before the heartbeat, damaged frames are not averaged
+ *
+ */
+static void test_burst(void)
+{
+	sim_heartbeat = 600000;
+	sim_stream.clear();
+	sim_frames_read = 0;
+	CHECK(init_rak12039());
+	CHECK_EQ(host_pin_level[SIM_SET_PIN], HIGH);
+	CHECK(sched_running);
+	CHECK_EQ(sched_delay, SIM_WARMUP_TIME + SIM_WARMUP_TOLERANCE);
+	// The first sample may be late to share a wakeup, never early
+	CHECK_EQ(sched_delay - sched_tolerance, SIM_WARMUP_TIME);
+
+	// 8 frames are read, 2 of them are damaged and one is not acknowledged
+	sim_frame_s frames[] = {{10, 20, 30, SIM_OK}, {11, 21, 31, SIM_OK}, {500, 500, 500, SIM_CHECKSUM},
+							{12, 22, 32, SIM_OK}, {500, 500, 500, SIM_NACK}, {13, 23, 33, SIM_OK},
+							{500, 500, 500, SIM_HEADER}, {14, 24, 34, SIM_OK}};
+	sim_stream.assign(frames, frames + 8);
+	run_cycle();
+	CHECK_EQ(sim_frames_read, 8);
+	CHECK(!sched_running);
+	CHECK_EQ(host_pin_level[SIM_SET_PIN], LOW);
+
+	// Average of the 5 good frames
+	g_solution_data.reset();
+	read_rak12039();
+	CHECK_EQ(g_solution_data.getSize(), 12);
+	CHECK_EQ(lpp_value(LPP_CHANNEL_PM_1_0), 12);
+	CHECK_EQ(lpp_value(LPP_CHANNEL_PM_2_5), 22);
+	CHECK_EQ(lpp_value(LPP_CHANNEL_PM_10_0), 32);
+
+	// Next burst is planned so it ends before the heartbeat
+	CHECK(sched_running);
+	CHECK_EQ(host_pin_level[SIM_SET_PIN], LOW);
+	uint32_t sent = millis();
+	host_advance_ms(sched_delay);
+	handle_rak12039();
+	CHECK_EQ(host_pin_level[SIM_SET_PIN], HIGH);
+	sim_stream.clear();
+	sim_last.error = SIM_OK;
+	sim_last.pm10 = 100;
+	sim_last.pm25 = 200;
+	sim_last.pm100 = 300;
+	run_cycle();
+	CHECK_EQ(host_pin_level[SIM_SET_PIN], LOW);
+	CHECK(millis() - sent <= sim_heartbeat);
+	CHECK(millis() - sent >= sim_heartbeat - 2 * SIM_SAMPLE_MARGIN);
+
+	// The averages start new with every packet
+	g_solution_data.reset();
+	read_rak12039();
+	CHECK_EQ(lpp_value(LPP_CHANNEL_PM_2_5), 200);
+	g_solution_data.reset();
+	read_rak12039();
+	CHECK_EQ(g_solution_data.getSize(), 0);
+}
+
+/**
+ * @brief The cycle is planned for the due time of the heartbeat job
+ *        The heartbeat ran early, its last sample is in the window of the next heartbeat
+ *
+ */
+static void test_heartbeat_due(void)
+{
+	sim_heartbeat = 600000;
+	sim_stream.clear();
+	sim_last.error = SIM_OK;
+
+	// Heartbeat ran 7.5 s early, the next one is due a bit more than one interval later
+	sim_heartbeat_remaining = sim_heartbeat + 7500;
+	g_solution_data.reset();
+	read_rak12039();
+	CHECK(sched_running);
+	CHECK_EQ(host_pin_level[SIM_SET_PIN], LOW);
+	uint32_t due = millis() + sim_heartbeat_remaining;
+	host_advance_ms(sched_delay);
+	handle_rak12039();
+	run_cycle();
+	CHECK(!sched_running);
+	CHECK(millis() <= due);
+	CHECK(due - millis() < SCHED_HEARTBEAT_TOLERANCE);
+
+	// Heartbeat too close for a cycle, the samples are for the one after it
+	sim_heartbeat_remaining = 20000;
+	g_solution_data.reset();
+	read_rak12039();
+	due = millis() + sim_heartbeat_remaining + sim_heartbeat;
+	host_advance_ms(sched_delay);
+	handle_rak12039();
+	run_cycle();
+	CHECK(millis() <= due);
+	CHECK(due - millis() < SCHED_HEARTBEAT_TOLERANCE);
+	sim_heartbeat_remaining = 0;
+	g_solution_data.reset();
+	read_rak12039();
+	sched_running = false;
+	host_pin_level[SIM_SET_PIN] = LOW;
+}
+
+/**
+ * @brief Heartbeat shorter than a cycle, the fan stays on and the sensor is sampled all the time
+ *
+ */
+static void test_continuous(void)
+{
+	sim_heartbeat = 30000;
+	g_solution_data.reset();
+	read_rak12039();
+	CHECK_EQ(host_pin_level[SIM_SET_PIN], HIGH);
+	CHECK_EQ(sched_delay, SIM_WARMUP_TIME + SIM_WARMUP_TOLERANCE);
+	sim_stream.clear();
+	sim_frames_read = 0;
+	for (int event = 0; event < 20; event++)
+	{
+		host_advance_ms(sched_delay);
+		handle_rak12039();
+		CHECK(sched_running);
+	}
+	CHECK_EQ(sim_frames_read, 20);
+	CHECK_EQ(host_pin_level[SIM_SET_PIN], HIGH);
+	g_solution_data.reset();
+	read_rak12039();
+	CHECK_EQ(lpp_value(LPP_CHANNEL_PM_10_0), 300);
+	CHECK_EQ(host_pin_level[SIM_SET_PIN], HIGH);
+
+	// Back to a long heartbeat, the fan goes off
+	sim_heartbeat = 600000;
+	read_rak12039();
+	CHECK_EQ(host_pin_level[SIM_SET_PIN], LOW);
+}
+
+/**
+ * @brief No sensor on the bus
+ *
+ */
+static void test_missing(void)
+{
+	sim_present = false;
+	sched_running = false;
+	CHECK(!init_rak12039());
+	CHECK_EQ(host_pin_level[SIM_SET_PIN], LOW);
+	CHECK(!sched_running);
+	sim_present = true;
+}
+
+int main(void)
+{
+	host_i2c_device = sim_pmsa;
+	init_i2c_bus();
+	RUN(test_parse);
+	RUN(test_burst);
+	RUN(test_heartbeat_due);
+	RUN(test_continuous);
+	RUN(test_missing);
+	return TEST_RESULT();
+}
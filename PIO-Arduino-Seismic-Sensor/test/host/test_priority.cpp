@@ -0,0 +1,195 @@
+/**
+ * @file test_priority.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host simulation of a priority inversion on the I2C bus lock
+ *        The loop holds the bus, the seismic task wakes up and waits for the bus
+ *        and a task with a priority between both becomes ready with a long job.
+ *        With a binary semaphore the middle task delays the seismic task for its whole job,
+ *        the mutex of the bus manager lends the priority of the seismic task to the loop.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "host_fakes.h"
+#include "test.h"
+
+void perf_i2c(uint16_t bytes)
+{
+}
+
+void perf_i2c_error(void)
+{
+}
+
+/** Lock created by init_i2c_bus() */
+static host_sem_s *sim_lock = NULL;
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+	sim_lock = new host_sem_s;
+	sim_lock->type = HOST_SEM_RECURSIVE;
+	sim_lock->count = 1;
+	sim_lock->owner = NULL;
+	sim_lock->depth = 0;
+	return sim_lock;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+	sim_lock = new host_sem_s;
+	sim_lock->type = HOST_SEM_BINARY;
+	sim_lock->count = 0;
+	sim_lock->owner = NULL;
+	sim_lock->depth = 0;
+	return sim_lock;
+}
+
+/** Simulation step in us */
+#define SIM_STEP_US 100
+
+/** Priorities of the simulated tasks, same order as on the RAK4631 */
+#define SIM_PRIO_LOOP 1
+#define SIM_PRIO_MIDDLE 2
+#define SIM_PRIO_SEISMIC 3
+
+/** One simulated task */
+struct sim_task_s
+{
+	int prio;		   // Priority of the task
+	uint32_t ready_us; // Time the task becomes ready
+	uint32_t work_us;  // CPU time of the job, with the bus for the loop and the seismic task
+	bool needs_bus;	   // Job runs with the bus taken
+	bool has_bus;	   // Task holds the bus
+	uint32_t done_us;  // Time the job was finished
+	uint32_t bus_us;   // Time the task got the bus
+};
+
+/**
+ * @brief Run the three tasks on one CPU, the task with the highest priority runs
+ *
+ * @param inherit the lock lends the priority of a waiting task to the holder
+ * @param middle_work_us job of the middle task
+ * @return uint32_t time the seismic task waited for the bus in us
+ */
+static uint32_t run_inversion(bool inherit, uint32_t middle_work_us)
+{
+	// The loop reads the PM sensor, 4 ms on the bus, 1 ms is done when the D7S interrupt comes
+	sim_task_s loop = {SIM_PRIO_LOOP, 0, 4000, true, false, 0, 0};
+	sim_task_s seismic = {SIM_PRIO_SEISMIC, 1000, 500, true, false, 0, 0};
+	sim_task_s middle = {SIM_PRIO_MIDDLE, 1200, middle_work_us, false, false, 0, 0};
+	sim_task_s *tasks[] = {&loop, &seismic, &middle};
+	sim_task_s *holder = NULL;
+
+	for (uint32_t now = 0; now < 1000000; now += SIM_STEP_US)
+	{
+		sim_task_s *run = NULL;
+		int run_prio = 0;
+		for (sim_task_s *task : tasks)
+		{
+			if ((task->ready_us > now) || (task->work_us == 0))
+			{
+				continue;
+			}
+			// A task that waits for the bus is blocked
+			if (task->needs_bus && (holder != NULL) && (holder != task))
+			{
+				continue;
+			}
+			int prio = task->prio;
+			if (inherit && (task == holder) && (seismic.ready_us <= now) && (seismic.work_us != 0))
+			{
+				prio = prio > seismic.prio ? prio : seismic.prio;
+			}
+			if (prio > run_prio)
+			{
+				run = task;
+				run_prio = prio;
+			}
+		}
+		if (run == NULL)
+		{
+			break;
+		}
+		if (run->needs_bus && (holder == NULL))
+		{
+			holder = run;
+			run->has_bus = true;
+			run->bus_us = now;
+		}
+		run->work_us -= SIM_STEP_US;
+		if (run->work_us == 0)
+		{
+			run->done_us = now + SIM_STEP_US;
+			if (holder == run)
+			{
+				holder = NULL;
+				run->has_bus = false;
+			}
+		}
+	}
+	CHECK_EQ(loop.work_us, 0);
+	CHECK_EQ(seismic.work_us, 0);
+	CHECK_EQ(middle.work_us, 0);
+	return seismic.bus_us - seismic.ready_us;
+}
+
+/**
+ * @brief The bus manager uses a lock with priority inheritance
+ *
+ */
+static void test_lock_type(void)
+{
+	init_i2c_bus();
+	CHECK(sim_lock != NULL);
+	CHECK_EQ(sim_lock->type, HOST_SEM_RECURSIVE);
+
+	// The holder is known, a nested session of the same task does not block
+	int loop_task = 1;
+	int seismic_task = 2;
+	TaskHandle_t current = host_current_task;
+	host_current_task = &loop_task;
+	i2c_begin(I2C_DEV_PMSA);
+	CHECK(xSemaphoreGetMutexHolder(sim_lock) == &loop_task);
+	i2c_begin(I2C_DEV_PMSA);
+	i2c_end(I2C_DEV_PMSA, 0);
+	CHECK(xSemaphoreGetMutexHolder(sim_lock) == &loop_task);
+	i2c_end(I2C_DEV_PMSA, 0);
+	CHECK(xSemaphoreGetMutexHolder(sim_lock) == NULL);
+	host_current_task = &seismic_task;
+	i2c_begin(I2C_DEV_D7S);
+	CHECK(xSemaphoreGetMutexHolder(sim_lock) == &seismic_task);
+	i2c_end(I2C_DEV_D7S, 0);
+	host_current_task = current;
+	CHECK_EQ(host_sem_deadlocks, 0);
+}
+
+/**
+ * @brief Wait time of the seismic task with and without priority inheritance
+ *
+ */
+static void test_inversion(void)
+{
+	bool inherit = sim_lock->type != HOST_SEM_BINARY;
+	uint32_t jobs[] = {1000, 10000, 100000};
+	for (uint32_t job : jobs)
+	{
+		uint32_t binary = run_inversion(false, job);
+		uint32_t mutex = run_inversion(inherit, job);
+		printf("Middle task %ld us: seismic task waits %ld us with a binary semaphore, %ld us with the bus manager\n",
+			   (long)job, (long)binary, (long)mutex);
+		// The wait is bounded by the rest of the loop's bus session
+		CHECK_EQ(mutex, 3000);
+		// Without inheritance the middle task's job adds to the wait
+		CHECK_EQ(binary, 3000 + job);
+	}
+}
+
+int main(void)
+{
+	RUN(test_lock_type);
+	RUN(test_inversion);
+	return TEST_RESULT();
+}
@@ -0,0 +1,317 @@
+/**
+ * @file test_rtc.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host test of the calendar conversion and the RAK12002 clock sync
+ *        Every day of the Unix time range is compared with a day by day calendar,
+ *        the RTC is simulated on register level including its power on reset flag.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "epoch_clock.h"
+#include "host_fakes.h"
+#include "test.h"
+#include <Melopero_RV3028.h>
+
+bool has_rak12002 = true;
+
+/** Registers of the simulated RV3028, 0x00 to 0x0E */
+static uint8_t rv3028[0x0F];
+
+/** Flag if the simulated RV3028 answers */
+static bool rv3028_present = true;
+
+/** Register reads of the simulated RV3028 */
+static uint32_t rv3028_reads = 0;
+
+/** Resync job started by the RTC module */
+static uint32_t sim_job_period = 0;
+static uint32_t sim_job_tolerance = 0;
+
+void sched_start(uint8_t job, uint32_t delay_ms, uint32_t period_ms, uint32_t tolerance_ms)
+{
+	CHECK_EQ(job, SCHED_RTC_SYNC);
+	CHECK_EQ(delay_ms, period_ms);
+	sim_job_period = period_ms;
+	sim_job_tolerance = tolerance_ms;
+}
+
+static uint8_t bin_to_bcd(uint8_t bin)
+{
+	return ((bin / 10) << 4) | (bin % 10);
+}
+
+/**
+ * @brief Backup power of the RV3028 was lost, the registers have their reset values
+ *
+ */
+static void rv3028_power_on_reset(void)
+{
+	memset(rv3028, 0, sizeof(rv3028));
+	rv3028[4] = 0x01; // 2000-01-01
+	rv3028[5] = 0x01;
+	rv3028[0x0E] = 0x01; // PORF
+}
+
+// The I2C bus, only what the RTC needs
+void i2c_begin(uint8_t dev)
+{
+}
+
+void i2c_end(uint8_t dev, uint16_t bytes)
+{
+}
+
+bool i2c_read_regs(uint8_t dev, uint8_t addr, const uint8_t *reg, uint8_t reg_len, uint8_t *data, uint8_t len)
+{
+	if (!rv3028_present || (reg[0] + len > (int)sizeof(rv3028)))
+	{
+		return false;
+	}
+	memcpy(data, &rv3028[reg[0]], len);
+	rv3028_reads++;
+	return true;
+}
+
+bool i2c_write(uint8_t dev, uint8_t addr, const uint8_t *data, uint8_t len)
+{
+	if (!rv3028_present || (data[0] + len - 1 > (int)sizeof(rv3028)))
+	{
+		return false;
+	}
+	memcpy(&rv3028[data[0]], &data[1], len - 1);
+	return true;
+}
+
+// The Melopero library writes the registers directly
+void Melopero_RV3028::initI2C(TwoWire &w)
+{
+}
+
+void Melopero_RV3028::useEEPROM(bool use)
+{
+}
+
+void Melopero_RV3028::set24HourMode(void)
+{
+}
+
+void Melopero_RV3028::writeToRegister(uint8_t reg, uint8_t value)
+{
+	if (reg < sizeof(rv3028))
+	{
+		rv3028[reg] = value;
+	}
+}
+
+uint8_t Melopero_RV3028::readFromRegister(uint8_t reg)
+{
+	return reg < sizeof(rv3028) ? rv3028[reg] : 0;
+}
+
+void Melopero_RV3028::setTime(uint16_t year, uint8_t month, uint8_t weekday, uint8_t date, uint8_t hour, uint8_t minute, uint8_t second)
+{
+	rv3028[0] = bin_to_bcd(second);
+	rv3028[1] = bin_to_bcd(minute);
+	rv3028[2] = bin_to_bcd(hour);
+	rv3028[3] = weekday;
+	rv3028[4] = bin_to_bcd(date);
+	rv3028[5] = bin_to_bcd(month);
+	rv3028[6] = bin_to_bcd(year - 2000);
+}
+
+/**
+ * @brief Walk day by day through the Unix time range and compare with the conversion
+ *
+ */
+static void test_calendar(void)
+{
+	uint16_t year = 1970;
+	uint8_t month = 1;
+	uint8_t date = 1;
+	uint8_t weekday = 4; // Thursday
+	uint32_t leap_days = 0;
+	for (uint32_t days = 0; days < 0xFFFFFFFF / 86400; days++)
+	{
+		uint32_t epoch = days * 86400 + (days % 86400);
+		CHECK_EQ(clock_days_from_civil(year, month, date), days);
+		CHECK_EQ(clock_to_epoch(year, month, date, 0, 0, 0), days * 86400);
+		date_time_s date_time;
+		clock_to_date(epoch, &date_time);
+		CHECK_EQ(date_time.year, year);
+		CHECK_EQ(date_time.month, month);
+		CHECK_EQ(date_time.date, date);
+		CHECK_EQ(date_time.weekday, weekday);
+		CHECK_EQ(date_time.hour * 3600 + date_time.minute * 60 + date_time.second, days % 86400);
+
+		// Next day with the rules of the Gregorian calendar
+		weekday = (weekday + 1) % 7;
+		uint8_t days_in_month = 31;
+		if (month == 2)
+		{
+			bool leap = (year % 400 == 0) || ((year % 4 == 0) && (year % 100 != 0));
+			days_in_month = leap ? 29 : 28;
+		}
+		else if ((month == 4) || (month == 6) || (month == 9) || (month == 11))
+		{
+			days_in_month = 30;
+		}
+		CHECK_EQ(clock_days_in_month(year, month), days_in_month);
+		if (date == 29 && month == 2)
+		{
+			leap_days++;
+		}
+		if (++date > days_in_month)
+		{
+			date = 1;
+			if (++month > 12)
+			{
+				month = 1;
+				year++;
+			}
+		}
+	}
+	// 1972 to 2104 without 2100
+	CHECK_EQ(leap_days, 33);
+	CHECK_EQ(year, 2106);
+}
+
+/**
+ * @brief The first and last second of leap days and years
+ *
+ */
+static void test_leap_years(void)
+{
+	struct
+	{
+		uint16_t year;
+		bool leap;
+	} years[] = {{1972, true}, {2000, true}, {2023, false}, {2024, true}, {2096, true}, {2100, false}};
+	for (auto &entry : years)
+	{
+		CHECK_EQ(clock_is_leap(entry.year), entry.leap);
+		uint32_t start = clock_to_epoch(entry.year, 1, 1, 0, 0, 0);
+		uint32_t end = clock_to_epoch(entry.year + 1, 1, 1, 0, 0, 0);
+		CHECK_EQ(end - start, (entry.leap ? 366 : 365) * 86400UL);
+
+		date_time_s date_time;
+		clock_to_date(clock_to_epoch(entry.year, 3, 1, 0, 0, 0) - 1, &date_time);
+		CHECK_EQ(date_time.month, 2);
+		CHECK_EQ(date_time.date, entry.leap ? 29 : 28);
+		CHECK_EQ(date_time.hour, 23);
+		CHECK_EQ(date_time.minute, 59);
+		CHECK_EQ(date_time.second, 59);
+		clock_to_date(end - 1, &date_time);
+		CHECK_EQ(date_time.year, entry.year);
+		CHECK_EQ(date_time.month, 12);
+		CHECK_EQ(date_time.date, 31);
+	}
+}
+
+/**
+ * @brief The RTC lost its backup power, the reset time must not be used
+ *
+ */
+static void test_rtc_power_on_reset(void)
+{
+	rv3028_power_on_reset();
+	host_set_ms(1000);
+	CHECK(init_rak12002());
+	CHECK(!is_rak12002_valid());
+	CHECK(!is_clock_valid());
+	CHECK(!sync_rak12002(true));
+	CHECK(!is_clock_valid());
+
+	// Resync does not take the reset time either
+	host_advance_ms(CLOCK_RESYNC_INTERVAL);
+	resync_rak12002();
+	CHECK(!is_clock_valid());
+
+	// Set manually on a leap day, clears the flag
+	set_rak12002(2024, 2, 29, 23, 59);
+	CHECK_EQ(rv3028[0x0E] & 0x01, 0);
+	CHECK(is_rak12002_valid());
+	CHECK(is_clock_valid());
+	CHECK_EQ(get_clock_source(), CLOCK_SRC_RTC);
+	CHECK_EQ(get_clock_ms() / 1000, clock_to_epoch(2024, 2, 29, 23, 59, 0));
+	CHECK_EQ(rv3028[3], clock_weekday(clock_days_from_civil(2024, 2, 29)));
+
+	// After a restart the time is taken from the RTC
+	CHECK(init_rak12002());
+	CHECK(is_rak12002_valid());
+	CHECK_EQ(g_date_time.year, 2024);
+	CHECK_EQ(g_date_time.month, 2);
+	CHECK_EQ(g_date_time.date, 29);
+
+	// Power lost again, the clock keeps the last good sync
+	uint64_t before = get_clock_ms();
+	rv3028_power_on_reset();
+	CHECK(!sync_rak12002(true));
+	CHECK(!is_rak12002_valid());
+	CHECK_EQ(get_clock_ms(), before);
+
+	// A time from the network is written into the RTC and clears the flag
+	write_rak12002(clock_to_epoch(2099, 12, 31, 23, 59, 58));
+	CHECK(is_rak12002_valid());
+	CHECK_EQ(rv3028[0x0E] & 0x01, 0);
+	CHECK_EQ(rv3028[6], 0x99);
+	CHECK(sync_rak12002(true));
+	CHECK_EQ(get_clock_ms() / 1000, clock_to_epoch(2099, 12, 31, 23, 59, 58));
+}
+
+/**
+ * @brief The resync is a job of the scheduler, it may run early to share a heartbeat
+ *        A resync right after the RTC was read or set is skipped
+ *
+ */
+static void test_resync_job(void)
+{
+	rv3028_power_on_reset();
+	host_set_ms(1000);
+	sim_job_period = 0;
+	CHECK(init_rak12002());
+	CHECK_EQ(sim_job_period, CLOCK_RESYNC_INTERVAL);
+	CHECK_EQ(sim_job_tolerance, CLOCK_RESYNC_INTERVAL / SCHED_RTC_SYNC_TOLERANCE_DIV);
+	write_rak12002(clock_to_epoch(2023, 6, 1, 12, 0, 0));
+
+	// Earliest run of the job
+	host_advance_ms(sim_job_period - sim_job_tolerance);
+	uint32_t reads = rv3028_reads;
+	resync_rak12002();
+	CHECK_EQ(rv3028_reads, reads + 1);
+
+	// The network time was written shortly before the job ran
+	host_advance_ms(sim_job_period - 60000);
+	write_rak12002(clock_to_epoch(2023, 6, 1, 18, 0, 0));
+	host_advance_ms(60000);
+	reads = rv3028_reads;
+	resync_rak12002();
+	CHECK_EQ(rv3028_reads, reads);
+}
+
+/**
+ * @brief No device on the bus
+ *
+ */
+static void test_rtc_missing(void)
+{
+	rv3028_present = false;
+	sim_job_period = 0;
+	CHECK(!init_rak12002());
+	CHECK_EQ(sim_job_period, 0);
+	CHECK(!sync_rak12002(true));
+	rv3028_present = true;
+}
+
+int main(void)
+{
+	RUN(test_calendar);
+	RUN(test_leap_years);
+	RUN(test_rtc_power_on_reset);
+	RUN(test_resync_job);
+	RUN(test_rtc_missing);
+	return TEST_RESULT();
+}
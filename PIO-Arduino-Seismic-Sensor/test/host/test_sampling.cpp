@@ -0,0 +1,254 @@
+/**
+ * @file test_sampling.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host timeline simulation of the heartbeat sampling
+ *        The old heartbeat read the battery and the SHTC3 with clock stretching before sending.
+ *        The new heartbeat sends the values of the last cycle and converts during the transmission.
+ *        The time the CPU is awake per heartbeat is compared, the radio time is spent sleeping.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "host_fakes.h"
+#include "test.h"
+
+WisCayenne g_solution_data(255);
+
+/** I2C address of the SHTC3 */
+#define SIM_SHTC3_ADDR 0x70
+
+/** Conversion time of the simulated SHTC3 in us, data sheet typical value */
+#define SIM_CONVERSION_US 10800
+
+/** Time the CPU needs for a battery reading in us, ADC acquisition and averaging */
+#define SIM_BATT_US 1000
+
+/** Time from the end of the uplink until LORA_TX_FIN, RX1 and RX2 windows in ms */
+#define SIM_RX_WINDOWS_MS 2000
+
+/** Time on air of the heartbeat in ms, SF10 */
+#define SIM_AIRTIME_MS 370
+
+void perf_i2c(uint16_t bytes)
+{
+}
+
+void perf_i2c_error(void)
+{
+}
+
+float read_batt(void)
+{
+	host_advance_us(SIM_BATT_US);
+	return 4000.0f;
+}
+
+/** State of the simulated SHTC3 */
+static bool sim_sleeping = true;
+static uint64_t sim_conversion_start = 0;
+static bool sim_converting = false;
+static uint16_t sim_raw_temp = 0x6666;
+static uint32_t sim_reads = 0;
+
+static uint8_t sim_crc(const uint8_t *data)
+{
+	uint8_t crc = 0xFF;
+	for (uint8_t idx = 0; idx < 2; idx++)
+	{
+		crc ^= data[idx];
+		for (uint8_t bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : (crc << 1);
+		}
+	}
+	return crc;
+}
+
+/**
+ * @brief SHTC3, a read during the conversion is not acknowledged
+ *        The clock stretching of the old code is simulated by the caller
+ *
+ */
+static bool sim_shtc3(uint8_t addr, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len)
+{
+	if (addr != SIM_SHTC3_ADDR)
+	{
+		return false;
+	}
+	if (tx_len == 2)
+	{
+		uint16_t cmd = (tx[0] << 8) | tx[1];
+		switch (cmd)
+		{
+		case 0x3517:
+			sim_sleeping = false;
+			return true;
+		case 0xB098:
+			sim_sleeping = true;
+			return true;
+		case 0x7866:
+		case 0x7CA2:
+			if (sim_sleeping)
+			{
+				return false;
+			}
+			sim_converting = true;
+			sim_conversion_start = host_us;
+			return true;
+		default:
+			return false;
+		}
+	}
+	if ((rx_len == 6) && sim_converting && !sim_sleeping)
+	{
+		if ((host_us - sim_conversion_start) < SIM_CONVERSION_US)
+		{
+			// Still converting
+			return false;
+		}
+		sim_converting = false;
+		sim_reads++;
+		rx[0] = sim_raw_temp >> 8;
+		rx[1] = sim_raw_temp;
+		rx[2] = sim_crc(&rx[0]);
+		rx[3] = 0x80;
+		rx[4] = 0x00;
+		rx[5] = sim_crc(&rx[3]);
+		sim_raw_temp += 0x100;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Heartbeat before, battery and SHTC3 with clock stretching, then send
+ *        The SHTC3 library holds the bus until the conversion is finished
+ *
+ * @return uint64_t time the CPU was awake in us
+ */
+static uint64_t heartbeat_old(void)
+{
+	uint64_t start = host_us;
+	read_batt();
+	static const uint8_t wakeup[2] = {0x35, 0x17};
+	static const uint8_t sleep[2] = {0xB0, 0x98};
+	i2c_write(I2C_DEV_SHTC3, SIM_SHTC3_ADDR, wakeup, 2);
+	delayMicroseconds(240);
+	// Measurement command with clock stretching, the read waits until the conversion is finished
+	static const uint8_t measure_stretch[2] = {0x7C, 0xA2};
+	Wire.beginTransmission(SIM_SHTC3_ADDR);
+	Wire.write(measure_stretch, 2);
+	Wire.endTransmission();
+	host_advance_us(SIM_CONVERSION_US);
+	Wire.requestFrom(SIM_SHTC3_ADDR, (uint8_t)6);
+	i2c_write(I2C_DEV_SHTC3, SIM_SHTC3_ADDR, sleep, 2);
+	uint64_t awake = host_us - start;
+
+	// The CPU sleeps while the radio sends and waits for the RX windows
+	host_advance_ms(SIM_AIRTIME_MS + SIM_RX_WINDOWS_MS);
+	return awake;
+}
+
+/**
+ * @brief Heartbeat after, same sequence as app_event_handler() and lora_data_handler()
+ *        The values of the last cycle are sent, the next conversion runs during the transmission
+ *
+ * @return uint64_t time the CPU was awake in us
+ */
+static uint64_t heartbeat_new(void)
+{
+	static float batt_sample = 0.0f;
+	uint64_t start = host_us;
+
+	// app_event_handler()
+	if (batt_sample == 0.0f)
+	{
+		batt_sample = read_batt();
+	}
+	g_solution_data.addVoltage(LPP_CHANNEL_BATT, batt_sample / 1000.0);
+	batt_sample = 0.0f;
+	read_rak1901();
+	g_solution_data.reset();
+	start_rak1901();
+	uint64_t awake = host_us - start;
+
+	// The CPU sleeps while the radio sends and waits for the RX windows
+	host_advance_ms(SIM_AIRTIME_MS + SIM_RX_WINDOWS_MS);
+
+	// lora_data_handler() at LORA_TX_FIN
+	start = host_us;
+	batt_sample = read_batt();
+	collect_rak1901();
+	awake += host_us - start;
+	return awake;
+}
+
+/**
+ * @brief Wake time per heartbeat before and after
+ *
+ */
+static void test_wake_time(void)
+{
+	host_i2c_device = sim_shtc3;
+	uint64_t old_total = 0;
+	for (int beat = 0; beat < 10; beat++)
+	{
+		old_total += heartbeat_old();
+		host_advance_ms(60000);
+	}
+
+	uint64_t first = heartbeat_new();
+	host_advance_ms(60000);
+	uint64_t new_total = 0;
+	uint32_t reads = sim_reads;
+	for (int beat = 0; beat < 10; beat++)
+	{
+		new_total += heartbeat_new();
+		host_advance_ms(60000);
+	}
+	// One conversion per heartbeat, no failed reads
+	CHECK_EQ(sim_reads, reads + 10);
+
+	printf("Wake time per heartbeat: %ld us before, %ld us after, %ld us for the first heartbeat\n",
+		   (long)(old_total / 10), (long)(new_total / 10), (long)first);
+	// The conversion time is spent sleeping now
+	CHECK(new_total / 10 + SIM_CONVERSION_US / 2 < old_total / 10);
+	// Only the first heartbeat waits for a conversion
+	CHECK(first >= SIM_CONVERSION_US);
+}
+
+/**
+ * @brief The payload has the values of the conversion started with the last packet
+ *
+ */
+static void test_previous_values(void)
+{
+	host_i2c_device = sim_shtc3;
+	g_solution_data.reset();
+	uint16_t raw = sim_raw_temp;
+	// Conversion of the previous cycle
+	CHECK(start_rak1901());
+	// Collect before the conversion is finished fails, the SHTC3 is still converting
+	CHECK(!collect_rak1901());
+	host_advance_ms(20);
+	CHECK(collect_rak1901());
+	read_rak1901();
+	uint8_t *data = g_solution_data.getBuffer();
+	CHECK_EQ(g_solution_data.getSize(), 7);
+	CHECK_EQ(data[0], LPP_CHANNEL_HUMID);
+	CHECK_EQ(data[3], LPP_CHANNEL_TEMP);
+	int16_t temp = (data[5] << 8) | data[6];
+	CHECK_EQ(temp, (int16_t)((-45.0f + 175.0f * raw / 65536.0f) * 10));
+	CHECK(sim_sleeping);
+}
+
+int main(void)
+{
+	init_i2c_bus();
+	RUN(test_wake_time);
+	RUN(test_previous_values);
+	return TEST_RESULT();
+}
@@ -0,0 +1,395 @@
+/**
+ * @file test_scheduler.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host simulation of the wakeups per day with the shared scheduler timer
+ *        A day of jobs is replayed with the same sched_start() calls the application modules make,
+ *        the particle sensor cycle and the heartbeat run the real module code.
+ *        Before the scheduler every job had its own SoftwareTimer, each job run was a wakeup of its own.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "RAK12039_PMSA003I.h"
+#include "host_fakes.h"
+#include "test.h"
+
+extern SoftwareTimer sched_timer;
+
+/** Due time of the scheduler timer */
+static uint32_t sim_timer_due = 0;
+static bool sim_timer_running = false;
+static uint32_t sim_timer_changes = 0;
+
+// The scheduler timer, the simulation needs to know when it fires
+void SoftwareTimer::start(void)
+{
+	_running = true;
+	sim_timer_running = true;
+	sim_timer_due = millis() + _period;
+	sim_timer_changes++;
+}
+
+void SoftwareTimer::stop(void)
+{
+	_running = false;
+	sim_timer_running = false;
+}
+
+void SoftwareTimer::setPeriod(uint32_t ms)
+{
+	_period = ms;
+	start();
+}
+
+/** Events sent to the seismic task */
+static uint16_t seismic_events = 0;
+
+void seismic_notify(uint16_t events)
+{
+	seismic_events |= events;
+}
+
+/** Heartbeat interval, 1 hour */
+#define SIM_HEARTBEAT 3600000
+
+/** Same value as in RAK12039_pm.cpp */
+#define SIM_PM_SAMPLES 8
+
+uint32_t get_heartbeat_time(void)
+{
+	return SIM_HEARTBEAT;
+}
+
+WisCayenne g_solution_data(255);
+
+void perf_i2c(uint16_t bytes)
+{
+}
+
+void perf_i2c_error(void)
+{
+}
+
+/**
+ * @brief PMSA003I on the I2C bus, always a valid frame with zero values
+ *
+ */
+static bool sim_pmsa(uint8_t addr, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len)
+{
+	if (addr != PMSA003I_DEV_ADDR)
+	{
+		return false;
+	}
+	uint8_t raw[32] = {0x42, 0x4D, 0x00, 28};
+	uint16_t sum = 0;
+	for (uint8_t idx = 0; idx < 30; idx++)
+	{
+		sum += raw[idx];
+	}
+	raw[30] = sum >> 8;
+	raw[31] = sum;
+	uint8_t reg = tx_len != 0 ? tx[0] : 0;
+	for (size_t idx = 0; idx < rx_len; idx++)
+	{
+		rx[idx] = (reg + idx) < sizeof(raw) ? raw[reg + idx] : 0;
+	}
+	return true;
+}
+
+/** Model of the application, the real particle sensor module and the scheduler calls of the other modules */
+struct sim_app_s
+{
+	uint16_t dump_pages;   // Pages left of a dump
+	uint32_t capture_end;  // End of the SI/PGA polling of an earthquake
+	uint32_t job_runs;	   // Runs of all jobs except heartbeat and RTC resync
+	uint32_t heartbeats;   // Runs of the heartbeat job
+	uint32_t rtc_syncs;	   // Runs of the RTC resync job
+};
+
+static sim_app_s sim_app;
+
+/**
+ * @brief Handle the events of the jobs like the loop and the seismic task do
+ *
+ * @param events events of the loop
+ */
+static void sim_handle(uint16_t events)
+{
+	if (events & TIME_SYNC)
+	{
+		if (sched_take(SCHED_RTC_SYNC))
+		{
+			sim_app.rtc_syncs++;
+		}
+		if (sched_take(SCHED_TIME_SYNC))
+		{
+			sim_app.job_runs++;
+			sched_start(SCHED_TIME_SYNC, 86400000, 0, 86400000 / SCHED_TIME_SYNC_TOLERANCE_DIV);
+		}
+	}
+	if (events & PM_SAMPLE)
+	{
+		sim_app.job_runs++;
+		handle_rak12039();
+	}
+	if (events & EVENT_DUMP)
+	{
+		sim_app.job_runs++;
+		if (--sim_app.dump_pages == 0)
+		{
+			sched_stop(SCHED_DUMP);
+		}
+	}
+	if (events & STATUS)
+	{
+		if (sched_take(SCHED_HEARTBEAT))
+		{
+			sim_app.heartbeats++;
+		}
+		else
+		{
+			sim_app.job_runs++;
+		}
+		// Every packet takes the PM values and plans the next cycle
+		g_solution_data.reset();
+		read_rak12039();
+	}
+	if (seismic_events & SEISMIC_CAPTURE)
+	{
+		sim_app.job_runs++;
+		if ((int32_t)(millis() - sim_app.capture_end) >= 0)
+		{
+			sched_stop(SCHED_CAPTURE);
+			sched_start(SCHED_FOLLOW_UP, 60000, 0, SCHED_FOLLOW_UP_TOLERANCE);
+			heartbeat_start();
+		}
+	}
+	seismic_events = 0;
+}
+
+/**
+ * @brief Run the simulation until a time
+ *
+ * @param end millis() at the end
+ */
+static void sim_run(uint32_t end)
+{
+	while ((int32_t)(end - millis()) > 0)
+	{
+		uint32_t next = end;
+		if (sim_timer_running && ((int32_t)(sim_timer_due - next) < 0))
+		{
+			next = sim_timer_due;
+		}
+		host_advance_ms(next - millis());
+		if (sim_timer_running && (sim_timer_due == millis()))
+		{
+			sim_timer_running = false;
+			g_task_event_type = 0;
+			sched_timer.fire();
+			sim_handle(g_task_event_type);
+		}
+	}
+}
+
+/**
+ * @brief Start of an earthquake like the seismic task, polling every second for 2 minutes
+ *
+ */
+static void sim_quake(void)
+{
+	heartbeat_stop();
+	sched_stop(SCHED_FOLLOW_UP);
+	sim_app.capture_end = millis() + 120000;
+	sched_start(SCHED_CAPTURE, 1000, 1000, 1000 / SCHED_CAPTURE_TOLERANCE_DIV);
+}
+
+/**
+ * @brief Timer wakeups of the scheduler
+ *
+ * @return uint32_t wakeups
+ */
+static uint32_t sched_wakes(void)
+{
+	host_serial.clear();
+	sched_print_stats();
+	long wakes = 0;
+	long runs = 0;
+	sscanf(host_serial.c_str(), "SCHED:%ld:%ld", &wakes, &runs);
+	return wakes;
+}
+
+/**
+ * @brief Start of the day like after a reset, the jobs the modules start in their init
+ *
+ */
+static void sim_start(void)
+{
+	for (uint8_t job = 0; job < SCHED_JOB_NUM; job++)
+	{
+		sched_stop(job);
+		sched_take(job);
+	}
+	memset(&sim_app, 0, sizeof(sim_app));
+	host_set_ms(0);
+	sched_reset_stats();
+	CHECK(init_rak12039());
+	heartbeat_start();
+	sched_start(SCHED_RTC_SYNC, CLOCK_RESYNC_INTERVAL, CLOCK_RESYNC_INTERVAL, CLOCK_RESYNC_INTERVAL / SCHED_RTC_SYNC_TOLERANCE_DIV);
+	sched_start(SCHED_TIME_SYNC, 86400000, 0, 86400000 / SCHED_TIME_SYNC_TOLERANCE_DIV);
+}
+
+/**
+ * @brief Print and check the wakeups of a day
+ *        Before the scheduler every job had its own timer, each job run was a wakeup of its own.
+ *        The RTC resync ran with the heartbeat packet and had no wakeup of its own.
+ *
+ * @param name scenario
+ * @return uint32_t wakeups with the scheduler
+ */
+static uint32_t sim_report(const char *name)
+{
+	uint32_t before = sim_app.job_runs + sim_app.heartbeats;
+	uint32_t after = sched_wakes();
+	printf("%s: %ld wakeups before, %ld after (%ld heartbeats, %ld job runs, %ld RTC resyncs)\n",
+		   name, (long)before, (long)after, (long)sim_app.heartbeats, (long)sim_app.job_runs, (long)sim_app.rtc_syncs);
+	// Every heartbeat shares the wakeup of the last PM sample, the clock sync and the RTC resync join other wakeups
+	CHECK(after + sim_app.heartbeats - 1 <= before);
+	CHECK(sim_app.rtc_syncs >= 3);
+	CHECK_EQ(host_sem_deadlocks, 0);
+	return after;
+}
+
+/**
+ * @brief One day with hourly heartbeats and PM cycles, RTC resyncs and a daily clock sync
+ *
+ */
+static void test_quiet_day(void)
+{
+	sim_start();
+	sim_run(86400000 + 1);
+	sim_report("Quiet day");
+	CHECK_EQ(sim_app.heartbeats, 24);
+	// Samples after the warm-up at the start, a cycle of 9 steps before each heartbeat but the first, and the clock sync
+	CHECK_EQ(sim_app.job_runs, SIM_PM_SAMPLES + 23 * (SIM_PM_SAMPLES + 1) + 1);
+	// The clock sync shares a wakeup, only the first heartbeat has no PM sample to share its wakeup with
+	CHECK_EQ(sched_wakes(), SIM_PM_SAMPLES + 23 * (SIM_PM_SAMPLES + 1) + 1);
+}
+
+/**
+ * @brief One day like the quiet day, with two earthquakes with SI/PGA polling
+ *        and follow-up packets and one journal dump
+ *
+ */
+static void test_wakes_per_day(void)
+{
+	sim_start();
+
+	// Earthquakes, polling every second for 2 minutes, then the follow-up packet
+	uint32_t quakes[] = {5 * 3600000 + 1234567, 17 * 3600000 + 42000};
+	for (uint32_t quake : quakes)
+	{
+		sim_run(quake);
+		sim_quake();
+	}
+
+	// The server asks for the journal while the second earthquake is still polled, 40 pages
+	sim_run(17 * 3600000 + 100000);
+	sim_app.dump_pages = 40;
+	sched_start(SCHED_DUMP, DUMP_PAGE_INTERVAL, DUMP_PAGE_INTERVAL, SCHED_DUMP_TOLERANCE);
+
+	sim_run(86400000 + 1);
+	sim_report("Day with earthquakes");
+	// The heartbeat is stopped while an earthquake is polled and restarts at its end
+	CHECK_EQ(sim_app.heartbeats, 22);
+	CHECK(sim_app.job_runs >= 240 + 2 + 40 + 1);
+}
+
+/**
+ * @brief Jobs with an open window run together, jobs without tolerance run on time
+ *
+ */
+static void test_coalesce(void)
+{
+	for (uint8_t job = 0; job < SCHED_JOB_NUM; job++)
+	{
+		sched_stop(job);
+	}
+	host_set_ms(100000);
+	sched_reset_stats();
+	sched_start(SCHED_FOLLOW_UP, 10000, 0, SCHED_FOLLOW_UP_TOLERANCE);
+	sched_start(SCHED_DUMP, 11000, DUMP_PAGE_INTERVAL, SCHED_DUMP_TOLERANCE);
+	sched_start(SCHED_MESH, 12000, 0, 0);
+	CHECK(sim_timer_running);
+	CHECK_EQ(sim_timer_due, 110000);
+
+	host_set_ms(sim_timer_due);
+	g_task_event_type = 0;
+	sched_timer.fire();
+	CHECK_EQ(g_task_event_type, STATUS | EVENT_DUMP);
+	CHECK(!sched_active(SCHED_FOLLOW_UP));
+	CHECK(sched_active(SCHED_DUMP));
+	CHECK_EQ(sim_timer_due, 112000);
+
+	host_set_ms(sim_timer_due);
+	g_task_event_type = 0;
+	sched_timer.fire();
+	CHECK_EQ(g_task_event_type, P2P_MESH);
+	// Next dump page one period after its due time
+	CHECK_EQ(sim_timer_due, 141000);
+
+	// Stopping the last job stops the timer
+	sched_stop(SCHED_DUMP);
+	CHECK(!sim_timer_running);
+	CHECK(!sched_active(SCHED_DUMP));
+	CHECK_EQ(sched_wakes(), 2);
+}
+
+/**
+ * @brief The loop, the seismic task and the timer daemon use the scheduler,
+ *        the mutex is released on every path
+ *
+ */
+static void test_serialized(void)
+{
+	int loop_task = 1;
+	int seismic_task = 2;
+	int timer_task = 3;
+	uint32_t deadlocks = host_sem_deadlocks;
+	host_set_ms(200000);
+
+	host_current_task = &loop_task;
+	sched_start(SCHED_FOLLOW_UP, 1000, 0, 0);
+	host_current_task = &seismic_task;
+	sched_start(SCHED_CAPTURE, 1000, 1000, 0);
+	sched_stop(SCHED_CAPTURE);
+	sched_stop(SCHED_JOB_NUM);
+	host_current_task = &timer_task;
+	host_set_ms(201000);
+	sched_timer.fire();
+	host_current_task = &loop_task;
+	sched_service();
+	sched_start(SCHED_MESH, 0, 0, 0);
+	sched_service();
+	host_current_task = NULL;
+
+	CHECK_EQ(host_sem_deadlocks, deadlocks);
+	CHECK(!sched_active(SCHED_FOLLOW_UP));
+	CHECK(!sched_active(SCHED_MESH));
+	CHECK(!sim_timer_running);
+}
+
+int main(void)
+{
+	host_i2c_device = sim_pmsa;
+	init_i2c_bus();
+	init_scheduler();
+	RUN(test_quiet_day);
+	RUN(test_wakes_per_day);
+	RUN(test_coalesce);
+	RUN(test_serialized);
+	return TEST_RESULT();
+}
@@ -0,0 +1,575 @@
+/**
+ * @file test_shutoff.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host timing test of the shutoff output
+ *        Two simulated D7S behind the TCA9548 pull INT1 low while the loop holds the I2C bus and the device has not joined.
+ *        The output must be switched in the interrupt, the seismic task confirms it after the bus is free.
+ *        Each GPIO access and millis() counts 1 us, pessimistic for the 64 MHz nRF52,
+ *        the D7S register reads take their time on the simulated 400 kHz bus.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include <RAK12027_D7S.h>
+#include "host_fakes.h"
+#include "test.h"
+
+app_settings_s g_app_settings;
+WisCayenne g_solution_data(255);
+
+/** Modelled time of a GPIO access or a millis() call in the interrupt in us */
+#define SIM_GPIO_US 1
+
+/** Bound for the interrupt path, from the INT1 edge to the output in us */
+#define SIM_ISR_BOUND_US 20
+
+/** Simulated D7S */
+struct sim_d7s_s
+{
+	bool collapse; // Collapse event in the register
+	bool shutoff;  // Shutoff event in the register
+};
+static sim_d7s_s sim_d7s[2];
+
+/** Channel of the simulated TCA9548 */
+static uint8_t sim_channel = 0;
+
+/** Called during the next register read of the D7S, an interrupt that comes while the task reads */
+static void (*sim_during_read)(void) = NULL;
+
+static bool sim_bus(uint8_t addr, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len)
+{
+	// TCA9548 on the default D7S_MUX_ADDR, the control register reads back the channel mask
+	if (addr == 0x71)
+	{
+		if (tx_len == 1)
+		{
+			sim_channel = tx[0] == 0x02 ? 1 : 0;
+		}
+		if (rx_len == 1)
+		{
+			rx[0] = 1 << sim_channel;
+		}
+		return true;
+	}
+	if (addr == 0x55)
+	{
+		memset(rx, 0, rx_len);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Register read of the D7S on the simulated bus, 16 bit register address
+ *
+ */
+static void sim_d7s_read(void)
+{
+	Wire.beginTransmission(0x55);
+	Wire.write(0x10);
+	Wire.write(0x00);
+	Wire.endTransmission(false);
+	Wire.requestFrom(0x55, 1);
+	Wire.read();
+	if (sim_during_read != NULL)
+	{
+		void (*irq)(void) = sim_during_read;
+		sim_during_read = NULL;
+		irq();
+	}
+}
+
+RAK_D7S::RAK_D7S(TwoWire &w, uint8_t addr)
+{
+}
+
+bool RAK_D7S::begin(void)
+{
+	return true;
+}
+
+uint8_t RAK_D7S::getState(void)
+{
+	return NORMAL_MODE;
+}
+
+void RAK_D7S::initialize(void)
+{
+	sim_d7s_read();
+}
+
+bool RAK_D7S::isReady(void)
+{
+	sim_d7s_read();
+	return true;
+}
+
+bool RAK_D7S::isEarthquakeOccuring(void)
+{
+	sim_d7s_read();
+	return true;
+}
+
+uint8_t RAK_D7S::isInCollapse(void)
+{
+	sim_d7s_read();
+	return sim_d7s[sim_channel].collapse ? 1 : 0;
+}
+
+uint8_t RAK_D7S::isInShutoff(void)
+{
+	sim_d7s_read();
+	return sim_d7s[sim_channel].shutoff ? 1 : 0;
+}
+
+void RAK_D7S::resetEvents(void)
+{
+	sim_d7s_read();
+	sim_d7s[sim_channel].collapse = false;
+	sim_d7s[sim_channel].shutoff = false;
+}
+
+void RAK_D7S::setAxis(D7S_axis_settings_t axis)
+{
+	sim_d7s_read();
+}
+
+void RAK_D7S::setThreshold(D7S_threshold_t threshold)
+{
+	sim_d7s_read();
+}
+
+/** GPIO and clock accesses with their modelled time */
+int digitalRead(uint32_t pin)
+{
+	host_advance_us(SIM_GPIO_US);
+	return host_pin_level[pin];
+}
+
+void digitalWrite(uint32_t pin, uint32_t level)
+{
+	host_advance_us(SIM_GPIO_US);
+	host_pin_level[pin] = level;
+}
+
+unsigned long millis(void)
+{
+	host_advance_us(SIM_GPIO_US);
+	return (uint32_t)(host_us / 1000);
+}
+
+/** Modules that are not part of the test */
+void event_log_start(void)
+{
+}
+
+void event_log_finish(float si, float pga, bool shutoff, bool collapse, uint8_t state)
+{
+}
+
+uint32_t event_log_start_time(void)
+{
+	return 0;
+}
+
+bool event_log_start_clock(void)
+{
+	return false;
+}
+
+uint16_t event_log_start_ms(void)
+{
+	return 0;
+}
+
+uint16_t event_log_start_uncertainty(void)
+{
+	return 0;
+}
+
+bool ew_armed(void)
+{
+	return false;
+}
+
+void ew_quake_start(void)
+{
+}
+
+uint32_t get_heartbeat_time(void)
+{
+	return 3600000;
+}
+
+bool is_clock_valid(void)
+{
+	return false;
+}
+
+bool is_full_payload(void)
+{
+	return false;
+}
+
+void mesh_send_alert(uint8_t alert)
+{
+}
+
+void perf_wakeup(uint16_t events)
+{
+}
+
+void perf_irq(uint8_t line)
+{
+}
+
+void perf_irq_handled(void)
+{
+}
+
+void perf_i2c(uint16_t bytes)
+{
+}
+
+void perf_i2c_error(void)
+{
+}
+
+void perf_handler_done(uint8_t handler, uint32_t start_us)
+{
+}
+
+void save_app_settings(void)
+{
+}
+
+void sched_start(uint8_t job, uint32_t delay_ms, uint32_t period_ms, uint32_t tolerance_ms)
+{
+}
+
+void sched_stop(uint8_t job)
+{
+}
+
+void heartbeat_start(void)
+{
+}
+
+void heartbeat_stop(void)
+{
+}
+
+void usb_stream_irq(uint8_t line, uint8_t level)
+{
+}
+
+void usb_stream_state(uint8_t state)
+{
+}
+
+extern SoftwareTimer shutoff_timer;
+
+/** Tasks of the simulation */
+static int sim_loop_task = 1;
+static int sim_seismic_task = 2;
+
+/** INT1 pins of the sensors, slot C and slot D */
+#define SIM_INT1_0 WB_IO3
+#define SIM_INT1_1 WB_IO5
+
+/**
+ * @brief A D7S pulls INT1 low, the interrupt runs
+ *
+ * @param sensor sensor index
+ * @return uint32_t time the interrupt needed until the output was switched in us
+ */
+static uint32_t sim_int1(uint8_t sensor)
+{
+	uint8_t pin = sensor == 0 ? SIM_INT1_0 : SIM_INT1_1;
+	uint64_t edge = host_us;
+	host_pin_set(pin, LOW);
+	return (uint32_t)(host_us - edge);
+}
+
+/**
+ * @brief Release INT1 of both sensors without an interrupt, the D7S does it after the reset of the events
+ *
+ */
+static void sim_int1_release(void)
+{
+	host_pin_level[SIM_INT1_0] = HIGH;
+	host_pin_level[SIM_INT1_1] = HIGH;
+}
+
+static void sim_int1_sensor1(void)
+{
+	sim_int1(1);
+}
+
+/**
+ * @brief The seismic task handles the events of the interrupts
+ *
+ */
+static void sim_seismic_task_run(void)
+{
+	TaskHandle_t current = host_current_task;
+	host_current_task = &sim_seismic_task;
+	while (g_task_event_type & SEISMIC_ALERT)
+	{
+		g_task_event_type &= N_SEISMIC_ALERT;
+		seismic_handler(SEISMIC_ALERT);
+	}
+	host_current_task = current;
+	sim_int1_release();
+}
+
+/** Values of AT+SHUTOFF? */
+struct sim_stats_s
+{
+	long mode, time, ok, on, count, last_us, max_us, confirm_us, rejected;
+};
+
+static sim_stats_s sim_stats(void)
+{
+	sim_stats_s stats = {-1, -1, -1, -1, -1, -1, -1, -1, -1};
+	host_serial.clear();
+	print_shutoff();
+	sscanf(host_serial.c_str(), "%ld:%ld:%ld:%ld:%ld:%ld:%ld:%ld:%ld", &stats.mode, &stats.time, &stats.ok, &stats.on,
+		   &stats.count, &stats.last_us, &stats.max_us, &stats.confirm_us, &stats.rejected);
+	return stats;
+}
+
+/**
+ * @brief Level of the shutoff output
+ *
+ * @return true output is active, SHUTOFF_ACTIVE is HIGH by default
+ */
+static bool output_on(void)
+{
+	return host_pin_level[SHUTOFF_PIN] == HIGH;
+}
+
+/**
+ * @brief Start the sensors and the output like init_app()
+ *
+ */
+static void test_init(void)
+{
+	host_set_ms(1000);
+	host_i2c_device = sim_bus;
+	host_current_task = &sim_loop_task;
+	g_lpwan_has_joined = false;
+	g_app_settings.shutoff_mode = SHUTOFF_LATCH;
+	g_app_settings.vote_k = 1;
+	sim_int1_release();
+	host_pin_level[WB_IO4] = HIGH;
+	host_pin_level[WB_IO6] = HIGH;
+	init_i2c_bus();
+	CHECK(init_rak12027());
+	CHECK_EQ(d7s_num, 2);
+	init_shutoff();
+	CHECK_EQ(sim_stats().ok, 1);
+	CHECK(!output_on());
+}
+
+/**
+ * @brief The loop holds the bus for a growing time, the output switches in the interrupt anyway
+ *
+ */
+static void test_latency(void)
+{
+	uint32_t holds[] = {1000, 4000, 20000, 100000};
+	uint32_t isr_max = 0;
+	for (uint32_t hold : holds)
+	{
+		shutoff_release();
+		host_advance_ms(10000);
+		host_current_task = &sim_loop_task;
+		// The loop reads the PM sensor and is busy with the radio while holding the bus
+		i2c_begin(I2C_DEV_PMSA);
+		host_advance_us(100);
+		sim_d7s[0].shutoff = true;
+		uint32_t isr = sim_int1(0);
+		// Switched before any task ran
+		CHECK(output_on());
+		host_advance_us(hold);
+		i2c_end(I2C_DEV_PMSA, 0);
+		sim_seismic_task_run();
+		CHECK(output_on());
+		CHECK(shutoff_active());
+		sim_stats_s stats = sim_stats();
+		printf("Loop holds the bus %6ld us: output after %2ld us in the interrupt, confirmed after %6ld us "
+			   "(the output switched only then before)\n",
+			   (long)hold, (long)stats.last_us, (long)stats.confirm_us);
+		CHECK(stats.last_us <= isr);
+		CHECK(stats.confirm_us >= (long)hold);
+		isr_max = isr > isr_max ? isr : isr_max;
+	}
+	sim_stats_s stats = sim_stats();
+	CHECK_EQ(stats.count, 4);
+	CHECK_EQ(stats.rejected, 0);
+	CHECK(stats.max_us <= SIM_ISR_BOUND_US);
+	CHECK(isr_max <= SIM_ISR_BOUND_US);
+	printf("Interrupt path at most %ld us, bound %d us\n", (long)isr_max, SIM_ISR_BOUND_US);
+}
+
+/**
+ * @brief INT1 without an event in the D7S registers, the task switches the output off again
+ *
+ */
+static void test_rejected(void)
+{
+	shutoff_release();
+	host_advance_ms(10000);
+	long rejected = sim_stats().rejected;
+	long count = sim_stats().count;
+	sim_int1(0);
+	CHECK(output_on());
+	sim_seismic_task_run();
+	CHECK(!output_on());
+	CHECK(!shutoff_active());
+	CHECK_EQ(sim_stats().rejected, rejected + 1);
+	CHECK_EQ(sim_stats().count, count);
+}
+
+/**
+ * @brief Two of two sensors must agree, the output switches with the second INT1
+ *
+ */
+static void test_voting(void)
+{
+	g_app_settings.vote_k = 2;
+	shutoff_release();
+	host_advance_ms(10000);
+	d7s_clear_votes();
+	long count = sim_stats().count;
+	sim_d7s[0].shutoff = true;
+	sim_int1(0);
+	CHECK(!output_on());
+	sim_seismic_task_run();
+	CHECK(!output_on());
+	host_advance_ms(1000);
+	sim_d7s[1].shutoff = true;
+	sim_int1(1);
+	CHECK(output_on());
+	sim_seismic_task_run();
+	CHECK(output_on());
+	CHECK_EQ(sim_stats().count, count + 1);
+
+	// Outside of the window the second sensor does not switch the output
+	shutoff_release();
+	host_advance_ms(10000);
+	d7s_clear_votes();
+	sim_d7s[0].shutoff = true;
+	sim_int1(0);
+	sim_seismic_task_run();
+	host_advance_ms(d7s_vote_window() + 100);
+	sim_d7s[1].shutoff = true;
+	sim_int1(1);
+	CHECK(!output_on());
+	sim_seismic_task_run();
+	CHECK(!output_on());
+	g_app_settings.vote_k = 1;
+}
+
+/**
+ * @brief The sensors agree on INT1 but report different alerts, the task does not confirm
+ *
+ */
+static void test_types_differ(void)
+{
+	g_app_settings.vote_k = 2;
+	shutoff_release();
+	host_advance_ms(10000);
+	d7s_clear_votes();
+	long rejected = sim_stats().rejected;
+	sim_d7s[0].collapse = true;
+	sim_int1(0);
+	sim_seismic_task_run();
+	host_advance_ms(500);
+	sim_d7s[1].shutoff = true;
+	sim_int1(1);
+	CHECK(output_on());
+	sim_seismic_task_run();
+	CHECK(!output_on());
+	CHECK_EQ(sim_stats().rejected, rejected + 1);
+	g_app_settings.vote_k = 1;
+}
+
+/**
+ * @brief The second INT1 comes while the task reads the first sensor
+ *        The first read alone has no agreement, the output stays on until the second sensor was read
+ *
+ */
+static void test_int1_during_read(void)
+{
+	g_app_settings.vote_k = 2;
+	shutoff_release();
+	host_advance_ms(10000);
+	d7s_clear_votes();
+	long rejected = sim_stats().rejected;
+	sim_d7s[0].shutoff = true;
+	sim_d7s[1].shutoff = true;
+	sim_int1(0);
+	sim_during_read = sim_int1_sensor1;
+	TaskHandle_t current = host_current_task;
+	host_current_task = &sim_seismic_task;
+	g_task_event_type &= N_SEISMIC_ALERT;
+	seismic_handler(SEISMIC_ALERT);
+	// Switched by the interrupt of the second sensor, not rejected by the first read
+	CHECK(output_on());
+	CHECK(g_task_event_type & SEISMIC_ALERT);
+	host_current_task = current;
+	sim_seismic_task_run();
+	CHECK(output_on());
+	CHECK_EQ(sim_stats().rejected, rejected);
+	g_app_settings.vote_k = 1;
+}
+
+/**
+ * @brief Pulse mode, the timer is started when the task confirms the output
+ *
+ */
+static void test_pulse(void)
+{
+	g_app_settings.shutoff_mode = SHUTOFF_PULSE;
+	g_app_settings.shutoff_time = 5;
+	shutoff_release();
+	host_advance_ms(10000);
+	CHECK(!shutoff_timer.isRunning());
+	sim_d7s[0].shutoff = true;
+	sim_int1(0);
+	CHECK(output_on());
+	CHECK(!shutoff_timer.isRunning());
+	sim_seismic_task_run();
+	CHECK(shutoff_timer.isRunning());
+	CHECK_EQ(shutoff_timer.getPeriod(), 5000);
+	shutoff_timer.fire();
+	CHECK(!output_on());
+
+	// Output off, no interrupt switch
+	g_app_settings.shutoff_mode = SHUTOFF_OFF;
+	sim_d7s[0].shutoff = true;
+	sim_int1(0);
+	CHECK(!output_on());
+	sim_seismic_task_run();
+	CHECK(!output_on());
+	g_app_settings.shutoff_mode = SHUTOFF_LATCH;
+	CHECK_EQ(host_sem_deadlocks, 0);
+}
+
+int main(void)
+{
+	RUN(test_init);
+	RUN(test_latency);
+	RUN(test_rejected);
+	RUN(test_voting);
+	RUN(test_types_differ);
+	RUN(test_int1_during_read);
+	RUN(test_pulse);
+	return TEST_RESULT();
+}
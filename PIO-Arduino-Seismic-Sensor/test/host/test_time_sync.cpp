@@ -0,0 +1,326 @@
+/**
+ * @file test_time_sync.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host simulation of the TS003 clock synchronization with a network server
+ *        The server answers with a rounded or truncated correction after a random latency.
+ *        After every sync the error of the clock must be within the uncertainty it reports.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "epoch_clock.h"
+#include "host_fakes.h"
+#include "test.h"
+#include <math.h>
+
+// Used by time_sync.cpp
+bool earthquake_start = false;
+bool dl_ack_pending = false;
+
+/** Datarate of the uplinks */
+static int8_t sim_datarate = 0;
+
+/** Number of times the time was written into the RTC */
+static uint32_t rtc_writes = 0;
+
+void sched_start(uint8_t job, uint32_t delay_ms, uint32_t period_ms, uint32_t tolerance_ms)
+{
+}
+
+void perf_uplink(uint8_t type, uint8_t result)
+{
+}
+
+lmh_error_status perf_lora_uplink(uint8_t type, lmh_error_status result)
+{
+	return result;
+}
+
+void perf_retry(void)
+{
+}
+
+void write_rak12002(uint32_t epoch)
+{
+	rtc_writes++;
+}
+
+LoRaMacStatus_t LoRaMacMibGetRequestConfirm(MibRequestConfirm_t *mibGet)
+{
+	mibGet->Param.ChannelsDatarate = sim_datarate;
+	return LORAMAC_STATUS_OK;
+}
+
+/** Unix time of the GPS epoch and the leap seconds, as the server knows them */
+#define SIM_GPS_EPOCH 315964800ULL
+#define SIM_LEAP_SECONDS 18
+
+/** Unix time in ms when millis() was 0 */
+static uint64_t sim_boot_epoch_ms = 0;
+
+/**
+ * @brief Real time of the simulation
+ *
+ * @return uint64_t Unix time in ms
+ */
+static uint64_t sim_now_ms(void)
+{
+	return sim_boot_epoch_ms + host_us / 1000;
+}
+
+/**
+ * @brief Time on air of an EU868 uplink, calculated independently of the firmware
+ *        Semtech AN1200.13, explicit header, CRC on, coding rate 4/5, 8 symbol preamble
+ *
+ * @param datarate DR0 to DR5
+ * @param len LoRaWAN frame size
+ * @return double time on air in ms
+ */
+static double sim_airtime(int8_t datarate, uint8_t len)
+{
+	int sf = 12 - datarate;
+	double symbol_ms = pow(2, sf) / 125.0;
+	int de = symbol_ms >= 16.0 ? 1 : 0;
+	double payload = ceil((8.0 * len - 4.0 * sf + 28 + 16) / (4.0 * (sf - 2 * de))) * 5;
+	return (8 + 4.25) * symbol_ms + (8 + (payload > 0 ? payload : 0)) * symbol_ms;
+}
+
+/** Result of one sync */
+struct sync_result_s
+{
+	bool synced;
+	double error_ms;
+	uint32_t uncertainty;
+	int32_t correction;
+};
+
+/**
+ * @brief One request and answer through the simulated network server
+ *
+ * @param truncate true if the server truncates the correction, false if it rounds it
+ * @return sync_result_s error of the clock after the sync
+ */
+static sync_result_s sim_sync(bool truncate)
+{
+	sync_result_s result = sync_result_s();
+	host_lora_tx.clear();
+	host_lora_fport.clear();
+	time_sync_handler();
+	if (host_lora_tx.size() != 1)
+	{
+		return result;
+	}
+	CHECK_EQ(host_lora_fport[0], TIME_SYNC_FPORT);
+	std::vector<uint8_t> &request = host_lora_tx[0];
+	CHECK_EQ(request.size(), 6);
+	CHECK_EQ(request[0], 0x01);
+	uint32_t device_time = request[1] | (request[2] << 8) | (request[3] << 16) | ((uint32_t)request[4] << 24);
+	uint8_t token = request[5] & 0x0F;
+
+	// Radio starts within a few ms, the uplink ends after the time on air, the server has its own latency
+	host_advance_us((uint64_t)(rand() % 5000) + (uint64_t)(sim_airtime(sim_datarate, 6 + 13) * 1000));
+	double server_gps = (sim_now_ms() - (SIM_GPS_EPOCH - SIM_LEAP_SECONDS) * 1000.0) / 1000.0;
+	double difference = server_gps - device_time;
+	int64_t correction = truncate ? (int64_t)floor(difference) : (int64_t)floor(difference + 0.5);
+	// The correction must fit the signed 32 bit field
+	CHECK(correction >= INT32_MIN && correction <= INT32_MAX);
+	result.correction = (int32_t)correction;
+
+	// Answer in RX1 one second later, the device needs a few ms to handle it
+	host_advance_us(1000000 + rand() % 30000);
+	uint8_t answer[6] = {0x01, (uint8_t)correction, (uint8_t)(correction >> 8), (uint8_t)(correction >> 16), (uint8_t)(correction >> 24), token};
+	uint32_t writes = rtc_writes;
+	handle_time_sync_ans(answer, sizeof(answer));
+	result.synced = rtc_writes != writes;
+	result.error_ms = (double)(int64_t)(get_clock_ms() - sim_now_ms());
+	result.uncertainty = get_clock_uncertainty();
+	return result;
+}
+
+/**
+ * @brief Boot at a random time and sync the clock
+ *        The clock has no Unix time before the first sync
+ *
+ */
+static void test_first_sync(void)
+{
+	srand(1);
+	double max_error = 0;
+	for (int run = 0; run < 2000; run++)
+	{
+		// The clock module keeps its state, a forced sync with an unknown time resets it
+		host_set_ms(0);
+		sim_boot_epoch_ms = clock_to_epoch(2023, 3, 1, 0, 0, 0) * 1000ULL + (uint64_t)rand() * 1000 % (20ULL * 365 * 86400 * 1000);
+		sim_datarate = rand() % 6;
+		host_advance_us((uint64_t)rand() * 1000 % (30ULL * 86400 * 1000000));
+		if (run == 0)
+		{
+			CHECK(!is_clock_valid());
+		}
+		else
+		{
+			clock_sync(0, 0xFFFFFFFE, CLOCK_SRC_NONE, true);
+		}
+
+		sync_result_s result = sim_sync(run & 1);
+		CHECK(result.synced);
+		CHECK(is_clock_valid());
+		CHECK_EQ(get_clock_source(), CLOCK_SRC_NETWORK);
+		CHECK(fabs(result.error_ms) <= result.uncertainty);
+		CHECK(result.uncertainty >= 1000);
+		if (fabs(result.error_ms) > max_error)
+		{
+			max_error = fabs(result.error_ms);
+		}
+	}
+	printf("First sync: max error %.0f ms, uncertainty %d ms\n", max_error, TIME_SYNC_UNCERTAINTY + TIME_SYNC_LATENCY);
+}
+
+/**
+ * @brief Daily syncs of a running clock that drifts
+ *
+ */
+static void test_daily_sync(void)
+{
+	srand(2);
+	sim_boot_epoch_ms = clock_to_epoch(2023, 6, 1, 0, 0, 0) * 1000ULL;
+	host_set_ms(0);
+	clock_sync(0, 0xFFFFFFFE, CLOCK_SRC_NONE, true);
+	double max_error = 0;
+	uint32_t syncs = 0;
+	for (int day = 0; day < 365; day++)
+	{
+		// The crystal of the device is 40 ppm slow
+		host_advance_us(TIME_SYNC_INTERVAL * 1000ULL);
+		sim_boot_epoch_ms += TIME_SYNC_INTERVAL * 40 / 1000000;
+		if (is_clock_valid())
+		{
+			double before = (double)(int64_t)(get_clock_ms() - sim_now_ms());
+			CHECK(fabs(before) <= get_clock_uncertainty());
+		}
+
+		sim_datarate = rand() % 6;
+		sync_result_s result = sim_sync(day & 1);
+		syncs += result.synced ? 1 : 0;
+		// A sync is only taken if it is better, the clock must be within its uncertainty either way
+		CHECK(fabs(result.error_ms) <= result.uncertainty);
+		if (fabs(result.error_ms) > max_error)
+		{
+			max_error = fabs(result.error_ms);
+		}
+	}
+	CHECK(syncs > 300);
+	printf("Daily sync: %ld syncs taken, max error %.0f ms\n", (long)syncs, max_error);
+}
+
+/**
+ * @brief The server answers with a wrong token or no request is pending
+ *
+ */
+static void test_unexpected_answer(void)
+{
+	sim_boot_epoch_ms = clock_to_epoch(2023, 6, 1, 0, 0, 0) * 1000ULL;
+	host_set_ms(0);
+	clock_sync(0, 0xFFFFFFFE, CLOCK_SRC_NONE, true);
+	uint8_t answer[6] = {0x01, 0x10, 0x00, 0x00, 0x00, 0x00};
+	handle_time_sync_ans(answer, sizeof(answer));
+	CHECK(!is_clock_valid());
+
+	host_lora_tx.clear();
+	time_sync_handler();
+	CHECK_EQ(host_lora_tx.size(), 1);
+	answer[5] = (host_lora_tx[0][5] + 1) & 0x0F;
+	handle_time_sync_ans(answer, sizeof(answer));
+	CHECK(!is_clock_valid());
+
+	// Truncated answer
+	answer[5] = host_lora_tx[0][5] & 0x0F;
+	handle_time_sync_ans(answer, 5);
+	CHECK(!is_clock_valid());
+}
+
+/**
+ * @brief P2P nodes that take the time from the same beacon are aligned much better than 1 second
+ *        The sender has the network time with its error of up to 1 second, every receiver has the
+ *        same error plus its own handling latency of 0 to TIME_BEACON_LATENCY.
+ *
+ */
+static void test_beacon_alignment(void)
+{
+	srand(3);
+	g_lorawan_settings.p2p_sf = 7;
+	g_lorawan_settings.p2p_bandwidth = 0;
+	g_lorawan_settings.p2p_cr = 1;
+	g_lorawan_settings.p2p_preamble_len = 8;
+	double max_network_error = 0;
+	double max_spread = 0;
+	for (int run = 0; run < 200; run++)
+	{
+		// Sender gets the network time
+		g_lorawan_settings.lorawan_enable = true;
+		host_set_ms(0);
+		sim_boot_epoch_ms = clock_to_epoch(2023, 6, 1, 0, 0, 0) * 1000ULL + (uint64_t)rand() * 1000 % (86400ULL * 1000);
+		host_advance_us((uint64_t)rand() * 1000 % (86400ULL * 1000000));
+		clock_sync(0, 0xFFFFFFFE, CLOCK_SRC_NONE, true);
+		sim_datarate = rand() % 6;
+		sync_result_s sender = sim_sync(run & 1);
+		CHECK(sender.synced);
+		if (fabs(sender.error_ms) > max_network_error)
+		{
+			max_network_error = fabs(sender.error_ms);
+		}
+
+		// Sender sends the beacon
+		g_lorawan_settings.lorawan_enable = false;
+		host_p2p_tx.clear();
+		time_sync_handler();
+		CHECK_EQ(host_p2p_tx.size(), 1);
+		if (host_p2p_tx.size() != 1)
+		{
+			continue;
+		}
+		std::vector<uint8_t> beacon = host_p2p_tx[0];
+		uint64_t sent_us = host_us;
+
+		// Receivers without a time take it, each with its own latency
+		double min_error = 1e9;
+		double max_error = -1e9;
+		for (int node = 0; node < 8; node++)
+		{
+			host_us = sent_us;
+			clock_sync(0, 0xFFFFFFFE, CLOCK_SRC_NONE, true);
+			host_advance_us((uint64_t)(sim_airtime(5, beacon.size()) * 1000) + rand() % (TIME_BEACON_LATENCY * 1000));
+			CHECK(handle_time_beacon(beacon.data(), beacon.size()));
+			CHECK_EQ(get_clock_source(), CLOCK_SRC_P2P);
+			double error = (double)(int64_t)(get_clock_ms() - sim_now_ms());
+			CHECK(fabs(error) <= get_clock_uncertainty());
+			// Same error as the sender within the latency and the rounding to ms
+			CHECK(fabs(error - sender.error_ms) <= TIME_BEACON_LATENCY / 2 + 2);
+			min_error = error < min_error ? error : min_error;
+			max_error = error > max_error ? error : max_error;
+		}
+		CHECK(max_error - min_error <= TIME_BEACON_LATENCY + 2);
+		if (max_error - min_error > max_spread)
+		{
+			max_spread = max_error - min_error;
+		}
+	}
+	CHECK(max_network_error > 500);
+	printf("Beacon: network time max error %.0f ms, receivers of one beacon within %.0f ms\n", max_network_error, max_spread);
+	g_lorawan_settings.lorawan_enable = true;
+}
+
+int main(void)
+{
+	g_lorawan_settings.lorawan_enable = true;
+	g_lorawan_settings.lora_region = LORAMAC_REGION_EU868;
+	g_lpwan_has_joined = true;
+	RUN(test_first_sync);
+	RUN(test_daily_sync);
+	RUN(test_unexpected_answer);
+	RUN(test_beacon_alignment);
+	return TEST_RESULT();
+}
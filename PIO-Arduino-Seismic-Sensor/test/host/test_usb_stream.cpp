@@ -0,0 +1,137 @@
+/**
+ * @file test_usb_stream.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host capture of the binary USB stream for the reader in tools/usb_stream_reader.cpp
+ *        10 s of snapshots with interrupt and state records, an overflow of the record queue
+ *        and AT command replies between the frames are written to usb_stream_capture.bin.
+ *        The usb_stream_reader test decodes the capture and checks the frame count.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "host_fakes.h"
+#include "test.h"
+
+bool earthquake_start = false;
+bool shutoff_alert = false;
+bool collapse_alert = false;
+
+/** Values of the simulated D7S */
+static float sim_si = 0.0f;
+static uint8_t sim_state = 0;
+
+bool instant_rak12027(float *si, float *pga)
+{
+	*si = sim_si;
+	*pga = sim_si * 2;
+	return true;
+}
+
+uint8_t state_rak12027(void)
+{
+	return sim_state;
+}
+
+bool is_clock_valid(void)
+{
+	return true;
+}
+
+void sched_start(uint8_t job, uint32_t delay_ms, uint32_t period_ms, uint32_t tolerance_ms)
+{
+	CHECK_EQ(job, SCHED_USB_STREAM);
+}
+
+void sched_stop(uint8_t job)
+{
+	CHECK_EQ(job, SCHED_USB_STREAM);
+}
+
+/** Snapshots of the capture */
+#define SIM_SNAPSHOTS 1000
+
+/** Interrupts sent at once to overflow the queue of 32 records */
+#define SIM_BURST 40
+
+/**
+ * @brief Frames between the 0x00 delimiters, no 0x00 inside a frame
+ *
+ * @param data capture
+ * @return uint32_t number of frames that are not text
+ */
+static uint32_t count_frames(const std::string &data)
+{
+	uint32_t frames = 0;
+	size_t start = 0;
+	while ((start = data.find('\0', start)) != std::string::npos)
+	{
+		size_t end = data.find('\0', start + 1);
+		if (end == std::string::npos)
+		{
+			break;
+		}
+		if (end - start > 1)
+		{
+			frames++;
+		}
+		start = end + 1;
+	}
+	return frames;
+}
+
+static void test_capture(void)
+{
+	host_set_ms(100000);
+	host_serial.clear();
+	usb_stream_start(10);
+	CHECK(g_usb_stream);
+	for (uint32_t idx = 0; idx < SIM_SNAPSHOTS; idx++)
+	{
+		host_advance_ms(10);
+		sim_si = idx * 0.001f;
+		sim_state = (idx / 100) % 4;
+		if (idx % 100 == 0)
+		{
+			usb_stream_irq(1, idx % 200 == 0 ? LOW : HIGH);
+			usb_stream_state(sim_state);
+		}
+		if (idx == 550)
+		{
+			for (uint8_t irq = 0; irq < SIM_BURST; irq++)
+			{
+				usb_stream_irq(2, LOW);
+			}
+		}
+		if (idx % 250 == 0)
+		{
+			// AT command reply between the frames
+			Serial.printf("+STREAM:10\r\nOK\r\n");
+		}
+		usb_stream_handler();
+	}
+	usb_stream_start(0);
+	CHECK(!g_usb_stream);
+
+	// Snapshots, 10 interrupt and 10 state records, the queue holds 32 of the burst, one lost record
+	uint32_t frames = SIM_SNAPSHOTS + 20 + 32 + 1;
+	CHECK_EQ(count_frames(host_serial), frames);
+	printf("Capture: %ld frames, %ld bytes, %ld records lost\n", (long)frames, (long)host_serial.size(),
+		   (long)(SIM_BURST - 32));
+
+	FILE *capture = fopen("usb_stream_capture.bin", "wb");
+	CHECK(capture != NULL);
+	if (capture != NULL)
+	{
+		CHECK_EQ(fwrite(host_serial.data(), 1, host_serial.size(), capture), host_serial.size());
+		fclose(capture);
+	}
+}
+
+int main(void)
+{
+	RUN(test_capture);
+	return TEST_RESULT();
+}
@@ -0,0 +1,787 @@
+/**
+ * @file test_user_at.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Host fuzz harness and benchmark of the user AT command parameters
+ *        Random parameter strings are given to every setter of the command table. A reference parser
+ *        built on strtoull() decides if a string is valid, the setter must agree, store the same values
+ *        and leave the string unchanged. The benchmark compares the old strtok() parser of AT+RTC
+ *        and the lookup in the command table.
+ * @version 0.1
+ * @date 2023-03-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "app.h"
+#include "epoch_clock.h"
+#include "host_fakes.h"
+#include "test.h"
+#include <chrono>
+#include <string>
+
+extern atcmd_t g_user_at_cmd_list_all[];
+extern uint8_t g_user_at_cmd_num;
+
+/** Calls of the setters into the application */
+struct sim_calls_s
+{
+	uint32_t rtc[5];
+	uint8_t threshold;
+	uint16_t stream;
+	uint32_t telem_changed;
+	uint32_t shutoff_release;
+	uint32_t early_warning;
+	uint32_t i2c_reset;
+	uint32_t sched_reset;
+	uint32_t perf_reset;
+	uint32_t evlog_find[2];
+};
+
+static sim_calls_s sim_calls;
+
+bool has_rak12002 = true;
+date_time_s g_date_time;
+
+void set_rak12002(uint16_t year, uint8_t month, uint8_t date, uint8_t hour, uint8_t minute)
+{
+	uint32_t values[5] = {year, month, date, hour, minute};
+	memcpy(sim_calls.rtc, values, sizeof(values));
+}
+
+void read_rak12002(void)
+{
+}
+
+void threshold_rak12027(uint8_t new_threshold)
+{
+	sim_calls.threshold = new_threshold;
+}
+
+uint16_t event_log_count(void)
+{
+	return 0;
+}
+
+uint16_t event_log_find(uint32_t from, uint32_t to, uint16_t *first)
+{
+	sim_calls.evlog_find[0] = from;
+	sim_calls.evlog_find[1] = to;
+	return 0;
+}
+
+bool event_log_in_range(uint16_t pos, uint32_t from, uint32_t to)
+{
+	return false;
+}
+
+bool event_log_get(uint16_t pos, event_record_s *record)
+{
+	return false;
+}
+
+void i2c_print_stats(void)
+{
+}
+
+void i2c_reset_stats(void)
+{
+	sim_calls.i2c_reset++;
+}
+
+void sched_print_stats(void)
+{
+}
+
+void sched_reset_stats(void)
+{
+	sim_calls.sched_reset++;
+}
+
+void print_batt_profile(void)
+{
+}
+
+void print_ble_telemetry(void)
+{
+}
+
+void ble_telemetry_interval_changed(void)
+{
+	sim_calls.telem_changed++;
+}
+
+void usb_stream_start(uint16_t interval_ms)
+{
+	sim_calls.stream = interval_ms;
+}
+
+uint16_t usb_stream_interval(void)
+{
+	return sim_calls.stream;
+}
+
+void print_d7s_array(void)
+{
+}
+
+void print_shutoff(void)
+{
+}
+
+void shutoff_release(void)
+{
+	sim_calls.shutoff_release++;
+}
+
+void print_mesh(void)
+{
+}
+
+void print_early_warning(void)
+{
+}
+
+void init_early_warning(void)
+{
+	sim_calls.early_warning++;
+}
+
+void perf_print(void)
+{
+}
+
+void perf_reset(void)
+{
+	sim_calls.perf_reset++;
+}
+
+/** Range of a number parameter of the reference parser */
+struct ref_field_s
+{
+	uint32_t min;
+	uint32_t max;
+};
+
+/**
+ * @brief Reference parser of ':' separated numbers, decimal or 0x hex
+ *
+ * @param str parameter string
+ * @param fields ranges of the parameters, a copy, the range of the second EVLOG parameter is set
+ * @param num number of parameters
+ * @param values parsed values
+ * @return int 0 if valid, AT_ERRNO_PARA_NUM or AT_ERRNO_PARA_VAL
+ */
+static int ref_parse(const std::string &str, ref_field_s *fields, uint8_t num, uint32_t *values)
+{
+	size_t pos = 0;
+	for (uint8_t idx = 0; idx < num; idx++)
+	{
+		if ((pos >= str.size()) || (str[pos] == ':'))
+		{
+			return AT_ERRNO_PARA_NUM;
+		}
+		size_t end = str.find(':', pos);
+		std::string token = str.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+		pos = end == std::string::npos ? str.size() : end + 1;
+
+		bool hex = (token.size() > 2) && (token[0] == '0') && ((token[1] == 'x') || (token[1] == 'X'));
+		std::string digits = hex ? token.substr(2) : token;
+		const char *allowed = hex ? "0123456789abcdefABCDEF" : "0123456789";
+		if (digits.empty() || (digits.find_first_not_of(allowed) != std::string::npos))
+		{
+			return AT_ERRNO_PARA_VAL;
+		}
+		// Leading zeros do not count for the overflow
+		size_t first = digits.find_first_not_of('0');
+		if ((first != std::string::npos) && (digits.size() - first > (hex ? 8u : 10u)))
+		{
+			return AT_ERRNO_PARA_VAL;
+		}
+		unsigned long long value = strtoull(digits.c_str(), NULL, hex ? 16 : 10);
+		if ((value > 0xFFFFFFFFULL) || (value < fields[idx].min) || (value > fields[idx].max))
+		{
+			return AT_ERRNO_PARA_VAL;
+		}
+		values[idx] = (uint32_t)value;
+		// The range of the second EVLOG parameter starts at the first
+		if ((idx == 0) && (num == 2) && (fields[1].min == 0xFFFFFFFF))
+		{
+			fields[1].min = (uint32_t)value;
+		}
+	}
+	return pos < str.size() ? AT_ERRNO_PARA_NUM : 0;
+}
+
+/** One setter with its parameters */
+struct ref_cmd_s
+{
+	const char *name;
+	uint8_t num;
+	ref_field_s fields[5];
+};
+
+static const ref_cmd_s ref_cmds[] = {
+	{"+SENS", 1, {{0, 1}}},
+	{"+EVLOG", 2, {{0, 0xFFFFFFFF}, {0xFFFFFFFF, 0xFFFFFFFF}}},
+	{"+I2C", 1, {{0, 0}}},
+	{"+SCHED", 1, {{0, 0}}},
+	{"+TELEM", 1, {{0, 25500}}},
+	{"+STREAM", 1, {{0, 60000}}},
+	{"+D7S", 2, {{0, D7S_MAX_SENSORS}, {0, 25500}}},
+	{"+SHUTOFF", 2, {{SHUTOFF_OFF, SHUTOFF_AUTO}, {0, 255}}},
+	{"+MESH", 1, {{0, 15}}},
+	{"+PERF", 1, {{0, 0}}},
+	{"+RTC", 5, {{2000, 2099}, {1, 12}, {1, 31}, {0, 23}, {0, 59}}},
+};
+
+/**
+ * @brief Check of the values beyond the ranges, e.g. steps of 100 ms
+ *
+ * @param name command
+ * @param values parsed values
+ * @return true values are valid
+ */
+static bool ref_valid(const char *name, const uint32_t *values)
+{
+	if ((strcmp(name, "+TELEM") == 0) || (strcmp(name, "+D7S") == 0))
+	{
+		return values[strcmp(name, "+D7S") == 0 ? 1 : 0] % 100 == 0;
+	}
+	if (strcmp(name, "+STREAM") == 0)
+	{
+		return (values[0] == 0) || (values[0] >= STREAM_INTERVAL_MIN);
+	}
+	if (strcmp(name, "+RTC") == 0)
+	{
+		return values[2] <= clock_days_in_month(values[0], values[1]);
+	}
+	return true;
+}
+
+/**
+ * @brief Check that the setter stored the values
+ *
+ * @param name command
+ * @param values parsed values
+ */
+static void ref_check_stored(const char *name, const uint32_t *values)
+{
+	if (strcmp(name, "+SENS") == 0)
+	{
+		CHECK_EQ(g_app_settings.threshold, values[0]);
+		CHECK_EQ(sim_calls.threshold, values[0]);
+	}
+	else if (strcmp(name, "+EVLOG") == 0)
+	{
+		CHECK_EQ(sim_calls.evlog_find[0], values[0]);
+		CHECK_EQ(sim_calls.evlog_find[1], values[1]);
+	}
+	else if (strcmp(name, "+TELEM") == 0)
+	{
+		CHECK_EQ(g_app_settings.telemetry_rate * 100, values[0]);
+	}
+	else if (strcmp(name, "+STREAM") == 0)
+	{
+		CHECK_EQ(sim_calls.stream, values[0]);
+	}
+	else if (strcmp(name, "+D7S") == 0)
+	{
+		CHECK_EQ(g_app_settings.vote_k, values[0]);
+		CHECK_EQ(g_app_settings.vote_window * 100, values[1]);
+	}
+	else if (strcmp(name, "+SHUTOFF") == 0)
+	{
+		CHECK_EQ(g_app_settings.shutoff_mode, values[0]);
+		CHECK_EQ(g_app_settings.shutoff_time, values[1]);
+	}
+	else if (strcmp(name, "+MESH") == 0)
+	{
+		CHECK_EQ(g_app_settings.mesh_ttl, values[0]);
+	}
+	else if (strcmp(name, "+RTC") == 0)
+	{
+		for (uint8_t idx = 0; idx < 5; idx++)
+		{
+			CHECK_EQ(sim_calls.rtc[idx], values[idx]);
+		}
+	}
+}
+
+/**
+ * @brief Find a command in the table, like the API does
+ *
+ * @param name command with +
+ * @return atcmd_t* command or NULL
+ */
+static atcmd_t *find_cmd(const char *name)
+{
+	for (uint8_t idx = 0; idx < g_user_at_cmd_num; idx++)
+	{
+		if (strcasecmp(g_user_at_cmd_list_all[idx].cmd_name, name) == 0)
+		{
+			return &g_user_at_cmd_list_all[idx];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Random parameter, mostly numbers around the limits, sometimes garbage
+ *
+ * @param field range of the parameter
+ * @return std::string parameter
+ */
+static std::string fuzz_field(const ref_field_s &field)
+{
+	char text[40];
+	static const uint64_t specials[] = {0, 1, 9, 10, 99, 100, 255, 256, 999, 2000, 2099, 25500, 60000, 65535, 65536,
+										0x7FFFFFFF, 0xFFFFFFFF, 0x100000000ULL, 99999999999ULL};
+	switch (rand() % 10)
+	{
+	case 0:
+		return "";
+	case 1:
+	{
+		// Random printable and non printable bytes
+		std::string garbage;
+		int len = rand() % 12;
+		for (int idx = 0; idx < len; idx++)
+		{
+			garbage += (char)(1 + rand() % 255);
+		}
+		return garbage;
+	}
+	case 2:
+		snprintf(text, sizeof(text), "0x%llX", (unsigned long long)specials[rand() % 19]);
+		return text;
+	case 3:
+		snprintf(text, sizeof(text), "%llu", (unsigned long long)specials[rand() % 19]);
+		return text;
+	case 4:
+	{
+		// Leading zeros, sign, space or hex prefix alone
+		static const char *prefixes[] = {"00", "-", "+", " ", "0x", "0X", "x", "0x0"};
+		snprintf(text, sizeof(text), "%s%lu", prefixes[rand() % 8], (unsigned long)(field.min + rand() % 30));
+		return text;
+	}
+	default:
+	{
+		// In or next to the range
+		uint64_t span = (uint64_t)field.max - field.min + 1;
+		int64_t value = (int64_t)field.min + (int64_t)(rand() % (span > 1000000 ? 1000000 : span)) - 1 + rand() % 3;
+		if (value < 0)
+		{
+			value = 0;
+		}
+		if (rand() % 4 == 0)
+		{
+			snprintf(text, sizeof(text), "0x%llx", (unsigned long long)value);
+		}
+		else
+		{
+			snprintf(text, sizeof(text), "%llu", (unsigned long long)value);
+		}
+		return text;
+	}
+	}
+}
+
+/**
+ * @brief Random parameter string for a command
+ *
+ * @param cmd command
+ * @return std::string parameters separated by ':'
+ */
+static std::string fuzz_params(const ref_cmd_s &cmd)
+{
+	std::string params;
+	int num = cmd.num + rand() % 3 - 1;
+	for (int idx = 0; idx < num; idx++)
+	{
+		if (idx != 0)
+		{
+			params += rand() % 20 == 0 ? "::" : ":";
+		}
+		params += fuzz_field(cmd.fields[idx < cmd.num ? idx : cmd.num - 1]);
+	}
+	if (rand() % 20 == 0)
+	{
+		params += ":";
+	}
+	return params;
+}
+
+/**
+ * @brief Every setter against the reference parser
+ *
+ */
+static void test_fuzz_numbers(void)
+{
+	srand(43);
+	for (const ref_cmd_s &ref : ref_cmds)
+	{
+		atcmd_t *cmd = find_cmd(ref.name);
+		CHECK(cmd != NULL);
+		if (cmd == NULL)
+		{
+			continue;
+		}
+		uint32_t accepted = 0;
+		for (int run = 0; run < 20000; run++)
+		{
+			std::string params = fuzz_params(ref);
+			std::vector<char> buffer(params.begin(), params.end());
+			buffer.push_back(0);
+			ref_cmd_s fields = ref;
+			uint32_t values[5] = {0};
+			int expected = ref_parse(params, fields.fields, ref.num, values);
+			if ((expected == 0) && !ref_valid(ref.name, values))
+			{
+				expected = AT_ERRNO_PARA_VAL;
+			}
+			memset(&sim_calls, 0, sizeof(sim_calls));
+			int result = cmd->exec_cmd(buffer.data());
+			if (result != expected)
+			{
+				printf("AT%s=%s: %d, expected %d\n", ref.name, params.c_str(), result, expected);
+			}
+			CHECK_EQ(result, expected);
+			// The parameter string is not changed
+			CHECK(strcmp(buffer.data(), params.c_str()) == 0);
+			if (result == 0)
+			{
+				accepted++;
+				ref_check_stored(ref.name, values);
+			}
+		}
+		printf("AT%s: %ld of 20000 accepted\n", ref.name, (long)accepted);
+		CHECK(accepted > 100);
+	}
+}
+
+/**
+ * @brief The multicast session with hex keys
+ *
+ */
+static void test_fuzz_hex(void)
+{
+	srand(44);
+	atcmd_t *cmd = find_cmd("+MCAST");
+	CHECK(cmd != NULL);
+	static const char hex[] = "0123456789abcdefABCDEFgx: ";
+	uint32_t accepted = 0;
+	for (int run = 0; run < 20000; run++)
+	{
+		std::string params;
+		int lens[3] = {8, 32, 32};
+		int num = 3 + rand() % 3 - 1;
+		for (int idx = 0; idx < num; idx++)
+		{
+			if (idx != 0)
+			{
+				params += ":";
+			}
+			int len = lens[idx < 3 ? idx : 2] + (rand() % 4 == 0 ? rand() % 3 - 1 : 0);
+			for (int pos = 0; pos < len; pos++)
+			{
+				params += hex[rand() % (rand() % 50 == 0 ? 26 : 22)];
+			}
+		}
+		if (rand() % 100 == 0)
+		{
+			params = "0";
+		}
+
+		// Reference
+		int expected = 0;
+		uint8_t ref_addr[4] = {0};
+		std::vector<std::string> parts;
+		size_t start = 0;
+		for (;;)
+		{
+			size_t end = params.find(':', start);
+			parts.push_back(params.substr(start, end == std::string::npos ? std::string::npos : end - start));
+			if (end == std::string::npos)
+			{
+				break;
+			}
+			start = end + 1;
+		}
+		if (params != "0")
+		{
+			for (int idx = 0; (idx < 3) && (expected == 0); idx++)
+			{
+				if ((idx >= (int)parts.size()) || parts[idx].empty())
+				{
+					expected = AT_ERRNO_PARA_NUM;
+				}
+				else if ((parts[idx].size() != (size_t)lens[idx]) ||
+						 (parts[idx].find_first_not_of("0123456789abcdefABCDEF") != std::string::npos))
+				{
+					expected = AT_ERRNO_PARA_VAL;
+				}
+			}
+			if ((expected == 0) && (parts.size() > 3))
+			{
+				expected = AT_ERRNO_PARA_NUM;
+			}
+			if (expected == 0)
+			{
+				for (int idx = 0; idx < 4; idx++)
+				{
+					ref_addr[idx] = (uint8_t)strtoul(parts[0].substr(idx * 2, 2).c_str(), NULL, 16);
+				}
+				if ((ref_addr[0] | ref_addr[1] | ref_addr[2] | ref_addr[3]) == 0)
+				{
+					expected = AT_ERRNO_PARA_VAL;
+				}
+			}
+		}
+
+		std::vector<char> buffer(params.begin(), params.end());
+		buffer.push_back(0);
+		memset(&sim_calls, 0, sizeof(sim_calls));
+		int result = cmd->exec_cmd(buffer.data());
+		CHECK_EQ(result, expected);
+		CHECK(strcmp(buffer.data(), params.c_str()) == 0);
+		if ((result == 0) && (params != "0"))
+		{
+			accepted++;
+			uint32_t addr = ((uint32_t)ref_addr[0] << 24) | ((uint32_t)ref_addr[1] << 16) | ((uint32_t)ref_addr[2] << 8) | ref_addr[3];
+			CHECK_EQ(g_app_settings.mc_dev_addr, addr);
+			CHECK_EQ(g_app_settings.mc_app_skey[15], strtoul(parts[2].substr(30, 2).c_str(), NULL, 16));
+			CHECK_EQ(sim_calls.early_warning, 1);
+		}
+	}
+	printf("AT+MCAST: %ld of 20000 accepted\n", (long)accepted);
+	CHECK(accepted > 100);
+}
+
+/**
+ * @brief AT+RTC before the shared parser, nested strtok() calls
+ *
+ */
+static int at_set_rtc_old(char *str)
+{
+	uint16_t year;
+	uint8_t month;
+	uint8_t date;
+	uint8_t hour;
+	uint8_t minute;
+	char *param = strtok(str, ":");
+	if (param == NULL)
+	{
+		return AT_ERRNO_PARA_NUM;
+	}
+	year = strtoul(param, NULL, 0);
+	if (year > 3000)
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	param = strtok(NULL, ":");
+	if (param == NULL)
+	{
+		return AT_ERRNO_PARA_NUM;
+	}
+	month = strtoul(param, NULL, 0);
+	if ((month < 1) || (month > 12))
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	param = strtok(NULL, ":");
+	if (param == NULL)
+	{
+		return AT_ERRNO_PARA_NUM;
+	}
+	date = strtoul(param, NULL, 0);
+	if ((date < 1) || (date > 31))
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	param = strtok(NULL, ":");
+	if (param == NULL)
+	{
+		return AT_ERRNO_PARA_NUM;
+	}
+	hour = strtoul(param, NULL, 0);
+	if (hour > 24)
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	param = strtok(NULL, ":");
+	if (param == NULL)
+	{
+		return AT_ERRNO_PARA_NUM;
+	}
+	minute = strtoul(param, NULL, 0);
+	if (minute > 59)
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	set_rak12002(year, month, date, hour, minute);
+	return 0;
+}
+
+/**
+ * @brief Time per call in ns
+ *
+ */
+template <typename F>
+static double bench_ns(uint32_t runs, F call)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (uint32_t run = 0; run < runs; run++)
+	{
+		call();
+	}
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / runs;
+}
+
+/**
+ * @brief Parser of AT+RTC before and after, lookup in the command table
+ *        The times are printed only, the host build has the sanitizers enabled
+ *
+ */
+static void test_bench(void)
+{
+	const char *params = "2023:3:28:14:05";
+	char buffer[32];
+	atcmd_t *rtc = find_cmd("+RTC");
+	CHECK(rtc != NULL);
+
+	// Same result for a valid time
+	strcpy(buffer, params);
+	CHECK_EQ(at_set_rtc_old(buffer), 0);
+	uint32_t old_rtc[5];
+	memcpy(old_rtc, sim_calls.rtc, sizeof(old_rtc));
+	strcpy(buffer, params);
+	CHECK_EQ(rtc->exec_cmd(buffer), 0);
+	CHECK(memcmp(old_rtc, sim_calls.rtc, sizeof(old_rtc)) == 0);
+	// The old parser accepted a date that does not exist and hour 24
+	strcpy(buffer, "2023:2:30:24:00");
+	CHECK_EQ(at_set_rtc_old(buffer), 0);
+	strcpy(buffer, "2023:2:30:24:00");
+	CHECK_EQ(rtc->exec_cmd(buffer), AT_ERRNO_PARA_VAL);
+
+	uint32_t runs = 200000;
+	double old_ns = bench_ns(runs, [&]()
+							 { strcpy(buffer, params); at_set_rtc_old(buffer); });
+	double new_ns = bench_ns(runs, [&]()
+							 { strcpy(buffer, params); rtc->exec_cmd(buffer); });
+	double lookup_ns = bench_ns(runs, [&]()
+								{ find_cmd("+RTC"); });
+	printf("AT+RTC parameters: %.0f ns with strtok(), %.0f ns with the shared parser, table lookup %.0f ns for %d commands\n",
+		   old_ns, new_ns, lookup_ns, g_user_at_cmd_num);
+}
+
+/**
+ * @brief Load a settings file as an older firmware saved it
+ *
+ * @param data content of the file
+ */
+static void load_settings(const std::vector<uint8_t> &data)
+{
+	host_fs_file("APPSET") = data;
+	g_app_settings = app_settings_s();
+	g_app_settings.threshold = 0xFF;
+	read_app_settings();
+}
+
+/**
+ * @brief Check the values of the settings file of the slot detection version
+ *
+ */
+static void check_slot_version(void)
+{
+	CHECK_EQ(g_app_settings.threshold, 1);
+	CHECK_EQ(g_app_settings.payload_format, PAYLOAD_COMPACT);
+	CHECK_EQ(g_app_settings.telemetry_rate, 5);
+	CHECK_EQ(g_app_settings.capture_rate, 200);
+	CHECK_EQ(g_app_settings.vote_k, 2);
+	CHECK_EQ(g_app_settings.vote_window, 30);
+	CHECK_EQ(g_app_settings.d7s_slot[0], 3);
+	CHECK_EQ(g_app_settings.d7s_slot[1], 2);
+	CHECK_EQ(g_app_settings.d7s_slot[2], D7S_SLOT_UNKNOWN);
+	CHECK_EQ(g_app_settings.d7s_slot[3], D7S_SLOT_UNKNOWN);
+}
+
+/**
+ * @brief Settings saved by an older firmware keep their values after an update, the new fields get their defaults
+ *        New fields must be added at the end of app_settings_s
+ *
+ */
+static void test_settings_layout(void)
+{
+	// Saved by the slot detection version, mark, threshold, format, telemetry, capture rate, votes, window, slots
+	std::vector<uint8_t> slots = {APP_SETTINGS_MARK, 1, PAYLOAD_COMPACT, 5, 0xC8, 0x00, 2, 30, 3, 2, 0xFF, 0xFF};
+	// Saved by the shutoff output version
+	std::vector<uint8_t> shutoff = slots;
+	shutoff.push_back(SHUTOFF_PULSE);
+	shutoff.push_back(7);
+	// Saved by the P2P mesh version
+	std::vector<uint8_t> mesh = shutoff;
+	mesh.push_back(6);
+	// Saved by the early warning version, padding, multicast address little endian, NwkSKey, AppSKey
+	std::vector<uint8_t> warning = mesh;
+	warning.push_back(0);
+	const uint8_t addr[4] = {0x45, 0x23, 0xAB, 0x01};
+	warning.insert(warning.end(), addr, addr + 4);
+	for (uint8_t idx = 0; idx < 32; idx++)
+	{
+		warning.push_back(0xA0 + idx);
+	}
+
+	load_settings(slots);
+	check_slot_version();
+	CHECK_EQ(g_app_settings.shutoff_mode, SHUTOFF_OFF);
+	CHECK_EQ(g_app_settings.shutoff_time, 0);
+	CHECK_EQ(g_app_settings.mesh_ttl, MESH_TTL_DEFAULT);
+
+	load_settings(shutoff);
+	check_slot_version();
+	CHECK_EQ(g_app_settings.shutoff_mode, SHUTOFF_PULSE);
+	CHECK_EQ(g_app_settings.shutoff_time, 7);
+	CHECK_EQ(g_app_settings.mesh_ttl, MESH_TTL_DEFAULT);
+
+	// A TTL of 0 switches the flooding off, it must not be taken for a missing field
+	mesh[mesh.size() - 1] = 0;
+	load_settings(mesh);
+	CHECK_EQ(g_app_settings.mesh_ttl, 0);
+	mesh[mesh.size() - 1] = 6;
+	load_settings(mesh);
+	check_slot_version();
+	CHECK_EQ(g_app_settings.shutoff_mode, SHUTOFF_PULSE);
+	CHECK_EQ(g_app_settings.shutoff_time, 7);
+	CHECK_EQ(g_app_settings.mesh_ttl, 6);
+	CHECK_EQ(g_app_settings.mc_dev_addr, 0);
+	CHECK_EQ(g_app_settings.mc_nwk_skey[0], 0);
+	CHECK_EQ(g_app_settings.mc_app_skey[15], 0);
+
+	load_settings(warning);
+	check_slot_version();
+	CHECK_EQ(g_app_settings.shutoff_mode, SHUTOFF_PULSE);
+	CHECK_EQ(g_app_settings.mesh_ttl, 6);
+	CHECK_EQ(g_app_settings.mc_dev_addr, 0x01AB2345UL);
+	CHECK_EQ(g_app_settings.mc_nwk_skey[0], 0xA0);
+	CHECK_EQ(g_app_settings.mc_nwk_skey[15], 0xAF);
+	CHECK_EQ(g_app_settings.mc_app_skey[0], 0xB0);
+	CHECK_EQ(g_app_settings.mc_app_skey[15], 0xBF);
+
+	// Saved again, the part an older firmware reads is unchanged
+	save_app_settings();
+	std::vector<uint8_t> &file = host_fs_file("APPSET");
+	CHECK_EQ(file.size(), sizeof(app_settings_s));
+	CHECK_EQ(warning.size(), sizeof(app_settings_s));
+	CHECK(std::equal(warning.begin(), warning.end(), file.begin()));
+}
+
+int main(void)
+{
+	host_fs_format();
+	init_user_at();
+	RUN(test_fuzz_numbers);
+	RUN(test_fuzz_hex);
+	RUN(test_bench);
+	RUN(test_settings_layout);
+	return TEST_RESULT();
+}
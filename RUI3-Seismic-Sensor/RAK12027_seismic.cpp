@@ -15,7 +15,8 @@
 
 RAK_D7S D7S;
 
-#define RAK12027_SLOT 'D'
+/** Slot used until the slot of the D7S is detected, 3 = Slot D */
+#define RAK12027_DEFAULT_SLOT 3
 
 //******************************************************************//
 // RAK12027 INT1_PIN
@@ -38,38 +39,28 @@ RAK_D7S D7S;
 // Slot F      WB_IO5
 //******************************************************************//
 
-/** Interrupt pin, depends on slot */
-// Slot A
-#if RAK12027_SLOT == 'A'
-#pragma message "Slot A"
-#define INT1_PIN WB_IO1
-#define INT2_PIN WB_IO2
-// Slot B
-#elif RAK12027_SLOT == 'B'
-#pragma message "Slot B"
-#define INT1_PIN WB_IO2
-#define INT2_PIN WB_IO1
-// Slot C
-#elif RAK12027_SLOT == 'C'
-#pragma message "Slot C"
-#define INT1_PIN WB_IO3
-#define INT2_PIN WB_IO4
-// Slot D
-#elif RAK12027_SLOT == 'D'
-#pragma message "Slot D"
-#define INT1_PIN WB_IO5
-#define INT2_PIN WB_IO6
-// Slot E
-#elif RAK12027_SLOT == 'E'
-#pragma message "Slot E"
-#define INT1_PIN WB_IO4
-#define INT2_PIN WB_IO3
-// Slot F
-#elif RAK12027_SLOT == 'F'
-#pragma message "Slot F"
-#define INT1_PIN WB_IO6
-#define INT2_PIN WB_IO5
-#endif
+/** INT1 and INT2 pin per slot, index is the slot number */
+static constexpr uint8_t slot_pins[D7S_SLOTS][2] = {
+	{WB_IO1, WB_IO2}, // Slot A
+	{WB_IO2, WB_IO1}, // Slot B
+	{WB_IO3, WB_IO4}, // Slot C
+	{WB_IO5, WB_IO6}, // Slot D
+	{WB_IO4, WB_IO3}, // Slot E
+	{WB_IO6, WB_IO5}, // Slot F
+};
+
+/** Slot of the D7S, detected during the calibration at startup and saved in flash */
+uint8_t g_d7s_slot = D7S_SLOT_UNKNOWN;
+
+/** Interrupt pins of the D7S */
+static uint8_t int1_pin = slot_pins[RAK12027_DEFAULT_SLOT][0];
+static uint8_t int2_pin = slot_pins[RAK12027_DEFAULT_SLOT][1];
+
+/** Slots whose INT2 pin was high before the calibration, 0 if no detection is running */
+static uint8_t probe_candidates = 0;
+
+/** Candidate slots whose INT2 pin went low during the calibration */
+static uint8_t probe_low = 0;
 
 // flag variables to handle collapse/shutoff only one time during an earthquake
 bool shutoff_alert = false;
@@ -122,6 +113,7 @@ void report_status(void)
 void d7s_int1_handler(void)
 {
 	MYLOG("SEIS", "INT1");
+	perf_irq(1);
 	g_task_event_type = SEISMIC_ALERT;
 	// api.system.timer.start(RAK_TIMER_1, 500, NULL);
 	int_1_triggered = true;
@@ -139,7 +131,8 @@ void d7s_int1_handler(void)
 void d7s_int2_handler(void)
 {
 	MYLOG("SEIS", "INT2");
-	if (digitalRead(INT2_PIN) == LOW)
+	perf_irq(2);
+	if (digitalRead(int2_pin) == LOW)
 	{
 		digitalWrite(LED_BLUE, HIGH);
 		earthquake_start = true;
@@ -187,6 +180,85 @@ void check_alarm(void *)
 	}
 }
 
+/**
+ * @brief Set the slot of the D7S and its interrupt pins
+ *
+ * @param slot slot number, 0 = Slot A ... 5 = Slot F
+ */
+static void set_slot_rak12027(uint8_t slot)
+{
+	int1_pin = slot_pins[slot][0];
+	int2_pin = slot_pins[slot][1];
+}
+
+/**
+ * @brief Start the slot detection, the INT2 line of the D7S is low while the calibration runs
+ * WB_IO2 switches the sensor power and is not checked, a D7S in Slot A is not detected
+ *
+ */
+static void probe_start_rak12027(void)
+{
+	probe_candidates = 0;
+	probe_low = 0;
+	for (uint8_t slot = 0; slot < D7S_SLOTS; slot++)
+	{
+		if (slot_pins[slot][1] == WB_IO2)
+		{
+			continue;
+		}
+		pinMode(slot_pins[slot][1], INPUT_PULLUP);
+		if (digitalRead(slot_pins[slot][1]) == HIGH)
+		{
+			probe_candidates |= 1 << slot;
+		}
+	}
+}
+
+/**
+ * @brief Check the candidate pins while the calibration runs
+ *
+ */
+static void probe_sample_rak12027(void)
+{
+	for (uint8_t slot = 0; slot < D7S_SLOTS; slot++)
+	{
+		if ((probe_candidates & (1 << slot)) && (digitalRead(slot_pins[slot][1]) == LOW))
+		{
+			probe_low |= 1 << slot;
+		}
+	}
+}
+
+/**
+ * @brief Finish the slot detection
+ * If exactly one candidate pin went low, its slot is used and saved in flash
+ *
+ */
+static void probe_end_rak12027(void)
+{
+	uint8_t found = probe_low;
+	probe_candidates = 0;
+	probe_low = 0;
+	// Exactly one slot must have seen the calibration
+	if ((found == 0) || ((found & (found - 1)) != 0))
+	{
+		MYLOG("SEIS", "Slot not detected, using Slot %c", 'A' + (g_d7s_slot < D7S_SLOTS ? g_d7s_slot : RAK12027_DEFAULT_SLOT));
+		return;
+	}
+	uint8_t slot = 0;
+	while ((found & (1 << slot)) == 0)
+	{
+		slot++;
+	}
+	MYLOG("SEIS", "D7S detected in Slot %c", 'A' + slot);
+	set_slot_rak12027(slot);
+	if (g_d7s_slot != slot)
+	{
+		g_d7s_slot = slot;
+		save_at_setting(SLOT_OFFSET);
+	}
+}
+
 /**
  * @brief Initialize Omron D7S seismic sensor
  *
@@ -217,10 +289,16 @@ bool init_rak12027(void)
 	MYLOG("SEIS", "Setting D7S sensor to switch axis at inizialization time.");
 	D7S.setAxis(SWITCH_AT_INSTALLATION);
 
+	// Use the saved slot until the calibration found the slot
+	set_slot_rak12027(g_d7s_slot < D7S_SLOTS ? g_d7s_slot : RAK12027_DEFAULT_SLOT);
+
 	/*********************************************************************/
 	/** Calling calibration, this should be done from AT command instead */
 	/*********************************************************************/
-	if (!calib_rak12027())
+	probe_start_rak12027();
+	bool calibrated = calib_rak12027();
+	probe_end_rak12027();
+	if (!calibrated)
 	{
 		MYLOG("SEIS", "Calibration failed with timeout");
 		return false;
@@ -241,10 +319,10 @@ bool init_rak12027(void)
 
 	// //--- INTERRUPT SETTINGS ---
 	// // registering event handler
-	// pinMode(INT1_PIN, INPUT_PULLUP);
-	// pinMode(INT2_PIN, INPUT_PULLUP);
-	// attachInterrupt(INT1_PIN, d7s_int1_handler, FALLING); // Shutoff or Collapse interrupt
-	// attachInterrupt(INT2_PIN, d7s_int2_handler, CHANGE);  // Earthquake start/end interrupt
+	// pinMode(int1_pin, INPUT_PULLUP);
+	// pinMode(int2_pin, INPUT_PULLUP);
+	// attachInterrupt(int1_pin, d7s_int1_handler, FALLING); // Shutoff or Collapse interrupt
+	// attachInterrupt(int2_pin, d7s_int2_handler, CHANGE);  // Earthquake start/end interrupt
 
 	// Create a timer for earthquake alarm handling
 	api.system.timer.create(RAK_TIMER_2, sensor_handler, RAK_TIMER_ONESHOT);
@@ -258,10 +336,10 @@ void enable_int_rak12027(void)
 	D7S.resetEvents();
 	//--- INTERRUPT SETTINGS ---
 	// registering event handler
-	pinMode(INT1_PIN, INPUT_PULLUP);
-	pinMode(INT2_PIN, INPUT_PULLUP);
-	attachInterrupt(INT1_PIN, d7s_int1_handler, FALLING); // Shutoff or Collapse interrupt
-	attachInterrupt(INT2_PIN, d7s_int2_handler, CHANGE);  // Earthquake start/end interrupt
+	pinMode(int1_pin, INPUT_PULLUP);
+	pinMode(int2_pin, INPUT_PULLUP);
+	attachInterrupt(int1_pin, d7s_int1_handler, FALLING); // Shutoff or Collapse interrupt
+	attachInterrupt(int2_pin, d7s_int2_handler, CHANGE);  // Earthquake start/end interrupt
 }
 
 /**
@@ -287,6 +365,11 @@ bool calib_rak12027(void)
 	time_t start_wait_time = millis();
 	while (!D7S.isReady())
 	{
+		if (probe_candidates != 0)
+		{
+			// INT2 is low while the D7S is busy
+			probe_sample_rak12027();
+		}
 		if ((millis() - start_wait_time) > 5000)
 		{
 			MYLOG("SEIS", "Timeout waiting initialization of D7S");
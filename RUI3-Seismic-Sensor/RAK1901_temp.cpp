@@ -22,8 +22,11 @@ SHTC3 shtc3;
  */
 bool init_rak1901(void)
 {
-	Wire.setClock(100000); // Wire.setClock(400000);
-	if (shtc3.begin(Wire) != SHTC3_Status_Nominal)
+	// SHTC3 runs with 100kHz, the D7S keeps the bus at 400kHz
+	Wire.setClock(100000);
+	bool result = shtc3.begin(Wire) == SHTC3_Status_Nominal;
+	Wire.setClock(400000);
+	if (!result)
 	{
 		MYLOG("T_H", "Could not initialize SHTC3");
 		return false;
@@ -40,7 +43,9 @@ bool init_rak1901(void)
 void read_rak1901(void)
 {
 	MYLOG("T_H", "Reading SHTC3");
+	Wire.setClock(100000);
 	shtc3.update();
+	Wire.setClock(400000);
 
 	if (shtc3.lastStatus == SHTC3_Status_Nominal)
 	{
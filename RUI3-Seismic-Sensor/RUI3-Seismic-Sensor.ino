@@ -65,16 +65,20 @@ void receiveCallback(SERVICE_LORA_RECEIVE_T *data)
  */
 void sendCallback(int32_t status)
 {
+	perf_tx_done(status == 0);
 	if (status != 0)
 	{
 		// Reend the packet
+		perf_retry();
 		if (api.lorawan.send(g_solution_data.getSize(), g_solution_data.getBuffer(), g_fport, confirmed_msg_enabled, g_repeat_send))
 		{
 			MYLOG("APP", "Enqueued");
+			perf_uplink(true);
 		}
 		else
 		{
 			MYLOG("APP", "Send fail");
+			perf_uplink(false);
 		}
 		fail_counter++;
 		if (fail_counter == 4)
@@ -97,6 +101,7 @@ void joinCallback(int32_t status)
 {
 	if (status != 0)
 	{
+		perf_join_fail();
 		if (!(ret = api.lorawan.join()))
 		{
 			MYLOG("J-CB", "Fail! \r\n");
@@ -131,6 +136,9 @@ void joinCallback(int32_t status)
  */
 void setup()
 {
+	// Check the retained counters and count this start
+	init_perf();
+
 	// Setup the callbacks for joined and send finished
 	api.lorawan.registerRecvCallback(receiveCallback);
 	api.lorawan.registerSendCallback(sendCallback);
@@ -177,6 +185,7 @@ void setup()
 	init_custom_at();
 	get_at_setting(SEND_FREQ_OFFSET);
 	get_at_setting(SENSITIVITY_OFFSET);
+	get_at_setting(SLOT_OFFSET);
 
 	// Initialize Seismic module
 	MYLOG("SET", "Initialize RAK12027");
@@ -218,6 +227,8 @@ void setup()
 void sensor_handler(void *)
 {
 	bool no_earthquake_event = true;
+	uint32_t perf_start = millis();
+	perf_wakeup(earthquake_start);
 
 	// Reset the packet
 	g_solution_data.reset();
@@ -276,6 +287,7 @@ void sensor_handler(void *)
 				earthquake_end = true;
 				MYLOG("APP", "Earthquake false event!");
 				earthquake_start = false;
+				perf_handler_done(perf_start);
 				return;
 				break;
 			}
@@ -322,6 +334,7 @@ void sensor_handler(void *)
 		{
 			digitalWrite(LED_GREEN, !digitalRead(LED_GREEN));
 			// api.system.timer.start(RAK_TIMER_1, 500, NULL);
+			perf_handler_done(perf_start);
 			return;
 		}
 		// api.system.timer.stop(RAK_TIMER_1);
@@ -363,11 +376,14 @@ void sensor_handler(void *)
 	if (api.lorawan.send(g_solution_data.getSize(), g_solution_data.getBuffer(), g_fport, confirmed_msg_enabled, g_repeat_send))
 	{
 		MYLOG("APP", "Enqueued");
+		perf_uplink(true);
 	}
 	else
 	{
 		MYLOG("APP", "Send fail");
+		perf_uplink(false);
 	}
+	perf_handler_done(perf_start);
 }
 
 /**
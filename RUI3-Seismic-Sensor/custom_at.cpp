@@ -14,23 +14,72 @@
 int freq_send_handler(SERIAL_PORT port, char *cmd, stParam *param);
 int status_handler(SERIAL_PORT port, char *cmd, stParam *param);
 int sensitivity_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int perf_handler(SERIAL_PORT port, char *cmd, stParam *param);
+
+/** Custom AT command entry */
+struct custom_at_s
+{
+	const char *cmd;
+	const char *usage;
+	const char *title;
+	int (*handler)(SERIAL_PORT port, char *cmd, stParam *param);
+};
+
+/** All custom AT commands, fixed at compile time */
+static const custom_at_s custom_at_list[] = {
+	{"SENDFREQ", "Set/Get the frequent sending time in seconds 0 = off, max 2,147,483 seconds", "SENDFREQ", freq_send_handler},
+	{"SENS", "Set the D7S sensitivity 1 = low sensitivity, 0 = high sensitivity", "SENS", sensitivity_handler},
+	{"STATUS", "Get device information", "STATUS", status_handler},
+	{"PERF", "Get the performance counters, kept over resets, 0 to reset", "PERF", perf_handler},
+};
+
 /**
- * @brief Add send-frequency AT command
+ * @brief Add the custom AT commands
  *
  * @return true if success
  * @return false if failed
  */
 bool init_custom_at(void)
 {
-	api.system.atMode.add((char *)"SENDFREQ",
-						  (char *)"Set/Get the frequent sending time in seconds 0 = off, max 2,147,483 seconds",
-						  (char *)"SENDFREQ", freq_send_handler);
-	api.system.atMode.add((char *)"SENS",
-						  (char *)"Set the D7S sensitivity 1 = low sensitivity, 0 = high sensitivity",
-						  (char *)"SENDFREQ", sensitivity_handler);
-	return api.system.atMode.add((char *)"STATUS",
-								 (char *)"Get device information",
-								 (char *)"STATUS", status_handler);
+	bool result = true;
+	for (uint8_t idx = 0; idx < sizeof(custom_at_list) / sizeof(custom_at_s); idx++)
+	{
+		result &= api.system.atMode.add((char *)custom_at_list[idx].cmd, (char *)custom_at_list[idx].usage,
+										(char *)custom_at_list[idx].title, custom_at_list[idx].handler);
+	}
+	return result;
+}
+
+/**
+ * @brief Parse an unsigned decimal AT command parameter, the string is not changed
+ *
+ * @param str parameter
+ * @param max highest valid value
+ * @param value parsed value
+ * @return true if the parameter is a valid number
+ */
+static bool parse_uint_param(const char *str, uint32_t max, uint32_t *value)
+{
+	uint32_t result = 0;
+	if (*str == 0)
+	{
+		return false;
+	}
+	for (; *str != 0; str++)
+	{
+		if ((*str < '0') || (*str > '9'))
+		{
+			return false;
+		}
+		uint32_t digit = *str - '0';
+		if ((digit > max) || (result > (max - digit) / 10))
+		{
+			return false;
+		}
+		result = result * 10 + digit;
+	}
+	*value = result;
+	return true;
 }
 
 /**
@@ -52,18 +101,13 @@ int freq_send_handler(SERIAL_PORT port, char *cmd, stParam *param)
 	}
 	else if (param->argc == 1)
 	{
-		// MYLOG("AT_CMD", "param->argv[0] >> %s", param->argv[0]);
-		for (int i = 0; i < strlen(param->argv[0]); i++)
+		// Limit so the time in ms fits into 32 bit
+		uint32_t new_send_freq;
+		if (!parse_uint_param(param->argv[0], 0xFFFFFFFF / 1000, &new_send_freq))
 		{
-			if (!isdigit(*(param->argv[0] + i)))
-			{
-				MYLOG("AT_CMD", "%d is no digit", i);
-				return AT_PARAM_ERROR;
-			}
+			return AT_PARAM_ERROR;
 		}
 
-		uint32_t new_send_freq = strtoul(param->argv[0], NULL, 10);
-
 		// MYLOG("AT_CMD", "Requested frequency %ld", new_send_freq);
 
 		g_send_repeat_time = new_send_freq * 1000;
@@ -171,6 +215,22 @@ bool get_at_setting(uint32_t setting_type)
 		MYLOG("AT_CMD", "Found treshold value %d", flash_value[0]);
 		return true;
 		break;
+	case SLOT_OFFSET:
+		if (!api.system.flash.get(SLOT_OFFSET, flash_value, 2))
+		{
+			MYLOG("AT_CMD", "Failed to read slot from Flash");
+			return false;
+		}
+		if ((flash_value[1] != 0xAA) || (flash_value[0] >= D7S_SLOTS))
+		{
+			// Not detected yet
+			g_d7s_slot = D7S_SLOT_UNKNOWN;
+			return false;
+		}
+		g_d7s_slot = flash_value[0];
+		MYLOG("AT_CMD", "Found D7S slot %c", 'A' + flash_value[0]);
+		return true;
+		break;
 	default:
 		return false;
 	}
@@ -233,6 +293,13 @@ bool save_at_setting(uint32_t setting_type)
 		}
 		return wr_result;
 		break;
+	case SLOT_OFFSET:
+		flash_value[0] = g_d7s_slot;
+		flash_value[1] = 0xAA;
+		wr_result = api.system.flash.set(SLOT_OFFSET, flash_value, 2);
+		MYLOG("AT_CMD", "Writing %s", wr_result ? "Success" : "Fail");
+		return wr_result;
+		break;
 	default:
 		return false;
 		break;
@@ -353,21 +420,8 @@ int sensitivity_handler(SERIAL_PORT port, char *cmd, stParam *param)
 	}
 	else if (param->argc == 1)
 	{
-		if (!strcmp(param->argv[0], "0") && !strcmp(param->argv[0], "1"))
-		{
-			return AT_PARAM_ERROR;
-		}
-
-		uint8_t new_threshold = 0;
-		if (strcmp(param->argv[0], "0"))
-		{
-			new_threshold = 0;
-		}
-		else
-		{
-			new_threshold = 1;
-		}
-		if (new_threshold > 1)
+		uint32_t new_threshold;
+		if (!parse_uint_param(param->argv[0], 1, &new_threshold))
 		{
 			return AT_PARAM_ERROR;
 		}
@@ -387,3 +441,35 @@ int sensitivity_handler(SERIAL_PORT port, char *cmd, stParam *param)
 
 	return AT_OK;
 }
+
+/**
+ * @brief Handler for the performance counter AT commands
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int perf_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if (param->argc == 1 && !strcmp(param->argv[0], "?"))
+	{
+		perf_print(cmd);
+	}
+	else if (param->argc == 1)
+	{
+		uint32_t reset;
+		if (!parse_uint_param(param->argv[0], 0, &reset))
+		{
+			return AT_PARAM_ERROR;
+		}
+		perf_reset();
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+	return AT_OK;
+}
@@ -119,6 +119,21 @@ extern uint8_t g_threshold;
 extern float savedSI;
 extern float savedPGA;
 extern bool int_1_triggered;
+#define D7S_SLOTS 6
+#define D7S_SLOT_UNKNOWN 0xFF
+extern uint8_t g_d7s_slot;
+
+/** Performance counter stuff */
+void init_perf(void);
+void perf_reset(void);
+void perf_irq(uint8_t line);
+void perf_wakeup(bool seismic);
+void perf_uplink(bool queued);
+void perf_tx_done(bool success);
+void perf_retry(void);
+void perf_join_fail(void);
+void perf_handler_done(uint32_t start_ms);
+void perf_print(char *cmd);
 
 // Custom AT commands
 bool get_at_setting(uint32_t setting_type);
@@ -129,3 +144,4 @@ bool init_custom_at(void);
 // #define GNSS_OFFSET 0L		// length 1 byte
 #define SEND_FREQ_OFFSET 2L	  // length 4 bytes
 #define SENSITIVITY_OFFSET 8L // length 1 byte
+#define SLOT_OFFSET 10L		  // length 1 byte
@@ -0,0 +1,169 @@
+/**
+ * @file perf_counters.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Runtime counters to check a deployed device without a debug build
+ *        The counters are in RAM that is not cleared at a reset, a power on clears them.
+ *        All counters stop at their maximum instead of wrapping around.
+ *        Each counter is changed from one context only, either an interrupt or the RUI3 callbacks.
+ *        Read with ATC+PERF=?, reset with ATC+PERF=0
+ * @version 0.1
+ * @date 2023-03-24
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "main.h"
+
+/** Marks a valid counter block, "PERF" */
+#define PERF_MAGIC 0x50455246
+
+/** Counter block */
+struct perf_counters_s
+{
+	uint32_t magic;
+	uint32_t size;
+	uint32_t boots;			  // Resets and power ons since the last clear
+	uint32_t wakeups_timer;	  // sensor_handler calls without earthquake
+	uint32_t wakeups_seismic; // sensor_handler calls during an earthquake
+	uint32_t d7s_irq[2];	  // INT1 and INT2
+	uint32_t uplinks_queued;  // Accepted by api.lorawan.send()
+	uint32_t uplinks_failed;  // Rejected by api.lorawan.send()
+	uint32_t tx_ok;			  // TX finished successfully
+	uint32_t tx_fail;		  // TX failed, e.g. no ACK for a confirmed packet
+	uint32_t retries;		  // Packets sent again after a failed TX
+	uint32_t join_fails;	  // Failed join attempts
+	uint32_t awake_ms;		  // Time spent in sensor_handler
+	uint32_t handler_max_ms;  // Longest run of sensor_handler
+};
+
+/** Counter block, not cleared by the startup code */
+static perf_counters_s perf __attribute__((section(".noinit")));
+
+/**
+ * @brief Increment a counter, stops at the maximum
+ *
+ * @param counter counter to change
+ */
+static inline void perf_inc(volatile uint32_t *counter)
+{
+	if (*counter != 0xFFFFFFFF)
+	{
+		*counter = *counter + 1;
+	}
+}
+
+/**
+ * @brief Check the counter block and count the start
+ *        The content is random after a power on, the magic detects that
+ *
+ */
+void init_perf(void)
+{
+	if ((perf.magic != PERF_MAGIC) || (perf.size != sizeof(perf_counters_s)))
+	{
+		perf_reset();
+	}
+	perf_inc(&perf.boots);
+}
+
+/**
+ * @brief Clear all counters
+ *
+ */
+void perf_reset(void)
+{
+	memset(&perf, 0, sizeof(perf_counters_s));
+	perf.magic = PERF_MAGIC;
+	perf.size = sizeof(perf_counters_s);
+}
+
+/**
+ * @brief Count a D7S interrupt
+ *
+ * @param line 1 for INT1, 2 for INT2
+ */
+void perf_irq(uint8_t line)
+{
+	perf_inc(&perf.d7s_irq[line - 1]);
+}
+
+/**
+ * @brief Count a call of sensor_handler
+ *
+ * @param seismic true if called during an earthquake
+ */
+void perf_wakeup(bool seismic)
+{
+	perf_inc(seismic ? &perf.wakeups_seismic : &perf.wakeups_timer);
+}
+
+/**
+ * @brief Count an uplink by the result of api.lorawan.send()
+ *
+ * @param queued result of api.lorawan.send()
+ */
+void perf_uplink(bool queued)
+{
+	perf_inc(queued ? &perf.uplinks_queued : &perf.uplinks_failed);
+}
+
+/**
+ * @brief Count a finished TX
+ *
+ * @param success true if the TX finished successfully
+ */
+void perf_tx_done(bool success)
+{
+	perf_inc(success ? &perf.tx_ok : &perf.tx_fail);
+}
+
+/**
+ * @brief Count a packet that is sent again
+ *
+ */
+void perf_retry(void)
+{
+	perf_inc(&perf.retries);
+}
+
+/**
+ * @brief Count a failed join attempt
+ *
+ */
+void perf_join_fail(void)
+{
+	perf_inc(&perf.join_fails);
+}
+
+/**
+ * @brief Add the run time of sensor_handler
+ *
+ * @param start_ms millis() when the handler started
+ */
+void perf_handler_done(uint32_t start_ms)
+{
+	uint32_t elapsed = millis() - start_ms;
+	perf.awake_ms = (perf.awake_ms > 0xFFFFFFFF - elapsed) ? 0xFFFFFFFF : perf.awake_ms + elapsed;
+	if (elapsed > perf.handler_max_ms)
+	{
+		perf.handler_max_ms = elapsed;
+	}
+}
+
+/**
+ * @brief Print all counters
+ *
+ * @param cmd AT command, printed in front of each line
+ */
+void perf_print(char *cmd)
+{
+	Serial.printf("%s=UPTIME:%ld\r\n", cmd, millis() / 1000);
+	Serial.printf("%s=BOOTS:%ld\r\n", cmd, perf.boots);
+	Serial.printf("%s=WAKE:%ld:%ld\r\n", cmd, perf.wakeups_timer, perf.wakeups_seismic);
+	Serial.printf("%s=IRQ:%ld:%ld\r\n", cmd, perf.d7s_irq[0], perf.d7s_irq[1]);
+	Serial.printf("%s=UP:%ld:%ld\r\n", cmd, perf.uplinks_queued, perf.uplinks_failed);
+	Serial.printf("%s=TX:%ld:%ld\r\n", cmd, perf.tx_ok, perf.tx_fail);
+	Serial.printf("%s=RETRY:%ld\r\n", cmd, perf.retries);
+	Serial.printf("%s=JOIN_FAIL:%ld\r\n", cmd, perf.join_fails);
+	Serial.printf("%s=AWAKE:%ld:%ld\r\n", cmd, perf.awake_ms, perf.handler_max_ms);
+}
@@ -0,0 +1,352 @@
+#!/usr/bin/env python3
+"""
+Energy model and battery life estimation for the WisBlock Seismic Sensor
+
+Replays one or more days of heartbeats, earthquakes, time sync requests and
+PM sensor cycles and integrates the charge used in each state.
+
+This is an approximation. The event flow is a hand-written copy of the steps
+of app_event_handler, not the compiled firmware, and these code paths are not
+tracked:
+  - Battery profiles (battery_profile.cpp): heartbeat interval, BLE
+    advertising, payload and capture rate stay at the values given on the
+    command line, they do not change with the state of charge.
+  - Pipelined sampling (start_samples/collect_samples): the SHTC3 conversion
+    and the battery sample are fixed times per heartbeat, their overlap with
+    the TX is not replayed.
+  - Scheduler coalescing (scheduler.cpp): every job is a wakeup of its own.
+    The heartbeat sharing the wakeup of the last PM sample, the RTC resync,
+    dump pages and the tolerances of the jobs are not modeled, the wakeup
+    count is an upper bound. test_scheduler in test/host counts the wakeups
+    of the real scheduler.
+A sweep over heartbeat interval, datarate, payload format and capture rate
+runs on all CPU cores and prints a battery life table.
+
+Usage:
+    python3 energy_model.py
+    python3 energy_model.py --heartbeat 900 3600 --dr 0 3 5 --capture 0 500
+    python3 energy_model.py --currents my_board.json --csv results.csv
+
+The currents are typical values for a RAK4631 with RAK12027 and RAK1901.
+Measure your own setup and pass them with --currents, a JSON file with
+the keys of DEFAULT_CURRENTS.
+"""
+
+import argparse
+import csv
+import heapq
+import itertools
+import json
+import math
+import multiprocessing
+import random
+import sys
+
+# Current draw per state in mA
+DEFAULT_CURRENTS = {
+    "sleep": 0.0025,  # nRF52840 System ON sleep with RTC running
+    "d7s_standby": 0.09,  # D7S waiting for an earthquake
+    "d7s_active": 0.3,  # D7S analysing an earthquake
+    "mcu_active": 3.0,  # nRF52840 running from the loop
+    "i2c": 3.5,  # MCU active plus I2C pull-ups
+    "tx": 118.0,  # SX1262 TX at 22 dBm
+    "rx": 5.3,  # SX1262 RX
+    "ble_adv": 0.6,  # Average while advertising, 100 ms interval
+    "shtc3": 0.43,  # SHTC3 during a conversion
+    "pm_fan": 55.0,  # PMSA003I fan running
+    "pm_standby": 0.2,  # PMSA003I with SET low
+}
+
+# Durations of the firmware steps in ms
+MCU_WAKE_MS = 5  # Event handler without I2C
+I2C_READ_MS = 1  # One register read over DMA
+SHTC3_CONV_MS = 13  # SHTC3 conversion, runs while the radio is busy
+RX_WINDOW_SYMBOLS = 8  # Symbols until the radio decides there is no preamble
+RX_MARGIN_MS = 10  # Wakeup margin of the RX windows
+BLE_ADV_MS = 15000  # restart_advertising(15) after each heartbeat
+LORAWAN_OVERHEAD = 13  # MHDR + FHDR + FPort + MIC
+FOLLOW_UP_MS = 60000  # Second packet after the end of an earthquake
+TIME_SYNC_INTERVAL_MS = 24 * 3600 * 1000
+PM_WARMUP_MS = 30000
+PM_SAMPLE_INTERVAL_MS = 2500
+PM_SAMPLE_NUM = 8
+PM_SAMPLE_MARGIN_MS = 5000
+
+# Payload sizes in bytes, see the data packet format in the README
+PAYLOAD_EQ_STATUS = 3  # Presence
+PAYLOAD_BATT = 4
+PAYLOAD_RAK1901 = 3 + 4
+PAYLOAD_PM = 3 * 4
+PAYLOAD_EQ_END = 3 + 3 + 3 + 4 + 4 + 6 + 4 + 4  # Event, shutoff, collapse, SI, PGA, time, ms, accuracy
+
+
+def lora_airtime(sf, bw_khz, cr, preamble, length):
+    """Time on air in ms, same calculation as lora_airtime() in time_sync.cpp"""
+    symbol_us = (1 << sf) * 1000 // bw_khz
+    bits_per_symbol = 4 * (sf - (2 if symbol_us >= 16000 else 0))
+    payload_bits = 8 * length - 4 * sf + 28 + 16
+    payload_symbols = 8
+    if payload_bits > 0:
+        payload_symbols += ((payload_bits + bits_per_symbol - 1) // bits_per_symbol) * (cr + 4)
+    return ((preamble * 4 + 17) * symbol_us / 4 + payload_symbols * symbol_us) / 1000
+
+
+def datarate_to_sf(region, dr):
+    """Spreading factor and bandwidth of a datarate, same mapping as uplink_airtime()"""
+    if region == "US915":
+        if dr >= 4:
+            return 8, 500
+        return 10 - dr, 125
+    if dr == 6:
+        return 7, 250
+    return 12 - dr, 125
+
+
+class Simulation:
+    """Replays the event handler of the firmware and sums the charge per state"""
+
+    def __init__(self, config, currents):
+        self.cfg = config
+        self.cur = currents
+        self.charge = {}  # mAs per state
+        self.queue = []
+        self.seq = 0
+        self.wakes = 0
+        self.uplinks = 0
+        self.quake_active = False
+        self.rng = random.Random(config["seed"])
+
+    def use(self, state, ms):
+        """Add the charge of a state that lasted ms"""
+        self.charge[state] = self.charge.get(state, 0.0) + self.cur[state] * ms / 1000.0
+
+    def schedule(self, time_ms, event):
+        heapq.heappush(self.queue, (time_ms, self.seq, event))
+        self.seq += 1
+
+    def uplink(self, payload_len):
+        """send_lora_packet() plus the RX windows of a class A device"""
+        sf, bw = datarate_to_sf(self.cfg["region"], self.cfg["dr"])
+        self.use("tx", lora_airtime(sf, bw, 1, 8, payload_len + LORAWAN_OVERHEAD))
+        # RX2 uses DR0, on US915 DR8 (SF12 500 kHz)
+        rx2 = (12, 500) if self.cfg["region"] == "US915" else datarate_to_sf(self.cfg["region"], 0)
+        for rx_sf, rx_bw in ((sf, bw), rx2):
+            symbol_ms = (1 << rx_sf) / rx_bw
+            self.use("rx", RX_WINDOW_SYMBOLS * symbol_ms + RX_MARGIN_MS)
+        # Wakeups for RX1, RX2 and LORA_TX_FIN
+        self.use("mcu_active", 3 * MCU_WAKE_MS)
+        self.wakes += 3
+        self.uplinks += 1
+
+    def heartbeat_payload(self):
+        size = PAYLOAD_EQ_STATUS + PAYLOAD_BATT
+        if self.cfg["payload"] == "full":
+            if self.cfg["rak1901"]:
+                size += PAYLOAD_RAK1901
+            if self.cfg["rak12039"]:
+                size += PAYLOAD_PM
+        return size
+
+    def cancel(self, event):
+        self.queue = [entry for entry in self.queue if entry[2] != event]
+        heapq.heapify(self.queue)
+
+    def on_heartbeat(self, now):
+        self.wakes += 1
+        self.use("mcu_active", MCU_WAKE_MS)
+        if self.cfg["rak1901"] and self.cfg["payload"] == "full":
+            # start_samples() and collect_samples(), conversion overlaps the TX
+            self.use("i2c", 2 * I2C_READ_MS)
+            self.use("shtc3", SHTC3_CONV_MS)
+        self.uplink(self.heartbeat_payload())
+        if self.cfg["ble"]:
+            self.use("ble_adv", BLE_ADV_MS)
+        self.schedule(now + self.cfg["heartbeat"] * 1000, "heartbeat")
+
+    def on_quake_start(self, now):
+        self.wakes += 1
+        self.quake_active = True
+        # heartbeat_stop() and no follow-up packet while analysing
+        self.cancel("heartbeat")
+        self.cancel("follow_up")
+        self.use("mcu_active", MCU_WAKE_MS)
+        self.use("i2c", 2 * I2C_READ_MS)
+        duration = self.rng.uniform(self.cfg["quake_min_s"], self.cfg["quake_max_s"]) * 1000
+        self.use("d7s_active", duration)
+        if self.cfg["capture"] > 0:
+            polls = int(duration // self.cfg["capture"])
+            self.wakes += polls
+            self.use("mcu_active", polls * MCU_WAKE_MS)
+            self.use("i2c", polls * I2C_READ_MS)
+        self.schedule(now + duration, "quake_end")
+
+    def on_quake_end(self, now):
+        self.wakes += 1
+        self.quake_active = False
+        self.use("mcu_active", MCU_WAKE_MS)
+        self.use("i2c", 4 * I2C_READ_MS)
+        self.uplink(PAYLOAD_EQ_END + PAYLOAD_BATT)
+        self.schedule(now + FOLLOW_UP_MS, "follow_up")
+        # heartbeat_start() restarts the heartbeat
+        self.schedule(now + self.cfg["heartbeat"] * 1000, "heartbeat")
+
+    def on_follow_up(self, now):
+        self.wakes += 1
+        self.use("mcu_active", MCU_WAKE_MS)
+        self.uplink(self.heartbeat_payload() + 4 + 4)
+
+    def on_time_sync(self, now):
+        self.wakes += 1
+        self.use("mcu_active", MCU_WAKE_MS)
+        self.uplink(6)
+        self.schedule(now + TIME_SYNC_INTERVAL_MS, "time_sync")
+
+    def pm_cycle_ms(self):
+        return PM_WARMUP_MS + PM_SAMPLE_NUM * PM_SAMPLE_INTERVAL_MS + PM_SAMPLE_MARGIN_MS
+
+    def run(self):
+        day_ms = 24 * 3600 * 1000
+        end = self.cfg["days"] * day_ms
+        self.schedule(self.cfg["heartbeat"] * 1000, "heartbeat")
+        self.schedule(30000, "time_sync")
+        # Earthquakes are a Poisson process
+        if self.cfg["quakes_per_day"] > 0:
+            t = 0.0
+            while True:
+                t += self.rng.expovariate(self.cfg["quakes_per_day"] / day_ms)
+                if t >= end:
+                    break
+                self.schedule(t, "quake_start")
+
+        handlers = {
+            "heartbeat": self.on_heartbeat,
+            "quake_start": self.on_quake_start,
+            "quake_end": self.on_quake_end,
+            "follow_up": self.on_follow_up,
+            "time_sync": self.on_time_sync,
+        }
+        while self.queue:
+            now, _, event = heapq.heappop(self.queue)
+            if now >= end:
+                break
+            if event == "quake_start" and self.quake_active:
+                continue
+            handlers[event](now)
+
+        # Always-on loads
+        self.use("d7s_standby", end)
+        self.use("sleep", end)
+        if self.cfg["rak12039"]:
+            heartbeat_ms = self.cfg["heartbeat"] * 1000
+            if heartbeat_ms <= self.pm_cycle_ms():
+                fan_ms = end
+            else:
+                fan_ms = end / heartbeat_ms * (self.pm_cycle_ms() - PM_SAMPLE_MARGIN_MS)
+                self.wakes += int(end / heartbeat_ms) * (PM_SAMPLE_NUM + 1)
+            self.use("pm_fan", fan_ms)
+            self.use("pm_standby", end - fan_ms)
+        return end
+
+
+def simulate(args):
+    """Worker for one configuration, returns a result row"""
+    config, currents, battery = args
+    sim = Simulation(config, currents)
+    end = sim.run()
+    total_mas = sum(sim.charge.values())
+    avg_ma = total_mas / (end / 1000.0)
+    daily_mah = avg_ma * 24
+    # Self discharge of the battery in % per month
+    self_discharge_mah = battery["capacity_mah"] * battery["self_discharge"] / 100.0 / 30.0
+    net_mah = daily_mah + self_discharge_mah - battery["solar_mah_per_day"]
+    usable = battery["capacity_mah"] * battery["usable"] / 100.0
+    life_days = float("inf") if net_mah <= 0 else usable / net_mah
+    row = dict(config)
+    row.update({
+        "avg_ua": avg_ma * 1000.0,
+        "mah_per_day": daily_mah,
+        "life_days": life_days,
+        "wakes_per_day": sim.wakes / config["days"],
+        "uplinks_per_day": sim.uplinks / config["days"],
+    })
+    for state, mas in sim.charge.items():
+        row["pct_" + state] = 100.0 * mas / total_mas if total_mas else 0.0
+    return row
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Battery life of the WisBlock Seismic Sensor")
+    parser.add_argument("--heartbeat", type=int, nargs="+", default=[900, 1800, 3600], help="heartbeat intervals in s")
+    parser.add_argument("--dr", type=int, nargs="+", default=[0, 3, 5], help="LoRaWAN datarates")
+    parser.add_argument("--payload", nargs="+", default=["full", "compact"], choices=["full", "compact"])
+    parser.add_argument("--capture", type=int, nargs="+", default=[0, 500], help="SI/PGA capture rate in ms, 0 = off")
+    parser.add_argument("--region", default="EU868")
+    parser.add_argument("--quakes", type=float, default=0.1, help="earthquakes per day")
+    parser.add_argument("--quake-min", type=float, default=30.0, help="shortest earthquake analysis in s")
+    parser.add_argument("--quake-max", type=float, default=120.0, help="longest earthquake analysis in s")
+    parser.add_argument("--days", type=int, default=7, help="simulated days per configuration")
+    parser.add_argument("--no-rak1901", action="store_true", help="without temperature sensor")
+    parser.add_argument("--rak12039", action="store_true", help="with PM sensor")
+    parser.add_argument("--no-ble", action="store_true", help="BLE advertising disabled")
+    parser.add_argument("--capacity", type=float, default=3200.0, help="battery capacity in mAh")
+    parser.add_argument("--usable", type=float, default=80.0, help="usable capacity in %%")
+    parser.add_argument("--self-discharge", type=float, default=2.0, help="self discharge in %% per month")
+    parser.add_argument("--solar", type=float, default=0.0, help="average solar harvest in mAh per day")
+    parser.add_argument("--currents", help="JSON file with current draws in mA")
+    parser.add_argument("--csv", help="write all results to a CSV file")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    currents = dict(DEFAULT_CURRENTS)
+    if args.currents:
+        with open(args.currents) as json_file:
+            currents.update(json.load(json_file))
+
+    battery = {
+        "capacity_mah": args.capacity,
+        "usable": args.usable,
+        "self_discharge": args.self_discharge,
+        "solar_mah_per_day": args.solar,
+    }
+
+    jobs = []
+    for heartbeat, dr, payload, capture in itertools.product(args.heartbeat, args.dr, args.payload, args.capture):
+        config = {
+            "heartbeat": heartbeat,
+            "dr": dr,
+            "payload": payload,
+            "capture": capture,
+            "region": args.region,
+            "quakes_per_day": args.quakes,
+            "quake_min_s": args.quake_min,
+            "quake_max_s": args.quake_max,
+            "days": args.days,
+            "rak1901": not args.no_rak1901,
+            "rak12039": args.rak12039,
+            "ble": not args.no_ble,
+            "seed": args.seed,
+        }
+        jobs.append((config, currents, battery))
+
+    with multiprocessing.Pool() as pool:
+        rows = pool.map(simulate, jobs)
+
+    print("| Heartbeat s | DR | Payload | Capture ms | Avg uA | mAh/day | Wakes/day | Life days |")
+    print("|-------------|----|---------|------------|--------|---------|-----------|-----------|")
+    for row in rows:
+        life = "unlimited" if math.isinf(row["life_days"]) else "%.0f" % row["life_days"]
+        print("| %11d | %2d | %-7s | %10d | %6.1f | %7.2f | %9.0f | %9s |" % (
+            row["heartbeat"], row["dr"], row["payload"], row["capture"],
+            row["avg_ua"], row["mah_per_day"], row["wakes_per_day"], life))
+
+    if args.csv:
+        fields = sorted(set(itertools.chain.from_iterable(row.keys() for row in rows)))
+        with open(args.csv, "w", newline="") as csv_file:
+            writer = csv.DictWriter(csv_file, fieldnames=fields, restval=0.0)
+            writer.writeheader()
+            writer.writerows(rows)
+        print("Results written to %s" % args.csv, file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
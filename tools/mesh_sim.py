@@ -0,0 +1,250 @@
+#!/usr/bin/env python3
+"""
+Simulation of the P2P alert flooding of the WisBlock Seismic Sensor
+
+Places the nodes on a grid and floods one alert from a node, following the
+same rules as p2p_mesh.cpp: every node sends a new frame again after a random
+backoff of 1 to MESH_BACKOFF_SLOTS slots while the TTL allows it, and skips
+its rebroadcast if it heard MESH_SUPPRESS copies during the backoff.
+Frames that overlap at a receiver are lost, a node that is sending does not
+receive. Each configuration is repeated with different random seeds, the
+sweep runs on all CPU cores.
+
+Usage:
+    python3 mesh_sim.py
+    python3 mesh_sim.py --grid 30 --range 2.5 --ttl 3 5 8 --suppress 0 2 3
+    python3 mesh_sim.py --sf 9 --bw 125 --csv results.csv
+
+The result is the share of nodes that got the alert, the time until the
+alert reached them, the share of received frames that were duplicates and
+the time on air used by all nodes together.
+"""
+
+import argparse
+import csv
+import heapq
+import itertools
+import math
+import multiprocessing
+import random
+import statistics
+import sys
+
+# Same values as in p2p_mesh.cpp and app.h
+MESH_SIZE = 16
+MESH_BACKOFF_SLOTS = 8
+MESH_SUPPRESS = 2
+MESH_TTL_DEFAULT = 3
+SLOT_MARGIN_MS = 10  # Added to the time on air for one backoff slot
+HANDLING_MS = 20  # TIME_BEACON_LATENCY, from the end of the reception to the handling
+
+
+def lora_airtime(sf, bw_khz, cr, preamble, length):
+    """Time on air in ms, same calculation as lora_airtime() in time_sync.cpp"""
+    symbol_us = (1 << sf) * 1000 // bw_khz
+    bits_per_symbol = 4 * (sf - (2 if symbol_us >= 16000 else 0))
+    payload_bits = 8 * length - 4 * sf + 28 + 16
+    payload_symbols = 8
+    if payload_bits > 0:
+        payload_symbols += ((payload_bits + bits_per_symbol - 1) // bits_per_symbol) * (cr + 4)
+    return ((preamble * 4 + 17) * symbol_us / 4 + payload_symbols * symbol_us) / 1000
+
+
+class Flood:
+    """One alert flooded through the grid"""
+
+    def __init__(self, config, seed):
+        self.rng = random.Random(seed)
+        self.config = config
+        size = config["grid"]
+        self.nodes = size * size
+        self.airtime = lora_airtime(config["sf"], config["bw"], config["cr"], config["preamble"], MESH_SIZE)
+        self.slot = self.airtime + SLOT_MARGIN_MS
+        # Neighbours within range, the grid spacing is 1
+        radius = config["range"]
+        reach = int(math.floor(radius))
+        self.neighbours = []
+        for node in range(self.nodes):
+            x, y = node % size, node // size
+            near = []
+            for dy in range(-reach, reach + 1):
+                for dx in range(-reach, reach + 1):
+                    nx, ny = x + dx, y + dy
+                    if (dx or dy) and 0 <= nx < size and 0 <= ny < size and dx * dx + dy * dy <= radius * radius:
+                        near.append(ny * size + nx)
+            self.neighbours.append(near)
+        self.events = []
+        self.counter = itertools.count()
+        self.seen = [False] * self.nodes
+        self.first_ms = [None] * self.nodes
+        self.pending = {}  # node -> [due, ttl, copies]
+        self.tx_until = [0.0] * self.nodes
+        self.rx = [[] for _ in range(self.nodes)]  # active receptions [start, end, ttl, lost]
+        self.sent = 0
+        self.suppressed = 0
+        self.received = 0
+        self.duplicates = 0
+        self.collisions = 0
+
+    def push(self, time, kind, node, data=None):
+        heapq.heappush(self.events, (time, next(self.counter), kind, node, data))
+
+    def backoff(self):
+        return self.rng.randint(1, MESH_BACKOFF_SLOTS) * self.slot
+
+    def transmit(self, time, node, ttl):
+        self.sent += 1
+        end = time + self.airtime
+        self.tx_until[node] = end
+        for other in self.neighbours[node]:
+            if self.tx_until[other] > time:
+                # Half duplex, a sending node does not hear the frame
+                continue
+            lost = self.rng.random() < self.config["loss"]
+            reception = [time, end, ttl, lost]
+            for active in self.rx[other]:
+                if active[1] > time:
+                    if not active[3]:
+                        self.collisions += 1
+                    active[3] = True
+                    reception[3] = True
+            self.rx[other].append(reception)
+            self.push(end, "rx", other, reception)
+
+    def run(self):
+        origin = self.origin_node()
+        self.seen[origin] = True
+        self.first_ms[origin] = 0.0
+        # Own alerts go out without backoff
+        self.pending[origin] = [0.0, self.config["ttl"], 0]
+        self.push(0.0, "tx", origin)
+        while self.events:
+            time, _, kind, node, data = heapq.heappop(self.events)
+            if kind == "tx":
+                self.handle_tx(time, node)
+            else:
+                self.handle_rx(time, node, data)
+        return self.result()
+
+    def handle_tx(self, time, node):
+        entry = self.pending.pop(node, None)
+        if entry is None:
+            return
+        due, ttl, copies = entry
+        own = node == self.origin_node()
+        if not own and copies >= self.config["suppress"] > 0:
+            self.suppressed += 1
+            return
+        if self.tx_until[node] > time:
+            # Radio is busy, try again after another backoff
+            entry[0] = time + self.backoff()
+            self.pending[node] = entry
+            self.push(entry[0], "tx", node)
+            return
+        self.transmit(time, node, ttl)
+
+    def handle_rx(self, time, node, reception):
+        self.rx[node].remove(reception)
+        if reception[3]:
+            return
+        ttl = reception[2]
+        if self.seen[node]:
+            self.duplicates += 1
+            if node in self.pending:
+                self.pending[node][2] += 1
+            return
+        self.received += 1
+        self.seen[node] = True
+        self.first_ms[node] = time + HANDLING_MS
+        if ttl > 1:
+            due = time + HANDLING_MS + self.backoff()
+            self.pending[node] = [due, ttl - 1, 0]
+            self.push(due, "tx", node)
+
+    def origin_node(self):
+        size = self.config["grid"]
+        return (size // 2) * size + size // 2 if self.config["origin"] == "center" else 0
+
+    def result(self):
+        reached = [ms for ms in self.first_ms if ms is not None]
+        latencies = sorted(reached)
+        total_rx = self.received + self.duplicates
+        return {
+            "coverage": 100.0 * len(reached) / self.nodes,
+            "latency_median_ms": statistics.median(latencies),
+            "latency_p95_ms": latencies[int(0.95 * (len(latencies) - 1))],
+            "latency_max_ms": latencies[-1],
+            "duplicate_pct": 100.0 * self.duplicates / total_rx if total_rx else 0.0,
+            "sent": self.sent,
+            "suppressed": self.suppressed,
+            "collisions": self.collisions,
+            "airtime_ms": self.sent * self.airtime,
+        }
+
+
+def simulate(args):
+    """Worker for one configuration, returns the averages over all runs"""
+    config, runs = args
+    results = [Flood(config, config["seed"] * 1000 + run).run() for run in range(runs)]
+    row = dict(config)
+    for key in results[0]:
+        row[key] = statistics.mean(result[key] for result in results)
+    return row
+
+
+def main():
+    parser = argparse.ArgumentParser(description="P2P alert flooding of the WisBlock Seismic Sensor")
+    parser.add_argument("--grid", type=int, nargs="+", default=[10, 20], help="nodes per side of the grid")
+    parser.add_argument("--range", type=float, default=1.5, help="radio range in grid spacings")
+    parser.add_argument("--ttl", type=int, nargs="+", default=[MESH_TTL_DEFAULT, 6, 12], help="hops of an alert")
+    parser.add_argument("--suppress", type=int, nargs="+", default=[0, MESH_SUPPRESS], help="copies that cancel a rebroadcast, 0 = never")
+    parser.add_argument("--loss", type=float, default=0.05, help="share of frames lost without a collision")
+    parser.add_argument("--origin", default="center", choices=["center", "corner"])
+    parser.add_argument("--sf", type=int, default=7)
+    parser.add_argument("--bw", type=int, default=125, help="bandwidth in kHz")
+    parser.add_argument("--cr", type=int, default=1, help="coding rate 1 = 4/5 to 4 = 4/8")
+    parser.add_argument("--preamble", type=int, default=8)
+    parser.add_argument("--runs", type=int, default=20, help="floods per configuration")
+    parser.add_argument("--csv", help="write all results to a CSV file")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    jobs = []
+    for grid, ttl, suppress in itertools.product(args.grid, args.ttl, args.suppress):
+        config = {
+            "grid": grid,
+            "range": args.range,
+            "ttl": ttl,
+            "suppress": suppress,
+            "loss": args.loss,
+            "origin": args.origin,
+            "sf": args.sf,
+            "bw": args.bw,
+            "cr": args.cr,
+            "preamble": args.preamble,
+            "seed": args.seed,
+        }
+        jobs.append((config, args.runs))
+
+    with multiprocessing.Pool() as pool:
+        rows = pool.map(simulate, jobs)
+
+    print("| Nodes | TTL | Suppress | Coverage % | Median ms | P95 ms | Max ms | Duplicates % | Frames | Airtime ms |")
+    print("|-------|-----|----------|------------|-----------|--------|--------|--------------|--------|------------|")
+    for row in rows:
+        print("| %5d | %3d | %8d | %10.1f | %9.0f | %6.0f | %6.0f | %12.1f | %6.0f | %10.0f |" % (
+            row["grid"] * row["grid"], row["ttl"], row["suppress"], row["coverage"],
+            row["latency_median_ms"], row["latency_p95_ms"], row["latency_max_ms"],
+            row["duplicate_pct"], row["sent"], row["airtime_ms"]))
+
+    if args.csv:
+        fields = list(rows[0].keys())
+        with open(args.csv, "w", newline="") as csv_file:
+            writer = csv.DictWriter(csv_file, fieldnames=fields)
+            writer.writeheader()
+            writer.writerows(rows)
+        print("Results written to %s" % args.csv, file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
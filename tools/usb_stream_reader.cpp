@@ -0,0 +1,539 @@
+/**
+ * @file usb_stream_reader.cpp
+ * @author Bernd Giesecke (bernd.giesecke@rakwireless.com)
+ * @brief Reader for the binary USB stream of the Seismic Sensor (AT+STREAM)
+ *        Splits the COBS frames at 0x00, checks the CRC and writes one CSV file
+ *        per record type, or one binary file per column for numpy/pandas.
+ *        Each frame starts and ends with 0x00, text between the frames (AT command replies)
+ *        fails the CRC and is skipped.
+ *
+ *        Build:
+ *          g++ -O2 -std=c++17 -o usb_stream_reader usb_stream_reader.cpp
+ *        Usage:
+ *          stty -F /dev/ttyACM0 raw
+ *          ./usb_stream_reader /dev/ttyACM0 shake_01
+ *          ./usb_stream_reader --columns capture.bin shake_01
+ *          ./usb_stream_reader --bench 1000000
+ *        Output:
+ *          <prefix>_snapshot.csv  time_ms,seq,si,pga,state
+ *          <prefix>_irq.csv       time_ms,seq,line,level
+ *          <prefix>_state.csv     time_ms,seq,code,flags
+ *          <prefix>_lost.csv      time_ms,seq,lost
+ *          With --columns <prefix>_<type>_<column>.u32 for time_ms, all other columns as .u16
+ * @version 0.1
+ * @date 2023-03-23
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/** Record types, same as STREAM_xxx in app.h */
+enum
+{
+	STREAM_SNAPSHOT = 0x01,
+	STREAM_IRQ = 0x02,
+	STREAM_STATE = 0x03,
+	STREAM_LOST = 0x04,
+	STREAM_TYPES = 5
+};
+
+/** Frame header type, seq and time */
+static const size_t STREAM_HEADER_SIZE = 6;
+
+/** Longest frame accepted, longer data is text or garbage */
+static const size_t STREAM_FRAME_MAX = 64;
+
+/** Description of a record type */
+struct record_type_s
+{
+	const char *name;
+	size_t payload_len;
+	std::vector<const char *> columns;
+};
+
+static const record_type_s record_types[STREAM_TYPES] = {
+	{nullptr, 0, {}},
+	{"snapshot", 5, {"si", "pga", "state"}},
+	{"irq", 2, {"line", "level"}},
+	{"state", 2, {"code", "flags"}},
+	{"lost", 2, {"lost"}},
+};
+
+/** Decoded record */
+struct record_s
+{
+	uint8_t type;
+	uint8_t seq;
+	uint32_t time;
+	uint16_t values[3];
+};
+
+/** Statistics of the stream */
+struct stats_s
+{
+	uint64_t bytes = 0;
+	uint64_t frames = 0;
+	uint64_t crc_errors = 0;
+	uint64_t bad_frames = 0;
+	uint64_t seq_gaps = 0;
+	uint64_t lost = 0;
+};
+
+/**
+ * @brief CRC16 CCITT, same as the firmware
+ *
+ * @param data data to check
+ * @param len number of bytes
+ * @return uint16_t CRC
+ */
+static uint16_t stream_crc(const uint8_t *data, size_t len)
+{
+	uint16_t crc = 0xFFFF;
+	while (len--)
+	{
+		crc ^= (uint16_t)(*data++) << 8;
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+		}
+	}
+	return crc;
+}
+
+/**
+ * @brief COBS decode a frame without the delimiter
+ *
+ * @param src encoded frame
+ * @param len size of the encoded frame
+ * @param dst decoded frame, at least len bytes
+ * @return size_t size of the decoded frame, 0 if the encoding is broken
+ */
+static size_t cobs_decode(const uint8_t *src, size_t len, uint8_t *dst)
+{
+	size_t in = 0;
+	size_t out = 0;
+	while (in < len)
+	{
+		uint8_t code = src[in++];
+		if ((code == 0) || (in + code - 1 > len))
+		{
+			return 0;
+		}
+		for (uint8_t idx = 1; idx < code; idx++)
+		{
+			dst[out++] = src[in++];
+		}
+		if ((code != 0xFF) && (in < len))
+		{
+			dst[out++] = 0;
+		}
+	}
+	return out;
+}
+
+/**
+ * @brief COBS encode a frame and add the delimiter, used for the benchmark
+ *
+ * @param src frame
+ * @param len size of the frame, less than 254 bytes
+ * @param dst encoded frame
+ * @return size_t size of the encoded frame
+ */
+static size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dst)
+{
+	size_t code_pos = 0;
+	size_t out = 1;
+	uint8_t code = 1;
+	for (size_t idx = 0; idx < len; idx++)
+	{
+		if (src[idx] == 0)
+		{
+			dst[code_pos] = code;
+			code_pos = out++;
+			code = 1;
+		}
+		else
+		{
+			dst[out++] = src[idx];
+			code++;
+		}
+	}
+	dst[code_pos] = code;
+	dst[out++] = 0;
+	return out;
+}
+
+/**
+ * @brief Check and parse a decoded frame
+ *
+ * @param frame decoded frame
+ * @param len size of the frame
+ * @param record parsed record
+ * @param stats statistics to update
+ * @return true if the frame is valid
+ */
+static bool parse_frame(const uint8_t *frame, size_t len, record_s *record, stats_s *stats)
+{
+	if (len < STREAM_HEADER_SIZE + 2)
+	{
+		stats->bad_frames++;
+		return false;
+	}
+	uint16_t crc = frame[len - 2] | (frame[len - 1] << 8);
+	if (stream_crc(frame, len - 2) != crc)
+	{
+		stats->crc_errors++;
+		return false;
+	}
+	uint8_t type = frame[0];
+	if ((type == 0) || (type >= STREAM_TYPES) || (len != STREAM_HEADER_SIZE + record_types[type].payload_len + 2))
+	{
+		stats->bad_frames++;
+		return false;
+	}
+	record->type = type;
+	record->seq = frame[1];
+	record->time = frame[2] | (frame[3] << 8) | (frame[4] << 16) | ((uint32_t)frame[5] << 24);
+	const uint8_t *payload = &frame[STREAM_HEADER_SIZE];
+	switch (type)
+	{
+	case STREAM_SNAPSHOT:
+		record->values[0] = payload[0] | (payload[1] << 8);
+		record->values[1] = payload[2] | (payload[3] << 8);
+		record->values[2] = payload[4];
+		break;
+	case STREAM_IRQ:
+	case STREAM_STATE:
+		record->values[0] = payload[0];
+		record->values[1] = payload[1];
+		break;
+	case STREAM_LOST:
+		record->values[0] = payload[0] | (payload[1] << 8);
+		stats->lost += record->values[0];
+		break;
+	}
+	return true;
+}
+
+/**
+ * @brief Output of the records, one file per record type or column
+ */
+class record_writer
+{
+public:
+	record_writer(const std::string &prefix, bool columns) : prefix(prefix), columns(columns) {}
+
+	~record_writer()
+	{
+		for (FILE *file : files)
+		{
+			if (file != nullptr)
+			{
+				fclose(file);
+			}
+		}
+	}
+
+	/**
+	 * @brief Write a record
+	 *
+	 * @param record record to write
+	 * @return true if the output file could be written
+	 */
+	bool write(const record_s &record)
+	{
+		const record_type_s &desc = record_types[record.type];
+		if (!columns)
+		{
+			FILE *file = open(record.type, 0, "csv");
+			if (file == nullptr)
+			{
+				return false;
+			}
+			char line[64];
+			int len;
+			if (record.type == STREAM_SNAPSHOT)
+			{
+				len = snprintf(line, sizeof(line), "%u,%u,%u.%03u,%u.%03u,%u\n", record.time, record.seq,
+							   record.values[0] / 1000, record.values[0] % 1000, record.values[1] / 1000, record.values[1] % 1000, record.values[2]);
+			}
+			else if (desc.columns.size() == 2)
+			{
+				len = snprintf(line, sizeof(line), "%u,%u,%u,%u\n", record.time, record.seq, record.values[0], record.values[1]);
+			}
+			else
+			{
+				len = snprintf(line, sizeof(line), "%u,%u,%u\n", record.time, record.seq, record.values[0]);
+			}
+			return fwrite(line, 1, len, file) == (size_t)len;
+		}
+
+		// Binary columns, little endian as on x86 and ARM hosts
+		FILE *file = open(record.type, 0, "u32");
+		if ((file == nullptr) || (fwrite(&record.time, 4, 1, file) != 1))
+		{
+			return false;
+		}
+		uint16_t seq = record.seq;
+		file = open(record.type, 1, "u16");
+		if ((file == nullptr) || (fwrite(&seq, 2, 1, file) != 1))
+		{
+			return false;
+		}
+		for (size_t idx = 0; idx < desc.columns.size(); idx++)
+		{
+			file = open(record.type, idx + 2, "u16");
+			if ((file == nullptr) || (fwrite(&record.values[idx], 2, 1, file) != 1))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+private:
+	/**
+	 * @brief Get the file of a record type or column, open it with the first record
+	 *
+	 * @param type record type
+	 * @param column column index, 0 = time_ms, 1 = seq, then the values
+	 * @param ext file extension
+	 * @return FILE* file, nullptr if it could not be opened
+	 */
+	FILE *open(uint8_t type, size_t column, const char *ext)
+	{
+		size_t index = type * 8 + column;
+		if (files.size() <= index)
+		{
+			files.resize(index + 1, nullptr);
+		}
+		if (files[index] != nullptr)
+		{
+			return files[index];
+		}
+		const record_type_s &desc = record_types[type];
+		std::string name = prefix + "_" + desc.name;
+		if (columns)
+		{
+			name += "_";
+			name += column == 0 ? "time_ms" : column == 1 ? "seq" : desc.columns[column - 2];
+		}
+		name += ".";
+		name += ext;
+		FILE *file = fopen(name.c_str(), "wb");
+		if (file == nullptr)
+		{
+			fprintf(stderr, "Cannot open %s\n", name.c_str());
+			return nullptr;
+		}
+		// Large buffer, the stream is written in big blocks
+		setvbuf(file, nullptr, _IOFBF, 1 << 16);
+		if (!columns)
+		{
+			fprintf(file, "time_ms,seq");
+			for (const char *name : desc.columns)
+			{
+				fprintf(file, ",%s", name);
+			}
+			fprintf(file, "\n");
+		}
+		files[index] = file;
+		return file;
+	}
+
+	std::string prefix;
+	bool columns;
+	std::vector<FILE *> files;
+};
+
+/**
+ * @brief Splits the stream into frames and passes the records on
+ */
+class stream_decoder
+{
+public:
+	/**
+	 * @brief Add received data
+	 *
+	 * @param data received bytes
+	 * @param len number of bytes
+	 * @param callback called for each valid record
+	 */
+	template <typename callback_t>
+	void feed(const uint8_t *data, size_t len, callback_t &&callback)
+	{
+		stats.bytes += len;
+		for (size_t idx = 0; idx < len; idx++)
+		{
+			uint8_t rx_byte = data[idx];
+			if (rx_byte != 0)
+			{
+				if (encoded_len < sizeof(encoded))
+				{
+					encoded[encoded_len] = rx_byte;
+				}
+				encoded_len++;
+				continue;
+			}
+			// Delimiter, empty frames come from the 0x00 in front of each frame
+			if ((encoded_len != 0) && (encoded_len <= sizeof(encoded)))
+			{
+				uint8_t frame[STREAM_FRAME_MAX];
+				size_t frame_len = cobs_decode(encoded, encoded_len, frame);
+				record_s record;
+				if (parse_frame(frame, frame_len, &record, &stats))
+				{
+					stats.frames++;
+					if (have_seq && ((uint8_t)(last_seq + 1) != record.seq))
+					{
+						stats.seq_gaps++;
+					}
+					last_seq = record.seq;
+					have_seq = true;
+					callback(record);
+				}
+			}
+			else if (encoded_len != 0)
+			{
+				stats.bad_frames++;
+			}
+			encoded_len = 0;
+		}
+	}
+
+	stats_s stats;
+
+private:
+	uint8_t encoded[STREAM_FRAME_MAX];
+	size_t encoded_len = 0;
+	uint8_t last_seq = 0;
+	bool have_seq = false;
+};
+
+/**
+ * @brief Print the statistics
+ *
+ * @param stats statistics of the stream
+ */
+static void print_stats(const stats_s &stats)
+{
+	fprintf(stderr, "%llu bytes, %llu frames, %llu CRC errors, %llu bad frames, %llu sequence gaps, %llu records lost in the device\n",
+			(unsigned long long)stats.bytes, (unsigned long long)stats.frames, (unsigned long long)stats.crc_errors,
+			(unsigned long long)stats.bad_frames, (unsigned long long)stats.seq_gaps, (unsigned long long)stats.lost);
+}
+
+/**
+ * @brief Decode a synthetic stream in memory and print the throughput
+ *        Full speed USB gives about 1 MByte/s for a CDC device
+ *
+ * @param frames number of frames to generate
+ * @return int exit code
+ */
+static int run_bench(size_t frames)
+{
+	std::vector<uint8_t> stream;
+	stream.reserve(frames * 16);
+	for (size_t idx = 0; idx < frames; idx++)
+	{
+		// Mostly snapshots with an interrupt and a state record now and then
+		uint8_t type = (idx % 100 == 0) ? STREAM_IRQ : (idx % 100 == 1) ? STREAM_STATE : STREAM_SNAPSHOT;
+		uint8_t frame[STREAM_FRAME_MAX];
+		uint32_t time = (uint32_t)(idx * 10);
+		frame[0] = type;
+		frame[1] = (uint8_t)idx;
+		memcpy(&frame[2], &time, 4);
+		size_t len = STREAM_HEADER_SIZE;
+		for (size_t pos = 0; pos < record_types[type].payload_len; pos++)
+		{
+			frame[len++] = (uint8_t)(idx * 7 + pos);
+		}
+		uint16_t crc = stream_crc(frame, len);
+		frame[len++] = (uint8_t)crc;
+		frame[len++] = (uint8_t)(crc >> 8);
+		uint8_t encoded[STREAM_FRAME_MAX + 2];
+		size_t encoded_len = cobs_encode(frame, len, encoded);
+		stream.insert(stream.end(), encoded, encoded + encoded_len);
+	}
+
+	// Format the CSV lines into memory, the disk is not part of the measurement
+	std::vector<char> out;
+	out.reserve(stream.size() * 3);
+	stream_decoder decoder;
+	auto start = std::chrono::steady_clock::now();
+	decoder.feed(stream.data(), stream.size(), [&out](const record_s &record)
+				 {
+					 char line[64];
+					 int len = snprintf(line, sizeof(line), "%u,%u,%u,%u,%u\n", record.time, record.seq, record.values[0], record.values[1], record.values[2]);
+					 out.insert(out.end(), line, line + len); });
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	print_stats(decoder.stats);
+	double mbyte_s = stream.size() / seconds / 1e6;
+	printf("Decoded %zu frames (%zu bytes) in %.3f s: %.1f MByte/s, %.1f Mframes/s, %.0fx full speed USB\n",
+		   frames, stream.size(), seconds, mbyte_s, frames / seconds / 1e6, mbyte_s / 1.0);
+	return decoder.stats.frames == frames ? 0 : 1;
+}
+
+/**
+ * @brief Print the usage
+ *
+ */
+static void usage(void)
+{
+	fprintf(stderr, "Usage: usb_stream_reader [--columns] <input> <output prefix>\n"
+					"       usb_stream_reader --bench <frames>\n"
+					"<input> is a serial port set to raw mode, a capture file or - for stdin\n");
+}
+
+int main(int argc, char **argv)
+{
+	bool columns = false;
+	int arg = 1;
+	if ((argc == 3) && (strcmp(argv[1], "--bench") == 0))
+	{
+		return run_bench(strtoul(argv[2], nullptr, 0));
+	}
+	if ((argc > arg) && (strcmp(argv[arg], "--columns") == 0))
+	{
+		columns = true;
+		arg++;
+	}
+	if (argc != arg + 2)
+	{
+		usage();
+		return 2;
+	}
+
+	FILE *input = strcmp(argv[arg], "-") == 0 ? stdin : fopen(argv[arg], "rb");
+	if (input == nullptr)
+	{
+		fprintf(stderr, "Cannot open %s\n", argv[arg]);
+		return 1;
+	}
+	// Unbuffered, fread returns what the serial port has instead of waiting for a full buffer
+	setvbuf(input, nullptr, _IONBF, 0);
+
+	record_writer writer(argv[arg + 1], columns);
+	stream_decoder decoder;
+	bool write_ok = true;
+	uint8_t buffer[1 << 16];
+	size_t len;
+	while (write_ok && ((len = fread(buffer, 1, sizeof(buffer), input)) > 0))
+	{
+		decoder.feed(buffer, len, [&](const record_s &record)
+					 { write_ok = write_ok && writer.write(record); });
+	}
+	if (input != stdin)
+	{
+		fclose(input);
+	}
+	print_stats(decoder.stats);
+	return write_ok ? 0 : 1;
+}